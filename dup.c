@@ -1,131 +1,498 @@
+/*
+ * File Name:	dup.c
+ * Function:	A layout benchmark for LMDB databases shaped like the
+ *		surrogate store: -k keys with -d duplicates each, keys
+ *		of -K bytes and values of -V, under the flags of -f (a
+ *		comma separated list of dupsort, dupfixed, integerkey,
+ *		integerdup, reversekey and reversedup). Keys and values
+ *		are random and unique; integer ones are stored natively
+ *		and must be 4 or 8 bytes, others big-endian, padded.
+ *
+ *		  load     every pair put, in sorted order, in random
+ *		           order, or in order with MDB_APPEND(DUP)
+ *		           (-i), -b puts per transaction (0: one)
+ *		  read     every key, in random order, found and its
+ *		           values walked with MDB_NEXT_DUP or, for
+ *		           dupfixed, MDB_GET/NEXT_MULTIPLE (-r)
+ *		  delete   -n deletions, one transaction each, of a
+ *		           random pair, of a random key with all its
+ *		           values, or of a run of -R pairs from a random
+ *		           one through a cursor (-x)
+ *
+ *		Each phase prints a line of name=value fields: the
+ *		operations, the seconds and the rate, and per-operation
+ *		latency percentiles in microseconds (a put, a key's
+ *		walk, a deletion with its commit). After load and after
+ *		delete, mdb_stat's depth and page counts, the pages in
+ *		use and the file size are printed the same way.
+ *
+ *		The store lives in -p (default ./testdb) and is
+ *		recreated on every run. Keys, values and orders are
+ *		drawn from -s (default 1), so runs with the same
+ *		options do the same work. The defaults repeat the
+ *		original experiment: 2M random 4-byte dups under one
+ *		key, all four flags, a MDB_NEXT_MULTIPLE scan and one
+ *		delete.
+ *
+ *		dup [-f flags] [-k keys] [-d dups] [-K bytes] [-V bytes]
+ *		    [-i sorted|random|append] [-b batch] [-r dup|multiple]
+ *		    [-x pair|key|range] [-n deletes] [-R run] [-s seed]
+ *		    [-m mapsize MB] [-p path]
+ *
+ *		cc dup.c -llmdb
+ */
+
 #include <stdlib.h>
 #include <sys/errno.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "lmdb.h"
 
+#define MAX_BYTES 511
+
+enum { SORTED, RANDOM, APPEND };
+enum { DEL_PAIR, DEL_KEY, DEL_RANGE };
+
+static const struct {
+	const char *name;
+	unsigned int flag;
+} FLAG_NAMES[] = {
+	{ "dupsort", MDB_DUPSORT },
+	{ "dupfixed", MDB_DUPFIXED },
+	{ "integerkey", MDB_INTEGERKEY },
+	{ "integerdup", MDB_INTEGERDUP },
+	{ "reversekey", MDB_REVERSEKEY },
+	{ "reversedup", MDB_REVERSEDUP },
+	{ NULL, 0 }
+};
+
+static const char *INSERT_NAMES[] = { "sorted", "random", "append", NULL };
+static const char *DELETE_NAMES[] = { "pair", "key", "range", NULL };
+
+typedef struct pair {
+	uint64_t key, val;
+} pair;
+
+typedef struct shape {
+	unsigned int flags;
+	size_t key_bytes, val_bytes;
+} shape;
+
+static uint64_t rng;
+
+// splitmix64
+static uint64_t
+next_rand (void) {
+
+	uint64_t z = (rng += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static double
+now (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+by_u64 (const void *a, const void *b) {
+
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+static int
+by_double (const void *a, const void *b) {
+
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+// random numbers that fit width bytes, sorted and unique; returns how
+// many are left
+static size_t
+unique_numbers (uint64_t *v, size_t n, size_t width) {
+
+	size_t i, m = 0;
+	uint64_t mask = width >= 8 ? ~0ULL : (1ULL << (8 * width)) - 1;
+
+	for (i = 0; i < n; i++)
+		v[i] = next_rand () & mask;
+	qsort (v, n, sizeof *v, by_u64);
+	for (i = 0; i < n; i++)
+		if (m == 0 || v[m - 1] != v[i])
+			v[m++] = v[i];
+	return m;
+}
+
+// a number as stored: native for integer flags, big-endian otherwise,
+// so memcmp order is numeric order
+static void
+encode (unsigned char *out, uint64_t x, size_t width, int integer) {
+
+	unsigned int u = (unsigned int) x;
+	size_t i, n = width < 8 ? width : 8;
 
-const unsigned int COMPACT =
-	MDB_DUPSORT | MDB_INTEGERKEY | MDB_DUPFIXED | MDB_INTEGERDUP;
+	if (integer && width == sizeof u)
+		memcpy (out, &u, sizeof u);
+	else if (integer)
+		memcpy (out, &x, sizeof x);
+	else {
+		memset (out, 0, width);
+		for (i = 0; i < n; i++)
+			out[i] = (unsigned char) (x >> (8 * (n - 1 - i)));
+	}
+}
+
+// point k and v at p, encoded into the buffers; cursor calls repoint
+// them into the map
+static void
+set_pair (const shape *s, const pair *p, unsigned char *kb, unsigned char *vb,
+		MDB_val *k, MDB_val *v) {
+
+	encode (kb, p->key, s->key_bytes, s->flags & MDB_INTEGERKEY);
+	encode (vb, p->val, s->val_bytes, s->flags & MDB_INTEGERDUP);
+	k->mv_size = s->key_bytes;
+	k->mv_data = kb;
+	v->mv_size = s->val_bytes;
+	v->mv_data = vb;
+}
+
+// one line: operations, rate and latency percentiles
+static void
+report (const char *phase, size_t ops, double secs, double *lat, size_t n) {
+
+	static const double pct[] = { 0.5, 0.9, 0.99, 0.999 };
+	static const char *names[] = { "p50", "p90", "p99", "p999" };
+	size_t i;
+
+	printf ("%s ops=%zu secs=%.6f ops_per_sec=%.1f", phase, ops, secs, secs > 0 ? ops / secs : 0);
+	if (n > 0) {
+		qsort (lat, n, sizeof *lat, by_double);
+		for (i = 0; i < sizeof pct / sizeof *pct; i++)
+			printf (" %s_us=%.3f", names[i], lat[(size_t) (pct[i] * (n - 1))] * 1e6);
+		printf (" max_us=%.3f", lat[n - 1] * 1e6);
+	}
+	printf ("\n");
+}
+
+static void
+report_stat (const char *phase, MDB_env *env, MDB_dbi dbi, const char *path) {
+
+	int rc;
+	char file[600];
+	MDB_txn *txn;
+	MDB_stat ms;
+	MDB_envinfo info;
+	struct stat sb;
+
+	rc = mdb_txn_begin (env, NULL, MDB_RDONLY, &txn);
+	assert (rc == 0);
+	rc = mdb_stat (txn, dbi, &ms);
+	assert (rc == 0);
+	mdb_txn_abort (txn);
+	rc = mdb_env_info (env, &info);
+	assert (rc == 0);
+	snprintf (file, sizeof file, "%s/data.mdb", path);
+	printf ("%s depth=%u branch_pages=%zu leaf_pages=%zu overflow_pages=%zu entries=%zu "
+		"pages_used=%zu page_bytes=%u file_bytes=%lld\n", phase, ms.ms_depth,
+		ms.ms_branch_pages, ms.ms_leaf_pages, ms.ms_overflow_pages, ms.ms_entries,
+		info.me_last_pgno + 1, ms.ms_psize,
+		stat (file, &sb) == 0 ? (long long) sb.st_size : -1LL);
+}
+
+static int
+lookup_name (const char *const *names, const char *s) {
 
+	int i;
+
+	for (i = 0; names[i] != NULL; i++)
+		if (strcmp (names[i], s) == 0)
+			return i;
+	return -1;
+}
+
+static int
+parse_flags (const char *s, unsigned int *flags) {
+
+	char buf[256], *tok;
+	int i;
+
+	snprintf (buf, sizeof buf, "%s", s);
+	*flags = 0;
+	for (tok = strtok (buf, ","); tok != NULL; tok = strtok (NULL, ",")) {
+		for (i = 0; FLAG_NAMES[i].name != NULL && strcmp (FLAG_NAMES[i].name, tok) != 0; i++)
+			;
+		if (FLAG_NAMES[i].name == NULL)
+			return -1;
+		*flags |= FLAG_NAMES[i].flag;
+	}
+	return 0;
+}
+
+static void
+usage (const char *prog) {
+
+	fprintf (stderr, "usage: %s [-f flags] [-k keys] [-d dups] [-K bytes] [-V bytes]\n"
+		"\t[-i sorted|random|append] [-b batch] [-r dup|multiple]\n"
+		"\t[-x pair|key|range] [-n deletes] [-R run] [-s seed] [-m mapsize MB] [-p path]\n", prog);
+}
 
 int
 main(int argc,char * argv[])
 {
-	int rc;
-	int i;
+	int rc, opt, insert = RANDOM, multiple = 1, del = DEL_PAIR;
+	size_t nkeys = 1, dups = 2000000, batch = 0, deletes = 1, run = 100, mapsize = 1024;
+	size_t i, j, k, n, npairs, *order, *start, *korder, count, seen, existing = 0, missing = 0;
+	const char *path = "./testdb";
+	char file[600];
+	uint64_t *keys, *vals;
+	pair *pairs;
+	double *lat, t0, t;
+	unsigned int put_flags;
+	shape s = { MDB_DUPSORT | MDB_INTEGERKEY | MDB_DUPFIXED | MDB_INTEGERDUP,
+		sizeof (unsigned int), sizeof (unsigned int) };
+
 	MDB_env *env;
 	MDB_dbi dbi;
 	MDB_txn *txn;
 	MDB_cursor *cursor;
-
 	MDB_val mkey, mval;
-	unsigned int key;
-	unsigned int val;
+	unsigned char key[MAX_BYTES], val[MAX_BYTES];
+
+	rng = 1;
+	while ((opt = getopt (argc, argv, "f:k:d:K:V:i:b:r:x:n:R:s:m:p:")) != -1) {
+		if (opt == 'f' && parse_flags (optarg, &s.flags) == 0)
+			continue;
+		else if (opt == 'k' && (nkeys = strtoul (optarg, NULL, 10)) > 0)
+			continue;
+		else if (opt == 'd' && (dups = strtoul (optarg, NULL, 10)) > 0)
+			continue;
+		else if (opt == 'K' && (s.key_bytes = atoi (optarg)) > 0 && s.key_bytes <= MAX_BYTES)
+			continue;
+		else if (opt == 'V' && (s.val_bytes = atoi (optarg)) > 0 && s.val_bytes <= MAX_BYTES)
+			continue;
+		else if (opt == 'i' && (insert = lookup_name (INSERT_NAMES, optarg)) >= 0)
+			continue;
+		else if (opt == 'b')
+			batch = strtoul (optarg, NULL, 10);
+		else if (opt == 'r' && (strcmp (optarg, "dup") == 0 || strcmp (optarg, "multiple") == 0))
+			multiple = strcmp (optarg, "multiple") == 0;
+		else if (opt == 'x' && (del = lookup_name (DELETE_NAMES, optarg)) >= 0)
+			continue;
+		else if (opt == 'n')
+			deletes = strtoul (optarg, NULL, 10);
+		else if (opt == 'R' && (run = strtoul (optarg, NULL, 10)) > 0)
+			continue;
+		else if (opt == 's')
+			rng = strtoull (optarg, NULL, 10);
+		else if (opt == 'm' && (mapsize = strtoul (optarg, NULL, 10)) > 0)
+			continue;
+		else if (opt == 'p')
+			path = optarg;
+		else {
+			usage (argv[0]);
+			return -1;
+		}
+	}
+
+	// shapes LMDB would refuse or mangle
+	if ((!(s.flags & MDB_DUPSORT) && (dups > 1 || (s.flags & (MDB_DUPFIXED | MDB_INTEGERDUP | MDB_REVERSEDUP)))) ||
+	    ((s.flags & MDB_INTEGERKEY) && s.key_bytes != sizeof (unsigned int) && s.key_bytes != sizeof (size_t)) ||
+	    ((s.flags & MDB_INTEGERDUP) && s.val_bytes != sizeof (unsigned int) && s.val_bytes != sizeof (size_t)) ||
+	    (multiple && !(s.flags & MDB_DUPFIXED)) ||
+	    (insert == APPEND && (s.flags & (MDB_REVERSEKEY | MDB_REVERSEDUP)))) {
+		fprintf (stderr, "dups need dupsort, integer keys and values 4 or 8 bytes, "
+			"-r multiple dupfixed, and -i append no reverse flags\n");
+		return -1;
+	}
 
-	mkey.mv_size = sizeof(unsigned int);
-	mkey.mv_data = &key;
-	mval.mv_size = sizeof(unsigned int);
-	mval.mv_data = &val;
+	// the data set: unique keys, each with unique values, in order
+	keys = malloc (nkeys * sizeof *keys);
+	vals = malloc (dups * sizeof *vals);
+	start = malloc ((nkeys + 1) * sizeof *start);
+	pairs = malloc (nkeys * dups * sizeof *pairs);
+	assert (keys != NULL && vals != NULL && start != NULL && pairs != NULL);
+	nkeys = unique_numbers (keys, nkeys, s.key_bytes);
+	for (i = 0, npairs = 0; i < nkeys; i++) {
+		start[i] = npairs;
+		n = unique_numbers (vals, dups, s.val_bytes);
+		for (j = 0; j < n; j++, npairs++) {
+			pairs[npairs].key = keys[i];
+			pairs[npairs].val = vals[j];
+		}
+	}
+	start[nkeys] = npairs;
+
+	// insertion and lookup orders
+	order = malloc (npairs * sizeof *order);
+	korder = malloc (nkeys * sizeof *korder);
+	n = npairs > deletes ? npairs : deletes;
+	lat = malloc ((n + 1) * sizeof *lat);
+	assert (order != NULL && korder != NULL && lat != NULL);
+	for (i = 0; i < npairs; i++)
+		order[i] = i;
+	for (i = npairs; insert == RANDOM && i > 1; i--) {
+		j = next_rand () % i;
+		k = order[i - 1], order[i - 1] = order[j], order[j] = k;
+	}
+	for (i = 0; i < nkeys; i++)
+		korder[i] = i;
+	for (i = nkeys; i > 1; i--) {
+		j = next_rand () % i;
+		k = korder[i - 1], korder[i - 1] = korder[j], korder[j] = k;
+	}
 
 	setbuf(stdout, NULL);
-	srand(time(NULL));
 
-	// open
+	// open a fresh store
+	mkdir (path, 0775);
+	snprintf (file, sizeof file, "%s/data.mdb", path);
+	unlink (file);
+	snprintf (file, sizeof file, "%s/lock.mdb", path);
+	unlink (file);
 	rc = mdb_env_create(&env);
 	assert(rc == 0);
-	rc = mdb_env_set_mapsize(env, 100*1024*1024);
+	rc = mdb_env_set_mapsize(env, mapsize*1024*1024);
 	assert(rc == 0);
-	rc = mdb_env_open(env, "./testdb", 0, 0664);
+	rc = mdb_env_open(env, path, 0, 0664);
 	assert(rc == 0);
-
-	// load initial state
-	printf("loading initial state... ");
 	rc = mdb_txn_begin(env, NULL, 0, &txn);
 	assert(rc == 0);
-	rc = mdb_dbi_open(txn, NULL, COMPACT, &dbi);
+	rc = mdb_dbi_open(txn, NULL, s.flags | MDB_CREATE, &dbi);
 	assert(rc == 0);
 	rc = mdb_txn_commit(txn);
 	assert(rc == 0);
 
-	key = rand();
+	printf ("shape keys=%zu dups=%zu pairs=%zu key_bytes=%zu val_bytes=%zu flags=0x%x insert=%s read=%s delete=%s\n",
+		nkeys, dups, npairs, s.key_bytes, s.val_bytes, s.flags, INSERT_NAMES[insert],
+		multiple ? "multiple" : "dup", DELETE_NAMES[del]);
 
+	// load
+	put_flags = insert != APPEND ? 0 : (s.flags & MDB_DUPSORT) ? MDB_APPENDDUP : MDB_APPEND;
 	rc = mdb_txn_begin(env, NULL, 0, &txn);
 	assert(rc == 0);
-	int to_del;
-	for (i=0; i<2000000; i++) {
-		val = rand();
-		if (i==1000000) to_del = val;
-		rc = mdb_put(txn, dbi, &mkey, &mval, 0);
-		assert(rc == 0);
-	}
-
-	rc = mdb_txn_commit(txn);
-	assert(rc == 0);
-
-	printf("loaded.\n\n");
-
-	// full scan
-	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
-	assert(rc == 0);
 	rc = mdb_cursor_open(txn, dbi, &cursor);
 	assert(rc == 0);
-
-	rc = mdb_cursor_get(cursor, &mkey, &mval, MDB_SET);
-	assert(rc == 0);
-	printf("key: %d val: %d\n",
-		*(unsigned int *) mkey.mv_data, *(unsigned int *) mval.mv_data);
-
-	size_t count;
-	rc = mdb_cursor_count(cursor, &count);
-	assert(rc == 0);
-	printf("count: %zu\n\n", count);
-
-	int n;
-	int seen = 0;
-	int alt = 0;
-	while ((rc = mdb_cursor_get(cursor, &mkey, &mval, MDB_NEXT_MULTIPLE)) == 0) {
-		n = mval.mv_size / sizeof(val);
-		seen += n;
-		if (alt % 100 == 0) {
-			printf("key: %d val: %d n: %d\n",
-				*(unsigned int *) mkey.mv_data, *(unsigned int *) mval.mv_data, n);
+	t0 = now ();
+	for (i = 0; i < npairs; i++) {
+		set_pair (&s, &pairs[order[i]], key, val, &mkey, &mval);
+		t = now ();
+		rc = mdb_cursor_put(cursor, &mkey, &mval, put_flags);
+		lat[i] = now () - t;
+		if (rc == MDB_KEYEXIST)
+			existing++;
+		else
+			assert(rc == 0);
+		if (batch > 0 && (i + 1) % batch == 0) {
+			mdb_cursor_close(cursor);
+			rc = mdb_txn_commit(txn);
+			assert(rc == 0);
+			rc = mdb_txn_begin(env, NULL, 0, &txn);
+			assert(rc == 0);
+			rc = mdb_cursor_open(txn, dbi, &cursor);
+			assert(rc == 0);
 		}
-		alt++;
 	}
-	printf("traversed: %d\n\n", seen);
-	assert(rc == MDB_NOTFOUND);
-
 	mdb_cursor_close(cursor);
-	mdb_txn_abort(txn);
-
-	// delete an item
-	rc = mdb_txn_begin(env, NULL, 0, &txn);
-	assert(rc == 0);
-	val = to_del;
-	printf("delete: %d\n", val);
-	rc = mdb_del(txn, dbi, &mkey, &mval);
-	assert(rc == 0);
 	rc = mdb_txn_commit(txn);
 	assert(rc == 0);
+	report ("load", npairs, now () - t0, lat, npairs);
+	if (existing > 0)
+		fprintf (stderr, "%zu pairs already there\n", existing);
+	report_stat ("load_stat", env, dbi, path);
 
+	// read every key with all its values
 	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
 	assert(rc == 0);
 	rc = mdb_cursor_open(txn, dbi, &cursor);
 	assert(rc == 0);
-
-	rc = mdb_cursor_get(cursor, &mkey, &mval, MDB_SET);
-	assert(rc == 0);
-	rc = mdb_cursor_count(cursor, &count);
-	assert(rc == 0);
-
-	printf("count: %zu\n\n", count);
+	seen = 0;
+	t0 = now ();
+	for (i = 0; i < nkeys; i++) {
+		set_pair (&s, &pairs[start[korder[i]]], key, val, &mkey, &mval);
+		t = now ();
+		rc = mdb_cursor_get(cursor, &mkey, &mval, MDB_SET);
+		assert(rc == 0);
+		if (!multiple) {
+			for (count = 1; mdb_cursor_get(cursor, &mkey, &mval, MDB_NEXT_DUP) == 0; count++)
+				;
+		}
+		else {
+			// a page of values per call
+			for (count = 0, rc = mdb_cursor_get(cursor, &mkey, &mval, MDB_GET_MULTIPLE); rc == 0;
+			     rc = mdb_cursor_get(cursor, &mkey, &mval, MDB_NEXT_MULTIPLE))
+				count += mval.mv_size / s.val_bytes;
+		}
+		lat[i] = now () - t;
+		seen += count;
+	}
+	t = now () - t0;
 	mdb_cursor_close(cursor);
 	mdb_txn_abort(txn);
+	report ("read", nkeys, t, lat, nkeys);
+	if (seen != npairs - existing)
+		fprintf (stderr, "read %zu values of %zu\n", seen, npairs);
+
+	// delete, a transaction per deletion
+	t0 = now ();
+	for (i = 0; i < deletes; i++) {
+		k = korder[next_rand () % nkeys];
+		j = start[k] + next_rand () % (start[k + 1] - start[k]);
+		set_pair (&s, &pairs[j], key, val, &mkey, &mval);
+		t = now ();
+		rc = mdb_txn_begin(env, NULL, 0, &txn);
+		assert(rc == 0);
+		if (del == DEL_PAIR)
+			rc = mdb_del(txn, dbi, &mkey, &mval);
+		else if (del == DEL_KEY)
+			rc = mdb_del(txn, dbi, &mkey, NULL);
+		else {
+			rc = mdb_cursor_open(txn, dbi, &cursor);
+			assert(rc == 0);
+			rc = mdb_cursor_get(cursor, &mkey, &mval, MDB_GET_BOTH);
+			// up to run values of the key, from the one drawn on
+			for (n = 0; rc == 0 && n < run; n++) {
+				rc = mdb_cursor_del(cursor, 0);
+				assert(rc == 0);
+				if (mdb_cursor_get(cursor, &mkey, &mval, MDB_GET_CURRENT) != 0 ||
+				    memcmp (mkey.mv_data, key, s.key_bytes) != 0)
+					break;
+			}
+			mdb_cursor_close(cursor);
+		}
+		if (rc == MDB_NOTFOUND)
+			missing++;
+		else
+			assert(rc == 0);
+		rc = mdb_txn_commit(txn);
+		assert(rc == 0);
+		lat[i] = now () - t;
+	}
+	report ("delete", deletes, now () - t0, lat, deletes);
+	if (missing > 0)
+		fprintf (stderr, "%zu deletions found nothing left\n", missing);
+	report_stat ("delete_stat", env, dbi, path);
 
 	// close
 	mdb_env_close(env);
+	free (keys);
+	free (vals);
+	free (start);
+	free (pairs);
+	free (order);
+	free (korder);
+	free (lat);
 	return 0;
 }
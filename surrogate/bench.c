@@ -0,0 +1,559 @@
+/*
+ * File Name:	bench.c
+ * Function:	End-to-end benchmark of the surrogate tools on a
+ *		synthetic feed (workload.h), in a scratch store created
+ *		under dir and removed afterwards (kept with -K):
+ *
+ *		  feed     the feed written to a file beside the store
+ *		  ingest   the file fed to map_data, run with -H, -B,
+ *		           -S, -T and -M as given
+ *		  examine  examine over the result
+ *		  lookup   -l keys, drawn as popular as in the feed,
+ *		           each looked up with all its URLs
+ *		  purge    -p keys purged with purger_remove, one
+ *		           transaction each, as purge does
+ *
+ *		map_data and examine are run from -t (default .). Each
+ *		phase prints one JSON object per line, to stdout or
+ *		appended to -o, with the workload and store options,
+ *		the time taken and the rate, per-operation latency
+ *		percentiles in microseconds for lookup and purge, the
+ *		data file size and the peak resident set (of the tool
+ *		for ingest and examine, of the benchmark so far
+ *		otherwise), so runs can be compared by machine:
+ *
+ *		  for n in 1000000 10000000 100000000; do
+ *		      bench -n $n -k $((n / 10)) -o results.json /scratch
+ *		  done
+ *
+ *		The store may grow to SURROGATE_MAP_SIZE, or to -M
+ *		gigabytes, which the 100M feed needs; its feed file
+ *		takes a few more on the same disk.
+ *
+ *		-P adds CPU counters (perfcount.h) to each object, per
+ *		operation: "ipc", "cycles", "instructions", "llc_misses",
+ *		"dtlb_misses" and "branch_misses". Those of ingest and
+ *		examine are the tool's.
+ *
+ *		bench [-n lines] [-k keys] [-m mean] [-d fixed|uniform|geometric]
+ *		      [-z skew] [-s seed] [-l lookups] [-p purges] [-H hash]
+ *		      [-B bytes] [-S] [-T] [-M GB] [-t tools] [-o results] [-P] [-K] dir
+ *
+ *		cc bench.c workload.c purger.c perfcount.c surrogate.c \
+ *		   blake2/sse/blake2b.c -llmdb -pthread -lm
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "lmdb.h"
+#include "surrogate.h"
+#include "purger.h"
+#include "workload.h"
+#include "perfcount.h"
+
+typedef struct bench {
+	workload_config wl;
+	unsigned long long lines, edges;
+	surrogate_config cfg;
+	const char *mode[8];		// map_data options, NULL ended
+	char tools[PATH_MAX], dir[PATH_MAX], store[PATH_MAX + 16], feed[PATH_MAX + 16];
+	FILE *out;
+	perfcount *pc;			// counting each phase (-P), or NULL
+} bench;
+
+typedef struct result {
+	const char *phase;
+	unsigned long long ops;
+	double secs;
+	double *lat;			// per operation, in seconds; NULL for none
+	long rss_kb;
+} result;
+
+static double
+now (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+by_double (const void *a, const void *b) {
+
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static long long
+file_bytes (const bench *b) {
+
+	char path[PATH_MAX + 32];
+	struct stat sb;
+
+	snprintf (path, sizeof path, "%s/data.mdb", b->store);
+	return stat (path, &sb) == 0 ? (long long) sb.st_size : -1;
+}
+
+static void
+count_start (bench *b) {
+
+	if (b->pc != NULL)
+		perfcount_start (b->pc);
+}
+
+static void
+count_stop (bench *b) {
+
+	if (b->pc != NULL)
+		perfcount_stop (b->pc);
+}
+
+// one JSON line per phase, with the counts since count_start
+static void
+report (const bench *b, const result *r) {
+
+	static const double pct[] = { 0.5, 0.9, 0.99, 0.999 };
+	static const char *names[] = { "p50", "p90", "p99", "p999" };
+	size_t i, n = r->ops;
+
+	fprintf (b->out, "{\"phase\":\"%s\",\"lines\":%llu,\"keys\":%llu,\"mean\":%u,"
+		"\"dist\":\"%s\",\"skew\":%g,\"seed\":%llu,\"hash\":\"%s\",\"id_bytes\":%zu,"
+		"\"strings\":%d,\"expiry\":%d,\"ops\":%llu,\"secs\":%.6f,\"ops_per_sec\":%.1f",
+		r->phase, b->lines, (unsigned long long) b->wl.keys, b->wl.mean,
+		workload_dist_names[b->wl.dist], b->wl.skew, (unsigned long long) b->wl.seed,
+		b->cfg.hash != NULL ? b->cfg.hash : SURROGATE_HASH_DEFAULT, surrogate_hash_bytes (),
+		b->cfg.strings, b->cfg.expiry, r->ops, r->secs, r->secs > 0 ? r->ops / r->secs : 0);
+	if (r->lat != NULL && n > 0) {
+		qsort (r->lat, n, sizeof *r->lat, by_double);
+		for (i = 0; i < sizeof pct / sizeof *pct; i++)
+			fprintf (b->out, ",\"%s_us\":%.3f", names[i], r->lat[(size_t) (pct[i] * (n - 1))] * 1e6);
+		fprintf (b->out, ",\"max_us\":%.3f", r->lat[n - 1] * 1e6);
+	}
+	if (b->pc != NULL)
+		perfcount_json (b->out, b->pc, r->ops);
+	fprintf (b->out, ",\"file_bytes\":%lld,\"max_rss_kb\":%ld}\n", file_bytes (b), r->rss_kb);
+	fflush (b->out);
+}
+
+static long
+self_rss (void) {
+
+	struct rusage ru;
+	getrusage (RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+// run tool with extra arguments in the scratch directory, stdout
+// discarded and stdin read from input unless it is NULL
+static pid_t
+spawn (const bench *b, const char *tool, const char *const *args, const char *input) {
+
+	int fd, null, n;
+	const char *argv[10];
+	char path[PATH_MAX + 64];
+	pid_t pid;
+
+	snprintf (path, sizeof path, "%s/%s", b->tools, tool);
+	argv[0] = path;
+	for (n = 1; args != NULL && args[n - 1] != NULL && n < 9; n++)
+		argv[n] = args[n - 1];
+	argv[n] = NULL;
+
+	pid = fork ();
+	if (pid == 0) {
+		if (input != NULL) {
+			fd = open (input, O_RDONLY);
+			if (fd < 0 || dup2 (fd, STDIN_FILENO) < 0)
+				_exit (127);
+			close (fd);
+		}
+		null = open ("/dev/null", O_WRONLY);
+		dup2 (null, STDOUT_FILENO);
+		if (chdir (b->dir) != 0)
+			_exit (127);
+		execv (path, (char *const *) argv);
+		fprintf (stderr, "Failure to run %s: %s\n", path, strerror (errno));
+		_exit (127);
+	}
+	return pid;
+}
+
+// wait for a spawned tool; its peak RSS goes to *rss_kb
+static int
+reap (pid_t pid, long *rss_kb) {
+
+	int status;
+	struct rusage ru;
+
+	if (wait4 (pid, &status, 0, &ru) != pid)
+		return -1;
+	*rss_kb = ru.ru_maxrss;
+	return WIFEXITED (status) && WEXITSTATUS (status) == 0 ? 0 : -1;
+}
+
+// write the feed to its file ahead of the ingest, so that the ingest
+// times map_data alone
+static int
+feed (bench *b) {
+
+	workload w;
+	char line[500];
+	size_t len;
+	unsigned long long i;
+	FILE *out;
+	result r = { "feed", 0, 0, NULL, 0 };
+	double t = now ();
+
+	out = fopen (b->feed, "w");
+	if (out == NULL) {
+		perror (b->feed);
+		return -1;
+	}
+	count_start (b);
+	workload_init (&w, &b->wl);
+	for (i = 0; i < b->lines; i++) {
+		len = workload_line (&w, line, sizeof line);
+		if (fwrite (line, 1, len, out) != len)
+			break;
+		// a key per space
+		while (len-- > 0)
+			b->edges += line[len] == ' ';
+	}
+	if (fclose (out) != 0 || i < b->lines) {
+		fprintf (stderr, "Failure to write %s\n", b->feed);
+		return -1;
+	}
+	count_stop (b);
+	r.secs = now () - t;
+	r.ops = b->lines;
+	r.rss_kb = self_rss ();
+	report (b, &r);
+	return 0;
+}
+
+static int
+ingest (bench *b) {
+
+	pid_t pid;
+	result r = { "ingest", 0, 0, NULL, 0 };
+	double t = now ();
+
+	// map_data, forked after the counters opened, counts too
+	count_start (b);
+	pid = spawn (b, "map_data", b->mode, b->feed);
+	if (pid < 0 || reap (pid, &r.rss_kb) != 0) {
+		fprintf (stderr, "map_data failed\n");
+		return -1;
+	}
+	count_stop (b);
+	r.secs = now () - t;
+	r.ops = b->edges;
+	report (b, &r);
+	return 0;
+}
+
+static int
+examine (bench *b) {
+
+	pid_t pid;
+	result r = { "examine", 0, 0, NULL, 0 };
+	double t = now ();
+
+	count_start (b);
+	pid = spawn (b, "examine", NULL, NULL);
+	if (pid < 0 || reap (pid, &r.rss_kb) != 0) {
+		fprintf (stderr, "examine failed\n");
+		return -1;
+	}
+	count_stop (b);
+	r.secs = now () - t;
+	r.ops = 1;
+	report (b, &r);
+	return 0;
+}
+
+static int
+lookup (bench *b, surrogate_store *st, unsigned long long n) {
+
+	int rc;
+	unsigned long long i;
+	char name[32];
+	unsigned char key[SURROGATE_MAX_HASH_BYTES];
+	size_t urls = 0;
+	double t0, t;
+	workload w;
+	workload_config wl = b->wl;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_val mkey, mval;
+	result r = { "lookup", n, 0, NULL, 0 };
+
+	r.lat = malloc ((n + 1) * sizeof *r.lat);
+	if (r.lat == NULL)
+		return ENOMEM;
+	wl.seed = b->wl.seed + 1;
+	workload_init (&w, &wl);
+	rc = mdb_txn_begin (st->env, NULL, MDB_RDONLY, &txn);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_cursor_open (txn, st->dbi, &cursor);
+	if (rc != MDB_SUCCESS) {
+		free (r.lat);
+		return rc;
+	}
+	mkey.mv_size = st->hash_bytes;
+	mkey.mv_data = key;
+
+	count_start (b);
+	t0 = now ();
+	for (i = 0; i < n; i++) {
+		workload_key_name (name, sizeof name, workload_key (&w));
+		t = now ();
+		surrogate_hash (key, name, strlen (name));
+		for (rc = mdb_cursor_get (cursor, &mkey, &mval, MDB_SET); rc == MDB_SUCCESS;
+		     rc = mdb_cursor_get (cursor, &mkey, &mval, MDB_NEXT_DUP))
+			urls++;
+		r.lat[i] = now () - t;
+	}
+	r.secs = now () - t0;
+	count_stop (b);
+	mdb_cursor_close (cursor);
+	mdb_txn_abort (txn);
+	r.rss_kb = self_rss ();
+	report (b, &r);
+	fprintf (stderr, "lookup: %.1f URLs per key\n", n ? (double) urls / n : 0);
+	free (r.lat);
+	return MDB_SUCCESS;
+}
+
+static int
+purge (bench *b, surrogate_store *st, unsigned long long n) {
+
+	int rc = MDB_SUCCESS;
+	unsigned long long i;
+	char name[32];
+	unsigned char key[SURROGATE_MAX_HASH_BYTES];
+	size_t urls, pairs, total_urls = 0, total_pairs = 0;
+	double t0, t;
+	workload w;
+	workload_config wl = b->wl;
+	MDB_txn *txn;
+	result r = { "purge", n, 0, NULL, 0 };
+
+	r.lat = malloc ((n + 1) * sizeof *r.lat);
+	if (r.lat == NULL)
+		return ENOMEM;
+	wl.seed = b->wl.seed + 2;
+	workload_init (&w, &wl);
+
+	count_start (b);
+	t0 = now ();
+	for (i = 0; rc == MDB_SUCCESS && i < n; i++) {
+		workload_key_name (name, sizeof name, workload_key (&w));
+		t = now ();
+		surrogate_hash (key, name, strlen (name));
+		rc = mdb_txn_begin (st->env, NULL, 0, &txn);
+		if (rc != MDB_SUCCESS)
+			break;
+		rc = purger_remove (st, txn, key, 0, &urls, &pairs);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_txn_commit (txn);
+		else
+			mdb_txn_abort (txn);
+		r.lat[i] = now () - t;
+		total_urls += urls;
+		total_pairs += pairs;
+	}
+	r.secs = now () - t0;
+	count_stop (b);
+	if (rc == MDB_SUCCESS) {
+		r.rss_kb = self_rss ();
+		report (b, &r);
+		fprintf (stderr, "purge: %zu URLs, %zu pairs removed\n", total_urls, total_pairs);
+	}
+	free (r.lat);
+	return rc;
+}
+
+static void
+cleanup (const bench *b) {
+
+	static const char *files[] = { "data.mdb", "lock.mdb", NULL };
+	char path[PATH_MAX + 32];
+	int i;
+
+	for (i = 0; files[i] != NULL; i++) {
+		snprintf (path, sizeof path, "%s/%s", b->store, files[i]);
+		unlink (path);
+	}
+	rmdir (b->store);
+	unlink (b->feed);
+	rmdir (b->dir);
+}
+
+static void
+usage (const char *prog) {
+
+	fprintf (stderr, "usage: %s [-n lines] [-k keys] [-m mean] [-d fixed|uniform|geometric]\n"
+		"\t[-z skew] [-s seed] [-l lookups] [-p purges] [-H hash] [-B bytes] [-S] [-T]\n"
+		"\t[-M GB] [-t tools] [-o results] [-P] [-K] dir\n", prog);
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int opt, d, keep = 0, counting = 0, nmode = 0, rc;
+	char bytes_opt[8], map_opt[16];
+	unsigned char no_key[SURROGATE_HASH_KEY_BYTES] = { 0 };
+	unsigned long long lookups = 100000, purges = 1000;
+	const char *tools = ".", *results = NULL;
+	surrogate_store st;
+	surrogate_config open_cfg = { NULL, 0, 0, 0, 0 };
+	workload w;
+	perfcount pc;
+	bench b;
+
+	memset (&b, 0, sizeof b);
+	b.lines = 1000000;
+	b.wl.keys = 100000;
+	b.wl.skew = 1.0;
+	b.wl.mean = 4;
+	b.wl.dist = WORKLOAD_GEOMETRIC;
+	b.wl.seed = 1;
+	b.cfg.hash_bytes = SURROGATE_HASH_BYTES;
+
+	while ((opt = getopt (argc, argv, "n:k:m:d:z:s:l:p:H:B:STM:t:o:PK")) != -1) {
+		if (opt == 'n')
+			b.lines = strtoull (optarg, NULL, 10);
+		else if (opt == 'k')
+			b.wl.keys = strtoull (optarg, NULL, 10);
+		else if (opt == 'm')
+			b.wl.mean = atoi (optarg);
+		else if (opt == 'd') {
+			for (d = 0; workload_dist_names[d] != NULL; d++)
+				if (strcmp (optarg, workload_dist_names[d]) == 0)
+					break;
+			b.wl.dist = workload_dist_names[d] != NULL ? d : -1;
+		}
+		else if (opt == 'z')
+			b.wl.skew = atof (optarg);
+		else if (opt == 's')
+			b.wl.seed = strtoull (optarg, NULL, 10);
+		else if (opt == 'l')
+			lookups = strtoull (optarg, NULL, 10);
+		else if (opt == 'p')
+			purges = strtoull (optarg, NULL, 10);
+		else if (opt == 'H')
+			b.cfg.hash = optarg;
+		else if (opt == 'B' && (b.cfg.hash_bytes = atoi (optarg)) > 0)
+			continue;
+		else if (opt == 'S')
+			b.cfg.strings = 1;
+		else if (opt == 'T')
+			b.cfg.expiry = 1;
+		else if (opt == 'M' && atoi (optarg) > 0)
+			b.cfg.map_size = (size_t) atoi (optarg) << 30;
+		else if (opt == 't')
+			tools = optarg;
+		else if (opt == 'o')
+			results = optarg;
+		else if (opt == 'P')
+			counting = 1;
+		else if (opt == 'K')
+			keep = 1;
+		else {
+			usage (argv[0]);
+			return -1;
+		}
+	}
+	// checks the hash and width; the store map_data creates draws its key
+	if (optind != argc - 1 || workload_init (&w, &b.wl) != 0 ||
+	    surrogate_select_hash (b.cfg.hash != NULL ? b.cfg.hash : SURROGATE_HASH_DEFAULT,
+		b.cfg.hash_bytes, no_key) != 0) {
+		usage (argv[0]);
+		return -1;
+	}
+
+	// map_data creates the store as asked
+	if (b.cfg.hash != NULL) {
+		b.mode[nmode++] = "-H";
+		b.mode[nmode++] = b.cfg.hash;
+	}
+	snprintf (bytes_opt, sizeof bytes_opt, "-B%zu", b.cfg.hash_bytes);
+	b.mode[nmode++] = bytes_opt;
+	if (b.cfg.strings)
+		b.mode[nmode++] = "-S";
+	if (b.cfg.expiry)
+		b.mode[nmode++] = "-T";
+	if (b.cfg.map_size != 0) {
+		snprintf (map_opt, sizeof map_opt, "-M%zu", b.cfg.map_size >> 30);
+		b.mode[nmode++] = map_opt;
+	}
+
+	if (realpath (tools, b.tools) == NULL) {
+		perror (tools);
+		return -1;
+	}
+	snprintf (b.dir, sizeof b.dir, "%s/bench.XXXXXX", argv[optind]);
+	if (mkdtemp (b.dir) == NULL) {
+		perror (b.dir);
+		return -1;
+	}
+	snprintf (b.store, sizeof b.store, "%s/db_dir", b.dir);
+	snprintf (b.feed, sizeof b.feed, "%s/feed", b.dir);
+	if (mkdir (b.store, 0775) != 0) {
+		perror (b.store);
+		return -1;
+	}
+	b.out = stdout;
+	if (results != NULL && (b.out = fopen (results, "a")) == NULL) {
+		perror (results);
+		return -1;
+	}
+	signal (SIGPIPE, SIG_IGN);
+	if (counting) {
+		if ((rc = perfcount_open (&pc)) == 0)
+			b.pc = &pc;
+		else
+			fprintf (stderr, "No CPU counters: %s\n", strerror (rc));
+	}
+
+	rc = feed (&b);
+	if (rc == 0)
+		rc = ingest (&b);
+	if (rc == 0)
+		rc = examine (&b);
+	if (rc == 0) {
+		// the purges may grow the store too
+		open_cfg.map_size = b.cfg.map_size;
+		rc = surrogate_open_config (&st, b.store, 0, &open_cfg);
+		if (rc == MDB_SUCCESS) {
+			rc = lookup (&b, &st, lookups);
+			if (rc == MDB_SUCCESS)
+				rc = purge (&b, &st, purges);
+			surrogate_close (&st);
+		}
+		if (rc != MDB_SUCCESS)
+			fprintf (stderr, "Benchmark failed: %s\n", surrogate_strerror (rc));
+	}
+
+	if (!keep)
+		cleanup (&b);
+	else
+		fprintf (stderr, "store kept in %s\n", b.store);
+	if (b.pc != NULL)
+		perfcount_close (b.pc);
+	if (b.out != stdout)
+		fclose (b.out);
+	return rc == 0 ? 0 : -1;
+}
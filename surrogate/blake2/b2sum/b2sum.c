@@ -13,27 +13,49 @@
    https://blake2.net.
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 
 #include <ctype.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "blake2.h"
 
+/* Regular files at least this large are mapped instead of read */
+#define MMAP_THRESHOLD ( 1UL << 20 )
+
+/* Page-aligned, so reads land on whole pages and avoid a stdio copy */
+static void *alloc_buffer( size_t length )
+{
+  long page = sysconf( _SC_PAGESIZE );
+  void *buffer = NULL;
+
+  if( posix_memalign( &buffer, page > 0 ? ( size_t )page : 4096, length ) != 0 )
+    return NULL;
+  return buffer;
+}
+
 /* This will help compatibility with coreutils */
 int blake2s_stream( FILE *stream, void *resstream, size_t outbytes )
 {
   int ret = -1;
   size_t sum, n;
   blake2s_state S[1];
-  static const size_t buffer_length = 32768;
-  uint8_t *buffer = ( uint8_t * )malloc( buffer_length );
+  static const size_t buffer_length = 1UL << 20;
+  uint8_t *buffer = ( uint8_t * )alloc_buffer( buffer_length );
 
   if( !buffer ) return -1;
 
@@ -82,8 +104,8 @@ int blake2b_stream( FILE *stream, void *resstream, size_t outbytes )
   int ret = -1;
   size_t sum, n;
   blake2b_state S[1];
-  static const size_t buffer_length = 32768;
-  uint8_t *buffer = ( uint8_t * )malloc( buffer_length );
+  static const size_t buffer_length = 1UL << 20;
+  uint8_t *buffer = ( uint8_t * )alloc_buffer( buffer_length );
 
   if( !buffer ) return -1;
 
@@ -133,7 +155,7 @@ int blake2sp_stream( FILE *stream, void *resstream, size_t outbytes )
   size_t sum, n;
   blake2sp_state S[1];
   static const size_t buffer_length = 16 * ( 1UL << 20 );
-  uint8_t *buffer = ( uint8_t * )malloc( buffer_length );
+  uint8_t *buffer = ( uint8_t * )alloc_buffer( buffer_length );
 
   if( !buffer ) return -1;
 
@@ -184,7 +206,7 @@ int blake2bp_stream( FILE *stream, void *resstream, size_t outbytes )
   size_t sum, n;
   blake2bp_state S[1];
   static const size_t buffer_length = 16 * ( 1UL << 20 );
-  uint8_t *buffer = ( uint8_t * )malloc( buffer_length );
+  uint8_t *buffer = ( uint8_t * )alloc_buffer( buffer_length );
 
   if( !buffer ) return -1;
 
@@ -229,6 +251,555 @@ cleanup_buffer:
 }
 
 typedef int ( *blake2fn )( FILE *, void *, size_t );
+typedef int ( *blake2mem )( void *, size_t, const void *, size_t, const void *, size_t );
+
+typedef struct
+{
+  const char *option;
+  const char *name;
+  blake2fn stream;
+  blake2mem memory;
+  unsigned long maxbytes;
+} b2sum_algorithm;
+
+static const b2sum_algorithm algorithms[] =
+{
+  { "blake2b",  "BLAKE2b",  blake2b_stream,  blake2b,  BLAKE2B_OUTBYTES },
+  { "blake2s",  "BLAKE2s",  blake2s_stream,  blake2s,  BLAKE2S_OUTBYTES },
+  { "blake2bp", "BLAKE2bp", blake2bp_stream, blake2bp, BLAKE2B_OUTBYTES },
+  { "blake2sp", "BLAKE2sp", blake2sp_stream, blake2sp, BLAKE2S_OUTBYTES },
+};
+
+#define ALGORITHMS ( sizeof( algorithms ) / sizeof( algorithms[0] ) )
+
+enum { HASH_OK = 0, HASH_OPEN_FAILED, HASH_FAILED, HASH_TRUNCATED };
+
+typedef struct
+{
+  const char *path;
+  const b2sum_algorithm *algorithm;
+  size_t outbytes;
+  uint8_t hash[BLAKE2B_OUTBYTES];
+  uint8_t expected[BLAKE2B_OUTBYTES]; /* --check only */
+  off_t size;                         /* --check only */
+  int result;
+  int error; /* errno when the file could not be opened */
+  bool done;
+} b2sum_job;
+
+static uintptr_t page_size;
+
+/*
+  A mapped file truncated while it is hashed faults past its new end
+  with SIGBUS, on whichever thread (OpenMP or the pool of -a
+  blake2bp/blake2sp) touched the page. Map zeros over that page and
+  let the hash run on; hash_mapped sees the file shrank and fails the
+  job. Any other SIGBUS takes the default action when it repeats.
+*/
+static void zero_fill( int sig, siginfo_t *info, void *context )
+{
+  void *page = ( void * )( ( uintptr_t )info->si_addr & ~( page_size - 1 ) );
+
+  ( void )context;
+  if( info->si_code != BUS_ADRERR ||
+      mmap( page, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0 ) == MAP_FAILED )
+    signal( sig, SIG_DFL );
+}
+
+static void catch_truncation( void )
+{
+  struct sigaction sa;
+  long page = sysconf( _SC_PAGESIZE );
+
+  page_size = page > 0 ? ( uintptr_t )page : 4096;
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_sigaction = zero_fill;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset( &sa.sa_mask );
+  sigaction( SIGBUS, &sa, NULL );
+}
+
+/* Map a large regular file and hash it in one call */
+static bool hash_mapped( b2sum_job *job, int fd )
+{
+  struct stat st;
+  size_t length;
+  void *map;
+
+  if( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) )
+    return false;
+
+  length = ( size_t )st.st_size;
+  if( ( off_t )length != st.st_size || length < MMAP_THRESHOLD )
+    return false;
+
+  map = mmap( NULL, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+  if( map == MAP_FAILED )
+    return false;
+
+  madvise( map, length, MADV_SEQUENTIAL );
+  job->result = job->algorithm->memory( job->hash, job->outbytes, map, length, NULL, 0 ) < 0 ? HASH_FAILED : HASH_OK;
+  munmap( map, length );
+
+  /* pages past a truncation were hashed as zeros */
+  if( fstat( fd, &st ) != 0 || st.st_size < ( off_t )length )
+    job->result = HASH_TRUNCATED;
+  return true;
+}
+
+static void hash_job( b2sum_job *job )
+{
+  FILE *f = NULL;
+  int fd;
+
+  if( job->path[0] == '-' && job->path[1] == '\0' )
+    f = stdin;
+  else
+  {
+    fd = open( job->path, O_RDONLY );
+    if( fd < 0 )
+    {
+      job->result = HASH_OPEN_FAILED;
+      job->error = errno;
+      return;
+    }
+
+    if( hash_mapped( job, fd ) )
+    {
+      close( fd );
+      return;
+    }
+
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+    f = fdopen( fd, "rb" );
+    if( !f )
+    {
+      job->result = HASH_OPEN_FAILED;
+      job->error = errno;
+      close( fd );
+      return;
+    }
+  }
+
+  /* the stream functions read in large blocks; stdio buffering only adds a copy */
+  setvbuf( f, NULL, _IONBF, 0 );
+  job->result = job->algorithm->stream( f, job->hash, job->outbytes ) < 0 ? HASH_FAILED : HASH_OK;
+
+  if( f != stdin ) fclose( f );
+}
+
+/*
+  Work-stealing pool for -j: every worker owns a queue of jobs, takes
+  from its front and, once it runs dry, steals from the back of the
+  others. Jobs never get added, so a worker that finds every queue
+  empty is done.
+*/
+typedef struct
+{
+  pthread_mutex_t lock;
+  size_t *items;
+  size_t head, tail;
+} b2sum_queue;
+
+typedef struct
+{
+  b2sum_job *jobs;
+  b2sum_queue *queues;
+  size_t nqueues;
+  pthread_mutex_t lock; /* guards jobs[].done and completed */
+  pthread_cond_t finished;
+  size_t *completed;    /* job indices in the order they finished */
+  size_t ncompleted;
+} b2sum_pool;
+
+typedef struct
+{
+  b2sum_pool *pool;
+  size_t self;
+} b2sum_worker;
+
+static bool queue_take( b2sum_queue *q, bool steal, size_t *item )
+{
+  bool found = false;
+
+  pthread_mutex_lock( &q->lock );
+  if( q->head < q->tail )
+  {
+    *item = steal ? q->items[--q->tail] : q->items[q->head++];
+    found = true;
+  }
+  pthread_mutex_unlock( &q->lock );
+  return found;
+}
+
+static void *pool_worker( void *arg )
+{
+  b2sum_worker *w = ( b2sum_worker * )arg;
+  b2sum_pool *pool = w->pool;
+  size_t item, k;
+
+  for( ;; )
+  {
+    bool found = queue_take( &pool->queues[w->self], false, &item );
+
+    for( k = 1; !found && k < pool->nqueues; ++k )
+      found = queue_take( &pool->queues[( w->self + k ) % pool->nqueues], true, &item );
+
+    if( !found )
+      break;
+
+    hash_job( &pool->jobs[item] );
+
+    pthread_mutex_lock( &pool->lock );
+    pool->jobs[item].done = true;
+    pool->completed[pool->ncompleted++] = item;
+    pthread_cond_broadcast( &pool->finished );
+    pthread_mutex_unlock( &pool->lock );
+  }
+  return NULL;
+}
+
+/* Start nthreads workers on jobs dealt round-robin in the given order */
+static int pool_start( b2sum_pool *pool, b2sum_worker *workers, pthread_t *threads, size_t nthreads,
+                       b2sum_job *jobs, const size_t *order, size_t njobs )
+{
+  size_t i, per = ( njobs + nthreads - 1 ) / nthreads;
+
+  pool->jobs = jobs;
+  pool->nqueues = nthreads;
+  pool->ncompleted = 0;
+  pool->queues = ( b2sum_queue * )calloc( nthreads, sizeof( b2sum_queue ) );
+  pool->completed = ( size_t * )malloc( ( njobs ? njobs : 1 ) * sizeof( size_t ) );
+  if( !pool->queues || !pool->completed ) return -1;
+  pthread_mutex_init( &pool->lock, NULL );
+  pthread_cond_init( &pool->finished, NULL );
+
+  for( i = 0; i < nthreads; ++i )
+  {
+    pool->queues[i].items = ( size_t * )malloc( ( per ? per : 1 ) * sizeof( size_t ) );
+    if( !pool->queues[i].items ) return -1;
+    pthread_mutex_init( &pool->queues[i].lock, NULL );
+  }
+  for( i = 0; i < njobs; ++i )
+  {
+    b2sum_queue *q = &pool->queues[i % nthreads];
+    q->items[q->tail++] = order ? order[i] : i;
+  }
+
+  for( i = 0; i < nthreads; ++i )
+  {
+    workers[i].pool = pool;
+    workers[i].self = i;
+    if( pthread_create( &threads[i], NULL, pool_worker, &workers[i] ) != 0 )
+      return -1;
+  }
+  return 0;
+}
+
+static void pool_wait( b2sum_pool *pool, const b2sum_job *job )
+{
+  pthread_mutex_lock( &pool->lock );
+  while( !job->done )
+    pthread_cond_wait( &pool->finished, &pool->lock );
+  pthread_mutex_unlock( &pool->lock );
+}
+
+/* The k-th job to finish, waiting for it if need be */
+static b2sum_job *pool_next( b2sum_pool *pool, size_t k )
+{
+  size_t item;
+
+  pthread_mutex_lock( &pool->lock );
+  while( pool->ncompleted <= k )
+    pthread_cond_wait( &pool->finished, &pool->lock );
+  item = pool->completed[k];
+  pthread_mutex_unlock( &pool->lock );
+  return &pool->jobs[item];
+}
+
+static bool print_error( const b2sum_job *job )
+{
+  if( job->result == HASH_OPEN_FAILED )
+    fprintf( stderr, "Could not open `%s': %s\n", job->path, strerror( job->error ) );
+  else if( job->result == HASH_FAILED )
+    fprintf( stderr, "Failed to hash `%s'\n", job->path );
+  else if( job->result == HASH_TRUNCATED )
+    fprintf( stderr, "`%s' was truncated while being hashed\n", job->path );
+  else
+    return false;
+  return true;
+}
+
+static void print_job( const b2sum_job *job, bool bsdstyle )
+{
+  size_t j;
+
+  if( print_error( job ) )
+    return;
+
+  if( bsdstyle )
+  {
+    if( job->outbytes < job->algorithm->maxbytes )
+      printf( "%s-%lu (%s) = ", job->algorithm->name, ( unsigned long )job->outbytes * 8, job->path );
+    else
+      printf( "%s (%s) = ", job->algorithm->name, job->path );
+  }
+
+  for( j = 0; j < job->outbytes; ++j )
+    printf( "%02x", job->hash[j] );
+
+  if( bsdstyle )
+    printf( "\n" );
+  else
+    printf( "  %s\n", job->path );
+}
+
+/* With -j, jobs on standard input would read it at the same time */
+static bool stdin_twice( const b2sum_job *jobs, size_t njobs, unsigned long nthreads )
+{
+  size_t k, n = 0;
+
+  for( k = 0; k < njobs && nthreads > 1; ++k )
+    if( strcmp( jobs[k].path, "-" ) == 0 && ++n > 1 )
+    {
+      fprintf( stderr, "Standard input given more than once with -j\n" );
+      return true;
+    }
+  return false;
+}
+
+static double now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t parse_hex( uint8_t *out, size_t maxbytes, const char *hex, size_t len )
+{
+  size_t i;
+  unsigned int byte;
+
+  if( len == 0 || len % 2 != 0 || len / 2 > maxbytes )
+    return 0;
+
+  for( i = 0; i < len; ++i )
+    if( !isxdigit( ( unsigned char )hex[i] ) )
+      return 0;
+
+  for( i = 0; i < len / 2; ++i )
+  {
+    sscanf( hex + 2 * i, "%2x", &byte );
+    out[i] = ( uint8_t )byte;
+  }
+  return len / 2;
+}
+
+/*
+  Fill in a --check job from a manifest line, either as b2sum writes it,
+  "<hex>  <file>", whose algorithm is the one given with -a, or in the
+  --tag form "BLAKE2b[-<bits>] (<file>) = <hex>", which names its own.
+  The line is cut up in place and becomes the job's path.
+*/
+static bool parse_check_line( b2sum_job *job, char *line, const b2sum_algorithm *algorithm )
+{
+  size_t len = strlen( line );
+  char *name, *tail;
+  size_t i;
+
+  while( len > 0 && ( line[len - 1] == '\n' || line[len - 1] == '\r' ) )
+    line[--len] = '\0';
+
+  tail = strstr( line, ") = " );
+  name = strstr( line, " (" );
+  if( 0 == strncmp( line, "BLAKE2", 6 ) && name && tail && name < tail )
+  {
+    char *dash;
+    unsigned long bits = 0;
+
+    while( ( dash = strstr( tail + 1, ") = " ) ) != NULL )
+      tail = dash;
+    *name = '\0';
+    dash = strchr( line, '-' );
+    if( dash )
+    {
+      char *end;
+      *dash = '\0';
+      bits = strtoul( dash + 1, &end, 10 );
+      if( *end != '\0' || bits == 0 || bits % 8 != 0 )
+        return false;
+    }
+
+    job->algorithm = NULL;
+    for( i = 0; i < ALGORITHMS; ++i )
+      if( 0 == strcmp( line, algorithms[i].name ) )
+        job->algorithm = &algorithms[i];
+    if( !job->algorithm )
+      return false;
+
+    job->outbytes = parse_hex( job->expected, job->algorithm->maxbytes, tail + 4, strlen( tail + 4 ) );
+    if( job->outbytes == 0 || ( bits && bits / 8 != job->outbytes ) )
+      return false;
+
+    *tail = '\0';
+    job->path = name + 2;
+    return true;
+  }
+
+  for( i = 0; isxdigit( ( unsigned char )line[i] ); ++i )
+    ;
+  if( line[i] != ' ' || ( line[i + 1] != ' ' && line[i + 1] != '*' ) || line[i + 2] == '\0' )
+    return false;
+
+  job->algorithm = algorithm;
+  job->outbytes = parse_hex( job->expected, algorithm->maxbytes, line, i );
+  job->path = line + i + 2;
+  return job->outbytes != 0;
+}
+
+static int by_size_desc( const void *a, const void *b, void *arg )
+{
+  const b2sum_job *jobs = ( const b2sum_job * )arg;
+  off_t x = jobs[*( const size_t * )a].size, y = jobs[*( const size_t * )b].size;
+  return ( x < y ) - ( x > y );
+}
+
+/*
+  --check: verify every file listed in the manifests. Files are handed
+  to the threads largest first so a big file found last does not hold
+  up the end of the run, and results are printed as files finish.
+*/
+static int check_manifests( char **manifests, int nmanifests, const b2sum_algorithm *algorithm,
+                            unsigned long nthreads, bool quiet )
+{
+  b2sum_job *jobs = NULL;
+  size_t *order;
+  size_t njobs = 0, cap = 0, k;
+  unsigned long mismatched = 0, unreadable = 0, malformed = 0;
+  bool missing = false;
+  double bytes = 0, start, seconds;
+  b2sum_pool pool;
+  b2sum_worker *workers;
+  pthread_t *threads;
+  int i;
+
+  for( i = 0; i < nmanifests; ++i )
+  {
+    FILE *f = strcmp( manifests[i], "-" ) == 0 ? stdin : fopen( manifests[i], "r" );
+    char *line = NULL;
+    size_t linecap = 0;
+
+    if( !f )
+    {
+      fprintf( stderr, "Could not open `%s': %s\n", manifests[i], strerror( errno ) );
+      missing = true;
+      continue;
+    }
+
+    while( getline( &line, &linecap, f ) != -1 )
+    {
+      struct stat st;
+
+      if( njobs == cap )
+      {
+        b2sum_job *grown;
+        cap = cap ? 2 * cap : 256;
+        grown = ( b2sum_job * )realloc( jobs, cap * sizeof( b2sum_job ) );
+        if( !grown )
+        {
+          fprintf( stderr, "Out of memory\n" );
+          exit( 1 );
+        }
+        jobs = grown;
+      }
+      memset( &jobs[njobs], 0, sizeof( b2sum_job ) );
+
+      if( !parse_check_line( &jobs[njobs], line, algorithm ) )
+      {
+        malformed++;
+        continue;
+      }
+      if( stat( jobs[njobs].path, &st ) == 0 )
+        jobs[njobs].size = st.st_size;
+
+      /* the job keeps pointing into this line */
+      njobs++;
+      line = NULL;
+      linecap = 0;
+    }
+    free( line );
+    if( f != stdin ) fclose( f );
+  }
+
+  if( malformed )
+    fprintf( stderr, "WARNING: %lu line%s improperly formatted\n", malformed, malformed == 1 ? " is" : "s are" );
+  if( njobs == 0 )
+  {
+    fprintf( stderr, "No properly formatted checksum lines found\n" );
+    return 1;
+  }
+
+  if( nthreads > njobs )
+    nthreads = njobs;
+  if( stdin_twice( jobs, njobs, nthreads ) )
+    return 1;
+
+  order = ( size_t * )malloc( njobs * sizeof( size_t ) );
+  workers = ( b2sum_worker * )calloc( nthreads, sizeof( b2sum_worker ) );
+  threads = ( pthread_t * )calloc( nthreads, sizeof( pthread_t ) );
+  if( !order || !workers || !threads )
+  {
+    fprintf( stderr, "Out of memory\n" );
+    return 1;
+  }
+  for( k = 0; k < njobs; ++k )
+    order[k] = k;
+  qsort_r( order, njobs, sizeof( size_t ), by_size_desc, jobs );
+
+  start = now();
+  if( pool_start( &pool, workers, threads, nthreads, jobs, order, njobs ) < 0 )
+  {
+    fprintf( stderr, "Failed to start %lu threads\n", nthreads );
+    return 1;
+  }
+
+  for( k = 0; k < njobs; ++k )
+  {
+    const b2sum_job *job = pool_next( &pool, k );
+
+    if( print_error( job ) )
+    {
+      printf( "%s: FAILED open or read\n", job->path );
+      unreadable++;
+    }
+    else if( memcmp( job->hash, job->expected, job->outbytes ) != 0 )
+    {
+      printf( "%s: FAILED\n", job->path );
+      mismatched++;
+      bytes += job->size;
+    }
+    else
+    {
+      if( !quiet )
+        printf( "%s: OK\n", job->path );
+      bytes += job->size;
+    }
+    fflush( stdout );
+  }
+  for( k = 0; k < nthreads; ++k )
+    pthread_join( threads[k], NULL );
+  seconds = now() - start;
+
+  if( unreadable )
+    fprintf( stderr, "WARNING: %lu listed file%s could not be read\n", unreadable, unreadable == 1 ? "" : "s" );
+  if( mismatched )
+    fprintf( stderr, "WARNING: %lu computed checksum%s did NOT match\n", mismatched, mismatched == 1 ? "" : "s" );
+  fprintf( stderr, "%lu file%s, %.1f MiB in %.2f s (%.1f MiB/s on %lu thread%s)\n",
+           ( unsigned long )njobs, njobs == 1 ? "" : "s", bytes / ( 1 << 20 ), seconds,
+           seconds > 0 ? bytes / ( 1 << 20 ) / seconds : 0.0, nthreads, nthreads == 1 ? "" : "s" );
+
+  return missing || mismatched || unreadable || malformed ? 1 : 0;
+}
 
 
 static void usage( char **argv, int errcode )
@@ -242,6 +813,9 @@ static void usage( char **argv, int errcode )
                 "               [blake2b|blake2s|blake2bp|blake2sp]\n" );
   fprintf( out, "  -l <length>  digest length in bits, must not exceed the maximum for\n"
                 "               the selected algorithm and must be a multiple of 8\n" );
+  fprintf( out, "  -j <jobs>    hash up to this many files at once, 0 for one per CPU\n" );
+  fprintf( out, "  -c, --check  read checksums from the FILEs and check them\n" );
+  fprintf( out, "  --quiet      with --check, don't print OK for each verified file\n" );
   fprintf( out, "  --tag        create a BSD-style checksum\n" );
   fprintf( out, "  --help       display this help and exit\n" );
   exit( errcode );
@@ -250,12 +824,14 @@ static void usage( char **argv, int errcode )
 
 int main( int argc, char **argv )
 {
-  blake2fn blake2_stream = blake2b_stream;
-  unsigned long maxbytes = BLAKE2B_OUTBYTES;
-  const char *algorithm = "BLAKE2b";
+  const b2sum_algorithm *algorithm = &algorithms[0];
   unsigned long outbytes = 0;
-  unsigned char hash[BLAKE2B_OUTBYTES] = {0};
+  unsigned long nthreads = 1;
   bool bsdstyle = false;
+  bool check = false;
+  bool quiet = false;
+  b2sum_job *jobs;
+  size_t njobs, k;
   int c, i;
   opterr = 1;
 
@@ -267,44 +843,26 @@ int main( int argc, char **argv )
     static struct option long_options[] = {
       { "help",  no_argument, 0,  0  },
       { "tag",   no_argument, 0,  0  },
+      { "check", no_argument, 0, 'c' },
+      { "quiet", no_argument, 0,  0  },
       { NULL, 0, NULL, 0 }
     };
 
-    c = getopt_long( argc, argv, "a:l:", long_options, &option_index );
+    c = getopt_long( argc, argv, "a:l:j:c", long_options, &option_index );
     if( c == -1 ) break;
     switch( c )
     {
     case 'a':
-      if( 0 == strcmp( optarg, "blake2b" ) )
-      {
-        blake2_stream = blake2b_stream;
-        maxbytes = BLAKE2B_OUTBYTES;
-        algorithm = "BLAKE2b";
-      }
-      else if ( 0 == strcmp( optarg, "blake2s" ) )
-      {
-        blake2_stream = blake2s_stream;
-        maxbytes = BLAKE2S_OUTBYTES;
-        algorithm = "BLAKE2s";
-      }
-      else if ( 0 == strcmp( optarg, "blake2bp" ) )
-      {
-        blake2_stream = blake2bp_stream;
-        maxbytes = BLAKE2B_OUTBYTES;
-        algorithm = "BLAKE2bp";
-      }
-      else if ( 0 == strcmp( optarg, "blake2sp" ) )
-      {
-        blake2_stream = blake2sp_stream;
-        maxbytes = BLAKE2S_OUTBYTES;
-        algorithm = "BLAKE2sp";
-      }
-      else
+      for( k = 0; k < ALGORITHMS; ++k )
+        if( 0 == strcmp( optarg, algorithms[k].option ) )
+          break;
+
+      if( k == ALGORITHMS )
       {
         printf( "Invalid function name: `%s'\n", optarg );
         usage( argv, 111 );
       }
-
+      algorithm = &algorithms[k];
       break;
 
     case 'l':
@@ -317,11 +875,31 @@ int main( int argc, char **argv )
       outbytes = outbits / 8;
       break;
 
+    case 'j':
+      nthreads = strtoul( optarg, &end, 10 );
+      if( !end || *end != '\0' )
+      {
+        printf( "Invalid jobs argument: `%s'\n", optarg );
+        usage( argv, 111 );
+      }
+      if( nthreads == 0 )
+      {
+        long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+        nthreads = cpus > 0 ? ( unsigned long )cpus : 1;
+      }
+      break;
+
+    case 'c':
+      check = true;
+      break;
+
     case 0:
       if( 0 == strcmp( "help", long_options[option_index].name ) )
         usage( argv, 0 );
       else if( 0 == strcmp( "tag", long_options[option_index].name ) )
         bsdstyle = true;
+      else if( 0 == strcmp( "quiet", long_options[option_index].name ) )
+        quiet = true;
       break;
 
     case '?':
@@ -330,57 +908,70 @@ int main( int argc, char **argv )
     }
   }
 
-  if(outbytes > maxbytes)
+  if(outbytes > algorithm->maxbytes)
   {
     printf( "Invalid length argument: %lu\n", outbytes * 8 );
-    printf( "Maximum digest length for %s is %lu\n", algorithm, maxbytes * 8 );
+    printf( "Maximum digest length for %s is %lu\n", algorithm->name, algorithm->maxbytes * 8 );
     usage( argv, 111 );
   }
   else if( outbytes == 0 )
-    outbytes = maxbytes;
+    outbytes = algorithm->maxbytes;
 
   if( optind == argc )
     argv[argc++] = (char *) "-";
 
+  catch_truncation();
+
+  if( check )
+    return check_manifests( argv + optind, argc - optind, algorithm, nthreads, quiet );
+
+  njobs = argc - optind;
+  jobs = ( b2sum_job * )calloc( njobs, sizeof( b2sum_job ) );
+  if( !jobs )
+  {
+    fprintf( stderr, "Out of memory\n" );
+    return 1;
+  }
   for( i = optind; i < argc; ++i )
   {
-    FILE *f = NULL;
-    if( argv[i][0] == '-' && argv[i][1] == '\0' )
-      f = stdin;
-    else
-      f = fopen( argv[i], "rb" );
+    jobs[i - optind].path = argv[i];
+    jobs[i - optind].algorithm = algorithm;
+    jobs[i - optind].outbytes = outbytes;
+  }
 
-    if( !f )
+  if( nthreads > njobs )
+    nthreads = njobs;
+  if( stdin_twice( jobs, njobs, nthreads ) )
+    return 1;
+
+  if( nthreads <= 1 )
+  {
+    for( k = 0; k < njobs; ++k )
     {
-      fprintf( stderr, "Could not open `%s': %s\n", argv[i], strerror( errno ) );
-      continue;
+      hash_job( &jobs[k] );
+      print_job( &jobs[k], bsdstyle );
     }
+  }
+  else
+  {
+    b2sum_pool pool;
+    b2sum_worker *workers = ( b2sum_worker * )calloc( nthreads, sizeof( b2sum_worker ) );
+    pthread_t *threads = ( pthread_t * )calloc( nthreads, sizeof( pthread_t ) );
 
-    if( blake2_stream( f, hash, outbytes ) < 0 )
+    if( !workers || !threads || pool_start( &pool, workers, threads, nthreads, jobs, NULL, njobs ) < 0 )
     {
-      fprintf( stderr, "Failed to hash `%s'\n", argv[i] );
+      fprintf( stderr, "Failed to start %lu threads\n", nthreads );
+      return 1;
     }
-    else
-    {
-      size_t j;
-      if( bsdstyle )
-      {
-        if( outbytes < maxbytes )
-          printf( "%s-%lu (%s) = ", algorithm, outbytes * 8, argv[i] );
-        else
-          printf( "%s (%s) = ", algorithm, argv[i] );
-      }
-
-      for( j = 0; j < outbytes; ++j )
-        printf( "%02x", hash[j] );
 
-      if( bsdstyle )
-        printf( "\n" );
-      else
-        printf( "  %s\n", argv[i] );
+    /* print in command line order as soon as each prefix is done */
+    for( k = 0; k < njobs; ++k )
+    {
+      pool_wait( &pool, &jobs[k] );
+      print_job( &jobs[k], bsdstyle );
     }
-
-    if( f != stdin ) fclose( f );
+    for( k = 0; k < nthreads; ++k )
+      pthread_join( threads[k], NULL );
   }
 
   return 0;
@@ -0,0 +1,449 @@
+/*
+   BLAKE2 reference source code package - benchmark driver
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+
+/*
+  Times every BLAKE2 variant of one implementation, keyed and unkeyed,
+  over message sizes from 8 bytes up to -m (1 GiB by default), in three
+  modes:
+
+    single   the same message hashed call after call
+    batch    a run of distinct messages laid out back to back, as a
+             batch of small records is hashed
+    threads  -t threads hashing their own messages at once (-t > 1)
+
+  Each point runs for about -T seconds and reports cycles per byte,
+  GB/s and per-call latency percentiles as CSV or, with -f json, JSON.
+  -P adds hardware counters per call (IPC, cycles, instructions, LLC,
+  dTLB and branch misses; see perfcount.h in the surrogate tools),
+  counted over the whole point, threads included, clock reads and all.
+  The makefile builds one binary per implementation (ref, sse, avx2,
+  and sse with the BLAKE2_THREADS pool); do.gplot plots b2bench.csv.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "blake2.h"
+#include "perfcount.h"
+
+#ifndef B2BENCH_IMPL
+#define B2BENCH_IMPL "unknown"
+#endif
+
+#if defined(__amd64__) || defined(__x86_64__)
+static unsigned long long cpucycles( void ) {
+  unsigned long long result;
+  __asm__ __volatile__(
+    ".byte 15;.byte 49\n"
+    "shlq $32,%%rdx\n"
+    "orq %%rdx,%%rax\n"
+    : "=a" ( result ) ::  "%rdx"
+  );
+  return result;
+}
+#elif defined(__i386__)
+static unsigned long long cpucycles( void ) {
+  unsigned long long result;
+  __asm__ __volatile__( ".byte 15;.byte 49;" : "=A" ( result ) );
+  return result;
+}
+#elif defined(_MSC_VER)
+#include <intrin.h>
+static unsigned long long cpucycles( void ) {
+  return __rdtsc();
+}
+#else
+#error "Don't know how to count cycles on this platform!"
+#endif
+
+/* Per-call samples kept per point; longer runs keep the first ones */
+#define MAX_SAMPLES  100000
+#define MIN_CALLS    3
+/* Bytes laid out for one batch */
+#define BATCH_BYTES  ( 64UL << 20 )
+#define BATCH_CALLS  1024
+
+typedef int ( *blake2fn )( void *, size_t, const void *, size_t, const void *, size_t );
+
+typedef struct
+{
+  const char *name;
+  blake2fn fn;
+  size_t outlen;
+  size_t keylen;
+} variant;
+
+static const variant variants[] =
+{
+  { "blake2b",  blake2b,  BLAKE2B_OUTBYTES, BLAKE2B_KEYBYTES },
+  { "blake2s",  blake2s,  BLAKE2S_OUTBYTES, BLAKE2S_KEYBYTES },
+  { "blake2bp", blake2bp, BLAKE2B_OUTBYTES, BLAKE2B_KEYBYTES },
+  { "blake2sp", blake2sp, BLAKE2S_OUTBYTES, BLAKE2S_KEYBYTES },
+  { "blake2xb", blake2xb, BLAKE2B_OUTBYTES, BLAKE2B_KEYBYTES },
+  { "blake2xs", blake2xs, BLAKE2S_OUTBYTES, BLAKE2S_KEYBYTES },
+};
+
+#define VARIANTS ( sizeof( variants ) / sizeof( variants[0] ) )
+
+typedef struct
+{
+  const variant *v;
+  size_t keylen;
+  size_t size;
+  const uint8_t *in;
+  size_t stride;      /* between consecutive messages, 0 to reuse one */
+  size_t span;        /* messages before wrapping around */
+  double seconds;
+  /* results */
+  double *ns;         /* per call */
+  size_t nsamples;
+  unsigned long long calls, cycles;
+  double busy;        /* seconds spent in calls */
+} run;
+
+static uint8_t key[BLAKE2B_KEYBYTES];
+static perfcount pc;
+static int counting;          /* -P */
+static double timer_overhead; /* of one now() call, taken off every sample */
+
+static double now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int by_value( const void *x, const void *y )
+{
+  const double a = *( const double * )x, b = *( const double * )y;
+  return ( a > b ) - ( a < b );
+}
+
+/* Hash until the time is up, timing every call */
+static void *run_calls( void *arg )
+{
+  run *r = ( run * )arg;
+  uint8_t out[BLAKE2B_OUTBYTES];
+  double t = now(), deadline = t + r->seconds;
+  size_t next = 0;
+
+  r->nsamples = 0;
+  r->calls = 0;
+  r->cycles = 0;
+  r->busy = 0;
+
+  while( r->calls < MIN_CALLS || t < deadline )
+  {
+    const uint8_t *in = r->in + next * r->stride;
+    unsigned long long c0, c1;
+    double t1, ns;
+
+    c0 = cpucycles();
+    r->v->fn( out, r->v->outlen, in, r->size, r->keylen ? key : NULL, r->keylen );
+    c1 = cpucycles();
+    t1 = now();
+
+    ns = ( t1 - t - timer_overhead ) * 1e9;
+    if( ns < 0 )
+      ns = 0;
+    r->cycles += c1 - c0;
+    r->busy += ns / 1e9;
+    if( r->nsamples < MAX_SAMPLES )
+      r->ns[r->nsamples++] = ns;
+    r->calls++;
+    t = t1;
+    if( ++next == r->span )
+      next = 0;
+  }
+  return NULL;
+}
+
+/* Median cost of reading the clock, which every sample includes once */
+static void calibrate( void )
+{
+  double d[101], t = now();
+  int i;
+
+  for( i = 0; i < 101; ++i )
+  {
+    double t1 = now();
+    d[i] = t1 - t;
+    t = t1;
+  }
+  qsort( d, 101, sizeof( double ), by_value );
+  timer_overhead = d[50];
+}
+
+static double percentile( const double *sorted, size_t n, double p )
+{
+  size_t i = ( size_t )( p * ( n - 1 ) + 0.5 );
+  return n ? sorted[i] : 0;
+}
+
+static int first_record = 1;
+
+static void report( const char *format, const char *mode, unsigned threads, run *r, size_t nruns )
+{
+  unsigned long long calls = 0, cycles = 0;
+  double bytes, gbps = 0, cpb;
+  double *ns;
+  size_t n = 0, i;
+
+  for( i = 0; i < nruns; ++i )
+  {
+    calls += r[i].calls;
+    cycles += r[i].cycles;
+    /* threads run side by side, so their rates add up */
+    if( r[i].busy > 0 )
+      gbps += ( double )r[i].calls * r[i].size / r[i].busy / 1e9;
+    n += r[i].nsamples;
+  }
+
+  ns = ( double * )malloc( ( n ? n : 1 ) * sizeof( double ) );
+  if( !ns )
+    return;
+  for( n = 0, i = 0; i < nruns; ++i )
+  {
+    memcpy( ns + n, r[i].ns, r[i].nsamples * sizeof( double ) );
+    n += r[i].nsamples;
+  }
+  qsort( ns, n, sizeof( double ), by_value );
+
+  bytes = ( double )calls * r->size;
+  cpb = calls ? ( double )cycles / bytes : 0;
+
+  if( 0 == strcmp( format, "json" ) )
+  {
+    printf( "%s\n  {\"impl\": \"%s\", \"variant\": \"%s\", \"keyed\": %d, \"mode\": \"%s\", \"threads\": %u, "
+            "\"size\": %lu, \"calls\": %llu, \"cycles_per_byte\": %.3f, \"gbps\": %.4f, "
+            "\"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f",
+            first_record ? "[" : ",", B2BENCH_IMPL, r->v->name, r->keylen != 0, mode, threads,
+            ( unsigned long )r->size, calls, cpb, gbps,
+            percentile( ns, n, 0.5 ), percentile( ns, n, 0.9 ), percentile( ns, n, 0.99 ), percentile( ns, n, 0.999 ) );
+    if( counting )
+      perfcount_json( stdout, &pc, calls );
+    printf( "}" );
+  }
+  else
+  {
+    if( first_record )
+    {
+      printf( "impl,variant,keyed,mode,threads,size,calls,cycles_per_byte,gbps,p50_ns,p90_ns,p99_ns,p999_ns" );
+      if( counting )
+      {
+        printf( ",ipc" );
+        for( i = 0; i < PERFCOUNT_EVENTS; ++i )
+          printf( ",%s", perfcount_names[i] );
+      }
+      printf( "\n" );
+    }
+    printf( "%s,%s,%d,%s,%u,%lu,%llu,%.3f,%.4f,%.0f,%.0f,%.0f,%.0f",
+            B2BENCH_IMPL, r->v->name, r->keylen != 0, mode, threads, ( unsigned long )r->size, calls, cpb, gbps,
+            percentile( ns, n, 0.5 ), percentile( ns, n, 0.9 ), percentile( ns, n, 0.99 ), percentile( ns, n, 0.999 ) );
+    if( counting )
+    {
+      /* empty where not counted */
+      const double *v = pc.value;
+      if( v[PERFCOUNT_CYCLES] > 0 && v[PERFCOUNT_INSTRUCTIONS] >= 0 )
+        printf( ",%.3f", v[PERFCOUNT_INSTRUCTIONS] / v[PERFCOUNT_CYCLES] );
+      else
+        printf( "," );
+      for( i = 0; i < PERFCOUNT_EVENTS; ++i )
+        if( v[i] >= 0 && calls > 0 )
+          printf( ",%.3f", v[i] / calls );
+        else
+          printf( "," );
+    }
+    printf( "\n" );
+  }
+  first_record = 0;
+  fflush( stdout );
+  free( ns );
+}
+
+/* name is one of the comma-separated list */
+static int selected( const char *list, const char *name )
+{
+  const size_t len = strlen( name );
+
+  while( *list )
+  {
+    const size_t n = strcspn( list, "," );
+    if( n == len && 0 == strncmp( list, name, len ) )
+      return 1;
+    list += n + ( list[n] == ',' );
+  }
+  return 0;
+}
+
+static size_t parse_size( const char *s )
+{
+  char *end;
+  unsigned long n = strtoul( s, &end, 10 );
+
+  switch( *end )
+  {
+  case 'G': case 'g': n <<= 10; /* fall through */
+  case 'M': case 'm': n <<= 10; /* fall through */
+  case 'K': case 'k': n <<= 10; break;
+  case '\0': break;
+  default: return 0;
+  }
+  return n;
+}
+
+static void usage( const char *prog )
+{
+  fprintf( stderr, "Usage: %s [-a variant,...] [-m max size] [-s step] [-t threads] [-T seconds] [-f csv|json] [-P]\n", prog );
+  fprintf( stderr, "  variants: blake2b blake2s blake2bp blake2sp blake2xb blake2xs (all by default)\n" );
+  exit( 1 );
+}
+
+int main( int argc, char **argv )
+{
+  const char *format = "csv", *only = NULL;
+  size_t maxsize = 1UL << 30, step = 4, size, i;
+  unsigned threads = 1, t;
+  double seconds = 0.1;
+  uint8_t *buf;
+  run *runs;
+  pthread_t *tids;
+  int opt, keyed, err;
+
+  while( ( opt = getopt( argc, argv, "a:m:s:t:T:f:P" ) ) != -1 )
+  {
+    switch( opt )
+    {
+    case 'a': only = optarg; break;
+    case 'm': maxsize = parse_size( optarg ); break;
+    case 's': step = strtoul( optarg, NULL, 10 ); break;
+    case 't': threads = ( unsigned )strtoul( optarg, NULL, 10 ); break;
+    case 'T': seconds = atof( optarg ); break;
+    case 'f': format = optarg; break;
+    case 'P': counting = 1; break;
+    default: usage( argv[0] );
+    }
+  }
+  if( maxsize < 8 || step < 2 || threads < 1 || seconds <= 0 ||
+      ( strcmp( format, "csv" ) && strcmp( format, "json" ) ) )
+    usage( argv[0] );
+
+  /* one message per thread, or a batch, whichever needs more */
+  buf = ( uint8_t * )malloc( ( maxsize > BATCH_BYTES ? maxsize : BATCH_BYTES ) * threads );
+  runs = ( run * )calloc( threads, sizeof( run ) );
+  tids = ( pthread_t * )calloc( threads, sizeof( pthread_t ) );
+  if( !buf || !runs || !tids )
+  {
+    fprintf( stderr, "Cannot allocate %lu bytes per thread; lower -m\n", ( unsigned long )maxsize );
+    return 1;
+  }
+  for( t = 0; t < threads; ++t )
+  {
+    runs[t].ns = ( double * )malloc( MAX_SAMPLES * sizeof( double ) );
+    if( !runs[t].ns )
+      return 1;
+  }
+  for( i = 0; i < ( maxsize > BATCH_BYTES ? maxsize : BATCH_BYTES ) * threads; ++i )
+    buf[i] = ( uint8_t )( i * 131 + 7 );
+  for( i = 0; i < sizeof( key ); ++i )
+    key[i] = ( uint8_t )i;
+  calibrate();
+  /* opened before any thread starts, so threads count too */
+  if( counting && ( err = perfcount_open( &pc ) ) != 0 )
+  {
+    fprintf( stderr, "No CPU counters: %s\n", strerror( err ) );
+    counting = 0;
+  }
+
+  for( i = 0; i < VARIANTS; ++i )
+  {
+    if( only && !selected( only, variants[i].name ) )
+      continue;
+
+    for( keyed = 0; keyed < 2; ++keyed )
+    for( size = 8; ; size = size * step > maxsize && size < maxsize ? maxsize : size * step )
+    {
+      run *r = &runs[0];
+
+      r->v = &variants[i];
+      r->keylen = keyed ? variants[i].keylen : 0;
+      r->size = size;
+      r->seconds = seconds;
+
+      r->in = buf;
+      r->stride = 0;
+      r->span = 1;
+      if( counting )
+        perfcount_start( &pc );
+      run_calls( r );
+      /* stopped before report sorts the samples */
+      if( counting )
+        perfcount_stop( &pc );
+      report( format, "single", 1, r, 1 );
+
+      if( size * 2 <= BATCH_BYTES )
+      {
+        r->stride = size;
+        r->span = BATCH_BYTES / size < BATCH_CALLS ? BATCH_BYTES / size : BATCH_CALLS;
+        if( counting )
+          perfcount_start( &pc );
+        run_calls( r );
+        if( counting )
+          perfcount_stop( &pc );
+        report( format, "batch", 1, r, 1 );
+      }
+
+      if( threads > 1 )
+      {
+        for( t = 0; t < threads; ++t )
+        {
+          runs[t].v = r->v;
+          runs[t].keylen = r->keylen;
+          runs[t].size = size;
+          runs[t].seconds = seconds;
+          runs[t].in = buf + t * ( maxsize > BATCH_BYTES ? maxsize : BATCH_BYTES );
+          runs[t].stride = 0;
+          runs[t].span = 1;
+        }
+        if( counting )
+          perfcount_start( &pc );
+        for( t = 0; t < threads; ++t )
+          if( pthread_create( &tids[t], NULL, run_calls, &runs[t] ) != 0 )
+            return 1;
+        for( t = 0; t < threads; ++t )
+          pthread_join( tids[t], NULL );
+        if( counting )
+          perfcount_stop( &pc );
+        report( format, "threads", threads, runs, threads );
+      }
+
+      if( size >= maxsize )
+        break;
+    }
+  }
+
+  if( 0 == strcmp( format, "json" ) )
+    printf( first_record ? "[]\n" : "\n]\n" );
+  if( counting )
+    perfcount_close( &pc );
+  return 0;
+}
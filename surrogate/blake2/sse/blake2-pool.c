@@ -0,0 +1,134 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "blake2-pool.h"
+
+/* No more workers than the widest parallel mode has leaves */
+#ifndef BLAKE2_POOL_THREADS
+#define BLAKE2_POOL_THREADS 0 /* one per online CPU */
+#endif
+#define BLAKE2_POOL_MAX 8
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_busy = PTHREAD_MUTEX_INITIALIZER; /* one job at a time */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER; /* guards job */
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static size_t pool_workers;
+
+static struct
+{
+  void ( *fn )( void *arg, size_t i );
+  void *arg;
+  size_t n, next, finished;
+  unsigned long generation;
+} job;
+
+/* Run items of the current job until none are left; pool_lock held */
+static void pool_drain( void )
+{
+  while( job.next < job.n )
+  {
+    size_t i = job.next++;
+    void ( *fn )( void *, size_t ) = job.fn;
+    void *arg = job.arg;
+
+    pthread_mutex_unlock( &pool_lock );
+    fn( arg, i );
+    pthread_mutex_lock( &pool_lock );
+
+    if( ++job.finished == job.n )
+      pthread_cond_signal( &pool_done );
+  }
+}
+
+static void *pool_worker( void *unused )
+{
+  unsigned long seen = 0;
+  (void)unused;
+
+  pthread_mutex_lock( &pool_lock );
+  for( ;; )
+  {
+    while( job.generation == seen )
+      pthread_cond_wait( &pool_work, &pool_lock );
+    seen = job.generation;
+    pool_drain();
+  }
+  return NULL;
+}
+
+static void pool_start( void )
+{
+  long want = BLAKE2_POOL_THREADS;
+  pthread_t thread;
+  pthread_attr_t attr;
+
+  if( want <= 0 )
+    want = sysconf( _SC_NPROCESSORS_ONLN );
+  if( want > BLAKE2_POOL_MAX )
+    want = BLAKE2_POOL_MAX;
+
+  pthread_attr_init( &attr );
+  pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+  /* the calling thread is the first member of every job */
+  while( (long)pool_workers + 1 < want )
+  {
+    if( pthread_create( &thread, &attr, pool_worker, NULL ) != 0 )
+      break;
+    pool_workers++;
+  }
+  pthread_attr_destroy( &attr );
+}
+
+size_t blake2_pool_size( void )
+{
+  pthread_once( &pool_once, pool_start );
+  return pool_workers + 1;
+}
+
+void blake2_pool_run( void ( *fn )( void *arg, size_t i ), void *arg, size_t n )
+{
+  size_t i;
+
+  pthread_once( &pool_once, pool_start );
+
+  if( pool_workers == 0 || n < 2 || pthread_mutex_trylock( &pool_busy ) != 0 )
+  {
+    for( i = 0; i < n; ++i )
+      fn( arg, i );
+    return;
+  }
+
+  pthread_mutex_lock( &pool_lock );
+  job.fn = fn;
+  job.arg = arg;
+  job.n = n;
+  job.next = 0;
+  job.finished = 0;
+  job.generation++;
+  pthread_cond_broadcast( &pool_work );
+
+  pool_drain();
+  while( job.finished < job.n )
+    pthread_cond_wait( &pool_done, &pool_lock );
+  pthread_mutex_unlock( &pool_lock );
+
+  pthread_mutex_unlock( &pool_busy );
+}
@@ -0,0 +1,48 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+#ifndef BLAKE2_POOL_H
+#define BLAKE2_POOL_H
+
+#include <stddef.h>
+
+/*
+  A process-wide pool of worker threads for the parallel modes, started
+  on first use and kept for the life of the process, so large inputs
+  are split across cores without spawning threads per call. Built only
+  with -DBLAKE2_THREADS (and -pthread).
+*/
+
+/* Inputs shorter than this are hashed on the calling thread */
+#ifndef BLAKE2_THREADS_MIN
+#define BLAKE2_THREADS_MIN ( 1 << 20 )
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+  /* Threads that take part in a job, the caller included */
+  size_t blake2_pool_size( void );
+
+  /* Run fn( arg, i ) for every i in [0, n) and return when all are done.
+     The caller works on the job too; if the pool is busy with another
+     caller's job, everything runs on the calling thread. */
+  void blake2_pool_run( void ( *fn )( void *arg, size_t i ), void *arg, size_t n );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -135,6 +135,15 @@ extern "C" {
     blake2b_param P[1];
   } blake2xb_state;
 
+  /* A key compressed ahead of time, for hashing many messages under it */
+  typedef struct blake2b_prekey_state__
+  {
+    uint64_t h[8];
+    size_t   outlen;
+    uint8_t  key[BLAKE2B_KEYBYTES];
+    size_t   keylen;
+  } blake2b_prekey_state;
+
   /* Padded structs result in a compile-time error */
   enum {
     BLAKE2_DUMMY_1 = 1/(sizeof(blake2s_param) == BLAKE2S_OUTBYTES),
@@ -185,6 +194,12 @@ extern "C" {
   int blake2xs( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen );
   int blake2xb( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen );
 
+  /* Same digests as blake2b( out, outlen, in, inlen, key, keylen ), with
+     the key block compressed once by blake2b_prekey. Messages of up to
+     one block take a single compression and no state buffering */
+  int blake2b_prekey( blake2b_prekey_state *K, size_t outlen, const void *key, size_t keylen );
+  int blake2b_prekeyed( const blake2b_prekey_state *K, void *out, const void *in, size_t inlen );
+
   /* This is simply an alias for blake2b */
   int blake2( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen );
 
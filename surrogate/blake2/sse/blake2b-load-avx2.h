@@ -0,0 +1,63 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+#ifndef BLAKE2B_LOAD_AVX2_H
+#define BLAKE2B_LOAD_AVX2_H
+
+/*
+  The message block is held as eight registers m[0..7], each with one
+  128-bit pair of words broadcast to both halves:
+
+    m[j] = ( w[2j], w[2j+1], w[2j], w[2j+1] )
+
+  so any two words can be brought into the low (or high) half with a
+  single in-lane unpack, alignr or blend. The sigma entries are
+  constants, so the choice between them is folded at compile time.
+*/
+
+static const uint8_t blake2b_sigma_avx2[12][16] =
+{
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 } ,
+  { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 } ,
+  {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 } ,
+  {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 } ,
+  {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 } ,
+  { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 } ,
+  { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 } ,
+  {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 } ,
+  { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13 , 0 } ,
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+/* ( w[x0], w[x1] ) in both halves */
+#define LOAD_PAIR_AVX2(m, x0, x1) \
+  ( ( ( (x0) & 1 ) == 0 && ( (x1) & 1 ) == 0 ) ? _mm256_unpacklo_epi64( m[(x0) >> 1], m[(x1) >> 1] ) \
+  : ( ( (x0) & 1 ) == 1 && ( (x1) & 1 ) == 1 ) ? _mm256_unpackhi_epi64( m[(x0) >> 1], m[(x1) >> 1] ) \
+  : ( ( (x0) & 1 ) == 1 ) ? _mm256_alignr_epi8( m[(x1) >> 1], m[(x0) >> 1], 8 ) \
+  : _mm256_blend_epi32( m[(x0) >> 1], m[(x1) >> 1], 0xCC ) )
+
+/* ( w[x0], w[x1], w[x2], w[x3] ) */
+#define LOAD_QUAD_AVX2(m, x0, x1, x2, x3) \
+  _mm256_blend_epi32( LOAD_PAIR_AVX2(m, x0, x1), LOAD_PAIR_AVX2(m, x2, x3), 0xF0 )
+
+/* words for the column step (b0, b1) and the diagonal step (b2, b3) of round r */
+#define LOAD_MSG_AVX2(m, r, b0, b1, b2, b3) \
+  b0 = LOAD_QUAD_AVX2(m, blake2b_sigma_avx2[r][ 0], blake2b_sigma_avx2[r][ 2], blake2b_sigma_avx2[r][ 4], blake2b_sigma_avx2[r][ 6]); \
+  b1 = LOAD_QUAD_AVX2(m, blake2b_sigma_avx2[r][ 1], blake2b_sigma_avx2[r][ 3], blake2b_sigma_avx2[r][ 5], blake2b_sigma_avx2[r][ 7]); \
+  b2 = LOAD_QUAD_AVX2(m, blake2b_sigma_avx2[r][ 8], blake2b_sigma_avx2[r][10], blake2b_sigma_avx2[r][12], blake2b_sigma_avx2[r][14]); \
+  b3 = LOAD_QUAD_AVX2(m, blake2b_sigma_avx2[r][ 9], blake2b_sigma_avx2[r][11], blake2b_sigma_avx2[r][13], blake2b_sigma_avx2[r][15]);
+
+#endif
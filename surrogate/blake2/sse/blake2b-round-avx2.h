@@ -0,0 +1,65 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+#ifndef BLAKE2B_ROUND_AVX2_H
+#define BLAKE2B_ROUND_AVX2_H
+
+/*
+  The 4x4 state lives in four ymm rows a, b, c, d. A column step runs
+  G on all four columns at once; the diagonals are then lined up as
+  columns by rotating rows b, c and d with vpermq.
+*/
+
+#define LOADU256(p)  _mm256_loadu_si256( (const __m256i *)(p) )
+#define STOREU256(p,r) _mm256_storeu_si256((__m256i *)(p), r)
+
+#define ROTR32_AVX2(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2,3,0,1))
+#define ROTR24_AVX2(x) _mm256_shuffle_epi8((x), r24)
+#define ROTR16_AVX2(x) _mm256_shuffle_epi8((x), r16)
+#define ROTR63_AVX2(x) _mm256_or_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define G1_AVX2(a,b,c,d,m) \
+  a = _mm256_add_epi64(_mm256_add_epi64(a, m), b); \
+  d = ROTR32_AVX2(_mm256_xor_si256(d, a)); \
+  c = _mm256_add_epi64(c, d); \
+  b = ROTR24_AVX2(_mm256_xor_si256(b, c));
+
+#define G2_AVX2(a,b,c,d,m) \
+  a = _mm256_add_epi64(_mm256_add_epi64(a, m), b); \
+  d = ROTR16_AVX2(_mm256_xor_si256(d, a)); \
+  c = _mm256_add_epi64(c, d); \
+  b = ROTR63_AVX2(_mm256_xor_si256(b, c));
+
+#define DIAGONALIZE_AVX2(a,b,c,d) \
+  b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0,3,2,1)); \
+  c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1,0,3,2)); \
+  d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2,1,0,3));
+
+#define UNDIAGONALIZE_AVX2(a,b,c,d) \
+  b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2,1,0,3)); \
+  c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1,0,3,2)); \
+  d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0,3,2,1));
+
+#include "blake2b-load-avx2.h"
+
+#define ROUND_AVX2(r) \
+  LOAD_MSG_AVX2(m, r, b0, b1, b2, b3) \
+  G1_AVX2(a,b,c,d,b0); \
+  G2_AVX2(a,b,c,d,b1); \
+  DIAGONALIZE_AVX2(a,b,c,d); \
+  G1_AVX2(a,b,c,d,b2); \
+  G2_AVX2(a,b,c,d,b3); \
+  UNDIAGONALIZE_AVX2(a,b,c,d);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+#ifndef BLAKE2B_X4_H
+#define BLAKE2B_X4_H
+
+/*
+  Four independent BLAKE2b instances compressed side by side. The
+  state is kept transposed: register v[i] holds word i of all four
+  instances, one instance per 64-bit lane, so a round is the scalar
+  round written with vector instructions and needs no diagonalization.
+  Message blocks are transposed the same way on load.
+*/
+
+#include "blake2-config.h"
+
+#if defined(HAVE_AVX2)
+#include <immintrin.h>
+
+static const uint64_t blake2b_x4_IV[8] =
+{
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+  0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+  0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t blake2b_x4_sigma[12][16] =
+{
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 } ,
+  { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 } ,
+  {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 } ,
+  {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 } ,
+  {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 } ,
+  { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 } ,
+  { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 } ,
+  {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 } ,
+  { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13 , 0 } ,
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+#define X4_ROTR32(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2,3,0,1))
+#define X4_ROTR24(x) _mm256_shuffle_epi8((x), r24)
+#define X4_ROTR16(x) _mm256_shuffle_epi8((x), r16)
+#define X4_ROTR63(x) _mm256_or_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define X4_G(r,i,a,b,c,d) \
+  a = _mm256_add_epi64(_mm256_add_epi64(a, b), m[blake2b_x4_sigma[r][2*i+0]]); \
+  d = X4_ROTR32(_mm256_xor_si256(d, a)); \
+  c = _mm256_add_epi64(c, d); \
+  b = X4_ROTR24(_mm256_xor_si256(b, c)); \
+  a = _mm256_add_epi64(_mm256_add_epi64(a, b), m[blake2b_x4_sigma[r][2*i+1]]); \
+  d = X4_ROTR16(_mm256_xor_si256(d, a)); \
+  c = _mm256_add_epi64(c, d); \
+  b = X4_ROTR63(_mm256_xor_si256(b, c));
+
+#define X4_ROUND(r) \
+  X4_G(r,0,v[ 0],v[ 4],v[ 8],v[12]); \
+  X4_G(r,1,v[ 1],v[ 5],v[ 9],v[13]); \
+  X4_G(r,2,v[ 2],v[ 6],v[10],v[14]); \
+  X4_G(r,3,v[ 3],v[ 7],v[11],v[15]); \
+  X4_G(r,4,v[ 0],v[ 5],v[10],v[15]); \
+  X4_G(r,5,v[ 1],v[ 6],v[11],v[12]); \
+  X4_G(r,6,v[ 2],v[ 7],v[ 8],v[13]); \
+  X4_G(r,7,v[ 3],v[ 4],v[ 9],v[14]);
+
+/* r[i] = ( word 0 of r[0..3] ) ... ( word 3 of r[0..3] ) */
+static BLAKE2_INLINE void blake2b_x4_transpose( __m256i r[4] )
+{
+  const __m256i t0 = _mm256_unpacklo_epi64( r[0], r[1] );
+  const __m256i t1 = _mm256_unpackhi_epi64( r[0], r[1] );
+  const __m256i t2 = _mm256_unpacklo_epi64( r[2], r[3] );
+  const __m256i t3 = _mm256_unpackhi_epi64( r[2], r[3] );
+  r[0] = _mm256_permute2x128_si256( t0, t2, 0x20 );
+  r[1] = _mm256_permute2x128_si256( t1, t3, 0x20 );
+  r[2] = _mm256_permute2x128_si256( t0, t2, 0x31 );
+  r[3] = _mm256_permute2x128_si256( t1, t3, 0x31 );
+}
+
+/* h[i] = word i of the chaining values of S[0..3] */
+static BLAKE2_INLINE void blake2b_x4_load( __m256i h[8], blake2b_state * const S[4] )
+{
+  size_t i, j;
+  for( j = 0; j < 8; j += 4 )
+  {
+    for( i = 0; i < 4; ++i )
+      h[j + i] = _mm256_loadu_si256( (const __m256i *)&S[i]->h[j] );
+    blake2b_x4_transpose( h + j );
+  }
+}
+
+static BLAKE2_INLINE void blake2b_x4_store( blake2b_state * const S[4], const __m256i h[8] )
+{
+  __m256i r[4];
+  size_t i, j;
+  for( j = 0; j < 8; j += 4 )
+  {
+    for( i = 0; i < 4; ++i )
+      r[i] = h[j + i];
+    blake2b_x4_transpose( r );
+    for( i = 0; i < 4; ++i )
+      _mm256_storeu_si256( (__m256i *)&S[i]->h[j], r[i] );
+  }
+}
+
+/*
+  Compress block[i] into lane i of h. t0/t1 hold the low/high counter
+  words and f0/f1 the finalization flags of each lane.
+*/
+static BLAKE2_INLINE void blake2b_x4_compress( __m256i h[8], const uint64_t t0[4], const uint64_t t1[4],
+                                 const uint64_t f0[4], const uint64_t f1[4],
+                                 const uint8_t * const block[4] )
+{
+  const __m256i r16 = _mm256_setr_epi8( 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 );
+  const __m256i r24 = _mm256_setr_epi8( 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 );
+  __m256i m[16];
+  __m256i v[16];
+  size_t i, j;
+
+  for( j = 0; j < 16; j += 4 )
+  {
+    for( i = 0; i < 4; ++i )
+      m[j + i] = _mm256_loadu_si256( (const __m256i *)( block[i] + 8 * j ) );
+    blake2b_x4_transpose( m + j );
+  }
+
+  for( i = 0; i < 8; ++i )
+  {
+    v[i] = h[i];
+    v[i + 8] = _mm256_set1_epi64x( (long long)blake2b_x4_IV[i] );
+  }
+  v[12] = _mm256_xor_si256( v[12], _mm256_loadu_si256( (const __m256i *)t0 ) );
+  v[13] = _mm256_xor_si256( v[13], _mm256_loadu_si256( (const __m256i *)t1 ) );
+  v[14] = _mm256_xor_si256( v[14], _mm256_loadu_si256( (const __m256i *)f0 ) );
+  v[15] = _mm256_xor_si256( v[15], _mm256_loadu_si256( (const __m256i *)f1 ) );
+
+  X4_ROUND( 0 );
+  X4_ROUND( 1 );
+  X4_ROUND( 2 );
+  X4_ROUND( 3 );
+  X4_ROUND( 4 );
+  X4_ROUND( 5 );
+  X4_ROUND( 6 );
+  X4_ROUND( 7 );
+  X4_ROUND( 8 );
+  X4_ROUND( 9 );
+  X4_ROUND( 10 );
+  X4_ROUND( 11 );
+
+  for( i = 0; i < 8; ++i )
+    h[i] = _mm256_xor_si256( h[i], _mm256_xor_si256( v[i], v[i + 8] ) );
+}
+
+#endif
+
+#endif
@@ -40,6 +40,9 @@
 #endif
 
 #include "blake2b-round.h"
+#if defined(HAVE_AVX2)
+#include "blake2b-round-avx2.h"
+#endif
 
 static const uint64_t blake2b_IV[8] =
 {
@@ -148,6 +151,45 @@ int blake2b_init_key( blake2b_state *S, size_t outlen, const void *key, size_t k
   return 0;
 }
 
+#if defined(HAVE_AVX2)
+/* Whole state in four ymm rows; see blake2b-round-avx2.h */
+static void blake2b_compress( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  __m256i a, b, c, d;
+  __m256i b0, b1, b2, b3;
+  __m256i m[8];
+  const __m256i r16 = _mm256_setr_epi8( 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 );
+  const __m256i r24 = _mm256_setr_epi8( 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 );
+  const __m256i h0 = LOADU256( &S->h[0] );
+  const __m256i h1 = LOADU256( &S->h[4] );
+  size_t i;
+
+  for( i = 0; i < 8; ++i )
+    m[i] = _mm256_broadcastsi128_si256( LOADU( block + 16 * i ) );
+
+  a = h0;
+  b = h1;
+  c = LOADU256( &blake2b_IV[0] );
+  /* t[0], t[1], f[0], f[1] are contiguous */
+  d = _mm256_xor_si256( LOADU256( &blake2b_IV[4] ), LOADU256( &S->t[0] ) );
+  ROUND_AVX2( 0 );
+  ROUND_AVX2( 1 );
+  ROUND_AVX2( 2 );
+  ROUND_AVX2( 3 );
+  ROUND_AVX2( 4 );
+  ROUND_AVX2( 5 );
+  ROUND_AVX2( 6 );
+  ROUND_AVX2( 7 );
+  ROUND_AVX2( 8 );
+  ROUND_AVX2( 9 );
+  ROUND_AVX2( 10 );
+  ROUND_AVX2( 11 );
+  STOREU256( &S->h[0], _mm256_xor_si256( h0, _mm256_xor_si256( a, c ) ) );
+  STOREU256( &S->h[4], _mm256_xor_si256( h1, _mm256_xor_si256( b, d ) ) );
+}
+#else
 static void blake2b_compress( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
 {
   __m128i row1l, row1h;
@@ -216,6 +258,7 @@ static void blake2b_compress( blake2b_state *S, const uint8_t block[BLAKE2B_BLOC
   STOREU( &S->h[4], _mm_xor_si128( LOADU( &S->h[4] ), row2l ) );
   STOREU( &S->h[6], _mm_xor_si128( LOADU( &S->h[6] ), row2h ) );
 }
+#endif
 
 
 int blake2b_update( blake2b_state *S, const void *pin, size_t inlen )
@@ -293,6 +336,64 @@ int blake2b( void *out, size_t outlen, const void *in, size_t inlen, const void
   return 0;
 }
 
+int blake2b_prekey( blake2b_prekey_state *K, size_t outlen, const void *key, size_t keylen )
+{
+  blake2b_state S[1];
+
+  if( !key || !keylen ) return -1;
+
+  if( blake2b_init_key( S, outlen, key, keylen ) < 0 ) return -1;
+
+  /* init_key leaves the key block buffered; compress it as
+     blake2b_update does once more input follows */
+  blake2b_increment_counter( S, BLAKE2B_BLOCKBYTES );
+  blake2b_compress( S, S->buf );
+
+  memcpy( K->h, S->h, sizeof( K->h ) );
+  K->outlen = outlen;
+  memcpy( K->key, key, keylen );
+  K->keylen = keylen;
+
+  secure_zero_memory( S, sizeof( S ) );
+  return 0;
+}
+
+int blake2b_prekeyed( const blake2b_prekey_state *K, void *out, const void *in, size_t inlen )
+{
+  blake2b_state S[1];
+
+  if ( NULL == in && inlen > 0 ) return -1;
+
+  if ( NULL == out ) return -1;
+
+  /* with no message the key block itself is the last block */
+  if( inlen == 0 )
+    return blake2b( out, K->outlen, in, 0, K->key, K->keylen );
+
+  memcpy( S->h, K->h, sizeof( S->h ) );
+  S->t[0] = BLAKE2B_BLOCKBYTES;
+  S->t[1] = 0;
+  S->f[0] = 0;
+  S->f[1] = 0;
+  S->buflen = 0;
+  S->outlen = K->outlen;
+  S->last_node = 0;
+
+  if( inlen <= BLAKE2B_BLOCKBYTES )
+  {
+    memcpy( S->buf, in, inlen );
+    memset( S->buf + inlen, 0, BLAKE2B_BLOCKBYTES - inlen );
+    S->t[0] += inlen;
+    S->f[0] = (uint64_t)-1;
+    blake2b_compress( S, S->buf );
+    memcpy( out, &S->h[0], S->outlen );
+    return 0;
+  }
+
+  blake2b_update( S, ( const uint8_t * )in, inlen );
+  return blake2b_final( S, out, S->outlen );
+}
+
 int blake2( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen ) {
   return blake2b(out, outlen, in, inlen, key, keylen);
 }
@@ -331,6 +432,23 @@ int main( void )
     }
   }
 
+  /* Test prekeyed API */
+  {
+    blake2b_prekey_state K[1];
+
+    if( blake2b_prekey( K, BLAKE2B_OUTBYTES, key, BLAKE2B_KEYBYTES ) < 0 )
+      goto fail;
+
+    for( i = 0; i < BLAKE2_KAT_LENGTH; ++i )
+    {
+      uint8_t hash[BLAKE2B_OUTBYTES];
+      blake2b_prekeyed( K, hash, buf, i );
+
+      if( 0 != memcmp( hash, blake2b_keyed_kat[i], BLAKE2B_OUTBYTES ) )
+        goto fail;
+    }
+  }
+
   /* Test streaming API */
   for(step = 1; step < BLAKE2B_BLOCKBYTES; ++step) {
     for (i = 0; i < BLAKE2_KAT_LENGTH; ++i) {
@@ -0,0 +1,307 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+#include "blake2btree.h"
+
+static int blake2b_tree_init_node( const blake2b_tree *T, blake2b_state *S, size_t depth, size_t offset )
+{
+  blake2b_param P[1];
+  const int root = depth + 1 == T->depth;
+
+  P->digest_length = (uint8_t)T->outlen;
+  P->key_length = 0;
+  P->fanout = (uint8_t)T->fanout;
+  P->depth = 255; /* unlimited */
+  store32( &P->leaf_length, (uint32_t)T->leaf_length );
+  store32( &P->node_offset, (uint32_t)offset );
+  store32( &P->xof_length, 0 );
+  P->node_depth = (uint8_t)depth;
+  P->inner_length = BLAKE2B_OUTBYTES;
+  memset( P->reserved, 0, sizeof( P->reserved ) );
+  memset( P->salt, 0, sizeof( P->salt ) );
+  memset( P->personal, 0, sizeof( P->personal ) );
+
+  if( blake2b_init_param( S, P ) < 0 )
+    return -1;
+
+  /* all but the root pass on inner_length bytes, as blake2bp leaves do */
+  if( !root )
+    S->outlen = BLAKE2B_OUTBYTES;
+  if( offset + 1 == T->count[depth] )
+    S->last_node = 1;
+  return 0;
+}
+
+/* Hash nodes [lo, hi) of a level from the level below, or the object */
+static int blake2b_tree_hash_range( blake2b_tree *T, const uint8_t *in, size_t depth, size_t lo, size_t hi )
+{
+  const size_t width = depth == 0 ? T->leaf_length : T->fanout * BLAKE2B_OUTBYTES;
+  const uint8_t *src = depth == 0 ? in : T->digest[depth - 1];
+  const size_t srclen = depth == 0 ? T->length : T->count[depth - 1] * BLAKE2B_OUTBYTES;
+  blake2b_state S[1];
+  size_t i;
+
+  for( i = lo; i < hi; ++i )
+  {
+    const size_t start = i * width;
+    const size_t len = srclen - start < width ? srclen - start : width;
+
+    if( blake2b_tree_init_node( T, S, depth, i ) < 0 )
+      return -1;
+    blake2b_update( S, src + start, len );
+    if( blake2b_final( S, T->digest[depth] + i * BLAKE2B_OUTBYTES, S->outlen ) < 0 )
+      return -1;
+  }
+  return 0;
+}
+
+/* Size the levels for an object of inlen bytes; returns the old counts */
+static int blake2b_tree_shape( blake2b_tree *T, size_t inlen, size_t old[BLAKE2B_TREE_MAXDEPTH] )
+{
+  size_t d, n;
+
+  memcpy( old, T->count, sizeof( T->count ) );
+
+  n = inlen == 0 ? 1 : ( inlen - 1 ) / T->leaf_length + 1;
+  for( d = 0; ; ++d )
+  {
+    if( d == BLAKE2B_TREE_MAXDEPTH )
+      return -1;
+    if( n != old[d] || !T->digest[d] )
+    {
+      uint8_t *p = (uint8_t *)realloc( T->digest[d], n * BLAKE2B_OUTBYTES );
+      if( !p )
+        return -1;
+      T->digest[d] = p;
+    }
+    T->count[d] = n;
+    if( n == 1 )
+      break;
+    n = ( n - 1 ) / T->fanout + 1;
+  }
+
+  T->depth = d + 1;
+  for( ++d; d < BLAKE2B_TREE_MAXDEPTH; ++d )
+  {
+    free( T->digest[d] );
+    T->digest[d] = NULL;
+    T->count[d] = 0;
+  }
+  T->length = inlen;
+  return 0;
+}
+
+int blake2b_tree_init( blake2b_tree *T, size_t outlen, size_t leaf_length, size_t fanout )
+{
+  if( !outlen || outlen > BLAKE2B_OUTBYTES ) return -1;
+
+  if( !leaf_length || leaf_length > 0xFFFFFFFFUL ) return -1;
+
+  if( fanout < 2 || fanout > 255 ) return -1;
+
+  memset( T, 0, sizeof( blake2b_tree ) );
+  T->outlen = outlen;
+  T->leaf_length = leaf_length;
+  T->fanout = fanout;
+  return 0;
+}
+
+void blake2b_tree_free( blake2b_tree *T )
+{
+  size_t d;
+
+  for( d = 0; d < BLAKE2B_TREE_MAXDEPTH; ++d )
+    free( T->digest[d] );
+  memset( T, 0, sizeof( blake2b_tree ) );
+}
+
+int blake2b_tree_build( blake2b_tree *T, const void *in, size_t inlen )
+{
+  size_t old[BLAKE2B_TREE_MAXDEPTH];
+  size_t d;
+
+  if( NULL == in && inlen > 0 ) return -1;
+
+  if( blake2b_tree_shape( T, inlen, old ) < 0 )
+    return -1;
+
+  for( d = 0; d < T->depth; ++d )
+    if( blake2b_tree_hash_range( T, (const uint8_t *)in, d, 0, T->count[d] ) < 0 )
+      return -1;
+
+  memcpy( T->root, T->digest[T->depth - 1], T->outlen );
+  return 0;
+}
+
+int blake2b_tree_update( blake2b_tree *T, const void *in, size_t inlen, size_t offset, size_t len )
+{
+  size_t old[BLAKE2B_TREE_MAXDEPTH];
+  size_t d, lo, hi, end;
+  const size_t oldlen = T->length;
+  const size_t olddepth = T->depth;
+
+  if( NULL == in && inlen > 0 ) return -1;
+
+  if( olddepth == 0 )
+    return blake2b_tree_build( T, in, inlen );
+
+  end = offset + len;
+  if( end < offset || end > inlen ) end = inlen;
+  if( inlen != oldlen )
+  {
+    /* the tail moved */
+    if( offset > oldlen ) offset = oldlen;
+    end = inlen;
+  }
+  if( offset >= end && inlen == oldlen )
+    return 0;
+
+  if( blake2b_tree_shape( T, inlen, old ) < 0 )
+    return -1;
+
+  lo = offset / T->leaf_length;
+  hi = end == 0 ? 1 : ( end - 1 ) / T->leaf_length + 1;
+
+  for( d = 0; d < T->depth; ++d )
+  {
+    /* a level that grew or shrank has a new last node, and the old one
+       lost its flag; a level the old tree lacked is hashed whole */
+    if( d >= olddepth )
+      lo = 0;
+    else if( old[d] != T->count[d] )
+    {
+      const size_t keep = old[d] < T->count[d] ? old[d] : T->count[d];
+      if( keep - 1 < lo ) lo = keep - 1;
+      hi = T->count[d];
+    }
+    /* so has a level whose root status changed */
+    if( d + 1 == T->depth || d + 1 == olddepth )
+    {
+      lo = 0;
+      hi = T->count[d];
+    }
+    if( hi > T->count[d] ) hi = T->count[d];
+
+    if( blake2b_tree_hash_range( T, (const uint8_t *)in, d, lo, hi ) < 0 )
+      return -1;
+
+    lo /= T->fanout;
+    hi = ( hi - 1 ) / T->fanout + 1;
+  }
+
+  memcpy( T->root, T->digest[T->depth - 1], T->outlen );
+  return 0;
+}
+
+int blake2b_tree_final( const blake2b_tree *T, void *out, size_t outlen )
+{
+  if( out == NULL || outlen < T->outlen || T->depth == 0 )
+    return -1;
+
+  memcpy( out, T->root, T->outlen );
+  return 0;
+}
+
+const uint8_t *blake2b_tree_node( const blake2b_tree *T, size_t depth, size_t offset )
+{
+  if( depth >= T->depth || offset >= T->count[depth] )
+    return NULL;
+  return T->digest[depth] + offset * BLAKE2B_OUTBYTES;
+}
+
+#if defined(BLAKE2BTREE_SELFTEST)
+#include <stdio.h>
+/*
+  No test vectors cover tree mode beyond BLAKE2bp, so check that a
+  single-leaf tree is plain BLAKE2b under its parameter block and that
+  incremental updates always reach the root a full rebuild does.
+*/
+int main( void )
+{
+  static const size_t lengths[] = { 0, 1, 63, 64, 65, 1000, 4096, 4097, 40000 };
+  static uint8_t buf[40000];
+  uint8_t a[BLAKE2B_OUTBYTES], b[BLAKE2B_OUTBYTES];
+  blake2b_tree T[1], U[1];
+  blake2b_state S[1];
+  blake2b_param P[1];
+  size_t i, j, k;
+
+  for( i = 0; i < sizeof( buf ); ++i )
+    buf[i] = ( uint8_t )( i * 7 + ( i >> 8 ) );
+
+  /* one leaf: depth 1, the leaf is the root */
+  memset( P, 0, sizeof( P ) );
+  P->digest_length = BLAKE2B_OUTBYTES;
+  P->fanout = 4;
+  P->depth = 255;
+  store32( &P->leaf_length, 4096 );
+  P->inner_length = BLAKE2B_OUTBYTES;
+  blake2b_init_param( S, P );
+  S->last_node = 1;
+  blake2b_update( S, buf, 100 );
+  blake2b_final( S, a, BLAKE2B_OUTBYTES );
+  blake2b_tree_init( T, BLAKE2B_OUTBYTES, 4096, 4 );
+  blake2b_tree_build( T, buf, 100 );
+  blake2b_tree_final( T, b, BLAKE2B_OUTBYTES );
+  blake2b_tree_free( T );
+  if( 0 != memcmp( a, b, BLAKE2B_OUTBYTES ) )
+    goto fail;
+
+  for( k = 2; k <= 5; k += 3 )
+  for( i = 0; i < sizeof( lengths ) / sizeof( lengths[0] ); ++i )
+  for( j = 0; j < sizeof( lengths ) / sizeof( lengths[0] ); ++j )
+  {
+    const size_t from = lengths[i], to = lengths[j];
+    const size_t offset = from / 3, len = from / 5 + 1;
+    size_t n;
+
+    blake2b_tree_init( T, 32, 64, k );
+    blake2b_tree_build( T, buf, from );
+
+    /* change a range in place, then resize */
+    for( n = offset; n < offset + len && n < from; ++n )
+      buf[n] ^= 0x5a;
+    blake2b_tree_update( T, buf, from, offset, len );
+    blake2b_tree_init( U, 32, 64, k );
+    blake2b_tree_build( U, buf, from );
+    blake2b_tree_final( T, a, 32 );
+    blake2b_tree_final( U, b, 32 );
+    if( 0 != memcmp( a, b, 32 ) )
+      goto fail;
+
+    blake2b_tree_update( T, buf, to, from < to ? from : to, 0 );
+    blake2b_tree_build( U, buf, to );
+    blake2b_tree_final( T, a, 32 );
+    blake2b_tree_final( U, b, 32 );
+    if( 0 != memcmp( a, b, 32 ) )
+      goto fail;
+
+    blake2b_tree_free( T );
+    blake2b_tree_free( U );
+  }
+
+  puts( "ok" );
+  return 0;
+fail:
+  puts("error");
+  return -1;
+}
+#endif
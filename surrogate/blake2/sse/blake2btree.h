@@ -0,0 +1,72 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+#ifndef BLAKE2BTREE_H
+#define BLAKE2BTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blake2.h"
+
+/*
+  BLAKE2b in tree mode over an object split into leaves of leaf_length
+  bytes. Nodes at depth d + 1 hash the digests of up to fanout nodes at
+  depth d, and the last node of each level carries the last-node flag.
+  Every node digest is kept, so after a byte range of the object
+  changes, blake2b_tree_update rehashes only the leaves covering it and
+  their ancestors.
+*/
+
+#define BLAKE2B_TREE_MAXDEPTH 64
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+  typedef struct blake2b_tree__
+  {
+    size_t outlen;
+    size_t leaf_length;
+    size_t fanout;
+    size_t length;                          /* of the object last hashed */
+    size_t depth;                           /* levels, 1 when the root is a leaf */
+    size_t count[BLAKE2B_TREE_MAXDEPTH];    /* nodes per level, leaves first */
+    uint8_t *digest[BLAKE2B_TREE_MAXDEPTH]; /* BLAKE2B_OUTBYTES per node */
+    uint8_t root[BLAKE2B_OUTBYTES];
+  } blake2b_tree;
+
+  /* fanout 2..255, leaf_length 1..2^32-1 */
+  int blake2b_tree_init( blake2b_tree *T, size_t outlen, size_t leaf_length, size_t fanout );
+  void blake2b_tree_free( blake2b_tree *T );
+
+  /* Hash the whole object */
+  int blake2b_tree_build( blake2b_tree *T, const void *in, size_t inlen );
+
+  /* Rehash after bytes [offset, offset + len) of the object changed;
+     inlen may differ from the previous length, the bytes past the
+     shorter of the two then count as changed too */
+  int blake2b_tree_update( blake2b_tree *T, const void *in, size_t inlen, size_t offset, size_t len );
+
+  int blake2b_tree_final( const blake2b_tree *T, void *out, size_t outlen );
+
+  /* Digest of node offset at depth, NULL past the end of the level. The
+     root's is truncated to outlen, the others are BLAKE2B_OUTBYTES */
+  const uint8_t *blake2b_tree_node( const blake2b_tree *T, size_t depth, size_t offset );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,174 @@
+/*
+   BLAKE2 reference source code package - optimized C implementations
+
+   Copyright 2012, Samuel Neves <sneves@dei.uc.pt>.  You may use this under the
+   terms of the CC0, the OpenSSL Licence, or the Apache Public License 2.0, at
+   your option.  The terms of these licenses can be found at:
+
+   - CC0 1.0 Universal : http://creativecommons.org/publicdomain/zero/1.0
+   - OpenSSL license   : https://www.openssl.org/source/license.html
+   - Apache 2.0        : http://www.apache.org/licenses/LICENSE-2.0
+
+   More information about the BLAKE2 hash function can be found at
+   https://blake2.net.
+*/
+#ifndef BLAKE2S_X8_H
+#define BLAKE2S_X8_H
+
+/*
+  Eight independent BLAKE2s instances compressed side by side. As in
+  blake2b-x4.h the state is transposed: register v[i] holds word i of
+  all eight instances, one instance per 32-bit lane.
+*/
+
+#include "blake2-config.h"
+
+#if defined(HAVE_AVX2)
+#include <immintrin.h>
+
+static const uint32_t blake2s_x8_IV[8] =
+{
+  0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+  0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL
+};
+
+static const uint8_t blake2s_x8_sigma[10][16] =
+{
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 } ,
+  { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 } ,
+  {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 } ,
+  {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 } ,
+  {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 } ,
+  { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 } ,
+  { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 } ,
+  {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 } ,
+  { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13 , 0 } ,
+};
+
+#define X8_ROTR16(x) _mm256_shuffle_epi8((x), r16)
+#define X8_ROTR12(x) _mm256_or_si256(_mm256_srli_epi32((x), 12), _mm256_slli_epi32((x), 20))
+#define X8_ROTR8(x)  _mm256_shuffle_epi8((x), r8)
+#define X8_ROTR7(x)  _mm256_or_si256(_mm256_srli_epi32((x), 7), _mm256_slli_epi32((x), 25))
+
+#define X8_G(r,i,a,b,c,d) \
+  a = _mm256_add_epi32(_mm256_add_epi32(a, b), m[blake2s_x8_sigma[r][2*i+0]]); \
+  d = X8_ROTR16(_mm256_xor_si256(d, a)); \
+  c = _mm256_add_epi32(c, d); \
+  b = X8_ROTR12(_mm256_xor_si256(b, c)); \
+  a = _mm256_add_epi32(_mm256_add_epi32(a, b), m[blake2s_x8_sigma[r][2*i+1]]); \
+  d = X8_ROTR8(_mm256_xor_si256(d, a)); \
+  c = _mm256_add_epi32(c, d); \
+  b = X8_ROTR7(_mm256_xor_si256(b, c));
+
+#define X8_ROUND(r) \
+  X8_G(r,0,v[ 0],v[ 4],v[ 8],v[12]); \
+  X8_G(r,1,v[ 1],v[ 5],v[ 9],v[13]); \
+  X8_G(r,2,v[ 2],v[ 6],v[10],v[14]); \
+  X8_G(r,3,v[ 3],v[ 7],v[11],v[15]); \
+  X8_G(r,4,v[ 0],v[ 5],v[10],v[15]); \
+  X8_G(r,5,v[ 1],v[ 6],v[11],v[12]); \
+  X8_G(r,6,v[ 2],v[ 7],v[ 8],v[13]); \
+  X8_G(r,7,v[ 3],v[ 4],v[ 9],v[14]);
+
+/* r[i] = ( word i of r[0..7] ) */
+static BLAKE2_INLINE void blake2s_x8_transpose( __m256i r[8] )
+{
+  const __m256i t0 = _mm256_unpacklo_epi32( r[0], r[1] );
+  const __m256i t1 = _mm256_unpackhi_epi32( r[0], r[1] );
+  const __m256i t2 = _mm256_unpacklo_epi32( r[2], r[3] );
+  const __m256i t3 = _mm256_unpackhi_epi32( r[2], r[3] );
+  const __m256i t4 = _mm256_unpacklo_epi32( r[4], r[5] );
+  const __m256i t5 = _mm256_unpackhi_epi32( r[4], r[5] );
+  const __m256i t6 = _mm256_unpacklo_epi32( r[6], r[7] );
+  const __m256i t7 = _mm256_unpackhi_epi32( r[6], r[7] );
+  const __m256i u0 = _mm256_unpacklo_epi64( t0, t2 );
+  const __m256i u1 = _mm256_unpackhi_epi64( t0, t2 );
+  const __m256i u2 = _mm256_unpacklo_epi64( t1, t3 );
+  const __m256i u3 = _mm256_unpackhi_epi64( t1, t3 );
+  const __m256i u4 = _mm256_unpacklo_epi64( t4, t6 );
+  const __m256i u5 = _mm256_unpackhi_epi64( t4, t6 );
+  const __m256i u6 = _mm256_unpacklo_epi64( t5, t7 );
+  const __m256i u7 = _mm256_unpackhi_epi64( t5, t7 );
+  r[0] = _mm256_permute2x128_si256( u0, u4, 0x20 );
+  r[1] = _mm256_permute2x128_si256( u1, u5, 0x20 );
+  r[2] = _mm256_permute2x128_si256( u2, u6, 0x20 );
+  r[3] = _mm256_permute2x128_si256( u3, u7, 0x20 );
+  r[4] = _mm256_permute2x128_si256( u0, u4, 0x31 );
+  r[5] = _mm256_permute2x128_si256( u1, u5, 0x31 );
+  r[6] = _mm256_permute2x128_si256( u2, u6, 0x31 );
+  r[7] = _mm256_permute2x128_si256( u3, u7, 0x31 );
+}
+
+/* h[i] = word i of the chaining values of S[0..7] */
+static BLAKE2_INLINE void blake2s_x8_load( __m256i h[8], blake2s_state * const S[8] )
+{
+  size_t i;
+  for( i = 0; i < 8; ++i )
+    h[i] = _mm256_loadu_si256( (const __m256i *)&S[i]->h[0] );
+  blake2s_x8_transpose( h );
+}
+
+static BLAKE2_INLINE void blake2s_x8_store( blake2s_state * const S[8], const __m256i h[8] )
+{
+  __m256i r[8];
+  size_t i;
+  for( i = 0; i < 8; ++i )
+    r[i] = h[i];
+  blake2s_x8_transpose( r );
+  for( i = 0; i < 8; ++i )
+    _mm256_storeu_si256( (__m256i *)&S[i]->h[0], r[i] );
+}
+
+/*
+  Compress block[i] into lane i of h. t0/t1 hold the low/high counter
+  words and f0/f1 the finalization flags of each lane.
+*/
+static BLAKE2_INLINE void blake2s_x8_compress( __m256i h[8], const uint32_t t0[8], const uint32_t t1[8],
+                                 const uint32_t f0[8], const uint32_t f1[8],
+                                 const uint8_t * const block[8] )
+{
+  const __m256i r8  = _mm256_setr_epi8( 1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                                        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12 );
+  const __m256i r16 = _mm256_setr_epi8( 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13 );
+  __m256i m[16];
+  __m256i v[16];
+  size_t i;
+
+  for( i = 0; i < 8; ++i )
+  {
+    m[i] = _mm256_loadu_si256( (const __m256i *)( block[i] ) );
+    m[i + 8] = _mm256_loadu_si256( (const __m256i *)( block[i] + 32 ) );
+  }
+  blake2s_x8_transpose( m );
+  blake2s_x8_transpose( m + 8 );
+
+  for( i = 0; i < 8; ++i )
+  {
+    v[i] = h[i];
+    v[i + 8] = _mm256_set1_epi32( (int)blake2s_x8_IV[i] );
+  }
+  v[12] = _mm256_xor_si256( v[12], _mm256_loadu_si256( (const __m256i *)t0 ) );
+  v[13] = _mm256_xor_si256( v[13], _mm256_loadu_si256( (const __m256i *)t1 ) );
+  v[14] = _mm256_xor_si256( v[14], _mm256_loadu_si256( (const __m256i *)f0 ) );
+  v[15] = _mm256_xor_si256( v[15], _mm256_loadu_si256( (const __m256i *)f1 ) );
+
+  X8_ROUND( 0 );
+  X8_ROUND( 1 );
+  X8_ROUND( 2 );
+  X8_ROUND( 3 );
+  X8_ROUND( 4 );
+  X8_ROUND( 5 );
+  X8_ROUND( 6 );
+  X8_ROUND( 7 );
+  X8_ROUND( 8 );
+  X8_ROUND( 9 );
+
+  for( i = 0; i < 8; ++i )
+    h[i] = _mm256_xor_si256( h[i], _mm256_xor_si256( v[i], v[i + 8] ) );
+}
+
+#endif
+
+#endif
@@ -23,6 +23,11 @@
 
 #include "blake2.h"
 #include "blake2-impl.h"
+#include "blake2s-x8.h"
+
+#if defined(BLAKE2_THREADS)
+#include "blake2-pool.h"
+#endif
 
 #define PARALLELISM_DEGREE 8
 
@@ -75,6 +80,116 @@ static int blake2sp_init_root( blake2s_state *S, size_t outlen, size_t keylen )
 }
 
 
+#if defined(HAVE_AVX2) && !defined(_OPENMP)
+/*
+  Feed whole strides of PARALLELISM_DEGREE blocks to the leaves, all of
+  them compressed at once in the lanes of one blake2s_x8_compress. As in
+  blake2s_update, the last block of each leaf is left in its buffer.
+  Returns the number of bytes consumed, 0 when the leaves are not in
+  lockstep.
+*/
+static size_t blake2sp_update_x8( blake2s_state *S[PARALLELISM_DEGREE], const uint8_t *in, size_t inlen )
+{
+  const size_t stride = PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES;
+  const size_t strides = inlen / stride;
+  const size_t buffered = S[0]->buflen;
+  const uint8_t *block[PARALLELISM_DEGREE];
+  uint32_t t0[PARALLELISM_DEGREE], t1[PARALLELISM_DEGREE], f[PARALLELISM_DEGREE];
+  __m256i h[8];
+  size_t i, s;
+
+  if( strides == 0 )
+    return 0;
+
+  if( buffered != 0 && buffered != BLAKE2S_BLOCKBYTES )
+    return 0;
+
+  for( i = 0; i < PARALLELISM_DEGREE; ++i )
+  {
+    if( S[i]->buflen != buffered || S[i]->f[0] != 0 )
+      return 0;
+    t0[i] = S[i]->t[0];
+    t1[i] = S[i]->t[1];
+    f[i] = 0;
+  }
+
+  blake2s_x8_load( h, S );
+
+  for( s = 0; s < strides; ++s )
+  {
+    if( s == 0 && !buffered )
+      continue;
+
+    for( i = 0; i < PARALLELISM_DEGREE; ++i )
+    {
+      /* the held-back block of the previous stride */
+      block[i] = s == 0 ? S[i]->buf : in + ( s - 1 ) * stride + i * BLAKE2S_BLOCKBYTES;
+      t0[i] += BLAKE2S_BLOCKBYTES;
+      t1[i] += ( t0[i] < BLAKE2S_BLOCKBYTES );
+    }
+    blake2s_x8_compress( h, t0, t1, f, f, block );
+  }
+
+  blake2s_x8_store( S, h );
+
+  for( i = 0; i < PARALLELISM_DEGREE; ++i )
+  {
+    S[i]->t[0] = t0[i];
+    S[i]->t[1] = t1[i];
+    memcpy( S[i]->buf, in + ( strides - 1 ) * stride + i * BLAKE2S_BLOCKBYTES, BLAKE2S_BLOCKBYTES );
+    S[i]->buflen = BLAKE2S_BLOCKBYTES;
+  }
+  return strides * stride;
+}
+#endif
+
+#if defined(BLAKE2_THREADS) && !defined(_OPENMP)
+typedef struct blake2sp_job__
+{
+  blake2s_state *S[PARALLELISM_DEGREE];
+  const uint8_t *in;
+  size_t inlen;
+} blake2sp_job;
+
+/* Leaf i takes the i-th block of every stride, as in the sequential loop */
+static void blake2sp_leaf_job( void *arg, size_t i )
+{
+  const blake2sp_job *job = ( const blake2sp_job * )arg;
+  const uint8_t *in = job->in + i * BLAKE2S_BLOCKBYTES;
+  size_t inlen = job->inlen;
+
+  while( inlen >= PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES )
+  {
+    blake2s_update( job->S[i], in, BLAKE2S_BLOCKBYTES );
+    in += PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES;
+    inlen -= PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES;
+  }
+}
+
+/*
+  Hand the whole strides of a large input to the thread pool, the leaves
+  spread over its members. Returns the number of bytes consumed, 0 when
+  the input is too short to be worth waking the pool for.
+*/
+static size_t blake2sp_update_mt( blake2s_state *S[PARALLELISM_DEGREE], const uint8_t *in, size_t inlen )
+{
+  const size_t stride = PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES;
+  blake2sp_job job;
+  size_t i;
+
+  if( inlen < BLAKE2_THREADS_MIN || inlen < stride || blake2_pool_size() < 2 )
+    return 0;
+
+  for( i = 0; i < PARALLELISM_DEGREE; ++i )
+    job.S[i] = S[i];
+  job.in = in;
+  job.inlen = inlen;
+
+  blake2_pool_run( blake2sp_leaf_job, &job, PARALLELISM_DEGREE );
+  return inlen - inlen % stride;
+}
+#endif
+
 int blake2sp_init( blake2sp_state *S, size_t outlen )
 {
   size_t i;
@@ -149,6 +264,26 @@ int blake2sp_update( blake2sp_state *S, const void *pin, size_t inlen )
     left = 0;
   }
 
+#if ( defined(HAVE_AVX2) || defined(BLAKE2_THREADS) ) && !defined(_OPENMP)
+  {
+    blake2s_state *L[PARALLELISM_DEGREE];
+    size_t done = 0;
+
+    for( i = 0; i < PARALLELISM_DEGREE; ++i )
+      L[i] = S->S[i];
+
+#if defined(BLAKE2_THREADS)
+    done = blake2sp_update_mt( L, in, inlen );
+#endif
+#if defined(HAVE_AVX2)
+    if( done == 0 )
+      done = blake2sp_update_x8( L, in, inlen );
+#endif
+    in += done;
+    inlen -= done;
+  }
+#endif
+
 #if defined(_OPENMP)
   #pragma omp parallel shared(S), num_threads(PARALLELISM_DEGREE)
 #else
@@ -247,6 +382,26 @@ int blake2sp( void *out, size_t outlen, const void *in, size_t inlen, const void
     secure_zero_memory( block, BLAKE2S_BLOCKBYTES ); /* Burn the key from stack */
   }
 
+#if ( defined(HAVE_AVX2) || defined(BLAKE2_THREADS) ) && !defined(_OPENMP)
+  {
+    blake2s_state *L[PARALLELISM_DEGREE];
+    size_t done = 0;
+
+    for( i = 0; i < PARALLELISM_DEGREE; ++i )
+      L[i] = S[i];
+
+#if defined(BLAKE2_THREADS)
+    done = blake2sp_update_mt( L, ( const uint8_t * )in, inlen );
+#endif
+#if defined(HAVE_AVX2)
+    if( done == 0 )
+      done = blake2sp_update_x8( L, ( const uint8_t * )in, inlen );
+#endif
+    in = ( const uint8_t * )in + done;
+    inlen -= done;
+  }
+#endif
+
 #if defined(_OPENMP)
   #pragma omp parallel shared(S,hash), num_threads(PARALLELISM_DEGREE)
 #else
@@ -292,6 +447,118 @@ int blake2sp( void *out, size_t outlen, const void *in, size_t inlen, const void
 #if defined(BLAKE2SP_SELFTEST)
 #include <string.h>
 #include "blake2-kat.h"
+
+/*
+  Inputs of several strides with a ragged tail, hashed in one call and
+  in chunks that cut across blocks and strides, must match the leaves
+  fed one block at a time as before the lane kernels. The inputs of
+  megabytes, and the chunks of one, are past BLAKE2_THREADS_MIN, so
+  the threads builds run them through the pool.
+*/
+static const size_t blake2sp_long_lengths[] = {
+  2 * PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES,
+  5 * PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES + 1,
+  9 * PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES + BLAKE2S_BLOCKBYTES - 1,
+  16 * PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES + 3 * BLAKE2S_BLOCKBYTES + 5,
+  ( 1 << 20 ) + 3 * PARALLELISM_DEGREE * BLAKE2S_BLOCKBYTES + 7,
+  ( 3 << 20 ) + 77
+};
+static const size_t blake2sp_long_steps[] = { 0, 63, 129, 513, 4099, ( 1 << 20 ) + 5 };
+#define BLAKE2SP_LONG_MAX ( ( 3 << 20 ) + 77 )
+
+static int blake2sp_serial( uint8_t *out, const uint8_t *in, size_t inlen, const uint8_t *key, size_t keylen )
+{
+  uint8_t hash[PARALLELISM_DEGREE][BLAKE2S_OUTBYTES];
+  uint8_t block[BLAKE2S_BLOCKBYTES];
+  blake2s_state S[PARALLELISM_DEGREE][1];
+  blake2s_state R[1];
+  size_t i, off, len;
+
+  for( i = 0; i < PARALLELISM_DEGREE; ++i )
+    if( blake2sp_init_leaf( S[i], BLAKE2S_OUTBYTES, keylen, i ) < 0 ) return -1;
+  S[PARALLELISM_DEGREE - 1]->last_node = 1;
+
+  if( keylen > 0 )
+  {
+    memset( block, 0, BLAKE2S_BLOCKBYTES );
+    memcpy( block, key, keylen );
+    for( i = 0; i < PARALLELISM_DEGREE; ++i )
+      blake2s_update( S[i], block, BLAKE2S_BLOCKBYTES );
+  }
+
+  /* block k of the input goes to leaf k mod PARALLELISM_DEGREE */
+  for( off = 0; off < inlen; off += len )
+  {
+    len = inlen - off < BLAKE2S_BLOCKBYTES ? inlen - off : BLAKE2S_BLOCKBYTES;
+    blake2s_update( S[( off / BLAKE2S_BLOCKBYTES ) % PARALLELISM_DEGREE], in + off, len );
+  }
+
+  for( i = 0; i < PARALLELISM_DEGREE; ++i )
+    blake2s_final( S[i], hash[i], BLAKE2S_OUTBYTES );
+
+  if( blake2sp_init_root( R, BLAKE2S_OUTBYTES, keylen ) < 0 ) return -1;
+  R->last_node = 1;
+  for( i = 0; i < PARALLELISM_DEGREE; ++i )
+    blake2s_update( R, hash[i], BLAKE2S_OUTBYTES );
+  return blake2s_final( R, out, BLAKE2S_OUTBYTES );
+}
+
+static int blake2sp_check_long( const uint8_t *key )
+{
+  static uint8_t buf[BLAKE2SP_LONG_MAX];
+  uint8_t want[BLAKE2S_OUTBYTES], hash[BLAKE2S_OUTBYTES];
+  blake2sp_state S;
+  size_t i, l, s, k, off, len;
+
+  for( i = 0; i < sizeof( buf ); ++i )
+    buf[i] = ( uint8_t )( i * 7 + ( i >> 11 ) );
+
+  for( k = 0; k < 2; ++k )
+  {
+    size_t keylen = k ? BLAKE2S_KEYBYTES : 0;
+
+    for( l = 0; l < sizeof( blake2sp_long_lengths ) / sizeof( blake2sp_long_lengths[0] ); ++l )
+    {
+      const size_t inlen = blake2sp_long_lengths[l];
+
+      if( blake2sp_serial( want, buf, inlen, key, keylen ) < 0 )
+        return -1;
+
+      for( s = 0; s < sizeof( blake2sp_long_steps ) / sizeof( blake2sp_long_steps[0] ); ++s )
+      {
+        const size_t step = blake2sp_long_steps[s];
+
+        if( step == 0 )
+        {
+          if( blake2sp( hash, BLAKE2S_OUTBYTES, buf, inlen, key, keylen ) < 0 )
+            return -1;
+        }
+        else
+        {
+          if( ( keylen ? blake2sp_init_key( &S, BLAKE2S_OUTBYTES, key, keylen ) : blake2sp_init( &S, BLAKE2S_OUTBYTES ) ) < 0 )
+            return -1;
+          for( off = 0; off < inlen; off += len )
+          {
+            len = inlen - off < step ? inlen - off : step;
+            if( blake2sp_update( &S, buf + off, len ) < 0 )
+              return -1;
+          }
+          if( blake2sp_final( &S, hash, BLAKE2S_OUTBYTES ) < 0 )
+            return -1;
+        }
+
+        if( 0 != memcmp( hash, want, BLAKE2S_OUTBYTES ) )
+        {
+          fprintf( stderr, "blake2sp: length %lu, step %lu, key %lu differs\n",
+                   ( unsigned long )inlen, ( unsigned long )step, ( unsigned long )keylen );
+          return -1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
 int main( void )
 {
   uint8_t key[BLAKE2S_KEYBYTES];
@@ -349,6 +616,9 @@ int main( void )
     }
   }
 
+  if( blake2sp_check_long( key ) < 0 )
+    goto fail;
+
   puts( "ok" );
   return 0;
 fail:
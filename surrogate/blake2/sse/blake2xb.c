@@ -22,6 +22,69 @@
 
 #include "blake2.h"
 #include "blake2-impl.h"
+#include "blake2b-x4.h"
+
+/*
+  Output block i is BLAKE2b of the root hash under the parameter block
+  of blake2xb_final with digest_length set to the block's size and
+  node_offset to i. Both fields sit in the first two words of the
+  parameter block, so a block's initial chaining value is that of a
+  full-size block 0 with them xored in, and B below is set up once for
+  the whole output.
+*/
+static void blake2xb_init_block( blake2b_state *C, const blake2b_state *B, size_t block_size, uint32_t node_offset )
+{
+  memcpy( C, B, sizeof( blake2b_state ) );
+  C->h[0] ^= BLAKE2B_OUTBYTES ^ block_size;
+  C->h[1] ^= node_offset;
+  C->outlen = block_size;
+}
+
+#if defined(HAVE_AVX2)
+/* Four output blocks from the root block, one per lane */
+static void blake2xb_expand_x4( uint8_t *out, const blake2b_state *B, const uint8_t *root,
+                                const size_t block_size[4], uint32_t node_offset )
+{
+  uint64_t t0[4], t1[4], f0[4], f1[4], h0[4], h1[4];
+  uint64_t words[4][8];
+  const uint8_t *block[4];
+  __m256i h[8], r[4];
+  size_t i, j;
+
+  for( i = 0; i < 4; ++i )
+  {
+    t0[i] = BLAKE2B_OUTBYTES; /* the root hash is the only input */
+    t1[i] = 0;
+    f0[i] = ( uint64_t )-1;
+    f1[i] = 0;
+    h0[i] = B->h[0] ^ BLAKE2B_OUTBYTES ^ block_size[i];
+    h1[i] = B->h[1] ^ ( node_offset + i );
+    block[i] = root;
+  }
+
+  h[0] = _mm256_loadu_si256( (const __m256i *)h0 );
+  h[1] = _mm256_loadu_si256( (const __m256i *)h1 );
+  for( j = 2; j < 8; ++j )
+    h[j] = _mm256_set1_epi64x( (long long)B->h[j] );
+
+  blake2b_x4_compress( h, t0, t1, f0, f1, block );
+
+  for( j = 0; j < 8; j += 4 )
+  {
+    for( i = 0; i < 4; ++i )
+      r[i] = h[j + i];
+    blake2b_x4_transpose( r );
+    for( i = 0; i < 4; ++i )
+      _mm256_storeu_si256( (__m256i *)&words[i][j], r[i] );
+  }
+
+  /* AVX2 implies little-endian, so the words are already the output bytes */
+  for( i = 0; i < 4; ++i )
+    memcpy( out + i * BLAKE2B_OUTBYTES, words[i], block_size[i] );
+
+  secure_zero_memory( words, sizeof( words ) );
+}
+#endif
 
 int blake2xb_init( blake2xb_state *S, const size_t outlen ) {
   return blake2xb_init_key(S, outlen, NULL, 0);
@@ -75,10 +138,11 @@ int blake2xb_update( blake2xb_state *S, const void *in, size_t inlen ) {
 
 int blake2xb_final( blake2xb_state *S, void *out, size_t outlen) {
 
-  blake2b_state C[1];
+  blake2b_state B[1], C[1];
   blake2b_param P[1];
   uint32_t xof_length = load32(&S->P->xof_length);
   uint8_t root[BLAKE2B_BLOCKBYTES];
+  uint8_t *o = (uint8_t *)out;
   size_t i;
 
   if (NULL == out) {
@@ -112,21 +176,36 @@ int blake2xb_final( blake2xb_state *S, void *out, size_t outlen) {
   P->inner_length = BLAKE2B_OUTBYTES;
   P->node_depth = 0;
 
-  for (i = 0; outlen > 0; ++i) {
+  P->digest_length = BLAKE2B_OUTBYTES;
+  store32(&P->node_offset, 0);
+  blake2b_init_param(B, P);
+
+  i = 0;
+#if defined(HAVE_AVX2)
+  /* the block is the root hash padded with zeros, as blake2b_final pads it */
+  memset(root + BLAKE2B_OUTBYTES, 0, BLAKE2B_BLOCKBYTES - BLAKE2B_OUTBYTES);
+  for (; outlen > 3 * BLAKE2B_OUTBYTES; i += 4) {
+    size_t block_size[4], k;
+    for (k = 0; k < 4; ++k) {
+      block_size[k] = (outlen < BLAKE2B_OUTBYTES) ? outlen : BLAKE2B_OUTBYTES;
+      outlen -= block_size[k];
+    }
+    blake2xb_expand_x4(o + i * BLAKE2B_OUTBYTES, B, root, block_size, (uint32_t)i);
+  }
+#endif
+
+  for (; outlen > 0; ++i) {
     const size_t block_size = (outlen < BLAKE2B_OUTBYTES) ? outlen : BLAKE2B_OUTBYTES;
-    /* Initialize state */
-    P->digest_length = block_size;
-    store32(&P->node_offset, i);
-    blake2b_init_param(C, P);
-    /* Process key if needed */
+    blake2xb_init_block(C, B, block_size, (uint32_t)i);
     blake2b_update(C, root, BLAKE2B_OUTBYTES);
-    if (blake2b_final(C, (uint8_t *)out + i * BLAKE2B_OUTBYTES, block_size) < 0 ) {
+    if (blake2b_final(C, o + i * BLAKE2B_OUTBYTES, block_size) < 0 ) {
         return -1;
     }
     outlen -= block_size;
   }
   secure_zero_memory(root, sizeof(root));
   secure_zero_memory(P, sizeof(P));
+  secure_zero_memory(B, sizeof(B));
   secure_zero_memory(C, sizeof(C));
   /* Put blake2xb in an invalid state? cf. blake2s_is_lastblock */
   return 0;
@@ -0,0 +1,409 @@
+/*
+ * File Name:	compact.c
+ * Function:	Rebuilds the store into a densely packed copy while
+ *		map_data.c and the other tools keep running, then swaps
+ *		the copy in:
+ *
+ *		1. mark the store as compacting, so writers log what
+ *		   they write to the changes database (surrogate_log);
+ *		2. copy it with mdb_env_copy2 (MDB_CP_COMPACT), which
+ *		   writes only live pages, from a read snapshot;
+ *		3. replay the changes logged meanwhile into the copy,
+ *		   pass after pass until a pass comes out short;
+ *		4. holding the old store's write lock, replay the rest,
+ *		   point the store path at the copy and clear the mark.
+ *		   Writers waiting for the lock then find their store
+ *		   stale (surrogate_txn_begin) and reopen it.
+ *
+ *		The first run turns the store path into a symbolic link
+ *		to numbered directories (db_dir -> db_dir.0, db_dir.1,
+ *		...), so that renaming a new link over it swaps stores
+ *		atomically. Replaying a write is idempotent, so changes
+ *		that made it into the snapshot can be applied again.
+ *		The old directory is removed afterwards unless -k is
+ *		given; tools that still map it keep working until they
+ *		reopen.
+ *
+ *		One compaction runs at a time: each holds an exclusive
+ *		lock on path.lock, which the system drops if it dies.
+ *		A compacting mark found under the lock is left from one
+ *		that died, and is set afresh.
+ *
+ *		compact [-k] [path]
+ *
+ *		cc compact.c surrogate.c blake2/sse/blake2b.c \
+ *		   -llmdb -pthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "lmdb.h"
+#include "surrogate.h"
+
+// replay passes continue until one applies fewer changes than this
+#define SHORT_PASS 1000
+#define PATH_BYTES 4096
+// room kept in paths for the names appended to them, "/data.mdb" and such
+#define PATH_ROOM 16
+
+static unsigned long long
+load_seq (const void *p) {
+
+	const unsigned char *b = p;
+	unsigned long long seq = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		seq = seq << 8 | b[i];
+	return seq;
+}
+
+static MDB_dbi
+log_dbi (const surrogate_store *st, int db, int *dupsort) {
+
+	*dupsort = db == SURROGATE_LOG_DATA || db == SURROGATE_LOG_REV;
+	switch (db) {
+	case SURROGATE_LOG_DATA:
+		return st->dbi;
+	case SURROGATE_LOG_REV:
+		return st->dbi_rev;
+	case SURROGATE_LOG_STRINGS:
+		return st->dbi_strings;
+	case SURROGATE_LOG_LASTSEEN:
+		return st->dbi_lastseen;
+	case SURROGATE_LOG_EXPIRY:
+		return st->dbi_expiry;
+	case SURROGATE_LOG_GENS:
+		return st->dbi_gens;
+	case SURROGATE_LOG_GRAVEYARD:
+		return st->dbi_graveyard;
+	}
+	return 0;
+}
+
+// apply the changes of from (read in ftxn) numbered *next and up to
+// the copy to; *next moves past the last one applied
+static int
+replay (const surrogate_store *from, MDB_txn *ftxn, surrogate_store *to,
+		unsigned long long *next, size_t *applied) {
+
+	int rc, dupsort;
+	unsigned char seq[8];
+	const unsigned char *p;
+	size_t klen, n = 0;
+	unsigned long long s = *next;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_dbi dbi;
+	MDB_val key, data, k, d;
+	int i;
+
+	rc = mdb_txn_begin (to->env, NULL, 0, &txn);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = mdb_cursor_open (ftxn, from->dbi_changes, &cursor);
+	if (rc != MDB_SUCCESS) {
+		mdb_txn_abort (txn);
+		return rc;
+	}
+
+	for (i = 0; i < 8; i++)
+		seq[i] = (unsigned char) (s >> (56 - 8 * i));
+	key.mv_size = sizeof seq;
+	key.mv_data = seq;
+	for (rc = mdb_cursor_get (cursor, &key, &data, MDB_SET_RANGE); rc == MDB_SUCCESS;
+	     rc = mdb_cursor_get (cursor, &key, &data, MDB_NEXT)) {
+		p = data.mv_data;
+		klen = (size_t) p[2] << 8 | p[3];
+		if (data.mv_size < 4 + klen) {
+			rc = SURROGATE_BAD_META;
+			break;
+		}
+		k.mv_size = klen;
+		k.mv_data = (void *) (p + 4);
+		d.mv_size = data.mv_size - 4 - klen;
+		d.mv_data = (void *) (p + 4 + klen);
+
+		// a store without the database never wrote to it
+		dbi = log_dbi (to, p[1], &dupsort);
+		if (dbi != 0) {
+			if (p[0] == SURROGATE_LOG_PUT)
+				rc = mdb_put (txn, dbi, &k, &d, dupsort ? MDB_NODUPDATA : 0);
+			else if (p[0] == SURROGATE_LOG_DEL)
+				rc = mdb_del (txn, dbi, &k, &d);
+			else if (p[0] == SURROGATE_LOG_DEL_KEY)
+				rc = mdb_del (txn, dbi, &k, NULL);
+			else
+				rc = SURROGATE_BAD_META;
+			if (rc == MDB_KEYEXIST || rc == MDB_NOTFOUND)
+				rc = MDB_SUCCESS;
+			if (rc != MDB_SUCCESS)
+				break;
+		}
+		s = load_seq (key.mv_data) + 1;
+		n++;
+	}
+	mdb_cursor_close (cursor);
+
+	if (rc != MDB_NOTFOUND) {
+		mdb_txn_abort (txn);
+		return rc;
+	}
+	rc = mdb_txn_commit (txn);
+	if (rc == MDB_SUCCESS) {
+		*next = s;
+		*applied += n;
+	}
+	return rc;
+}
+
+static off_t
+file_size (const char *dir) {
+
+	char file[PATH_BYTES];
+	struct stat sb;
+
+	snprintf (file, sizeof file, "%s/data.mdb", dir);
+	return stat (file, &sb) == 0 ? sb.st_size : 0;
+}
+
+static void
+remove_store (const char *dir) {
+
+	char file[PATH_BYTES];
+
+	snprintf (file, sizeof file, "%s/data.mdb", dir);
+	unlink (file);
+	snprintf (file, sizeof file, "%s/lock.mdb", dir);
+	unlink (file);
+	rmdir (dir);
+}
+
+// make path a link to path.0 if it is still a plain directory, and
+// name the directory it links to and the next one
+static int
+generations (const char *path, char *cur, char *next) {
+
+	char target[PATH_BYTES], tmp[PATH_BYTES];
+	const char *base = strrchr (path, '/');
+	struct stat sb;
+	ssize_t len;
+	char *dot, *end;
+	size_t dir_len;
+	unsigned long gen;
+
+	base = base != NULL ? base + 1 : path;
+	dir_len = base - path;
+
+	if (lstat (path, &sb) != 0)
+		return errno;
+	if (S_ISDIR (sb.st_mode)) {
+		// tools that have it open keep their descriptors
+		snprintf (tmp, sizeof tmp, "%s.0", path);
+		if (rename (path, tmp) != 0)
+			return errno;
+		snprintf (target, sizeof target, "%s.0", base);
+		if (symlink (target, path) != 0)
+			return errno;
+	}
+
+	len = readlink (path, target, sizeof target - 1);
+	if (len < 0)
+		return errno;
+	target[len] = '\0';
+	dot = strrchr (target, '.');
+	if (dot == NULL || strchr (target, '/') != NULL)
+		return EINVAL;
+	gen = strtoul (dot + 1, &end, 10);
+	if (end == dot + 1 || *end != '\0')
+		return EINVAL;
+
+	if (snprintf (cur, PATH_BYTES, "%.*s%s", (int) dir_len, path, target) >=
+		PATH_BYTES - PATH_ROOM ||
+	    snprintf (next, PATH_BYTES, "%.*s%.*s.%lu", (int) dir_len, path,
+		(int) (dot - target), target, gen + 1) >= PATH_BYTES - PATH_ROOM)
+		return ENAMETOOLONG;
+	return 0;
+}
+
+// hold the lock of path's compactions until the process exits
+static int
+lock_path (const char *path) {
+
+	char file[PATH_BYTES];
+	int fd;
+
+	if (strlen (path) >= PATH_BYTES - PATH_ROOM)
+		return ENAMETOOLONG;
+	snprintf (file, sizeof file, "%s.lock", path);
+	fd = open (file, O_RDWR | O_CREAT, 0664);
+	if (fd < 0)
+		return errno;
+	if (flock (fd, LOCK_EX | LOCK_NB) != 0) {
+		close (fd);
+		return errno == EWOULDBLOCK ? EBUSY : errno;
+	}
+	return 0;
+}
+
+// point path at dir (a sibling) in one rename
+static int
+swap_link (const char *path, const char *dir) {
+
+	char tmp[PATH_BYTES];
+	const char *base = strrchr (dir, '/');
+
+	base = base != NULL ? base + 1 : dir;
+	snprintf (tmp, sizeof tmp, "%s.swap", path);
+	unlink (tmp);
+	if (symlink (base, tmp) != 0 || rename (tmp, path) != 0)
+		return errno;
+	return 0;
+}
+
+static int
+set_mark (surrogate_store *st, int on) {
+
+	int rc;
+	MDB_txn *txn;
+
+	rc = mdb_txn_begin (st->env, NULL, 0, &txn);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	// a fresh log for every compaction
+	rc = mdb_drop (txn, st->dbi_changes, 0);
+	if (rc == MDB_SUCCESS)
+		rc = surrogate_compacting (st, txn, on);
+	if (rc != MDB_SUCCESS) {
+		mdb_txn_abort (txn);
+		return rc;
+	}
+	return mdb_txn_commit (txn);
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int rc, opt, keep = 0;
+	const char *path = SURROGATE_DB_DIR;
+	char cur[PATH_BYTES], next[PATH_BYTES];
+	unsigned long long seq = 1;
+	size_t applied = 0, before;
+	off_t old_size, new_size;
+	surrogate_store st, copy;
+	MDB_txn *txn;
+
+	while ((opt = getopt (argc, argv, "k")) != -1) {
+		if (opt == 'k')
+			keep = 1;
+		else {
+			fprintf (stderr, "usage: %s [-k] [path]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (optind < argc)
+		path = argv[optind];
+
+	rc = lock_path (path);
+	if (rc != 0) {
+		fprintf (stderr, "Cannot lock %s: %s\n", path,
+			rc == EBUSY ? "another compaction is running" : strerror (rc));
+		return -1;
+	}
+	rc = generations (path, cur, next);
+	if (rc != 0) {
+		fprintf (stderr, "Cannot set up %s for swapping: %s\n", path, strerror (rc));
+		return -1;
+	}
+	rc = surrogate_open (&st, path, 0);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to open data store: %s\n", surrogate_strerror (rc));
+		return -1;
+	}
+
+	// 1. from here on, writers log
+	rc = set_mark (&st, 1);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to mark %s: %s\n", path, surrogate_strerror (rc));
+		return -1;
+	}
+
+	// 2. the copy; the mark and the log come along and are cleared
+	if (mkdir (next, 0775) != 0) {
+		fprintf (stderr, "Cannot create %s: %s\n", next, strerror (errno));
+		set_mark (&st, 0);
+		return -1;
+	}
+	rc = mdb_env_copy2 (st.env, next, MDB_CP_COMPACT);
+	if (rc == MDB_SUCCESS)
+		rc = surrogate_open (&copy, next, 0);
+	if (rc == MDB_SUCCESS) {
+		rc = set_mark (&copy, 0);
+		if (rc != MDB_SUCCESS)
+			surrogate_close (&copy);
+	}
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to copy %s: %s\n", path, surrogate_strerror (rc));
+		remove_store (next);
+		set_mark (&st, 0);
+		return -1;
+	}
+
+	// 3. catch up while writers keep going
+	do {
+		before = applied;
+		rc = mdb_txn_begin (st.env, NULL, MDB_RDONLY, &txn);
+		if (rc != MDB_SUCCESS)
+			break;
+		rc = replay (&st, txn, &copy, &seq, &applied);
+		mdb_txn_abort (txn);
+	} while (rc == MDB_SUCCESS && applied - before >= SHORT_PASS);
+
+	// 4. the last changes and the swap, with writers held off
+	if (rc == MDB_SUCCESS)
+		rc = mdb_txn_begin (st.env, NULL, 0, &txn);
+	if (rc == MDB_SUCCESS) {
+		rc = replay (&st, txn, &copy, &seq, &applied);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_env_sync (copy.env, 1);
+		if (rc == MDB_SUCCESS)
+			rc = swap_link (path, next);
+		if (rc == MDB_SUCCESS) {
+			// writers waiting on the lock will find the store stale
+			rc = surrogate_compacting (&st, txn, 0);
+			if (rc == MDB_SUCCESS)
+				rc = mdb_drop (txn, st.dbi_changes, 0);
+			if (rc == MDB_SUCCESS)
+				rc = mdb_txn_commit (txn);
+			else
+				mdb_txn_abort (txn);
+		}
+		else
+			mdb_txn_abort (txn);
+	}
+	surrogate_close (&copy);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Compaction failed: %s\n", surrogate_strerror (rc));
+		if (!surrogate_stale (&st)) {
+			remove_store (next);
+			set_mark (&st, 0);
+		}
+		surrogate_close (&st);
+		return -1;
+	}
+	surrogate_close (&st);
+
+	old_size = file_size (cur);
+	new_size = file_size (next);
+	fprintf (stdout, "%s: %s (%lld bytes) -> %s (%lld bytes), %zu change(s) replayed\n",
+		path, cur, (long long) old_size, next, (long long) new_size, applied);
+	if (!keep)
+		remove_store (cur);
+	return 0;
+}
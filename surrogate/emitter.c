@@ -0,0 +1,591 @@
+/*
+ * File Name:	emitter.c
+ * Function:	Pipelined PURGE requests to the cache nodes. See
+ *		emitter.h.
+ *
+ *		One non-blocking connection per endpoint, driven by a
+ *		single poll loop, so all endpoints are served at once.
+ *		Each connection keeps a ring of the URLs it has in
+ *		flight; answers come back in request order (HTTP/1.1
+ *		pipelining), so each one settles the oldest. When a
+ *		connection fails, what it had in flight goes back to the
+ *		endpoint's retry list.
+ *
+ *		An answer ends after its Content-Length, its last chunk
+ *		(Transfer-Encoding: chunked) or, for 1xx, 204 and 304,
+ *		its headers. An answer with none of these runs until
+ *		the connection closes: its status counts, and the
+ *		requests behind it are sent again on a new connection,
+ *		as after Connection: close.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "emitter.h"
+#include "idstrings.h"
+
+#define IN_BYTES	16384
+#define BACKOFF		100	// ms before the first reconnect, doubling
+#define MAX_BACKOFF	2000
+
+typedef struct endpoint {
+	char host[256], port[16];
+	struct addrinfo *addr;
+	int fd, connecting;
+	size_t next;			// next URL never sent here
+	size_t *retry, nretry, retry_cap;	// URLs to send again
+	unsigned char *attempts;	// per URL
+	size_t *inflight, head, count;	// ring of depth URLs awaiting answers
+	char *out;
+	size_t out_len, out_off, out_cap;
+	char in[IN_BYTES];
+	size_t in_len;
+	double last, wait_until;	// last progress; no reconnect before
+	unsigned int failures;		// connection failures since an answer
+} endpoint;
+
+struct emitter {
+	endpoint ep[EMITTER_MAX_ENDPOINTS];
+	size_t nep;
+	unsigned int depth, retries, timeout;
+	char *text;			// URLs, NUL terminated, back to back
+	size_t *off, bytes, text_cap, nurls, url_cap;
+	unsigned char *ids;		// hashes collected by emitter_watch
+	size_t nids, ids_cap;
+	emitter_stat stat;
+};
+
+static double
+now_ms (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static int
+grow (void **p, size_t *cap, size_t need, size_t size) {
+
+	void *q;
+	size_t c = *cap;
+
+	if (need <= c)
+		return 0;
+	while (c < need)
+		c = c ? 2 * c : 1024;
+	q = realloc (*p, c * size);
+	if (q == NULL)
+		return ENOMEM;
+	*p = q;
+	*cap = c;
+	return 0;
+}
+
+int
+emitter_create (const emitter_config *cfg, emitter **em) {
+
+	emitter *p;
+	endpoint *e;
+	struct addrinfo hints;
+	const char *colon;
+	size_t i, hlen;
+
+	if (cfg->nendpoints == 0 || cfg->nendpoints > EMITTER_MAX_ENDPOINTS)
+		return EINVAL;
+	p = calloc (1, sizeof *p);
+	if (p == NULL)
+		return ENOMEM;
+	p->depth = cfg->depth ? cfg->depth : EMITTER_DEPTH;
+	p->retries = cfg->retries;
+	p->timeout = cfg->timeout ? cfg->timeout : EMITTER_TIMEOUT;
+
+	memset (&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	for (i = 0; i < cfg->nendpoints; i++, p->nep++) {
+		e = &p->ep[i];
+		e->fd = -1;
+		colon = strrchr (cfg->endpoints[i], ':');
+		hlen = colon != NULL ? (size_t) (colon - cfg->endpoints[i]) : 0;
+		if (hlen == 0 || hlen >= sizeof e->host || strlen (colon + 1) >= sizeof e->port) {
+			emitter_destroy (p);
+			return EINVAL;
+		}
+		memcpy (e->host, cfg->endpoints[i], hlen);
+		e->host[hlen] = '\0';
+		strcpy (e->port, colon + 1);
+		if (getaddrinfo (e->host, e->port, &hints, &e->addr) != 0) {
+			emitter_destroy (p);
+			return EINVAL;
+		}
+		e->inflight = malloc (p->depth * sizeof *e->inflight);
+		if (e->inflight == NULL) {
+			p->nep++;
+			emitter_destroy (p);
+			return ENOMEM;
+		}
+	}
+	*em = p;
+	return 0;
+}
+
+void
+emitter_destroy (emitter *em) {
+
+	size_t i;
+
+	for (i = 0; i < em->nep; i++) {
+		if (em->ep[i].fd >= 0)
+			close (em->ep[i].fd);
+		freeaddrinfo (em->ep[i].addr);
+		free (em->ep[i].retry);
+		free (em->ep[i].attempts);
+		free (em->ep[i].inflight);
+		free (em->ep[i].out);
+	}
+	free (em->text);
+	free (em->off);
+	free (em->ids);
+	free (em);
+}
+
+int
+emitter_add (emitter *em, const char *url, size_t len) {
+
+	if (grow ((void **) &em->text, &em->text_cap, em->bytes + len + 1, 1) != 0 ||
+	    grow ((void **) &em->off, &em->url_cap, em->nurls + 1, sizeof *em->off) != 0)
+		return ENOMEM;
+	memcpy (em->text + em->bytes, url, len);
+	em->text[em->bytes + len] = '\0';
+	em->off[em->nurls++] = em->bytes;
+	em->bytes += len + 1;
+	return 0;
+}
+
+void
+emitter_watch (const void *url, void *ctx) {
+
+	emitter *em = ctx;
+	size_t w = surrogate_hash_bytes ();
+
+	// a failed append loses the URL, not the purge
+	if (grow ((void **) &em->ids, &em->ids_cap, (em->nids + 1) * w, 1) == 0)
+		memcpy (em->ids + em->nids++ * w, url, w);
+}
+
+int
+emitter_resolve (emitter *em, const surrogate_store *st, MDB_txn *txn) {
+
+	int rc = 0;
+	size_t i, w = st->hash_bytes;
+	char hex[2 * SURROGATE_MAX_HASH_BYTES + 1];
+	MDB_val token;
+
+	for (i = 0; rc == 0 && i < em->nids; i++) {
+		if (idstrings_get (st, txn, em->ids + i * w, &token) == MDB_SUCCESS)
+			rc = emitter_add (em, token.mv_data, token.mv_size);
+		else {
+			surrogate_hex (hex, em->ids + i * w);
+			rc = emitter_add (em, hex, strlen (hex));
+		}
+	}
+	em->nids = 0;
+	return rc;
+}
+
+void
+emitter_discard (emitter *em) {
+
+	em->nids = 0;
+}
+
+static int
+has_work (const emitter *em, const endpoint *e) {
+
+	return e->nretry > 0 || e->next < em->nurls;
+}
+
+// the answer for u was lost; send it again unless it is out of tries
+static void
+requeue (emitter *em, endpoint *e, size_t u, int penalize) {
+
+	if (penalize && ++e->attempts[u] > em->retries) {
+		em->stat.failed++;
+		return;
+	}
+	if (grow ((void **) &e->retry, &e->retry_cap, e->nretry + 1, sizeof *e->retry) != 0) {
+		em->stat.failed++;
+		return;
+	}
+	e->retry[e->nretry++] = u;
+	if (penalize)
+		em->stat.retried++;
+}
+
+// drop the connection and take back what it had in flight; penalize
+// counts it as a failed attempt for each of those URLs
+static void
+drop (emitter *em, endpoint *e, int penalize, double now) {
+
+	unsigned int shift;
+
+	close (e->fd);
+	e->fd = -1;
+	e->connecting = 0;
+	e->out_len = e->out_off = 0;
+	e->in_len = 0;
+	for (; e->count > 0; e->count--, e->head = (e->head + 1) % em->depth)
+		requeue (em, e, e->inflight[e->head], penalize);
+	e->head = 0;
+	if (penalize) {
+		shift = e->failures < 5 ? e->failures : 5;
+		e->failures++;
+		e->wait_until = now + (BACKOFF << shift < MAX_BACKOFF ? BACKOFF << shift : MAX_BACKOFF);
+	}
+}
+
+// start connecting; e->fd stays -1 on failure, with a reconnect delay
+static void
+connect_endpoint (emitter *em, endpoint *e, double now) {
+
+	int one = 1;
+	struct addrinfo *a = e->addr;
+
+	e->fd = socket (a->ai_family, a->ai_socktype, a->ai_protocol);
+	if (e->fd < 0) {
+		e->failures++;
+		e->wait_until = now + BACKOFF;
+		return;
+	}
+	fcntl (e->fd, F_SETFL, fcntl (e->fd, F_GETFL) | O_NONBLOCK);
+	setsockopt (e->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+	e->last = now;
+	if (connect (e->fd, a->ai_addr, a->ai_addrlen) == 0)
+		em->stat.connects++;
+	else if (errno == EINPROGRESS)
+		e->connecting = 1;
+	else
+		drop (em, e, 1, now);
+}
+
+// queue the request line for URL u
+static int
+append_request (emitter *em, endpoint *e, size_t u) {
+
+	const char *url = em->text + em->off[u], *host = e->host, *path = url, *p;
+	int hlen = strlen (e->host), n;
+	size_t need = strlen (url) + sizeof e->host + 64;
+
+	if ((p = strstr (url, "://")) != NULL) {
+		host = p + 3;
+		path = strchr (host, '/');
+		hlen = path != NULL ? path - host : (int) strlen (host);
+		if (path == NULL)
+			path = "/";
+	}
+	if (grow ((void **) &e->out, &e->out_cap, e->out_len + need, 1) != 0)
+		return ENOMEM;
+	n = snprintf (e->out + e->out_len, need, "PURGE %s%s HTTP/1.1\r\nHost: %.*s\r\n\r\n",
+		path[0] == '/' ? "" : "/", path, hlen, host);
+	e->out_len += n;
+	return 0;
+}
+
+// the value of header name in the header block, or NULL
+static const char *
+header (const char *h, size_t len, const char *name) {
+
+	const char *line = h, *end = h + len, *nl;
+	size_t n = strlen (name);
+
+	while (line < end && (nl = memchr (line, '\n', end - line)) != NULL) {
+		line = nl + 1;
+		if ((size_t) (end - line) > n && strncasecmp (line, name, n) == 0 && line[n] == ':')
+			return line + n + 1;
+	}
+	return NULL;
+}
+
+// whether the value of a header, up to the end of its line, ends with
+// the token word
+static int
+ends_with_token (const char *v, const char *end, const char *word) {
+
+	const char *nl = memchr (v, '\n', end - v);
+	size_t n = strlen (word);
+
+	if (nl == NULL)
+		nl = end;
+	while (nl > v && isspace ((unsigned char) nl[-1]))
+		nl--;
+	return (size_t) (nl - v) >= n && strncasecmp (nl - n, word, n) == 0 &&
+		(nl - n == v || nl[-n - 1] == ' ' || nl[-n - 1] == ',' || nl[-n - 1] == ':');
+}
+
+// the length of the chunked body at b, of which len bytes have
+// arrived, trailers included: 1 with *body set once it is whole, 0
+// while it is not, -1 if it is malformed or would not fit the buffer
+static int
+chunked_length (const char *b, size_t len, size_t *body) {
+
+	const char *nl;
+	unsigned long size;
+	size_t at = 0;
+
+	for (;;) {
+		if ((nl = memchr (b + at, '\n', len - at)) == NULL)
+			return 0;
+		if (!isxdigit ((unsigned char) b[at]))
+			return -1;
+		size = strtoul (b + at, NULL, 16);
+		at = nl - b + 1;
+		if (size == 0)
+			break;
+		if (size > IN_BYTES)
+			return -1;
+		if (len - at < size + 2)
+			return 0;
+		at += size;
+		if (b[at] != '\r' || b[at + 1] != '\n')
+			return -1;
+		at += 2;
+	}
+	// trailers, up to a blank line
+	for (;;) {
+		if ((nl = memchr (b + at, '\n', len - at)) == NULL)
+			return 0;
+		if (nl == b + at || (nl == b + at + 1 && b[at] == '\r')) {
+			*body = nl - b + 1;
+			return 1;
+		}
+		at = nl - b + 1;
+	}
+}
+
+// settle the answers that have fully arrived
+static void
+read_answers (emitter *em, endpoint *e, double now) {
+
+	ssize_t got;
+	size_t hdr, total, body;
+	const char *v, *end;
+	int status, close_after, framed;
+	size_t u;
+
+	got = recv (e->fd, e->in + e->in_len, sizeof e->in - e->in_len, 0);
+	if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+		drop (em, e, 1, now);
+		return;
+	}
+	if (got < 0)
+		return;
+	e->in_len += got;
+
+	for (;;) {
+		end = NULL;
+		for (hdr = 0; hdr + 4 <= e->in_len; hdr++)
+			if (memcmp (e->in + hdr, "\r\n\r\n", 4) == 0) {
+				end = e->in + hdr;
+				break;
+			}
+		if (end == NULL) {
+			if (e->in_len == sizeof e->in)
+				drop (em, e, 1, now);
+			return;
+		}
+		if (e->count == 0 || hdr < 12 || memcmp (e->in, "HTTP/1.", 7) != 0) {
+			drop (em, e, 1, now);
+			return;
+		}
+		status = atoi (e->in + 9);
+
+		// where the answer ends; without a length, at the close
+		body = 0;
+		framed = 1;
+		if (status / 100 == 1 || status == 204 || status == 304)
+			;
+		else if ((v = header (e->in, hdr + 2, "Transfer-Encoding")) != NULL &&
+			 ends_with_token (v, e->in + hdr + 2, "chunked")) {
+			framed = chunked_length (e->in + hdr + 4, e->in_len - hdr - 4, &body);
+			if (framed < 0) {
+				drop (em, e, 1, now);
+				return;
+			}
+			if (framed == 0) {
+				if (e->in_len == sizeof e->in)
+					drop (em, e, 1, now);
+				return;
+			}
+		}
+		else if ((v = header (e->in, hdr + 2, "Content-Length")) != NULL)
+			body = strtoul (v, NULL, 10);
+		else
+			framed = 0;
+		total = hdr + 4 + body;
+		if (total > sizeof e->in) {
+			drop (em, e, 1, now);
+			return;
+		}
+		if (framed && e->in_len < total)
+			return;
+
+		// an interim answer; the final one follows
+		if (status / 100 == 1) {
+			e->in_len -= total;
+			memmove (e->in, e->in + total, e->in_len);
+			continue;
+		}
+
+		v = header (e->in, hdr + 2, "Connection");
+		close_after = !framed ||
+			(v != NULL && strncasecmp (v + strspn (v, " "), "close", 5) == 0);
+		u = e->inflight[e->head];
+		e->head = (e->head + 1) % em->depth;
+		e->count--;
+		if ((status >= 200 && status < 300) || status == 404)
+			em->stat.ok++;
+		else if (status >= 500 || status == 429)
+			requeue (em, e, u, 1);
+		else
+			em->stat.failed++;
+		e->failures = 0;
+		e->last = now;
+
+		if (!framed)
+			total = e->in_len;
+		e->in_len -= total;
+		memmove (e->in, e->in + total, e->in_len);
+		if (close_after) {
+			// not a failure: the rest is sent on a new connection
+			drop (em, e, 0, now);
+			return;
+		}
+	}
+}
+
+int
+emitter_run (emitter *em, emitter_stat *stat) {
+
+	size_t i, j, u, npfd, polled[EMITTER_MAX_ENDPOINTS];
+	double now, start = now_ms (), t;
+	int timeout, err;
+	socklen_t len;
+	ssize_t sent;
+	endpoint *e;
+	struct pollfd pfd[EMITTER_MAX_ENDPOINTS];
+
+	memset (&em->stat, 0, sizeof em->stat);
+	em->stat.requests = em->nurls * em->nep;
+	for (i = 0; i < em->nep; i++) {
+		e = &em->ep[i];
+		free (e->attempts);
+		e->attempts = calloc (em->nurls + 1, 1);
+		if (e->attempts == NULL)
+			return ENOMEM;
+		e->next = e->nretry = 0;
+		e->failures = 0;
+		e->wait_until = 0;
+	}
+
+	for (;;) {
+		now = now_ms ();
+		timeout = -1;
+		npfd = 0;
+		for (i = 0; i < em->nep; i++) {
+			e = &em->ep[i];
+			if (e->fd < 0) {
+				if (!has_work (em, e))
+					continue;
+				if (e->failures > em->retries) {
+					// unreachable: everything left fails
+					em->stat.failed += e->nretry + em->nurls - e->next;
+					e->nretry = 0;
+					e->next = em->nurls;
+					continue;
+				}
+				if (now < e->wait_until) {
+					t = e->wait_until - now + 1;
+					timeout = timeout < 0 || t < timeout ? (int) t : timeout;
+					continue;
+				}
+				connect_endpoint (em, e, now);
+				if (e->fd < 0)
+					continue;
+			}
+
+			// fill the pipeline
+			while (!e->connecting && e->count < em->depth && has_work (em, e)) {
+				u = e->nretry > 0 ? e->retry[--e->nretry] : e->next++;
+				if (append_request (em, e, u) != 0) {
+					em->stat.failed++;
+					continue;
+				}
+				if (e->count == 0)
+					e->last = now;
+				e->inflight[(e->head + e->count++) % em->depth] = u;
+			}
+			if (e->count == 0 && !e->connecting)
+				continue;
+
+			pfd[npfd].fd = e->fd;
+			pfd[npfd].events = POLLIN;
+			if (e->connecting || e->out_off < e->out_len)
+				pfd[npfd].events |= POLLOUT;
+			polled[npfd++] = i;
+			t = e->last + em->timeout - now + 1;
+			t = t < 0 ? 0 : t;
+			timeout = timeout < 0 || t < timeout ? (int) t : timeout;
+		}
+		if (npfd == 0 && timeout < 0)
+			break;
+
+		poll (pfd, npfd, timeout);
+		now = now_ms ();
+		for (j = 0; j < npfd; j++) {
+			e = &em->ep[polled[j]];
+			if (e->connecting && pfd[j].revents != 0) {
+				err = 0;
+				len = sizeof err;
+				getsockopt (e->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+				if (err != 0) {
+					drop (em, e, 1, now);
+					continue;
+				}
+				e->connecting = 0;
+				e->last = now;
+				em->stat.connects++;
+			}
+			else {
+				if (pfd[j].revents & (POLLIN | POLLHUP | POLLERR))
+					read_answers (em, e, now);
+				if (e->fd >= 0 && e->out_off < e->out_len && (pfd[j].revents & POLLOUT)) {
+					sent = send (e->fd, e->out + e->out_off, e->out_len - e->out_off, MSG_NOSIGNAL);
+					if (sent < 0 && errno != EAGAIN && errno != EINTR)
+						drop (em, e, 1, now);
+					else if (sent > 0 && (e->out_off += sent) == e->out_len)
+						e->out_off = e->out_len = 0;
+				}
+			}
+			if (e->fd >= 0 && (e->count > 0 || e->connecting) && now - e->last > em->timeout)
+				drop (em, e, 1, now);
+		}
+	}
+
+	em->stat.ms = now_ms () - start;
+	em->nurls = em->bytes = 0;
+	if (stat != NULL)
+		*stat = em->stat;
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * File Name:	emitter.h
+ * Function:	Tells the caches which URLs a purge invalidated. Every
+ *		URL is sent as an HTTP PURGE request to every configured
+ *		endpoint ("host:port", the cache nodes) over persistent
+ *		connections, pipelining up to depth requests on each
+ *		one, so that the fan-out costs round trips per batch
+ *		rather than per URL. Requests answered 5xx or 429, or
+ *		lost with their connection, are resent up to retries
+ *		times, reconnecting with a growing delay.
+ *
+ *		A URL given as "scheme://host/path" is purged as /path
+ *		with that host in the Host header; anything else is
+ *		taken as a path on the endpoint. purge_stub.c is a
+ *		local server that answers these requests, for testing;
+ *		emitter_check.sh runs purged -e against it.
+ */
+
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include <stddef.h>
+#include "lmdb.h"
+#include "surrogate.h"
+
+#define EMITTER_MAX_ENDPOINTS	16
+#define EMITTER_DEPTH		32	// requests in flight per connection
+#define EMITTER_RETRIES		3
+#define EMITTER_TIMEOUT		2000	// ms without an answer before reconnecting
+
+typedef struct emitter emitter;
+
+typedef struct emitter_config {
+	const char *endpoints[EMITTER_MAX_ENDPOINTS];
+	size_t nendpoints;
+	unsigned int depth;		// 0 for EMITTER_DEPTH
+	unsigned int retries;		// resends per request
+	unsigned int timeout;		// 0 for EMITTER_TIMEOUT
+} emitter_config;
+
+typedef struct emitter_stat {
+	size_t requests;	// URLs times endpoints
+	size_t ok;		// answered 2xx, or 404 (not cached)
+	size_t failed;		// out of retries, or answered otherwise
+	size_t retried;		// resends
+	size_t connects;
+	double ms;
+} emitter_stat;
+
+/* resolve the endpoints; fails with EINVAL on a malformed or unknown
+ * one, or with none */
+int emitter_create (const emitter_config *cfg, emitter **em);
+void emitter_destroy (emitter *em);
+
+/* queue a URL; the string is copied */
+int emitter_add (emitter *em, const char *url, size_t len);
+
+/* a purger_watch function: collects the hashes of removed URLs while
+ * a purge transaction runs */
+void emitter_watch (const void *url, void *em);
+
+/* after the purge commits, queue the collected URLs by their original
+ * strings, looked up in txn, or as hex when the store keeps none;
+ * emitter_discard drops them when it aborts instead */
+int emitter_resolve (emitter *em, const surrogate_store *st, MDB_txn *txn);
+void emitter_discard (emitter *em);
+
+/* send the queued URLs and wait for all answers; the queue is emptied.
+ * *stat (if not NULL) describes the run. Returns 0, or ENOMEM. */
+int emitter_run (emitter *em, emitter_stat *stat);
+
+#endif
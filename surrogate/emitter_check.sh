@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# File Name:	emitter_check.sh
+# Function:	Runs purged -e against purge_stub, so the pipelined
+#		PURGE path of emitter.h is exercised end to end. A
+#		store of URLS URLs under one key is built with
+#		map_data -S and the key purged once per way purge_stub
+#		frames its answers (empty, length, chunked and close),
+#		with a fifth of them 503 to be resent; every request
+#		has to end up answered ok. map_data, purged and
+#		purge_stub are run from the directory given (default
+#		.), the store is built in a scratch directory, and the
+#		stub listens on the port given (default 18080).
+#
+#		emitter_check.sh [tools] [port]
+
+URLS=200
+
+tools=$(cd "${1:-.}" && pwd) || exit 1
+port=${2:-18080}
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+cd "$work" || exit 1
+
+i=0
+while [ $i -lt $URLS ]; do
+	echo "http://example.com/p$i hot k$i"
+	i=$((i + 1))
+done > feed
+
+status=0
+for framing in empty length chunked close; do
+	rm -rf db_dir && mkdir db_dir
+	if ! "$tools/map_data" -S < feed > /dev/null 2>&1; then
+		echo "map_data failed" >&2
+		exit 1
+	fi
+	"$tools/purge_stub" -p "$port" -b "$framing" -f 20 > stub.out 2>&1 &
+	stub=$!
+	sleep 1
+
+	# the second line: requests, ok, failed, resent, ms
+	echo hot | "$tools/purged" -e "127.0.0.1:$port" -r 10 -w 10 > purged.out 2> purged.err
+	kill $stub
+	wait $stub
+	set -- $(sed -n 2p purged.out) x x x x
+	if [ "$1" = "$URLS" ] && [ "$2" = "$URLS" ]; then
+		echo "$framing: $1 requests, $2 ok, $4 resent; stub: $(cat stub.out)"
+	else
+		echo "$framing: FAILED" >&2
+		cat purged.out purged.err stub.out >&2
+		status=1
+	fi
+done
+exit $status
@@ -1,23 +1,192 @@
+/*
+ * File Name:	examine.c
+ * Function:	Lists each key of the store with the number of URLs
+ *		it carries.
+ *
+ *		With -r it reports the physical layout instead, as one
+ *		JSON object per line, to stdout or appended to -o, so
+ *		that runs from cron can be trended to tell when the
+ *		store wants compacting or another layout. The first
+ *		line ("report":"env") has mdb_env_info and the data
+ *		file: page size, map size, pages used, free pages on
+ *		the freelist, file bytes, last transaction and readers.
+ *		Then one line per database present ("report":"db"):
+ *		mdb_stat's depth, page counts and entries, and from a
+ *		walk of its pages with -j threads (default one per CPU,
+ *		see pagewalk.h) the fill of branch and leaf pages,
+ *		overflow bytes, and for MDB_DUPSORT databases how many
+ *		keys keep their values inline and how many in sub-trees,
+ *		the sub-trees by depth ("subdb_depths", from depth 0)
+ *		with their pages and fill, and the most values of a key.
+ *		Everything is read in one read transaction, so writers
+ *		may keep running.
+ *
+ *		examine [-r [-j threads] [-o report]]
+ *
+ *		cc examine.c pagewalk.c surrogate.c \
+ *		   blake2/sse/blake2b.c -llmdb -pthread
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/errno.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "lmdb.h"
 #include "blake2/sse/blake2.h"
 #include "blake2/sse/blake2-impl.h"
+#include "surrogate.h"
+#include "pagewalk.h"
 
 const int NUM_BYTES = 17;
 const size_t MAX_KEY_COUNT= 1000;
 const unsigned int FLAGS = MDB_DUPSORT |  MDB_DUPFIXED | MDB_CREATE;
 
+// the databases -r reports on, when the store has them
+static const char *report_dbs[] = { SURROGATE_DATA_STORE, SURROGATE_REV_STORE, SURROGATE_STRINGS,
+	SURROGATE_LASTSEEN, SURROGATE_EXPIRY, SURROGATE_GENS, SURROGATE_GRAVEYARD, SURROGATE_META,
+	SURROGATE_CHANGES, NULL };
+
+static double
+now (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// pages on the freelist, as mdb_stat -f counts them
+static int
+free_pages (MDB_txn *txn, unsigned long long *pages) {
+
+	int rc;
+	MDB_cursor *cursor;
+	MDB_val key, data;
+	size_t n;
+
+	*pages = 0;
+	rc = mdb_cursor_open (txn, 0, &cursor);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	while ((rc = mdb_cursor_get (cursor, &key, &data, MDB_NEXT)) == MDB_SUCCESS)
+		if (data.mv_size >= sizeof n) {
+			memcpy (&n, data.mv_data, sizeof n);
+			*pages += n;
+		}
+	mdb_cursor_close (cursor);
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
+static int
+report_env (FILE *out, surrogate_store *st, MDB_txn *txn, time_t when) {
+
+	int rc, fd;
+	MDB_envinfo info;
+	MDB_stat ms;
+	struct stat sb;
+	unsigned long long freed;
+
+	rc = mdb_env_info (st->env, &info);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_env_stat (st->env, &ms);
+	if (rc == MDB_SUCCESS)
+		rc = free_pages (txn, &freed);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_env_get_fd (st->env, &fd);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	if (fstat (fd, &sb) != 0)
+		return errno;
+	fprintf (out, "{\"report\":\"env\",\"time\":%lld,\"page_size\":%u,\"map_size\":%zu,"
+		"\"pages\":%zu,\"free_pages\":%llu,\"file_bytes\":%lld,\"last_txnid\":%zu,"
+		"\"readers\":%u,\"max_readers\":%u}\n",
+		(long long) when, ms.ms_psize, info.me_mapsize, info.me_last_pgno + 1, freed,
+		(long long) sb.st_size, info.me_last_txnid, info.me_numreaders, info.me_maxreaders);
+	return MDB_SUCCESS;
+}
+
+static int
+report_db (FILE *out, MDB_txn *txn, const char *name, unsigned int threads, time_t when) {
+
+	int rc, i, last;
+	MDB_dbi dbi;
+	MDB_stat ms;
+	pagewalk_stat ws;
+	double t;
+
+	rc = mdb_dbi_open (txn, name, 0, &dbi);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_stat (txn, dbi, &ms);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	t = now ();
+	rc = pagewalk (txn, name, threads, &ws);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	t = now () - t;
+
+	fprintf (out, "{\"report\":\"db\",\"time\":%lld,\"name\":\"%s\",\"depth\":%u,"
+		"\"branch_pages\":%zu,\"leaf_pages\":%zu,\"overflow_pages\":%zu,\"entries\":%zu,"
+		"\"keys\":%llu,\"branch_fill\":%.4f,\"leaf_fill\":%.4f,\"overflow_bytes\":%llu,"
+		"\"inline_keys\":%llu,\"inline_values\":%llu,\"inline_bytes\":%llu,\"subdbs\":%llu,"
+		"\"subdb_depths\":[",
+		(long long) when, name, ms.ms_depth, ms.ms_branch_pages, ms.ms_leaf_pages,
+		ms.ms_overflow_pages, ms.ms_entries, ws.keys,
+		pagewalk_fill (&ws, ws.branch_pages, ws.branch_used),
+		pagewalk_fill (&ws, ws.leaf_pages, ws.leaf_used), ws.overflow_bytes,
+		ws.inline_keys, ws.inline_values, ws.inline_bytes, ws.subdbs);
+	// up to the deepest sub-tree
+	for (last = PAGEWALK_MAX_DEPTH; last > 0 && ws.subdb_depth[last] == 0; last--)
+		;
+	for (i = 0; i <= last; i++)
+		fprintf (out, "%s%llu", i ? "," : "", ws.subdb_depth[i]);
+	fprintf (out, "],\"sub_branch_pages\":%llu,\"sub_leaf_pages\":%llu,\"sub_branch_fill\":%.4f,"
+		"\"sub_leaf_fill\":%.4f,\"max_values\":%llu,\"bad_pages\":%llu,\"walk_ms\":%.3f}\n",
+		ws.sub_branch_pages, ws.sub_leaf_pages,
+		pagewalk_fill (&ws, ws.sub_branch_pages, ws.sub_branch_used),
+		pagewalk_fill (&ws, ws.sub_leaf_pages, ws.sub_leaf_used),
+		ws.max_values, ws.bad_pages, t * 1e3);
+	return MDB_SUCCESS;
+}
+
+// the -r report, from one read transaction
+static int
+report (FILE *out, unsigned int threads) {
+
+	int rc, i;
+	surrogate_store st;
+	MDB_txn *txn;
+	time_t when = time (NULL);
+
+	rc = surrogate_open (&st, SURROGATE_DB_DIR, MDB_RDONLY);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = mdb_txn_begin (st.env, NULL, MDB_RDONLY, &txn);
+	if (rc == MDB_SUCCESS) {
+		rc = report_env (out, &st, txn, when);
+		for (i = 0; rc == MDB_SUCCESS && report_dbs[i] != NULL; i++) {
+			rc = report_db (out, txn, report_dbs[i], threads, when);
+			if (rc == MDB_NOTFOUND)
+				rc = MDB_SUCCESS;
+		}
+		mdb_txn_abort (txn);
+	}
+	surrogate_close (&st);
+	fflush (out);
+	return rc;
+}
+
 
 int
 main(int argc, char * argv[]) {
 
 	// set up variables
-	int rc, j;
+	int rc, j, opt, reporting = 0;
+	long threads = sysconf (_SC_NPROCESSORS_ONLN);
+	FILE *out = stdout;
 	size_t count;
 	char * max_keys;
 	MDB_env *env;
@@ -35,6 +204,29 @@ main(int argc, char * argv[]) {
         mval.mv_size = NUM_BYTES;
         mval.mv_data = &val;
 
+	while ((opt = getopt (argc, argv, "rj:o:")) != -1) {
+		if (opt == 'r')
+			reporting = 1;
+		else if (opt == 'j' && (threads = atol (optarg)) > 0)
+			continue;
+		else if (opt == 'o' && (out = fopen (optarg, "a")) != NULL)
+			continue;
+		else {
+			fprintf (stderr, "usage: %s [-r [-j threads] [-o report]]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (reporting) {
+		rc = report (out, threads > 0 ? threads : 1);
+		if (rc != MDB_SUCCESS) {
+			fprintf (stderr, "Failure to report on data store: %s\n", surrogate_strerror (rc));
+			return -1;
+		}
+		if (out != stdout)
+			fclose (out);
+		return 0;
+	}
+
 	// initialize environment; set 2 database limit
         rc = mdb_env_create (&env);
         assert (rc == 0);
@@ -0,0 +1,221 @@
+/*
+ * File Name:	expiry.c
+ * Function:	Maintains and sweeps the expiry index. See expiry.h.
+ *
+ *		A sweep batch takes the oldest entries of expiry, which
+ *		come in time order, and deletes their pairs from
+ *		data_store sorted by key and from rev_data_store sorted
+ *		by URL, so each tree is walked left to right once per
+ *		batch instead of being hit at random.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "expiry.h"
+
+#define ENTRY_BYTES (8 + 2 * SURROGATE_MAX_HASH_BYTES)
+
+// an expiry key: time, key, URL
+typedef struct expired {
+	unsigned char e[ENTRY_BYTES];
+} expired;
+
+// qsort has no context argument; sweeps are not concurrent
+static size_t sort_width;
+
+static void
+store_time (unsigned char *p, unsigned long long t) {
+
+	int i;
+
+	for (i = 7; i >= 0; i--, t >>= 8)
+		p[i] = (unsigned char) t;
+}
+
+static unsigned long long
+load_time (const unsigned char *p) {
+
+	unsigned long long t = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		t = t << 8 | p[i];
+	return t;
+}
+
+static int
+by_key (const void *a, const void *b) {
+
+	return memcmp (((const expired *) a)->e + 8, ((const expired *) b)->e + 8, 2 * sort_width);
+}
+
+static int
+by_url (const void *a, const void *b) {
+
+	const unsigned char *x = ((const expired *) a)->e + 8, *y = ((const expired *) b)->e + 8;
+	int c = memcmp (x + sort_width, y + sort_width, sort_width);
+
+	return c != 0 ? c : memcmp (x, y, sort_width);
+}
+
+int
+expiry_touch (surrogate_store *st, MDB_txn *txn, const void *key, const void *url,
+		unsigned long long now) {
+
+	int rc;
+	size_t w = st->hash_bytes;
+	unsigned char entry[ENTRY_BYTES], t[8];
+	MDB_val pair, seen, e, none;
+
+	if (st->dbi_lastseen == 0 || st->dbi_expiry == 0)
+		return MDB_SUCCESS;
+
+	memcpy (entry + 8, key, w);
+	memcpy (entry + 8 + w, url, w);
+	pair.mv_size = 2 * w;
+	pair.mv_data = entry + 8;
+	e.mv_size = 8 + 2 * w;
+	e.mv_data = entry;
+	none.mv_size = 0;
+	none.mv_data = t;
+
+	rc = mdb_get (txn, st->dbi_lastseen, &pair, &seen);
+	if (rc == MDB_NOTFOUND)
+		rc = MDB_SUCCESS;
+	else if (rc == MDB_SUCCESS && seen.mv_size == sizeof t) {
+		if (now < load_time (seen.mv_data) + EXPIRY_RESOLUTION)
+			return MDB_SUCCESS;
+		// the pair moves to its new place in time order
+		memcpy (entry, seen.mv_data, sizeof t);
+		rc = mdb_del (txn, st->dbi_expiry, &e, NULL);
+		if (rc == MDB_SUCCESS)
+			rc = surrogate_log (st, txn, SURROGATE_LOG_DEL_KEY, SURROGATE_LOG_EXPIRY, &e, NULL);
+		else if (rc == MDB_NOTFOUND)
+			rc = MDB_SUCCESS;
+	}
+	if (rc != MDB_SUCCESS)
+		return rc;
+
+	store_time (t, now);
+	store_time (entry, now);
+	seen.mv_size = sizeof t;
+	seen.mv_data = t;
+	rc = mdb_put (txn, st->dbi_lastseen, &pair, &seen, 0);
+	if (rc == MDB_SUCCESS)
+		rc = surrogate_log (st, txn, SURROGATE_LOG_PUT, SURROGATE_LOG_LASTSEEN, &pair, &seen);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_put (txn, st->dbi_expiry, &e, &none, 0);
+	if (rc == MDB_SUCCESS)
+		rc = surrogate_log (st, txn, SURROGATE_LOG_PUT, SURROGATE_LOG_EXPIRY, &e, &none);
+	return rc;
+}
+
+// delete key/data from dbi if present, logging it
+static int
+del_pair (surrogate_store *st, MDB_txn *txn, MDB_dbi dbi, int db, MDB_val *key, MDB_val *data) {
+
+	int rc = mdb_del (txn, dbi, key, data);
+
+	if (rc == MDB_SUCCESS)
+		return surrogate_log (st, txn, data != NULL ? SURROGATE_LOG_DEL : SURROGATE_LOG_DEL_KEY,
+			db, key, data);
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
+// one transaction: up to batch pairs older than cutoff, into list
+static int
+sweep_batch (surrogate_store *st, unsigned long long cutoff, expired *list, size_t batch,
+		size_t *n) {
+
+	int rc;
+	size_t w = st->hash_bytes, i;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_val e, data, key, url, pair;
+
+	*n = 0;
+	rc = surrogate_txn_begin (st, 0, &txn);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = mdb_cursor_open (txn, st->dbi_expiry, &cursor);
+	if (rc != MDB_SUCCESS) {
+		mdb_txn_abort (txn);
+		return rc;
+	}
+
+	// the index entries go first, oldest to newest
+	rc = mdb_cursor_get (cursor, &e, &data, MDB_FIRST);
+	while (rc == MDB_SUCCESS && *n < batch) {
+		if (e.mv_size != 8 + 2 * w || load_time (e.mv_data) >= cutoff)
+			break;
+		memcpy (list[*n].e, e.mv_data, e.mv_size);
+		e.mv_data = list[(*n)++].e;
+		rc = surrogate_log (st, txn, SURROGATE_LOG_DEL_KEY, SURROGATE_LOG_EXPIRY, &e, NULL);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_cursor_del (cursor, 0);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_cursor_get (cursor, &e, &data, MDB_NEXT);
+	}
+	mdb_cursor_close (cursor);
+	if (rc == MDB_NOTFOUND || rc == MDB_SUCCESS)
+		rc = MDB_SUCCESS;
+
+	key.mv_size = url.mv_size = w;
+	pair.mv_size = 2 * w;
+	sort_width = w;
+	if (rc == MDB_SUCCESS) {
+		qsort (list, *n, sizeof *list, by_key);
+		for (i = 0; rc == MDB_SUCCESS && i < *n; i++) {
+			key.mv_data = pair.mv_data = list[i].e + 8;
+			url.mv_data = list[i].e + 8 + w;
+			rc = del_pair (st, txn, st->dbi, SURROGATE_LOG_DATA, &key, &url);
+			if (rc == MDB_SUCCESS)
+				rc = del_pair (st, txn, st->dbi_lastseen, SURROGATE_LOG_LASTSEEN, &pair, NULL);
+		}
+	}
+	if (rc == MDB_SUCCESS) {
+		qsort (list, *n, sizeof *list, by_url);
+		for (i = 0; rc == MDB_SUCCESS && i < *n; i++) {
+			key.mv_data = list[i].e + 8;
+			url.mv_data = list[i].e + 8 + w;
+			rc = del_pair (st, txn, st->dbi_rev, SURROGATE_LOG_REV, &url, &key);
+		}
+	}
+
+	if (rc != MDB_SUCCESS) {
+		mdb_txn_abort (txn);
+		*n = 0;
+		return rc;
+	}
+	return mdb_txn_commit (txn);
+}
+
+int
+expiry_sweep (surrogate_store *st, unsigned long long cutoff, size_t batch, size_t *removed) {
+
+	int rc = MDB_SUCCESS;
+	size_t n, total = 0;
+	expired *list;
+
+	if (removed != NULL)
+		*removed = 0;
+	if (st->dbi_lastseen == 0 || st->dbi_expiry == 0)
+		return MDB_SUCCESS;
+	if (batch == 0)
+		batch = EXPIRY_BATCH;
+	list = malloc (batch * sizeof *list);
+	if (list == NULL)
+		return ENOMEM;
+
+	do {
+		rc = sweep_batch (st, cutoff, list, batch, &n);
+		if (rc == MDB_SUCCESS)
+			total += n;
+	} while (rc == MDB_SUCCESS && n == batch);
+
+	free (list);
+	if (removed != NULL)
+		*removed = total;
+	return rc;
+}
@@ -0,0 +1,39 @@
+/*
+ * File Name:	expiry.h
+ * Function:	The expiry index of a surrogate store: when each
+ *		(key, URL) pair was last ingested. lastseen maps the
+ *		pair to that time and expiry holds the time and the
+ *		pair in one key, so that walking expiry from the start
+ *		visits the pairs least recently seen first. Sweeping
+ *		removes the pairs not seen since a cutoff from
+ *		data_store and rev_data_store, so the store tracks the
+ *		content still being fed to it.
+ *
+ *		Times are seconds since the epoch, stored big-endian.
+ *		A pair is touched again only once its time is
+ *		EXPIRY_RESOLUTION old, which keeps ingest of a busy
+ *		feed from rewriting the index on every line.
+ */
+
+#ifndef EXPIRY_H
+#define EXPIRY_H
+
+#include "lmdb.h"
+#include "surrogate.h"
+
+#define EXPIRY_RESOLUTION	60	// seconds
+#define EXPIRY_BATCH		10000	// pairs per sweep transaction
+
+/* record in txn that key maps to url as of now; a no-op for stores
+ * without the index */
+int expiry_touch (surrogate_store *st, MDB_txn *txn, const void *key, const void *url,
+		unsigned long long now);
+
+/* remove the pairs last seen before cutoff from the store and the
+ * index, batch pairs per transaction (EXPIRY_BATCH when 0), each batch
+ * in key order. *removed (if not NULL) gets the number of pairs
+ * removed. Returns MDB_SUCCESS, SURROGATE_STALE when the store was
+ * swapped by a compaction (reopen and sweep again), or an LMDB error. */
+int expiry_sweep (surrogate_store *st, unsigned long long cutoff, size_t batch, size_t *removed);
+
+#endif
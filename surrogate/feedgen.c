@@ -0,0 +1,83 @@
+/*
+ * File Name:	feedgen.c
+ * Function:	Writes a synthetic feed for map_data.c (see workload.h):
+ *		-n lines, each a new URL with keys out of a space of -k,
+ *		-m per line on average, distributed per -d, with key
+ *		popularity of Zipf skew -z. With -q it writes -n keys
+ *		instead, one per line and as popular as in the feed of
+ *		the same options, to drive query.c, purge or purged.c.
+ *		The same -s seed gives the same output; draw a query
+ *		stream with another seed than its feed.
+ *
+ *		feedgen [-n lines] [-k keys] [-m mean] [-d fixed|uniform|geometric]
+ *		        [-z skew] [-s seed] [-q] > feed
+ *
+ *		cc feedgen.c workload.c -lm
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "workload.h"
+
+static void
+usage (const char *prog) {
+
+	fprintf (stderr, "usage: %s [-n lines] [-k keys] [-m mean] [-d fixed|uniform|geometric] "
+		"[-z skew] [-s seed] [-q] > feed\n", prog);
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int opt, keys_only = 0, d;
+	unsigned long long lines = 1000000, i;
+	char line[500];
+	size_t len;
+	workload w;
+	workload_config cfg = { 100000, 1.0, 4, WORKLOAD_GEOMETRIC, 1 };
+
+	while ((opt = getopt (argc, argv, "n:k:m:d:z:s:q")) != -1) {
+		if (opt == 'n')
+			lines = strtoull (optarg, NULL, 10);
+		else if (opt == 'k')
+			cfg.keys = strtoull (optarg, NULL, 10);
+		else if (opt == 'm')
+			cfg.mean = atoi (optarg);
+		else if (opt == 'd') {
+			for (d = 0; workload_dist_names[d] != NULL; d++)
+				if (strcmp (optarg, workload_dist_names[d]) == 0)
+					break;
+			cfg.dist = workload_dist_names[d] != NULL ? d : -1;
+		}
+		else if (opt == 'z')
+			cfg.skew = atof (optarg);
+		else if (opt == 's')
+			cfg.seed = strtoull (optarg, NULL, 10);
+		else if (opt == 'q')
+			keys_only = 1;
+		else {
+			usage (argv[0]);
+			return -1;
+		}
+	}
+	if (workload_init (&w, &cfg) != 0) {
+		usage (argv[0]);
+		return -1;
+	}
+
+	for (i = 0; i < lines; i++) {
+		if (keys_only) {
+			len = workload_key_name (line, sizeof line - 1, workload_key (&w));
+			line[len++] = '\n';
+		}
+		else
+			len = workload_line (&w, line, sizeof line);
+		if (fwrite (line, 1, len, stdout) != len) {
+			perror ("feedgen");
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * File Name:	hash_bench.c
+ * Function:	Compares the hash policies of surrogate.h on an ingest
+ *		feed in map_data.c's format, "<url> <key> ..." per line.
+ *		The feed is read into memory and every token is hashed
+ *		with each policy, best of -r runs. With -i the feed is
+ *		also ingested into a scratch store per policy, created
+ *		under the given directory and removed afterwards, with
+ *		the puts map_data.c makes, so the difference shows up
+ *		in lines per second end to end. -b sets the ID width and
+ *		-S keeps a strings database in the scratch stores, to
+ *		see what collision checking costs. -P hashes the feed
+ *		once more per policy under CPU counters (perfcount.h)
+ *		and prints them per token.
+ *
+ *		hash_bench [-r runs] [-b 8|12|16] [-i dir [-S]] [-P] < feed
+ *
+ *		cc hash_bench.c surrogate.c idstrings.c perfcount.c \
+ *		   blake2/sse/blake2b.c -llmdb -pthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "lmdb.h"
+#include "surrogate.h"
+#include "idstrings.h"
+#include "perfcount.h"
+
+#define LINE_BYTES 500
+#define COMMIT_TXN 10000
+
+typedef struct feed {
+	char *text;		// tokens, NUL terminated, back to back
+	size_t *start;		// offset of each token in text
+	size_t *len;
+	size_t *line;		// first token (the URL) of each line
+	size_t ntokens, nlines, bytes;
+} feed;
+
+static double
+now (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+grow (void **p, size_t *cap, size_t need, size_t size) {
+
+	void *q;
+
+	if (need <= *cap)
+		return 0;
+	while (*cap < need)
+		*cap = *cap ? 2 * *cap : 4096;
+	q = realloc (*p, *cap * size);
+	if (q == NULL)
+		return -1;
+	*p = q;
+	return 0;
+}
+
+static int
+read_feed (FILE *in, feed *f) {
+
+	char buf[LINE_BYTES], *token;
+	size_t n, text_cap = 0, tok_cap = 0, len_cap = 0, line_cap = 0;
+
+	memset (f, 0, sizeof *f);
+	while (fgets (buf, sizeof buf, in) != NULL) {
+		if ((token = strtok (buf, " \n")) == NULL)
+			continue;
+		if (grow ((void **) &f->line, &line_cap, f->nlines + 1, sizeof *f->line) != 0)
+			return -1;
+		f->line[f->nlines++] = f->ntokens;
+		for (; token != NULL; token = strtok (NULL, " \n")) {
+			n = strlen (token);
+			if (grow ((void **) &f->text, &text_cap, f->bytes + n + 1, 1) != 0 ||
+			    grow ((void **) &f->start, &tok_cap, f->ntokens + 1, sizeof *f->start) != 0 ||
+			    grow ((void **) &f->len, &len_cap, f->ntokens + 1, sizeof *f->len) != 0)
+				return -1;
+			memcpy (f->text + f->bytes, token, n + 1);
+			f->start[f->ntokens] = f->bytes;
+			f->len[f->ntokens++] = n;
+			f->bytes += n + 1;
+		}
+	}
+	return 0;
+}
+
+// seconds to hash every token of the feed once
+static double
+hash_feed (const feed *f, uint64_t *sink) {
+
+	unsigned char out[SURROGATE_MAX_HASH_BYTES];
+	uint64_t acc = 0, w;
+	double t = now ();
+	size_t i;
+
+	for (i = 0; i < f->ntokens; i++) {
+		surrogate_hash (out, f->text + f->start[i], f->len[i]);
+		memcpy (&w, out, sizeof w);
+		acc ^= w;
+	}
+	t = now () - t;
+	*sink ^= acc;
+	return t;
+}
+
+// seconds to ingest the feed into a fresh store under dir
+static int
+ingest_feed (const feed *f, const char *dir, const surrogate_config *cfg, double *secs) {
+
+	int rc;
+	char path[512], file[600];
+	unsigned char url[SURROGATE_MAX_HASH_BYTES], key[SURROGATE_MAX_HASH_BYTES];
+	size_t l, i, end;
+	surrogate_store st;
+	idstrings *q = NULL;
+	MDB_txn *txn;
+	MDB_val mkey, mval;
+	double t;
+
+	snprintf (path, sizeof path, "%s/hash_bench.XXXXXX", dir);
+	if (mkdtemp (path) == NULL) {
+		perror (path);
+		return -1;
+	}
+	rc = surrogate_open_config (&st, path, 0, cfg);
+	if (rc != MDB_SUCCESS)
+		goto done;
+	if (st.dbi_strings != 0 && (rc = idstrings_create (st.hash_bytes, &q)) != MDB_SUCCESS) {
+		surrogate_close (&st);
+		goto done;
+	}
+
+	mkey.mv_size = mval.mv_size = st.hash_bytes;
+	mkey.mv_data = key;
+	mval.mv_data = url;
+
+	t = now ();
+	txn = NULL;
+	rc = mdb_txn_begin (st.env, NULL, 0, &txn);
+	for (l = 0; rc == MDB_SUCCESS && l < f->nlines; l++) {
+		i = f->line[l];
+		end = l + 1 < f->nlines ? f->line[l + 1] : f->ntokens;
+		surrogate_hash (url, f->text + f->start[i], f->len[i]);
+		if (q != NULL)
+			rc = idstrings_add (q, url, f->text + f->start[i], f->len[i]);
+		for (i++; rc == MDB_SUCCESS && i < end; i++) {
+			surrogate_hash (key, f->text + f->start[i], f->len[i]);
+			if (q != NULL && (rc = idstrings_add (q, key, f->text + f->start[i], f->len[i])) != MDB_SUCCESS)
+				break;
+			rc = mdb_put (txn, st.dbi, &mkey, &mval, MDB_NODUPDATA);
+			if (rc == MDB_KEYEXIST)
+				rc = MDB_SUCCESS;
+			else if (rc == MDB_SUCCESS)
+				rc = mdb_put (txn, st.dbi_rev, &mval, &mkey, 0);
+		}
+		if (rc == MDB_SUCCESS && (l + 1) % COMMIT_TXN == 0) {
+			if (q != NULL) {
+				rc = idstrings_flush (q, &st, txn, NULL, NULL, NULL);
+				idstrings_clear (q);
+			}
+			if (rc == MDB_SUCCESS)
+				rc = mdb_txn_commit (txn);
+			else
+				mdb_txn_abort (txn);
+			txn = NULL;
+			if (rc == MDB_SUCCESS)
+				rc = mdb_txn_begin (st.env, NULL, 0, &txn);
+		}
+	}
+	if (rc == MDB_SUCCESS && q != NULL)
+		rc = idstrings_flush (q, &st, txn, NULL, NULL, NULL);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_txn_commit (txn);
+	else if (txn != NULL)
+		mdb_txn_abort (txn);
+	*secs = now () - t;
+	if (q != NULL)
+		idstrings_destroy (q);
+	surrogate_close (&st);
+
+done:
+	snprintf (file, sizeof file, "%s/data.mdb", path);
+	unlink (file);
+	snprintf (file, sizeof file, "%s/lock.mdb", path);
+	unlink (file);
+	rmdir (path);
+	if (rc != MDB_SUCCESS)
+		fprintf (stderr, "Ingest with %s failed: %s\n", cfg->hash, surrogate_strerror (rc));
+	return rc;
+}
+
+static void
+usage (const char *prog) {
+
+	fprintf (stderr, "usage: %s [-r runs] [-b 8|12|16] [-i dir [-S]] [-P] < feed\n", prog);
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int opt, runs = 5, r, p, counting = 0;
+	const char *dir = NULL;
+	unsigned char key[SURROGATE_HASH_KEY_BYTES];
+	uint64_t sink = 0;
+	double best, t, base = 0, ingest;
+	surrogate_config cfg = { NULL, SURROGATE_HASH_BYTES, 0, 0, 0 };
+	feed f;
+	perfcount pc;
+
+	while ((opt = getopt (argc, argv, "r:b:i:SP")) != -1) {
+		if (opt == 'r' && (runs = atoi (optarg)) > 0)
+			continue;
+		if (opt == 'b' && (cfg.hash_bytes = atoi (optarg)) > 0)
+			continue;
+		if (opt == 'i') {
+			dir = optarg;
+			continue;
+		}
+		if (opt == 'S') {
+			cfg.strings = 1;
+			continue;
+		}
+		if (opt == 'P') {
+			counting = 1;
+			continue;
+		}
+		usage (argv[0]);
+		return -1;
+	}
+	if (surrogate_select_hash (SURROGATE_HASH_DEFAULT, cfg.hash_bytes, NULL) != 0) {
+		usage (argv[0]);
+		return -1;
+	}
+
+	if (counting && (r = perfcount_open (&pc)) != 0) {
+		fprintf (stderr, "No CPU counters: %s\n", strerror (r));
+		counting = 0;
+	}
+
+	if (read_feed (stdin, &f) != 0) {
+		fprintf (stderr, "Out of memory\n");
+		return -1;
+	}
+	if (f.ntokens == 0) {
+		fprintf (stderr, "Empty feed\n");
+		return -1;
+	}
+	fprintf (stdout, "%zu lines, %zu tokens, %.1f bytes/token, %zu-byte IDs%s\n\n",
+		f.nlines, f.ntokens, (double) (f.bytes - f.ntokens) / f.ntokens, cfg.hash_bytes,
+		dir != NULL && cfg.strings ? ", strings kept" : "");
+	fprintf (stdout, "%-10s %12s %9s %9s %8s%s\n", "hash", "tokens/s", "ns/token", "MB/s",
+		"speedup", dir != NULL ? "  ingest lines/s" : "");
+
+	// any key will do; the store draws its own on -i
+	for (r = 0; r < SURROGATE_HASH_KEY_BYTES; r++)
+		key[r] = (unsigned char) (r * 0x9e + 0x37);
+
+	for (p = 0; surrogate_hash_names[p] != NULL; p++) {
+		surrogate_select_hash (surrogate_hash_names[p], cfg.hash_bytes, key);
+		best = hash_feed (&f, &sink);
+		for (r = 1; r < runs; r++)
+			if ((t = hash_feed (&f, &sink)) < best)
+				best = t;
+		if (p == 0)
+			base = best;
+
+		fprintf (stdout, "%-10s %12.0f %9.1f %9.1f %7.2fx", surrogate_hash_names[p],
+			f.ntokens / best, best * 1e9 / f.ntokens,
+			(f.bytes - f.ntokens) / best / 1e6, base / best);
+		if (dir != NULL) {
+			cfg.hash = surrogate_hash_names[p];
+			if (ingest_feed (&f, dir, &cfg, &ingest) != MDB_SUCCESS)
+				return -1;
+			fprintf (stdout, "  %15.0f", f.nlines / ingest);
+		}
+		fputc ('\n', stdout);
+		if (counting) {
+			perfcount_start (&pc);
+			hash_feed (&f, &sink);
+			perfcount_stop (&pc);
+			fprintf (stdout, "%-10s per token: ", "");
+			perfcount_print (stdout, &pc, f.ntokens);
+			fputc ('\n', stdout);
+		}
+	}
+	if (counting)
+		perfcount_close (&pc);
+	fprintf (stderr, "(checksum %016llx)\n", (unsigned long long) sink);
+
+	free (f.text);
+	free (f.start);
+	free (f.len);
+	free (f.line);
+	return 0;
+}
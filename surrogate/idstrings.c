@@ -0,0 +1,230 @@
+/*
+ * File Name:	idstrings.c
+ * Function:	Batched, collision-checked writes of the strings
+ *		database. See idstrings.h.
+ *
+ *		A batch repeats most IDs many times (popular keys occur
+ *		on many lines), so it is sorted by ID and then by token,
+ *		which puts the copies of an ID side by side and makes a
+ *		second token for the same ID end its run. Each run then
+ *		costs one MDB_NOOVERWRITE put: it stores the token of a
+ *		new ID and returns the stored one of a known ID, which
+ *		is compared in place.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "idstrings.h"
+#include "surrogate.h"
+
+typedef struct id_entry {
+	unsigned char id[SURROGATE_MAX_HASH_BYTES];	// zero padded
+	size_t off, len;	// token in the text buffer
+	int collided;
+} id_entry;
+
+struct idstrings {
+	size_t id_bytes;
+	id_entry *e;
+	size_t n, cap;
+	char *text;
+	size_t bytes, text_cap;
+	int sorted;
+};
+
+// qsort has no context argument; flushes are not concurrent
+static const char *sort_text;
+
+static int
+by_id_token (const void *a, const void *b) {
+
+	const id_entry *x = a, *y = b;
+	int c = memcmp (x->id, y->id, sizeof x->id);
+
+	if (c == 0) {
+		c = memcmp (sort_text + x->off, sort_text + y->off, x->len < y->len ? x->len : y->len);
+		if (c == 0)
+			c = (x->len > y->len) - (x->len < y->len);
+	}
+	return c;
+}
+
+static MDB_val
+token_val (const idstrings *q, size_t i) {
+
+	MDB_val v;
+
+	v.mv_size = q->e[i].len;
+	v.mv_data = q->text + q->e[i].off;
+	return v;
+}
+
+static int
+same_val (const MDB_val *a, const MDB_val *b) {
+
+	return a->mv_size == b->mv_size && memcmp (a->mv_data, b->mv_data, a->mv_size) == 0;
+}
+
+int
+idstrings_create (size_t id_bytes, idstrings **q) {
+
+	idstrings *p;
+
+	if (id_bytes == 0 || id_bytes > SURROGATE_MAX_HASH_BYTES)
+		return EINVAL;
+	p = calloc (1, sizeof *p);
+	if (p == NULL)
+		return ENOMEM;
+	p->id_bytes = id_bytes;
+	*q = p;
+	return MDB_SUCCESS;
+}
+
+void
+idstrings_destroy (idstrings *q) {
+
+	free (q->e);
+	free (q->text);
+	free (q);
+}
+
+int
+idstrings_add (idstrings *q, const void *id, const char *token, size_t len) {
+
+	id_entry *e;
+	char *t;
+	size_t cap;
+
+	if (q->n == q->cap) {
+		cap = q->cap ? 2 * q->cap : 4096;
+		e = realloc (q->e, cap * sizeof *e);
+		if (e == NULL)
+			return ENOMEM;
+		q->e = e;
+		q->cap = cap;
+	}
+	if (q->bytes + len > q->text_cap) {
+		for (cap = q->text_cap ? q->text_cap : 65536; cap < q->bytes + len; cap *= 2)
+			;
+		t = realloc (q->text, cap);
+		if (t == NULL)
+			return ENOMEM;
+		q->text = t;
+		q->text_cap = cap;
+	}
+
+	e = &q->e[q->n++];
+	memset (e->id, 0, sizeof e->id);
+	memcpy (e->id, id, q->id_bytes);
+	e->off = q->bytes;
+	e->len = len;
+	e->collided = 0;
+	memcpy (q->text + q->bytes, token, len);
+	q->bytes += len;
+	q->sorted = 0;
+	return MDB_SUCCESS;
+}
+
+int
+idstrings_flush (idstrings *q, surrogate_store *st, MDB_txn *txn,
+		idstrings_collision_fn *fn, void *ctx, size_t *collisions) {
+
+	int rc;
+	size_t i, j, k, found = 0;
+	MDB_cursor *cursor;
+	MDB_val key, stored, other, last;
+
+	sort_text = q->text;
+	qsort (q->e, q->n, sizeof *q->e, by_id_token);
+	q->sorted = 1;
+
+	rc = mdb_cursor_open (txn, st->dbi_strings, &cursor);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	for (i = 0; i < q->n; i = j) {
+		// the run of entries for one ID; a second token ends up last
+		for (j = i + 1; j < q->n && memcmp (q->e[j].id, q->e[i].id, q->id_bytes) == 0; j++)
+			;
+
+		key.mv_size = q->id_bytes;
+		key.mv_data = q->e[i].id;
+		stored = token_val (q, i);
+		last = token_val (q, j - 1);
+
+		if (same_val (&stored, &last)) {
+			// one token: store it, or compare it with the stored one
+			rc = mdb_cursor_put (cursor, &key, &stored, MDB_NOOVERWRITE);
+			if (rc == MDB_SUCCESS)
+				rc = surrogate_log (st, txn, SURROGATE_LOG_PUT, SURROGATE_LOG_STRINGS, &key, &stored);
+			if (rc == MDB_SUCCESS)
+				continue;
+			if (rc != MDB_KEYEXIST)
+				break;
+			rc = MDB_SUCCESS;
+			if (same_val (&stored, &last))
+				continue;
+			other = last;
+		}
+		else {
+			// two tokens in the batch; report against the stored one, if any
+			rc = mdb_cursor_get (cursor, &key, &stored, MDB_SET_KEY);
+			if (rc == MDB_NOTFOUND)
+				stored = token_val (q, i);
+			else if (rc != MDB_SUCCESS)
+				break;
+			rc = MDB_SUCCESS;
+			other = same_val (&stored, &last) ? token_val (q, i) : last;
+		}
+
+		for (k = i; k < j; k++)
+			q->e[k].collided = 1;
+		found++;
+		if (fn != NULL)
+			fn (q->e[i].id, &stored, &other, ctx);
+	}
+	mdb_cursor_close (cursor);
+
+	if (collisions != NULL)
+		*collisions = found;
+	return rc;
+}
+
+int
+idstrings_get (const surrogate_store *st, MDB_txn *txn, const void *id, MDB_val *token) {
+
+	MDB_val key;
+
+	if (st->dbi_strings == 0)
+		return MDB_NOTFOUND;
+	key.mv_size = st->hash_bytes;
+	key.mv_data = (void *) id;
+	return mdb_get (txn, st->dbi_strings, &key, token);
+}
+
+int
+idstrings_collided (const idstrings *q, const void *id) {
+
+	size_t lo = 0, hi = q->n, mid;
+	int c;
+
+	if (!q->sorted)
+		return 0;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = memcmp (q->e[mid].id, id, q->id_bytes);
+		if (c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < q->n && memcmp (q->e[lo].id, id, q->id_bytes) == 0 && q->e[lo].collided;
+}
+
+void
+idstrings_clear (idstrings *q) {
+
+	q->n = 0;
+	q->bytes = 0;
+	q->sorted = 0;
+}
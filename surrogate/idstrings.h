@@ -0,0 +1,52 @@
+/*
+ * File Name:	idstrings.h
+ * Function:	The strings database of a surrogate store: each ID
+ *		mapped to the token it was hashed from. Writes are
+ *		queued per transaction batch and flushed in ID order,
+ *		so the puts walk the tree left to right. Flushing checks
+ *		every ID against the string already stored and against
+ *		the other strings in the batch. A mismatch means two
+ *		tokens hash to the same ID.
+ */
+
+#ifndef IDSTRINGS_H
+#define IDSTRINGS_H
+
+#include <stddef.h>
+#include "lmdb.h"
+#include "surrogate.h"
+
+typedef struct idstrings idstrings;
+
+/* called once per colliding ID with the string it has in the store (or
+ * the first one queued, when the ID is new) and a different one queued
+ * for it */
+typedef void (idstrings_collision_fn) (const void *id, const MDB_val *stored,
+		const MDB_val *other, void *ctx);
+
+/* a queue for IDs of id_bytes bytes */
+int idstrings_create (size_t id_bytes, idstrings **q);
+void idstrings_destroy (idstrings *q);
+
+/* queue the token an ID was hashed from; the token is copied */
+int idstrings_add (idstrings *q, const void *id, const char *token, size_t len);
+
+/* store the queued strings of new IDs in the strings database of st
+ * (logging them for surrogate_log) and check the rest. IDs
+ * that collide are not written and stay known to idstrings_collided
+ * until the next idstrings_clear. Returns MDB_SUCCESS or an LMDB error;
+ * *collisions (if not NULL) gets the number of colliding IDs. */
+int idstrings_flush (idstrings *q, surrogate_store *st, MDB_txn *txn,
+		idstrings_collision_fn *fn, void *ctx, size_t *collisions);
+
+/* the string stored for id; MDB_NOTFOUND when there is none or the
+ * store keeps no strings */
+int idstrings_get (const surrogate_store *st, MDB_txn *txn, const void *id, MDB_val *token);
+
+/* whether a flushed ID collided */
+int idstrings_collided (const idstrings *q, const void *id);
+
+/* empty the queue for the next batch */
+void idstrings_clear (idstrings *q);
+
+#endif
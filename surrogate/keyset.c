@@ -0,0 +1,111 @@
+/*
+ * File Name:	keyset.c
+ * Function:	Streaming intersection and union of the URL lists of
+ *		several surrogate keys. See keyset.h.
+ *
+ *		Each list is read one leaf page at a time and decoded
+ *		into integers in memcmp order: 64-bit for 8-byte IDs,
+ *		128-bit (zero padded) for 12- and 16-byte IDs. An
+ *		intersection
+ *		takes a page of the smallest list as candidates and
+ *		filters it through the other lists in turn; the other
+ *		lists only move forward, first by stepping to the next
+ *		page and otherwise by seeking with MDB_GET_BOTH_RANGE.
+ *		Inside a page, lists of very different lengths are
+ *		intersected by galloping search and lists of similar
+ *		length by comparing blocks of 4 against 4 in AVX2.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "keyset.h"
+#include "surrogate.h"
+
+// gallop instead of scanning when one side is this many times longer
+#define GALLOP_RATIO 16
+
+
+// memcmp order of 8 bytes is the order of the big-endian integer
+static uint64_t
+load_be64 (const void *src) {
+
+	uint64_t w;
+	memcpy (&w, src, sizeof w);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64 (w);
+#endif
+	return w;
+}
+
+static void
+store_be64 (void *dst, uint64_t w) {
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap64 (w);
+#endif
+	memcpy (dst, &w, sizeof w);
+}
+
+__extension__ typedef unsigned __int128 uint128;
+
+static uint128
+load_be128 (const void *src, size_t width) {
+
+	unsigned char buf[16] = { 0 };
+
+	memcpy (buf, src, width);
+	return (uint128) load_be64 (buf) << 64 | load_be64 (buf + 8);
+}
+
+static void
+store_be128 (void *dst, uint128 w, size_t width) {
+
+	unsigned char buf[16];
+
+	store_be64 (buf, (uint64_t) (w >> 64));
+	store_be64 (buf + 8, (uint64_t) w);
+	memcpy (dst, buf, width);
+}
+
+#define KS(name)		name ## _64
+#define KS_WORD			uint64_t
+#define KS_BITS			64
+#define KS_MAX			UINT64_MAX
+#define KS_LOAD(p, width)	((void) (width), load_be64 (p))
+#define KS_STORE(p, w, width)	((void) (width), store_be64 (p, w))
+#include "keyset_impl.h"
+
+#define KS(name)		name ## _128
+#define KS_WORD			uint128
+#define KS_BITS			128
+#define KS_MAX			(~(uint128) 0)
+#define KS_LOAD(p, width)	load_be128 (p, width)
+#define KS_STORE(p, w, width)	store_be128 (p, w, width)
+#include "keyset_impl.h"
+
+int
+keyset_intersect (MDB_txn *txn, MDB_dbi dbi, const MDB_val *keys, int nkeys,
+		keyset_emit_fn *emit, void *ctx) {
+
+	size_t width = surrogate_hash_bytes ();
+
+	if (width == 8)
+		return intersect_64 (txn, dbi, keys, nkeys, width, emit, ctx);
+	return intersect_128 (txn, dbi, keys, nkeys, width, emit, ctx);
+}
+
+int
+keyset_union (MDB_txn *txn, MDB_dbi dbi, const MDB_val *keys, int nkeys,
+		keyset_emit_fn *emit, void *ctx) {
+
+	size_t width = surrogate_hash_bytes ();
+
+	if (width == 8)
+		return union_64 (txn, dbi, keys, nkeys, width, emit, ctx);
+	return union_128 (txn, dbi, keys, nkeys, width, emit, ctx);
+}
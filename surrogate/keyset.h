@@ -0,0 +1,30 @@
+/*
+ * File Name:	keyset.h
+ * Function:	Set queries over the forward index. Every key in
+ *		data_store holds a sorted DUPFIXED list of URL hashes,
+ *		so "URLs carrying all of these keys" and "URLs carrying
+ *		any of these keys" are intersections and unions of
+ *		sorted lists. Both are streamed a leaf page at a time
+ *		(MDB_GET_MULTIPLE / MDB_NEXT_MULTIPLE) and never load a
+ *		whole list into memory.
+ */
+
+#ifndef KEYSET_H
+#define KEYSET_H
+
+#include "lmdb.h"
+
+/* called once per matching URL hash, in ascending order; a non-zero
+ * return stops the query and is passed back to the caller */
+typedef int (keyset_emit_fn) (const void *url, void *ctx);
+
+/* keys[] are hashed keys of data_store. The intersection is driven by
+ * the key with the fewest URLs; a key that does not exist makes the
+ * result empty. The union skips missing keys. Both return MDB_SUCCESS,
+ * an LMDB error, ENOMEM, or the non-zero value returned by emit. */
+int keyset_intersect (MDB_txn *txn, MDB_dbi dbi, const MDB_val *keys, int nkeys,
+		keyset_emit_fn *emit, void *ctx);
+int keyset_union (MDB_txn *txn, MDB_dbi dbi, const MDB_val *keys, int nkeys,
+		keyset_emit_fn *emit, void *ctx);
+
+#endif
@@ -0,0 +1,402 @@
+/*
+ * File Name:	keyset_impl.h
+ * Function:	The list machinery of keyset.c, written once and
+ *		included once per word type: KS_WORD holds a decoded
+ *		URL hash, KS(name) names this copy of each function,
+ *		KS_LOAD/KS_STORE convert a word from/to the stored
+ *		bytes, KS_MAX is the largest word and KS_BITS its size.
+ *		Only 64-bit words take the AVX2 merge.
+ */
+
+typedef struct KS(keyset_iter) {
+	MDB_cursor *cursor;
+	MDB_val key;
+	size_t count;		// URLs under key
+	KS_WORD *page;		// current leaf page, decoded
+	size_t n, cap, pos;
+	size_t width;		// bytes per URL hash
+	int done;
+} KS(keyset_iter);
+
+// first index i in [lo, n) with b[i] >= a, or n
+static size_t
+KS(gallop) (const KS_WORD *b, size_t lo, size_t n, KS_WORD a) {
+
+	size_t hi = lo, step = 1, mid;
+
+	while (hi < n && b[hi] < a) {
+		lo = hi + 1;
+		hi += step;
+		step <<= 1;
+	}
+	if (hi > n)
+		hi = n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (b[mid] < a)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// look up each element of the short list a in the long list b
+static size_t
+KS(intersect_gallop) (const KS_WORD *a, size_t na, const KS_WORD *b, size_t nb, KS_WORD *out) {
+
+	size_t i, j = 0, k = 0;
+
+	for (i = 0; i < na; i++) {
+		j = KS(gallop) (b, j, nb, a[i]);
+		if (j == nb)
+			break;
+		if (b[j] == a[i])
+			out[k++] = a[i];
+	}
+	return k;
+}
+
+static size_t
+KS(intersect_merge) (const KS_WORD *a, size_t na, const KS_WORD *b, size_t nb, KS_WORD *out) {
+
+	size_t i = 0, j = 0, k = 0;
+
+#if defined(__AVX2__) && KS_BITS == 64
+	KS_WORD amax, bmax;
+
+
+	// compare a block of a against all 4 rotations of a block of b,
+	// then retire whichever block has the smaller maximum
+	while (i + 4 <= na && j + 4 <= nb) {
+		__m256i va = _mm256_loadu_si256 ((const __m256i *) (a + i));
+		__m256i vb = _mm256_loadu_si256 ((const __m256i *) (b + j));
+		__m256i m = _mm256_cmpeq_epi64 (va, vb);
+		int mask;
+
+		vb = _mm256_permute4x64_epi64 (vb, _MM_SHUFFLE (0, 3, 2, 1));
+		m = _mm256_or_si256 (m, _mm256_cmpeq_epi64 (va, vb));
+		vb = _mm256_permute4x64_epi64 (vb, _MM_SHUFFLE (0, 3, 2, 1));
+		m = _mm256_or_si256 (m, _mm256_cmpeq_epi64 (va, vb));
+		vb = _mm256_permute4x64_epi64 (vb, _MM_SHUFFLE (0, 3, 2, 1));
+		m = _mm256_or_si256 (m, _mm256_cmpeq_epi64 (va, vb));
+
+		mask = _mm256_movemask_pd (_mm256_castsi256_pd (m));
+		while (mask) {
+			out[k++] = a[i + __builtin_ctz (mask)];
+			mask &= mask - 1;
+		}
+		amax = a[i + 3];
+		bmax = b[j + 3];
+		if (amax <= bmax)
+			i += 4;
+		if (bmax <= amax)
+			j += 4;
+	}
+#endif
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			i++;
+		else if (a[i] > b[j])
+			j++;
+		else {
+			out[k++] = a[i];
+			i++;
+			j++;
+		}
+	}
+	return k;
+}
+
+static size_t
+KS(intersect_sorted) (const KS_WORD *a, size_t na, const KS_WORD *b, size_t nb, KS_WORD *out) {
+
+	if (na * GALLOP_RATIO < nb)
+		return KS(intersect_gallop) (a, na, b, nb, out);
+	if (nb * GALLOP_RATIO < na)
+		return KS(intersect_gallop) (b, nb, a, na, out);
+	return KS(intersect_merge) (a, na, b, nb, out);
+}
+
+static int
+KS(iter_load) (KS(keyset_iter) *it, const MDB_val *data) {
+
+	size_t i, n = data->mv_size / it->width;
+	const unsigned char *p = data->mv_data;
+
+	if (n > it->cap) {
+		KS_WORD *page = realloc (it->page, n * sizeof *page);
+		if (page == NULL)
+			return ENOMEM;
+		it->page = page;
+		it->cap = n;
+	}
+	for (i = 0; i < n; i++)
+		it->page[i] = KS_LOAD (p + i * it->width, it->width);
+	it->n = n;
+	it->pos = 0;
+	return MDB_SUCCESS;
+}
+
+static int
+KS(iter_open) (KS(keyset_iter) *it, MDB_txn *txn, MDB_dbi dbi, const MDB_val *key) {
+
+	int rc;
+	MDB_val k = *key, data;
+
+	it->key = *key;
+	rc = mdb_cursor_open (txn, dbi, &it->cursor);
+	if (rc != MDB_SUCCESS)
+		return rc;
+
+	rc = mdb_cursor_get (it->cursor, &k, &data, MDB_SET);
+	if (rc == MDB_NOTFOUND) {
+		it->done = 1;
+		return MDB_SUCCESS;
+	}
+	if (rc == MDB_SUCCESS)
+		rc = mdb_cursor_count (it->cursor, &it->count);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_cursor_get (it->cursor, &k, &data, MDB_GET_MULTIPLE);
+	if (rc == MDB_SUCCESS)
+		rc = KS(iter_load) (it, &data);
+	return rc;
+}
+
+static int
+KS(iter_next_page) (KS(keyset_iter) *it) {
+
+	int rc;
+	MDB_val k = it->key, data;
+
+	rc = mdb_cursor_get (it->cursor, &k, &data, MDB_NEXT_MULTIPLE);
+	if (rc == MDB_NOTFOUND) {
+		it->done = 1;
+		it->n = it->pos = 0;
+		return MDB_SUCCESS;
+	}
+	if (rc != MDB_SUCCESS)
+		return rc;
+	return KS(iter_load) (it, &data);
+}
+
+// make the current page end at or beyond target, or mark the list done
+static int
+KS(iter_seek) (KS(keyset_iter) *it, KS_WORD target) {
+
+	int rc;
+	unsigned char buf[SURROGATE_MAX_HASH_BYTES];
+	MDB_val k = it->key, data;
+
+	if (it->done || it->page[it->n - 1] >= target)
+		return MDB_SUCCESS;
+
+	// lists of similar density usually continue on the next page
+	rc = KS(iter_next_page) (it);
+	if (rc != MDB_SUCCESS || it->done || it->page[it->n - 1] >= target)
+		return rc;
+
+	// otherwise jump through the dupsort tree
+	KS_STORE (buf, target, it->width);
+	data.mv_size = it->width;
+	data.mv_data = buf;
+	rc = mdb_cursor_get (it->cursor, &k, &data, MDB_GET_BOTH_RANGE);
+	if (rc == MDB_NOTFOUND) {
+		it->done = 1;
+		it->n = it->pos = 0;
+		return MDB_SUCCESS;
+	}
+	if (rc == MDB_SUCCESS)
+		rc = mdb_cursor_get (it->cursor, &k, &data, MDB_GET_MULTIPLE);
+	if (rc == MDB_SUCCESS)
+		rc = KS(iter_load) (it, &data);
+	return rc;
+}
+
+// keep the candidates cand[0..nc) that are also in it; *nout gets the count
+static int
+KS(iter_filter) (KS(keyset_iter) *it, const KS_WORD *cand, size_t nc, KS_WORD *out, size_t *nout) {
+
+	int rc;
+	size_t j = 0, jend, k = 0;
+	KS_WORD last;
+
+	while (j < nc) {
+		rc = KS(iter_seek) (it, cand[j]);
+		if (rc != MDB_SUCCESS)
+			return rc;
+		if (it->done)
+			break;
+
+		// candidates up to the end of this page
+		last = it->page[it->n - 1];
+		jend = last == KS_MAX ? nc : KS(gallop) (cand, j, nc, last + 1);
+
+		k += KS(intersect_sorted) (cand + j, jend - j, it->page + it->pos, it->n - it->pos, out + k);
+		it->pos = KS(gallop) (it->page, it->pos, it->n, cand[jend - 1]);
+		j = jend;
+	}
+	*nout = k;
+	return MDB_SUCCESS;
+}
+
+static int
+KS(by_count) (const void *a, const void *b) {
+
+	const KS(keyset_iter) *x = a, *y = b;
+	return (x->count > y->count) - (x->count < y->count);
+}
+
+static int
+KS(emit_all) (const KS_WORD *v, size_t n, size_t width, keyset_emit_fn *emit, void *ctx) {
+
+	size_t i;
+	int rc;
+	unsigned char buf[SURROGATE_MAX_HASH_BYTES];
+
+	for (i = 0; i < n; i++) {
+		KS_STORE (buf, v[i], width);
+		if ((rc = emit (buf, ctx)) != 0)
+			return rc;
+	}
+	return 0;
+}
+
+static void
+KS(iter_close_all) (KS(keyset_iter) *it, int nkeys) {
+
+	int i;
+
+	for (i = 0; i < nkeys; i++) {
+		if (it[i].cursor != NULL)
+			mdb_cursor_close (it[i].cursor);
+		free (it[i].page);
+	}
+	free (it);
+}
+
+static int
+KS(intersect) (MDB_txn *txn, MDB_dbi dbi, const MDB_val *keys, int nkeys, size_t width,
+		keyset_emit_fn *emit, void *ctx) {
+
+	int i, rc = MDB_SUCCESS, exhausted = 0;
+	size_t nc, cap = 0;
+	KS_WORD *cand = NULL, *next = NULL, *tmp;
+	KS(keyset_iter) *it;
+
+	if (nkeys <= 0)
+		return MDB_SUCCESS;
+	it = calloc (nkeys, sizeof *it);
+	if (it == NULL)
+		return ENOMEM;
+
+	for (i = 0; i < nkeys; i++) {
+		it[i].width = width;
+		rc = KS(iter_open) (&it[i], txn, dbi, &keys[i]);
+		if (rc != MDB_SUCCESS || it[i].done)
+			goto done;
+	}
+
+	// the smallest list drives, so the others are only probed
+	qsort (it, nkeys, sizeof *it, KS(by_count));
+
+	while (!it[0].done && !exhausted) {
+		nc = it[0].n;
+		if (nc > cap) {
+			free (cand);
+			free (next);
+			cand = malloc (nc * sizeof *cand);
+			next = malloc (nc * sizeof *next);
+			cap = nc;
+			if (cand == NULL || next == NULL) {
+				rc = ENOMEM;
+				goto done;
+			}
+		}
+		memcpy (cand, it[0].page, nc * sizeof *cand);
+
+		for (i = 1; i < nkeys && nc > 0; i++) {
+			rc = KS(iter_filter) (&it[i], cand, nc, next, &nc);
+			if (rc != MDB_SUCCESS)
+				goto done;
+			tmp = cand;
+			cand = next;
+			next = tmp;
+			// nothing beyond the end of any list can match
+			if (it[i].done)
+				exhausted = 1;
+		}
+
+		if ((rc = KS(emit_all) (cand, nc, width, emit, ctx)) != 0)
+			goto done;
+		if (!exhausted)
+			rc = KS(iter_next_page) (&it[0]);
+		if (rc != MDB_SUCCESS)
+			goto done;
+	}
+
+done:
+	free (cand);
+	free (next);
+	KS(iter_close_all) (it, nkeys);
+	return rc;
+}
+
+static int
+KS(union) (MDB_txn *txn, MDB_dbi dbi, const MDB_val *keys, int nkeys, size_t width,
+		keyset_emit_fn *emit, void *ctx) {
+
+	int i, found, rc = MDB_SUCCESS;
+	KS_WORD min;
+	KS(keyset_iter) *it;
+
+	if (nkeys <= 0)
+		return MDB_SUCCESS;
+	it = calloc (nkeys, sizeof *it);
+	if (it == NULL)
+		return ENOMEM;
+
+	for (i = 0; i < nkeys; i++) {
+		it[i].width = width;
+		rc = KS(iter_open) (&it[i], txn, dbi, &keys[i]);
+		if (rc != MDB_SUCCESS)
+			goto done;
+	}
+
+	// k-way merge; the number of keys in a query is small
+	for (;;) {
+		found = 0;
+		min = KS_MAX;
+		for (i = 0; i < nkeys; i++) {
+			if (!it[i].done && (!found || it[i].page[it[i].pos] < min)) {
+				min = it[i].page[it[i].pos];
+				found = 1;
+			}
+		}
+		if (!found)
+			break;
+
+		if ((rc = KS(emit_all) (&min, 1, width, emit, ctx)) != 0)
+			goto done;
+
+		for (i = 0; i < nkeys; i++) {
+			if (it[i].done || it[i].page[it[i].pos] != min)
+				continue;
+			if (++it[i].pos == it[i].n)
+				rc = KS(iter_next_page) (&it[i]);
+			if (rc != MDB_SUCCESS)
+				goto done;
+		}
+	}
+
+done:
+	KS(iter_close_all) (it, nkeys);
+	return rc;
+}
+
+#undef KS
+#undef KS_WORD
+#undef KS_BITS
+#undef KS_MAX
+#undef KS_LOAD
+#undef KS_STORE
@@ -14,6 +14,58 @@
  * 		base will be created with the URL as the key
  * 		with its stored value(s) being each key that
  * 		is mapped to it.   
+ *
+ *		-H <hash> picks the hash policy of a new store
+ *		(blake2b or siphash13, see surrogate.h) and -B its ID
+ *		width (8, 12 or 16 bytes); adding to an existing store
+ *		built with another hash or width is refused. -S keeps
+ *		the original string of every ID in the strings
+ *		database. Each batch of lines then has its strings
+ *		checked before its entries are written, and a key or
+ *		URL whose ID collides with another string is reported
+ *		and left out instead of being merged with it. -T
+ *		keeps the expiry index (expiry.h): every pair written
+ *		or seen again is stamped with the time of its batch,
+ *		for sweep.c to remove the pairs that stop coming. -M
+ *		lets the store grow to that many gigabytes instead of
+ *		SURROGATE_MAP_SIZE. The other tools map at least the
+ *		size it has reached, so they read it whole, but write
+ *		only where pages were freed.
+ *
+ *		Tokens end at spaces and, in stores created since
+ *		map_data stopped hashing the newline into the last key
+ *		of a line, at newlines (surrogate_token_delims). Older
+ *		stores keep being fed the old way, so the same key is
+ *		never stored under two IDs.
+ *
+ *		A key purged with purge -l, or a URL under one, is
+ *		cleaned up before anything new is added to it, so the
+ *		purge cannot catch the new entries (purger.h). A batch
+ *		spends at most PURGER_BATCH URLs on that; entries still
+ *		waiting on a purge are held over to the next batch,
+ *		and the last batch settles whatever is left.
+ *
+ *		Every batch starts with surrogate_txn_begin, so the
+ *		batch is logged while compact.c copies the store, and a
+ *		store swapped out by compact.c is reopened.
+ *
+ *		-J <file> times every stage of the ingest (stagetime.h)
+ *		and writes JSON lines to the file. Each commit gives a
+ *		"commit" line: the microseconds of the commit, the
+ *		bytes it handed to write calls and that many pages, the
+ *		bytes that reached storage and the pages the file grew
+ *		by. The commit time includes the sync: LMDB makes its
+ *		two fsyncs (data pages, then the meta page) inside
+ *		mdb_txn_commit, so sync time is not reported on its
+ *		own. Every TIMER lines a "stages" line gives the lines
+ *		per second and, per stage, the count, total time and
+ *		latency percentiles: read (fgets), parse, hash and
+ *		strings per line or batch; settle, lookup (the
+ *		MAX_KEY_COUNT check), put, rev and touch (expiry and
+ *		change log) per entry; commit per batch.
+ *
+ *		-P counts CPU events over the whole ingest (perfcount.h)
+ *		and prints them per entry processed, new or not.
  */
 
 #include <stdio.h>
@@ -23,103 +75,368 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include "lmdb.h"
-#include "blake2/sse/blake2.h"
-#include "blake2/sse/blake2-impl.h"
+#include "surrogate.h"
+#include "idstrings.h"
+#include "expiry.h"
+#include "purger.h"
+#include "stagetime.h"
+#include "perfcount.h"
 
-const int HASH_BYTES = 8;
 const int COMMIT_TXN = 10000;
 const int TIMER = 100000;
-const size_t MAP_SIZE = (size_t) 8*1024*1024*1024;
 const size_t MAX_KEY_COUNT= 100000;
-const unsigned int FLAGS = MDB_DUPSORT |  MDB_DUPFIXED | MDB_CREATE;
+
+// the stages -J times
+enum { READ, PARSE, HASH, STRINGS, SETTLE, LOOKUP, PUT, REV, TOUCH, COMMIT, STAGES };
+static const char *stage_names[STAGES] = { "read", "parse", "hash", "strings", "settle",
+	"lookup", "put", "rev", "touch", "commit" };
+static stagetime_hist *stages;
+
+// record the time since *t under stage s, and restart *t
+static void
+lap (int s, uint64_t *t) {
+
+	uint64_t now = stagetime_now ();
+
+	stagetime_record (&stages[s], now - *t);
+	*t = now;
+}
+
+// the write counters of /proc/self/io: bytes handed to write calls, and
+// bytes sent to storage; 0 where there is no such file
+static void
+read_io (int fd, unsigned long long *wchar, unsigned long long *wbytes) {
+
+	char buf[512], *p;
+	ssize_t n;
+
+	*wchar = *wbytes = 0;
+	if (fd < 0 || (n = pread (fd, buf, sizeof buf - 1, 0)) <= 0)
+		return;
+	buf[n] = '\0';
+	if ((p = strstr (buf, "wchar:")) != NULL)
+		*wchar = strtoull (p + 6, NULL, 10);
+	if ((p = strstr (buf, "\nwrite_bytes:")) != NULL)
+		*wbytes = strtoull (p + 13, NULL, 10);
+}
+
+// commit, timing it whole: splitting off the fsyncs would take
+// MDB_NOSYNC, which lets the meta page reach the disk before the data
+static int
+timed_commit (surrogate_store *st, MDB_txn *txn, FILE *json, int io, int lines) {
+
+	int rc;
+	uint64_t t0, t1;
+	double ns = stagetime_ns_per_tick ();
+	unsigned long long wchar0, wbytes0, wchar1, wbytes1;
+	size_t pgno0;
+	MDB_envinfo info;
+	MDB_stat ms;
+
+	mdb_env_info (st->env, &info);
+	pgno0 = info.me_last_pgno;
+	read_io (io, &wchar0, &wbytes0);
+	t0 = stagetime_now ();
+	rc = mdb_txn_commit (txn);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	t1 = stagetime_now ();
+	stagetime_record (&stages[COMMIT], t1 - t0);
+	read_io (io, &wchar1, &wbytes1);
+	mdb_env_info (st->env, &info);
+	mdb_env_stat (st->env, &ms);
+
+	fprintf (json, "{\"type\":\"commit\",\"lines\":%d,\"commit_us\":%.1f,"
+		"\"written_bytes\":%llu,\"written_pages\":%llu,\"storage_bytes\":%llu,\"new_pages\":%zu}\n",
+		lines, (t1 - t0) * ns / 1e3, wchar1 - wchar0, (wchar1 - wchar0) / ms.ms_psize,
+		wbytes1 - wbytes0, info.me_last_pgno - pgno0);
+	return MDB_SUCCESS;
+}
+
+// the stages since the last report
+static void
+report_stages (FILE *json, int lines, int period, double secs) {
+
+	int s;
+
+	fprintf (json, "{\"type\":\"stages\",\"lines\":%d,\"secs\":%.6f,\"lines_per_sec\":%.1f",
+		lines, secs, secs > 0 ? period / secs : 0);
+	for (s = 0; s < STAGES; s++) {
+		fprintf (json, ",\"%s\":", stage_names[s]);
+		stagetime_json (json, &stages[s]);
+		stagetime_reset (&stages[s]);
+	}
+	fprintf (json, "}\n");
+	fflush (json);
+}
+
+// a key -> URL entry waiting for the end of its batch
+typedef struct edge {
+	unsigned char key [SURROGATE_MAX_HASH_BYTES];
+	unsigned char url [SURROGATE_MAX_HASH_BYTES];
+} edge;
+
+// begin the next batch, on the new store if compact.c swapped it
+static int
+begin_batch (surrogate_store *st, const surrogate_config *cfg, MDB_txn **txn) {
+
+	int rc;
+
+	rc = surrogate_txn_begin (st, 0, txn);
+	if (rc != SURROGATE_STALE)
+		return rc;
+	surrogate_close (st);
+	rc = surrogate_open_config (st, SURROGATE_DB_DIR, 0, cfg);
+	if (rc == MDB_SUCCESS)
+		rc = surrogate_txn_begin (st, 0, txn);
+	return rc;
+}
+
+// settle the purge pending on id, a URL or a key, out of *left URLs, or
+// all of it when not bounded; whether nothing is pending on it now
+static int
+settle (surrogate_store *st, MDB_txn *txn, purger_pendset *ps, const void *id, int url,
+		int bounded, size_t *left) {
+
+	int rc, done;
+	size_t n;
+
+	if (!url && !purger_pendset_has (st, txn, ps, id))
+		return 1;
+	if (bounded && *left == 0)
+		return url && !purger_pendset_url (st, txn, ps, id);
+	if (url)
+		rc = purger_settle_url (st, txn, ps, id, bounded ? *left : 0, &n, &done);
+	else
+		rc = purger_settle (st, txn, ps, id, bounded ? *left : 0, &n, &done);
+	assert (rc == MDB_SUCCESS);
+	if (bounded)
+		*left -= n;
+	return done;
+}
+
+static void
+report_collision (const void *id, const MDB_val *stored, const MDB_val *other, void *ctx) {
+
+	char hex [2 * SURROGATE_MAX_HASH_BYTES + 1];
+
+	(void) ctx;
+	surrogate_hex (hex, id);
+	fprintf (stderr, "Hash collision on %s: \"%.*s\" and \"%.*s\"\n", hex,
+		(int) stored->mv_size, (char *) stored->mv_data,
+		(int) other->mv_size, (char *) other->mv_data);
+}
 
 int
 main(int argc, char * argv[]) {
     
 	// set up variables
-        int rc, keys_added, duplicates; 
-	size_t count, max_count;
+        int rc, opt, keys_added = 0, duplicates = 0, skipped = 0;
+	size_t count, i, nedges = 0, nheld, max_edges = 0, collisions = 0, found = 0;
+	size_t settle_left;
 
 	int lines = 0;
 	clock_t begin = clock();
 	clock_t end;
 	double time_spent;
+	unsigned long long now;
+	int pending, url_ok = 1, url_checked;
+	unsigned char settled [SURROGATE_MAX_HASH_BYTES];
+	purger_pendset pend = { NULL, 0, 0, 0 };
+	FILE *json = NULL;
+	int io = -1, reported = 0, counting = 0;
+	perfcount pc;
+	uint64_t t = 0, hash_ticks = 0, line_start = 0;
+	struct timespec wall, wall_now;
 
-	MDB_env *env;
-        MDB_dbi dbi, dbi_rev;
+	surrogate_store st;
+	surrogate_config cfg = { NULL, 0, 0, 0, 0 };
+	idstrings *strings = NULL;
+	edge *edges = NULL, *e;
         MDB_txn *txn;
         MDB_cursor *cursor;
 
         // set up key and node info
         MDB_val mkey, mval, tmp_val;
-        char key [HASH_BYTES]; 
-        char val [HASH_BYTES];
-        
-	mkey.mv_size = HASH_BYTES;
-        mkey.mv_data = &key;
-        mval.mv_size = HASH_BYTES; 
-        mval.mv_data = &val;
-
-        // initialize environment; set 2 database limit
-        rc = mdb_env_create (&env);
-        assert (rc == MDB_SUCCESS);
-	rc = mdb_env_set_mapsize (env, MAP_SIZE);
-        assert (rc == MDB_SUCCESS);
-	rc = mdb_env_set_maxreaders (env, 1);
-        assert (rc == MDB_SUCCESS);
-	rc = mdb_env_set_maxdbs (env, 2); 
-        assert (rc == MDB_SUCCESS);  
-        rc = mdb_env_open (env, "./db_dir", 0, 0664);
-        assert (rc == MDB_SUCCESS); 
+
+	while ((opt = getopt (argc, argv, "H:B:STM:J:P")) != -1) {
+		if (opt == 'H')
+			cfg.hash = optarg;
+		else if (opt == 'B')
+			cfg.hash_bytes = atoi (optarg);
+		else if (opt == 'S')
+			cfg.strings = 1;
+		else if (opt == 'T')
+			cfg.expiry = 1;
+		else if (opt == 'M' && atoi (optarg) > 0)
+			cfg.map_size = (size_t) atoi (optarg) << 30;
+		else if (opt == 'J' && (json = fopen (optarg, "w")) != NULL)
+			continue;
+		else if (opt == 'P')
+			counting = 1;
+		else {
+			fprintf (stderr, "usage: %s [-H blake2b|siphash13] [-B 8|12|16] [-S] [-T] [-M GB] [-J stats] [-P] < data\n", argv[0]);
+			return -1;
+		}
+	}
+	if (json != NULL) {
+		stages = calloc (STAGES, sizeof *stages);
+		assert (stages != NULL);
+		io = open ("/proc/self/io", O_RDONLY);
+		stagetime_ns_per_tick ();
+		clock_gettime (CLOCK_MONOTONIC, &wall);
+	}
+	if (counting && (rc = perfcount_open (&pc)) != 0) {
+		fprintf (stderr, "No CPU counters: %s\n", strerror (rc));
+		counting = 0;
+	}
+
+        // open environment and databases; the store fixes the hash
+	rc = surrogate_open_config (&st, SURROGATE_DB_DIR, 0, &cfg);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to open data store: %s\n", surrogate_strerror (rc));
+		return -1;
+	}
+	if (st.dbi_strings != 0) {
+		rc = idstrings_create (st.hash_bytes, &strings);
+		assert (rc == MDB_SUCCESS);
+	}
+
+	mkey.mv_size = st.hash_bytes;
+        mval.mv_size = st.hash_bytes; 
 
         // begin transaction
-        rc = mdb_txn_begin (env, NULL, 0, &txn);
+        rc = begin_batch (&st, &cfg, &txn);
         assert (rc == MDB_SUCCESS); 
-	
-	// open databases 
-        rc = mdb_dbi_open (txn, "data_store", FLAGS, &dbi);
-        assert (rc == MDB_SUCCESS);
-	rc = mdb_dbi_open (txn, "rev_data_store", FLAGS, &dbi_rev); 
-        assert(rc == MDB_SUCCESS); 
 
 	// initiate cursors
-        rc = mdb_cursor_open (txn, dbi, &cursor); 
+        rc = mdb_cursor_open (txn, st.dbi, &cursor); 
         assert (rc == MDB_SUCCESS);
 
+	if (counting)
+		perfcount_start (&pc);
+
 	// set up for hashing
-        size_t j;
         char line [500];
         char * token;
+	const char * delims = surrogate_token_delims (&st);
+	int more = 1;
   
-	uint8_t hash_key[HASH_BYTES];
-        for( j = 0; j < HASH_BYTES; ++j ) {       
-                hash_key[j] = ( uint8_t )j;
-        }
+	// process the input a batch of lines at a time
+	while (more) {
+		if (json != NULL)
+			t = stagetime_now ();
+		more = fgets (line, 500, stdin) != NULL;
+		if (json != NULL) {
+			lap (READ, &t);
+			line_start = t;
+			hash_ticks = 0;
+		}
 
-	// process each line
-	while ( fgets (line, 500, stdin) != NULL ) {       
+		if (more && (token = strtok (line, delims)) != NULL) {  //gets url
+			unsigned char url [SURROGATE_MAX_HASH_BYTES];
 
-                token = strtok (line, " ");  //gets url
+			// hash URL        
+			if (json != NULL)
+				t = stagetime_now ();
+			rc = surrogate_hash (url, token, strlen (token));
+			assert (rc == 0);
+			if (strings != NULL) {
+				rc = idstrings_add (strings, url, token, strlen (token));
+				assert (rc == MDB_SUCCESS);
+			}
+			if (json != NULL)
+				hash_ticks += stagetime_now () - t;
 
-                // hash URL        
-                rc = blake2b (val, HASH_BYTES, token, strlen (token) , hash_key, HASH_BYTES);
-                assert (rc == 0);
-		
-               // process each key 
-                while ((token = strtok (NULL, " ")) != NULL) {     
+			// process each key 
+			while ((token = strtok (NULL, delims)) != NULL) {     
+				if (nedges == max_edges) {
+					max_edges = max_edges ? 2 * max_edges : 65536;
+					edges = realloc (edges, max_edges * sizeof *edges);
+					assert (edges != NULL);
+				}
+				e = &edges[nedges++];
+				memcpy (e->url, url, st.hash_bytes);
 
-			// hash key 
-                        rc = blake2b (key, HASH_BYTES, token, strlen (token), hash_key, HASH_BYTES);
-                        assert (rc == 0); 
-              	 		
-			// check if key exists and has too many data entries
-			if ( mdb_cursor_get (cursor, &mkey, &tmp_val, MDB_SET) == 0) {
-				mdb_cursor_count (cursor, &count);
-				if (count >= MAX_KEY_COUNT) {
+				// hash key 
+				if (json != NULL)
+					t = stagetime_now ();
+				rc = surrogate_hash (e->key, token, strlen (token));
+				assert (rc == 0); 
+				if (strings != NULL) {
+					rc = idstrings_add (strings, e->key, token, strlen (token));
+					assert (rc == MDB_SUCCESS);
+				}
+				if (json != NULL)
+					hash_ticks += stagetime_now () - t;
+			}
+
+			// track lines read
+			lines++;  
+			if (json != NULL) {
+				// parse is the rest of the line's time
+				t = stagetime_now ();
+				stagetime_record (&stages[HASH], hash_ticks);
+				stagetime_record (&stages[PARSE], t - line_start - hash_ticks);
+			}
+		}
+
+		if (more && (lines % COMMIT_TXN) != 0)
+			continue;
+
+		// check the batch's strings before any of its entries go in
+		if (json != NULL)
+			t = stagetime_now ();
+		if (strings != NULL) {
+			rc = idstrings_flush (strings, &st, txn, report_collision, NULL, &found);
+			assert (rc == MDB_SUCCESS);
+			collisions += found;
+			if (json != NULL)
+				lap (STRINGS, &t);
+		}
+
+		now = time (NULL);
+		rc = purger_pendset_load (&st, txn, &pend);
+		assert (rc == MDB_SUCCESS);
+		pending = pend.n > 0 || pend.overflow;
+		settle_left = PURGER_BATCH;
+		nheld = 0;
+		url_checked = 0;
+		for (i = 0, e = edges; i < nedges; i++, e++) {
+			if (strings != NULL && found > 0 &&
+			    (idstrings_collided (strings, e->key) || idstrings_collided (strings, e->url))) {
+				skipped++;
+				continue;
+			}
+			mkey.mv_data = e->key;
+			mval.mv_data = e->url;
+
+			// finish purges still pending on the URL and the key, or
+			// hold the entry over; the last batch settles them all
+			if (pending) {
+				if (!url_checked || memcmp (settled, e->url, st.hash_bytes) != 0) {
+					url_ok = settle (&st, txn, &pend, e->url, 1, more, &settle_left);
+					memcpy (settled, e->url, st.hash_bytes);
+					url_checked = 1;
+				}
+				if (!url_ok || !settle (&st, txn, &pend, e->key, 0, more, &settle_left)) {
+					edges[nheld++] = *e;
 					continue;
 				}
+				if (json != NULL)
+					lap (SETTLE, &t);
 			}
+              	 		
+			// check if key exists and has too many data entries
+			rc = mdb_cursor_get (cursor, &mkey, &tmp_val, MDB_SET);
+			if (rc == 0)
+				mdb_cursor_count (cursor, &count);
+			if (json != NULL)
+				lap (LOOKUP, &t);
+			if (rc == 0 && count >= MAX_KEY_COUNT)
+				continue;
 			
 			// enter in database
                 	rc = mdb_cursor_put (cursor, &mkey, &mval, MDB_NODUPDATA);
@@ -127,64 +444,109 @@ main(int argc, char * argv[]) {
 			// track number of duplicates	
 			if (rc == MDB_KEYEXIST) {
 				duplicates++;	
+				if (json != NULL)
+					lap (PUT, &t);
+				rc = expiry_touch (&st, txn, e->key, e->url, now);
+				assert (rc == MDB_SUCCESS);
+				if (json != NULL)
+					lap (TOUCH, &t);
 				continue;
 			}
 			else if ( rc == 0) {
 				keys_added++;
+				rc = surrogate_log (&st, txn, SURROGATE_LOG_PUT, SURROGATE_LOG_DATA, &mkey, &mval);
+				assert (rc == MDB_SUCCESS);
 			}	
 			else {  
                                 fprintf (stderr, "Failure to add key into database");
                                 return -1;
                         }
+			if (json != NULL)
+				lap (PUT, &t);
 			
-			// track count of items at current key
-			rc = mdb_cursor_count (cursor, &count);
-		        assert (rc == MDB_SUCCESS);
-		
-			//fprintf (stdout, "Key: %s\t\t\t Count: %zu \n",  mkey.mv_data, count);
-	
 			// enter in reverse-mapped database
-               		rc = mdb_put ( txn, dbi_rev, &mval, &mkey, 0); 
+               		rc = mdb_put ( txn, st.dbi_rev, &mval, &mkey, 0); 
                 	assert (rc == MDB_SUCCESS);
-			
+			if (json != NULL)
+				lap (REV, &t);
+			rc = surrogate_log (&st, txn, SURROGATE_LOG_PUT, SURROGATE_LOG_REV, &mval, &mkey);
+			assert (rc == MDB_SUCCESS);
+			rc = expiry_touch (&st, txn, e->key, e->url, now);
+			assert (rc == MDB_SUCCESS);
+			if (json != NULL)
+				lap (TOUCH, &t);
 		}
-		
-		// track lines read
-                lines++;  
-		
-		if ((lines % COMMIT_TXN) == 0) {
-                	//commit transaction
-                	rc = mdb_txn_commit (txn);
-                	assert (rc == MDB_SUCCESS);
+		nedges = nheld;
+		if (strings != NULL)
+			idstrings_clear (strings);
+		if (!more)
+			break;
 
-                	// reset transaction
-                	rc = mdb_txn_begin (env, NULL, 0, &txn);
-                	assert (rc == MDB_SUCCESS);
+               	//commit transaction
+		if (json != NULL)
+			rc = timed_commit (&st, txn, json, io, lines);
+		else
+			rc = mdb_txn_commit (txn);
+               	assert (rc == MDB_SUCCESS);
+
+               	// reset transaction
+               	rc = begin_batch (&st, &cfg, &txn);
+               	assert (rc == MDB_SUCCESS);
 		
-                	// re-initiate cursor
-                	rc = mdb_cursor_open (txn, dbi, &cursor);
-                	assert (rc == MDB_SUCCESS);
-          	}
+               	// re-initiate cursor
+               	rc = mdb_cursor_open (txn, st.dbi, &cursor);
+               	assert (rc == MDB_SUCCESS);
 
 		if (lines % TIMER == 0) {
 			end = clock();
 			time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
 			begin = end;
 			fprintf (stdout, "%d %f\n", lines, time_spent);
+			if (json != NULL) {
+				clock_gettime (CLOCK_MONOTONIC, &wall_now);
+				report_stages (json, lines, lines - reported, wall_now.tv_sec - wall.tv_sec +
+					(wall_now.tv_nsec - wall.tv_nsec) * 1e-9);
+				reported = lines;
+				wall = wall_now;
+			}
 		}
 	}
 	
 	fprintf (stdout, "\nAdded a total of %d keys to the data store \n", keys_added);
 	fprintf (stdout, "\nThere were %d duplicates \n", duplicates); 
+	if (strings != NULL)
+		fprintf (stdout, "\nThere were %zu hash collisions; %d entries left out \n", collisions, skipped);
 	
 	//close cursor
 	mdb_cursor_close (cursor);
 	
 	//commit transaction
-	mdb_txn_commit (txn); 
+	if (json != NULL) {
+		timed_commit (&st, txn, json, io, lines);
+		clock_gettime (CLOCK_MONOTONIC, &wall_now);
+		report_stages (json, lines, lines - reported, wall_now.tv_sec - wall.tv_sec +
+			(wall_now.tv_nsec - wall.tv_nsec) * 1e-9);
+		fclose (json);
+		if (io >= 0)
+			close (io);
+		free (stages);
+	}
+	else
+		mdb_txn_commit (txn); 
+	if (counting) {
+		perfcount_stop (&pc);
+		fprintf (stdout, "\nPer entry: ");
+		perfcount_print (stdout, &pc, keys_added + duplicates);
+		fprintf (stdout, "\n");
+		perfcount_close (&pc);
+	}
 	
 	//close environment
-        mdb_env_close (env);
+	if (strings != NULL)
+		idstrings_destroy (strings);
+	free (edges);
+	purger_pendset_free (&pend);
+        surrogate_close (&st);
 
         return 0;
 }
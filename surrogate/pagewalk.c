@@ -0,0 +1,422 @@
+/*
+ * File Name:	pagewalk.c
+ * Function:	Page level walk of a database. See pagewalk.h.
+ *
+ *		cc ... pagewalk.c -llmdb -pthread
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pagewalk.h"
+
+// the layout of LMDB 0.9 pages and nodes, after mdb.c
+#define PAGEHDRSZ	16		// pgno, pad, flags, lower/upper or pages
+#define NODESZ		8		// lo, hi, flags, ksize
+#define P_BRANCH	0x01
+#define P_LEAF		0x02
+#define P_OVERFLOW	0x04
+#define P_LEAF2		0x20
+#define F_BIGDATA	0x01
+#define F_SUBDATA	0x02
+#define F_DUPDATA	0x04
+#define P_INVALID	(~(uint64_t) 0)
+
+// a database record (MDB_db), as the main database holds it by name
+typedef struct dbrec {
+	uint32_t pad;
+	uint16_t flags, depth;
+	uint64_t branch_pages, leaf_pages, overflow_pages, entries, root;
+} dbrec;
+
+// at most this many subtrees per thread are handed out
+#define SPLIT 8
+
+typedef struct walk {
+	const unsigned char *map;
+	size_t psize;
+	uint64_t npages;
+	uint64_t *todo;			// subtree roots for the threads
+	size_t ntodo, next;
+	unsigned int level;		// of the subtrees
+	pthread_mutex_t lock;
+	pagewalk_fn fn;			// for each page, unless NULL
+	void *ctx;
+} walk;
+
+typedef struct worker {
+	walk *w;
+	pagewalk_stat stat;
+	unsigned int index;		// passed to fn as its thread
+	pthread_t tid;
+} worker;
+
+static unsigned int
+u16 (const unsigned char *p) {
+
+	uint16_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static uint32_t
+u32 (const unsigned char *p) {
+
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static uint64_t
+u64 (const unsigned char *p) {
+
+	uint64_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+// the lower and upper halves of a node's size or child page number
+static uint64_t
+node_lohi (const unsigned char *node) {
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return u16 (node + 2) | (uint64_t) u16 (node) << 16;
+#else
+	return u16 (node) | (uint64_t) u16 (node + 2) << 16;
+#endif
+}
+
+static unsigned int
+numkeys (const unsigned char *p) {
+
+	return (u16 (p + 12) - PAGEHDRSZ) >> 1;
+}
+
+static const unsigned char *
+page (const walk *w, uint64_t pgno) {
+
+	return pgno < w->npages ? w->map + pgno * w->psize : NULL;
+}
+
+// whether the free space of a page of size bytes lies within it
+static int
+valid (const unsigned char *p, size_t size) {
+
+	unsigned int lower = u16 (p + 12), upper = u16 (p + 14);
+	return lower >= PAGEHDRSZ && lower <= upper && upper <= size;
+}
+
+// the node i of page p of size bytes, or NULL when it lies outside
+static const unsigned char *
+node (const unsigned char *p, size_t size, unsigned int i) {
+
+	unsigned int off = u16 (p + PAGEHDRSZ + 2 * i);
+	if (off < PAGEHDRSZ || off + NODESZ > size || off + NODESZ + u16 (p + off + 6) > size)
+		return NULL;
+	return p + off;
+}
+
+static void tree (worker *k, uint64_t pgno, unsigned int level, int sub);
+
+static void
+visit (const worker *k, uint64_t pgno, int kind, unsigned int level, unsigned int pages) {
+
+	if (k->w->fn != NULL)
+		k->w->fn (pgno, kind, level, pages, k->index, k->w->ctx);
+}
+
+// the values of a leaf node of the main tree, at level
+static void
+values (worker *k, const unsigned char *n, size_t room, unsigned int level) {
+
+	const walk *w = k->w;
+	pagewalk_stat *s = &k->stat;
+	unsigned int flags = u16 (n + 4), ksize = u16 (n + 6);
+	uint64_t dsize = node_lohi (n), count = 1;
+	const unsigned char *data = n + NODESZ + ksize, *op;
+	dbrec db;
+
+	if (dsize > room && !(flags & F_BIGDATA)) {
+		s->bad_pages++;
+		return;
+	}
+	s->keys++;
+	if (flags & F_BIGDATA) {
+		op = page (w, u64 (data));
+		if (op != NULL && u16 (op + 10) & P_OVERFLOW) {
+			s->overflow_pages += u32 (op + 12);
+			s->overflow_bytes += dsize;
+			visit (k, u64 (data), PAGEWALK_OVERFLOW, level + 1, u32 (op + 12));
+		}
+		else
+			s->bad_pages++;
+	}
+	else if (flags & F_DUPDATA && flags & F_SUBDATA && dsize == sizeof db) {
+		memcpy (&db, data, sizeof db);
+		s->subdbs++;
+		s->subdb_depth[db.depth <= PAGEWALK_MAX_DEPTH ? db.depth : PAGEWALK_MAX_DEPTH]++;
+		count = db.entries;
+		if (db.root != P_INVALID)
+			tree (k, db.root, 0, 1);
+	}
+	else if (flags & F_DUPDATA) {
+		if (dsize < PAGEHDRSZ || !valid (data, dsize)) {
+			s->bad_pages++;
+			return;
+		}
+		count = numkeys (data);
+		s->inline_keys++;
+		s->inline_values += count;
+		s->inline_bytes += dsize;
+	}
+	if (count > s->max_values)
+		s->max_values = count;
+}
+
+static void
+tree (worker *k, uint64_t pgno, unsigned int level, int sub) {
+
+	const walk *w = k->w;
+	pagewalk_stat *s = &k->stat;
+	const unsigned char *p = page (w, pgno), *n;
+	unsigned int flags, i, keys;
+	unsigned long long used;
+
+	if (p == NULL || level >= PAGEWALK_MAX_DEPTH || !valid (p, w->psize)) {
+		s->bad_pages++;
+		return;
+	}
+	flags = u16 (p + 10);
+	keys = numkeys (p);
+	used = w->psize - PAGEHDRSZ - (u16 (p + 14) - u16 (p + 12));
+
+	if (flags & P_BRANCH) {
+		visit (k, pgno, sub ? PAGEWALK_SUB_BRANCH : PAGEWALK_BRANCH, level, 1);
+		if (sub) {
+			s->sub_branch_pages++;
+			s->sub_branch_used += used;
+		}
+		else {
+			s->branch_pages++;
+			s->branch_used += used;
+		}
+		for (i = 0; i < keys; i++) {
+			if ((n = node (p, w->psize, i)) == NULL) {
+				s->bad_pages++;
+				continue;
+			}
+			tree (k, node_lohi (n) | (uint64_t) u16 (n + 4) << 32, level + 1, sub);
+		}
+	}
+	else if (flags & P_LEAF) {
+		visit (k, pgno, sub ? PAGEWALK_SUB_LEAF : PAGEWALK_LEAF, level, 1);
+		if (sub) {
+			s->sub_leaf_pages++;
+			s->sub_leaf_used += used;
+			return;
+		}
+		s->leaf_pages++;
+		s->leaf_used += used;
+		for (i = 0; i < keys; i++) {
+			if ((n = node (p, w->psize, i)) == NULL) {
+				s->bad_pages++;
+				continue;
+			}
+			values (k, n, w->psize - (n - p) - NODESZ - u16 (n + 6), level);
+		}
+	}
+	else
+		s->bad_pages++;
+}
+
+static void
+merge (pagewalk_stat *to, const pagewalk_stat *from) {
+
+	int i;
+
+	to->branch_pages += from->branch_pages;
+	to->leaf_pages += from->leaf_pages;
+	to->overflow_pages += from->overflow_pages;
+	to->branch_used += from->branch_used;
+	to->leaf_used += from->leaf_used;
+	to->overflow_bytes += from->overflow_bytes;
+	to->keys += from->keys;
+	if (from->max_values > to->max_values)
+		to->max_values = from->max_values;
+	to->inline_keys += from->inline_keys;
+	to->inline_values += from->inline_values;
+	to->inline_bytes += from->inline_bytes;
+	to->subdbs += from->subdbs;
+	for (i = 0; i <= PAGEWALK_MAX_DEPTH; i++)
+		to->subdb_depth[i] += from->subdb_depth[i];
+	to->sub_branch_pages += from->sub_branch_pages;
+	to->sub_leaf_pages += from->sub_leaf_pages;
+	to->sub_branch_used += from->sub_branch_used;
+	to->sub_leaf_used += from->sub_leaf_used;
+	to->bad_pages += from->bad_pages;
+}
+
+static void *
+work (void *arg) {
+
+	worker *k = arg;
+	walk *w = k->w;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock (&w->lock);
+		i = w->next++;
+		pthread_mutex_unlock (&w->lock);
+		if (i >= w->ntodo)
+			break;
+		tree (k, w->todo[i], w->level, 0);
+	}
+	return NULL;
+}
+
+// read the branch levels at the top until there are enough subtrees
+// for the threads, on the first one, k
+static int
+split (walk *w, worker *k, uint64_t root, size_t want) {
+
+	pagewalk_stat *s = &k->stat;
+	const unsigned char *p, *n;
+	uint64_t *next;
+	size_t i, nnext;
+	unsigned int j, keys;
+
+	w->todo = malloc (sizeof *w->todo);
+	if (w->todo == NULL)
+		return ENOMEM;
+	w->todo[0] = root;
+	w->ntodo = 1;
+	w->level = 0;
+	while (w->ntodo < want && w->level + 1 < PAGEWALK_MAX_DEPTH) {
+		// a level down, if the whole level is branch pages
+		for (i = nnext = 0; i < w->ntodo; i++) {
+			p = page (w, w->todo[i]);
+			if (p == NULL || !valid (p, w->psize) || !(u16 (p + 10) & P_BRANCH))
+				return 0;
+			nnext += numkeys (p);
+		}
+		next = malloc ((nnext + 1) * sizeof *next);
+		if (next == NULL)
+			return ENOMEM;
+		for (i = nnext = 0; i < w->ntodo; i++) {
+			p = page (w, w->todo[i]);
+			keys = numkeys (p);
+			visit (k, w->todo[i], PAGEWALK_BRANCH, w->level, 1);
+			s->branch_pages++;
+			s->branch_used += w->psize - PAGEHDRSZ - (u16 (p + 14) - u16 (p + 12));
+			for (j = 0; j < keys; j++) {
+				if ((n = node (p, w->psize, j)) == NULL)
+					s->bad_pages++;
+				else
+					next[nnext++] = node_lohi (n) | (uint64_t) u16 (n + 4) << 32;
+			}
+		}
+		free (w->todo);
+		w->todo = next;
+		w->ntodo = nnext;
+		w->level++;
+	}
+	return 0;
+}
+
+int
+pagewalk (MDB_txn *txn, const char *name, unsigned int threads, pagewalk_stat *stat) {
+
+	return pagewalk_pages (txn, name, threads, NULL, NULL, stat);
+}
+
+int
+pagewalk_pages (MDB_txn *txn, const char *name, unsigned int threads, pagewalk_fn fn,
+		void *ctx, pagewalk_stat *stat) {
+
+	int rc, fd;
+	unsigned int i, started = 0;
+	MDB_env *env = mdb_txn_env (txn);
+	MDB_dbi main_dbi;
+	MDB_val key, data;
+	MDB_stat ms;
+	struct stat sb;
+	dbrec db;
+	walk w;
+	worker *k;
+
+	memset (stat, 0, sizeof *stat);
+	rc = mdb_dbi_open (txn, NULL, 0, &main_dbi);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	key.mv_size = strlen (name);
+	key.mv_data = (void *) name;
+	rc = mdb_get (txn, main_dbi, &key, &data);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	if (data.mv_size != sizeof db)
+		return MDB_INCOMPATIBLE;
+	memcpy (&db, data.mv_data, sizeof db);
+	rc = mdb_env_stat (env, &ms);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	stat->page_size = ms.ms_psize;
+	stat->depth = db.depth;
+	stat->entries = db.entries;
+	if (db.root == P_INVALID)
+		return MDB_SUCCESS;
+
+	rc = mdb_env_get_fd (env, &fd);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	if (fstat (fd, &sb) != 0)
+		return errno;
+	memset (&w, 0, sizeof w);
+	w.fn = fn;
+	w.ctx = ctx;
+	w.psize = ms.ms_psize;
+	w.npages = sb.st_size / w.psize;
+	w.map = mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (w.map == MAP_FAILED)
+		return errno;
+	if (threads == 0)
+		threads = 1;
+	k = calloc (threads, sizeof *k);
+	if (k != NULL)
+		k[0].w = &w;
+	rc = k == NULL ? ENOMEM : split (&w, &k[0], db.root, (size_t) threads * SPLIT);
+	if (rc == 0) {
+		pthread_mutex_init (&w.lock, NULL);
+		if (threads > w.ntodo)
+			threads = w.ntodo;
+		for (i = 0; i < threads; i++) {
+			k[i].w = &w;
+			k[i].index = i;
+			if (i > 0 && pthread_create (&k[i].tid, NULL, work, &k[i]) != 0)
+				break;
+			started = i + 1;
+		}
+		// this thread is the first worker
+		work (&k[0]);
+		for (i = 1; i < started; i++)
+			pthread_join (k[i].tid, NULL);
+		for (i = 0; i < started; i++)
+			merge (stat, &k[i].stat);
+		pthread_mutex_destroy (&w.lock);
+	}
+	free (w.todo);
+	free (k);
+	munmap ((void *) w.map, sb.st_size);
+	return rc;
+}
+
+double
+pagewalk_fill (const pagewalk_stat *stat, unsigned long long pages, unsigned long long used) {
+
+	if (pages == 0 || stat->page_size <= PAGEHDRSZ)
+		return 0;
+	return (double) used / (pages * (stat->page_size - PAGEHDRSZ));
+}
@@ -0,0 +1,77 @@
+/*
+ * File Name:	pagewalk.h
+ * Function:	Physical layout of a named database, read page by
+ *		page. mdb_stat gives a database's depth and page
+ *		counts but not how full its pages are, and nothing of
+ *		the sub-trees MDB_DUPSORT keeps values in: the values
+ *		of a key sit in a sub-page inside its leaf node until
+ *		they outgrow it, then in a B+tree of their own whose
+ *		depth adds to every lookup of the key.
+ *
+ *		The walk maps the data file read-only and follows the
+ *		database from its root as the caller's read transaction
+ *		sees it, so writers may run meanwhile. The top of the
+ *		tree is read first and the subtrees below it are shared
+ *		out among threads. It reads the page layout of LMDB 0.9
+ *		(data version 1, see mdb.c) directly, as the API has no
+ *		way to it; pages that do not parse are counted as bad
+ *		and skipped rather than followed.
+ */
+
+#ifndef PAGEWALK_H
+#define PAGEWALK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lmdb.h"
+
+#define PAGEWALK_MAX_DEPTH	16
+
+// kinds of pages; SUB ones belong to MDB_DUPSORT sub-trees
+enum {
+	PAGEWALK_BRANCH,
+	PAGEWALK_LEAF,
+	PAGEWALK_OVERFLOW,
+	PAGEWALK_SUB_BRANCH,
+	PAGEWALK_SUB_LEAF,
+	PAGEWALK_KINDS
+};
+
+typedef struct pagewalk_stat {
+	size_t page_size;
+	unsigned int depth;			// of the tree, from its record
+	unsigned long long entries;		// likewise: values, all keys
+	unsigned long long branch_pages, leaf_pages, overflow_pages;
+	unsigned long long branch_used, leaf_used;	// bytes of those pages in use
+	unsigned long long overflow_bytes;	// of values kept in overflow pages
+	unsigned long long keys;		// leaf nodes
+	unsigned long long max_values;		// most values of one key
+	// MDB_DUPSORT values in a sub-page of the key's node
+	unsigned long long inline_keys, inline_values, inline_bytes;
+	// and in sub-trees, by depth, with their pages
+	unsigned long long subdbs, subdb_depth[PAGEWALK_MAX_DEPTH + 1];
+	unsigned long long sub_branch_pages, sub_leaf_pages;
+	unsigned long long sub_branch_used, sub_leaf_used;
+	unsigned long long bad_pages;
+} pagewalk_stat;
+
+/* called for each page walked, from whichever thread walks it, with
+ * its number, kind, level in its tree (0 at the root; overflow pages
+ * are one below their leaf), length in pages and the thread, numbered
+ * from 0 and below the threads asked for, so fn can count per thread
+ * without a lock */
+typedef void (*pagewalk_fn) (uint64_t pgno, int kind, unsigned int level, unsigned int pages,
+		unsigned int thread, void *ctx);
+
+/* walk database name as txn sees it, with up to threads threads;
+ * MDB_NOTFOUND when there is no such database. pagewalk_pages also
+ * calls fn (unless NULL) with ctx for every page. */
+int pagewalk (MDB_txn *txn, const char *name, unsigned int threads, pagewalk_stat *stat);
+int pagewalk_pages (MDB_txn *txn, const char *name, unsigned int threads, pagewalk_fn fn,
+		void *ctx, pagewalk_stat *stat);
+
+/* the fraction of the space of pages bytes in use, 0 for no pages */
+double pagewalk_fill (const pagewalk_stat *stat, unsigned long long pages,
+		unsigned long long used);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * File Name:	perfcount.c
+ * Function:	Hardware counters. See perfcount.h.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfcount.h"
+
+const char *perfcount_names[] = { "cycles", "instructions", "llc_misses", "dtlb_misses",
+	"branch_misses" };
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} events[PERFCOUNT_EVENTS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+int
+perfcount_open (perfcount *pc) {
+
+	struct perf_event_attr attr;
+	int i, err = 0, any = 0;
+
+	for (i = 0; i < PERFCOUNT_EVENTS; i++) {
+		memset (&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		pc->fd[i] = syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		pc->value[i] = -1;
+		if (pc->fd[i] >= 0)
+			any = 1;
+		else if (err == 0)
+			err = errno;
+	}
+	return any ? 0 : err;
+}
+
+void
+perfcount_close (perfcount *pc) {
+
+	int i;
+
+	for (i = 0; i < PERFCOUNT_EVENTS; i++)
+		if (pc->fd[i] >= 0) {
+			close (pc->fd[i]);
+			pc->fd[i] = -1;
+		}
+}
+
+void
+perfcount_start (perfcount *pc) {
+
+	int i;
+
+	for (i = 0; i < PERFCOUNT_EVENTS; i++)
+		if (pc->fd[i] >= 0) {
+			ioctl (pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl (pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+}
+
+void
+perfcount_stop (perfcount *pc) {
+
+	uint64_t v[3];		// value, time enabled, time running
+	int i;
+
+	for (i = 0; i < PERFCOUNT_EVENTS; i++) {
+		pc->value[i] = -1;
+		if (pc->fd[i] < 0)
+			continue;
+		ioctl (pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read (pc->fd[i], v, sizeof v) != sizeof v || v[2] == 0)
+			continue;
+		pc->value[i] = (double) v[0] * v[1] / v[2];
+	}
+}
+
+static double
+ipc (const perfcount *pc) {
+
+	if (pc->value[PERFCOUNT_CYCLES] <= 0 || pc->value[PERFCOUNT_INSTRUCTIONS] < 0)
+		return -1;
+	return pc->value[PERFCOUNT_INSTRUCTIONS] / pc->value[PERFCOUNT_CYCLES];
+}
+
+void
+perfcount_print (FILE *out, const perfcount *pc, double n) {
+
+	double x = ipc (pc);
+	int i;
+
+	if (x >= 0)
+		fprintf (out, "%.2f IPC", x);
+	else
+		fprintf (out, "n/a IPC");
+	for (i = 0; i < PERFCOUNT_EVENTS; i++) {
+		if (pc->value[i] >= 0 && n > 0)
+			fprintf (out, ", %.2f %s", pc->value[i] / n, perfcount_names[i]);
+		else
+			fprintf (out, ", n/a %s", perfcount_names[i]);
+	}
+}
+
+void
+perfcount_json (FILE *out, const perfcount *pc, double n) {
+
+	double x = ipc (pc);
+	int i;
+
+	if (x >= 0)
+		fprintf (out, ",\"ipc\":%.3f", x);
+	else
+		fprintf (out, ",\"ipc\":null");
+	for (i = 0; i < PERFCOUNT_EVENTS; i++) {
+		if (pc->value[i] >= 0 && n > 0)
+			fprintf (out, ",\"%s\":%.3f", perfcount_names[i], pc->value[i] / n);
+		else
+			fprintf (out, ",\"%s\":null", perfcount_names[i]);
+	}
+}
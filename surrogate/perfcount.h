@@ -0,0 +1,53 @@
+/*
+ * File Name:	perfcount.h
+ * Function:	Hardware counters around a stretch of work, through
+ *		Linux perf_event_open: cycles, instructions, last level
+ *		cache misses, dTLB read misses and branch misses, in
+ *		user space, for this process and the threads and
+ *		children it starts afterwards. Each event is opened on
+ *		its own, so a CPU without one still counts the rest, and
+ *		counts the kernel multiplexed are scaled up to the whole
+ *		stretch. Tools enable it with -P; where perf events are
+ *		not allowed (see /proc/sys/kernel/perf_event_paranoid)
+ *		or not there, as in many VMs, they say so and run
+ *		without.
+ */
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdio.h>
+
+enum {
+	PERFCOUNT_CYCLES,
+	PERFCOUNT_INSTRUCTIONS,
+	PERFCOUNT_LLC_MISSES,
+	PERFCOUNT_DTLB_MISSES,
+	PERFCOUNT_BRANCH_MISSES,
+	PERFCOUNT_EVENTS
+};
+
+typedef struct perfcount {
+	int fd[PERFCOUNT_EVENTS];
+	double value[PERFCOUNT_EVENTS];	// of the last start .. stop; < 0 when not counted
+} perfcount;
+
+extern const char *perfcount_names[];	// by PERFCOUNT_CYCLES ...
+
+/* open the counters, stopped; 0 when any of them counts, or the errno
+ * of the first that failed */
+int perfcount_open (perfcount *pc);
+void perfcount_close (perfcount *pc);
+
+/* count from zero, and stop counting and read the values */
+void perfcount_start (perfcount *pc);
+void perfcount_stop (perfcount *pc);
+
+/* the values per one of n operations, with IPC, as "<ipc> IPC, <x>
+ * instructions, ..." or as JSON fields "ipc", "instructions" ...,
+ * each after a comma, for the caller's object; "n/a" or null when not
+ * counted */
+void perfcount_print (FILE *out, const perfcount *pc, double n);
+void perfcount_json (FILE *out, const perfcount *pc, double n);
+
+#endif
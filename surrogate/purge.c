@@ -1,184 +1,264 @@
+/*
+ * File Name:	purge.c
+ * Function:	Purges a surrogate key: every URL (image) it maps to is
+ *		removed from the store together with all the keys of
+ *		that URL. The key is read from the command line or
+ *		prompted for, hashed or as the hex query.c prints.
+ *
+ *		By default the URLs are removed right away, PURGER_BATCH
+ *		of them per transaction. With -l the key is only marked
+ *		purged, which takes constant time; lookups stop seeing
+ *		it at once and sweep.c removes its URLs later (see
+ *		purger.h).
+ *
+ *		Each -e names a cache node (host:port) to send a PURGE
+ *		for every URL of the key once the purge commits, -l or
+ *		not (see emitter.h).
+ *
+ *		-P counts CPU events over the purge transactions
+ *		(perfcount.h) and prints them per URL removed, or, with
+ *		-l, for the one key marked.
+ *
+ *		purge [-l] [-P] [-e host:port ...] [key]
+ *
+ *		cc purge.c purger.c emitter.c idstrings.c keyset.c \
+ *		   perfcount.c surrogate.c blake2/sse/blake2b.c -llmdb -pthread
+ */
+
 #include <sys/errno.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "lmdb.h"
-#include "blake2/sse/blake2.h"
-#include "blake2/sse/blake2-impl.h"
+#include "surrogate.h"
+#include "purger.h"
+#include "keyset.h"
+#include "emitter.h"
+#include "perfcount.h"
+
+// longest key accepted, as map_data.c reads lines of 500 bytes
+#define KEY_BYTES 500
+
+// begin a transaction, on the new store if compact.c swapped it
+static int
+begin_txn (surrogate_store *st, MDB_txn **txn) {
+
+	int rc;
+
+	rc = surrogate_txn_begin (st, 0, txn);
+	if (rc != SURROGATE_STALE)
+		return rc;
+	surrogate_close (st);
+	rc = surrogate_open (st, SURROGATE_DB_DIR, 0);
+	if (rc == MDB_SUCCESS)
+		rc = surrogate_txn_begin (st, 0, txn);
+	return rc;
+}
+
+static int
+invalidated (const void *url, void *ctx) {
+
+	(void) ctx;
+	purger_invalidated (url);
+	return 0;
+}
+
+// send the URLs purged since the last call to the caches
+static int
+emit (surrogate_store *st, emitter *em) {
 
-const unsigned int FLAGS = MDB_DUPSORT | MDB_DUPFIXED;
-const int HASH_BYTES = 8;
-int byte_to_hex (char outstr[], char * instr);
+	int rc;
+	MDB_txn *txn;
+	emitter_stat s;
+
+	rc = mdb_txn_begin (st->env, NULL, MDB_RDONLY, &txn);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = emitter_resolve (em, st, txn);
+	mdb_txn_abort (txn);
+	if (rc == 0)
+		rc = emitter_run (em, &s);
+	if (rc == 0)
+		fprintf (stdout, "%zu PURGE requests: %zu ok, %zu failed, %zu resent, %zu connects, %.3f ms\n",
+			s.requests, s.ok, s.failed, s.retried, s.connects, s.ms);
+	return rc;
+}
 
 int
 main(int argc, char * argv[]) {
 
         // set up variables
-        int rc, i = 0, j, image_number = 0, key_number = 0;
-        size_t num_images = 0, num_url_keys = 0;
-        char hashed_key [HASH_BYTES];
-        char url_array [HASH_BYTES];
-        char * key_to_delete = malloc (HASH_BYTES);
-        char * hash_status = malloc (HASH_BYTES);
+        int rc, opt, logical = 0, counting = 0;
+        size_t urls, pairs, num_images = 0, num_pairs = 0;
+        unsigned long long gen;
+        char hashed_key [SURROGATE_MAX_HASH_BYTES];
+        char * key_to_delete = calloc (1, KEY_BYTES);
+        char * hash_status = calloc (1, 8);
+        emitter_config ecfg = { {0}, 0, 0, EMITTER_RETRIES, 0 };
+        emitter *em = NULL;
+        perfcount pc;
+        MDB_val key;
 
         // database variables
-        MDB_env *env;
-        MDB_dbi dbi, dbi_rev;
+        surrogate_store st;
         MDB_txn *txn;
-        MDB_cursor *cursor, *cursor2, *cursor_rev;
-        MDB_val key, url, new_key;
-        MDB_stat stats;
-
-        //set up key to look up
-        key.mv_size = HASH_BYTES;
-        key.mv_data = &hashed_key;
-        url.mv_size = HASH_BYTES;
-        url.mv_data = &url_array;
-
-        // set up key
-        uint8_t hash_key[HASH_BYTES];
-        for( j = 0; j < HASH_BYTES; ++j ) {
-                hash_key[j] = (uint8_t) j;
-        }  
+
+        while ((opt = getopt (argc, argv, "lPe:")) != -1) {
+                if (opt == 'l')
+                        logical = 1;
+                else if (opt == 'P')
+                        counting = 1;
+                else if (opt == 'e' && ecfg.nendpoints < EMITTER_MAX_ENDPOINTS)
+                        ecfg.endpoints[ecfg.nendpoints++] = optarg;
+                else {
+                        fprintf (stderr, "usage: %s [-l] [-P] [-e host:port ...] [key]\n", argv[0]);
+                        return -1;
+                }
+        }
+        if (ecfg.nendpoints > 0) {
+                rc = emitter_create (&ecfg, &em);
+                if (rc != 0) {
+                        fprintf (stderr, "Invalid cache endpoint: %s\n", surrogate_strerror (rc));
+                        return -1;
+                }
+                purger_watch (emitter_watch, em);
+        }
+        if (counting && (rc = perfcount_open (&pc)) != 0) {
+                fprintf (stderr, "No CPU counters: %s\n", strerror (rc));
+                counting = 0;
+        }
 
         // assign search key
-        if (argc == 1) {
+        if (optind == argc) {
                 fprintf (stdout, "Enter in key to delete: ");
-                scanf ("%s", key_to_delete);
-        }  
-        else {  
-		strncpy (key_to_delete, argv[1], strlen(argv[1]));
-        }  
+                scanf ("%499s", key_to_delete);
+        }
+        else {
+		strncpy (key_to_delete, argv[optind], KEY_BYTES - 1);
+        }
 
         // get hash status
         fprintf (stdout, "Is this key hashed(yes/no)?\n");
-        scanf ("%s", hash_status);
+        scanf ("%7s", hash_status);
+
+        // open environment and databases; the store fixes the hash
+        rc = surrogate_open (&st, SURROGATE_DB_DIR, 0);
+        if (rc != MDB_SUCCESS) {
+                fprintf (stderr, "Failure to open data store: %s\n", surrogate_strerror (rc));
+                return -1;
+        }
 
         if ((strcmp (hash_status, "no")) == 0) {
                 // hash input string to key
-                rc = blake2b (hashed_key, HASH_BYTES, key_to_delete, strlen(key_to_delete), hash_key, HASH_BYTES);
+                rc = surrogate_hash (hashed_key, key_to_delete, strlen(key_to_delete));
                 assert (rc == 0);
         }
         else if ((strcmp(hash_status, "yes")) == 0) {
-                strncpy(hashed_key, key_to_delete, NUM_BYTES);
+                // hashed keys are given in hex, as query.c prints them
+                if (surrogate_parse_hex (hashed_key, key_to_delete) != 0) {
+                        fprintf (stderr, "Invalid key hash: %s\n", key_to_delete);
+                        return -1;
+                }
         }
         else {
                 fprintf (stderr, "INVAlID INPUT \n Exiting Program...\n");
                 return -1;
         }
 
-        // initialize environment; set 2 database limit
-        rc = mdb_env_create (&env);
-        assert (rc == MDB_SUCCESS);
-        rc = mdb_env_set_maxdbs (env, 2);
-        assert (rc == MDB_SUCCESS);
-        rc = mdb_env_open (env, "./db_dir", 0, 0664);
-        assert (rc == MDB_SUCCESS);
-
-        // begin transaction
-        rc = mdb_txn_begin (env, NULL, 0, &txn);
-        assert (rc == MDB_SUCCESS);
-
-        // open databases
-        rc = mdb_dbi_open (txn, "data_store", FLAGS, &dbi);
-        assert (rc == MDB_SUCCESS);
-        rc = mdb_dbi_open (txn, "rev_data_store", FLAGS, &dbi_rev);
-        assert (rc == MDB_SUCCESS);
-
-        // initiate cursors
-        rc = mdb_cursor_open (txn, dbi, &cursor);
-        assert (rc == MDB_SUCCESS);
-        rc = mdb_cursor_open (txn, dbi_rev, &cursor_rev);
-        assert (rc == MDB_SUCCESS);
-        rc = mdb_cursor_open (txn, dbi, &cursor2);
-        assert (rc == MDB_SUCCESS);
-
-                 /***End of Set Up***/
-
- 	// locate key, get first url
-        rc = mdb_cursor_get (cursor, &key, &url, MDB_SET | MDB_FIRST_DUP);
-        if (rc != MDB_SUCCESS) {
-                fprintf (stderr, "\nERROR: Key not found\n\n");
-                return -1;
-        }
-
-        // count, print # of images(URLs) under this input key
-        rc = mdb_cursor_count (cursor, &num_images);
-        assert (rc == MDB_SUCCESS);
-        fprintf (stdout, "\nThis key has %zu image(s)\n", num_images);
-
-        while ( image_number < num_images ) {
-                // get 1st key from reverse mapped database
-                rc = mdb_cursor_get (cursor_rev, &url, &new_key, MDB_SET_KEY | MDB_FIRST_DUP);
+        if (logical) {
+                // one small transaction, whatever the size of the key
+                if (counting)
+                        perfcount_start (&pc);
+                rc = begin_txn (&st, &txn);
+                assert (rc == MDB_SUCCESS);
+                rc = purger_mark (&st, txn, hashed_key, &gen);
+                if (rc == MDB_SUCCESS && em != NULL) {
+                        // the caches drop the URLs now, not when sweep runs
+                        key.mv_size = st.hash_bytes;
+                        key.mv_data = hashed_key;
+                        rc = keyset_union (txn, st.dbi, &key, 1, invalidated, NULL);
+                }
+                if (rc == MDB_SUCCESS)
+                        rc = mdb_txn_commit (txn);
+                else
+                        mdb_txn_abort (txn);
                 if (rc != MDB_SUCCESS) {
-                        fprintf (stderr, "\nERROR: Key's URL not found\n\n");
+                        fprintf (stderr, "Failure to purge key: %s\n", surrogate_strerror (rc));
                         return -1;
                 }
-
-                // get,print count of keys under URL
-                rc = mdb_cursor_count (cursor_rev, &num_url_keys);
-                assert (rc == MDB_SUCCESS);
-                fprintf (stdout, "\nImage %d has %zu keys\n", (image_number+1), num_url_keys);
-
-                // loop through to delete each key
-                while (key_number < num_url_keys) {
-
-                        //position at specified key and url
-                        rc = mdb_cursor_get (cursor2, &new_key, &url, MDB_GET_BOTH);
-                        if (rc == MDB_SUCCESS) {
-                                //fprintf (stdout, "Deleting from %s: Key %s \tURL %s\n", key.mv_data, new_key.mv_data, url.mv_data);
-                                rc = mdb_cursor_del (cursor2, 0);
-                                assert (rc == MDB_SUCCESS);
-                                i++; //delete total number of items deleted
-                        }
-                        else
-                                fprintf (stderr, "ERROR: Finding the folowing surrogate key: %s\n", new_key.mv_data);
-
-                        // get next key in reverse mapped database
-                        if ((mdb_cursor_get (cursor_rev, &url, &new_key, MDB_NEXT_DUP)) == 0) {
-                                key_number++;
-                        }
-                        else {
-                                // delete URL in reverse mapped data map and all its entries
-                                rc = mdb_cursor_del (cursor_rev, MDB_NODUPDATA);
-                                assert (rc == MDB_SUCCESS);
-                                break;
+                fprintf (stdout, "%s purged (generation %llu); sweep removes its URLs\n\n",
+                        key_to_delete, gen);
+                if (counting) {
+                        perfcount_stop (&pc);
+                        fprintf (stdout, "Per key: ");
+                        perfcount_print (stdout, &pc, 1);
+                        fprintf (stdout, "\n\n");
+                        perfcount_close (&pc);
+                }
+                if (em != NULL) {
+                        rc = emit (&st, em);
+                        if (rc != 0) {
+                                fprintf (stderr, "Failure to notify caches: %s\n", surrogate_strerror (rc));
+                                return -1;
                         }
+                        emitter_destroy (em);
                 }
-                //commit transaction
-		rc = mdb_txn_commit (txn);
-                assert (rc == MDB_SUCCESS);
-
-                // reset transaction
-                rc = mdb_txn_begin (env, NULL, 0, &txn);
-                assert (rc == MDB_SUCCESS);
+                surrogate_close (&st);
+                free (key_to_delete);
+                free (hash_status);
+                return 0;
+        }
 
-                // re-initiate cursor
-                rc = mdb_cursor_open (txn, dbi, &cursor);
-                rc = mdb_cursor_open (txn, dbi_rev, &cursor_rev);
-                rc = mdb_cursor_open (txn, dbi, &cursor2);
+        // a batch of images (URLs) and all their keys per transaction
+        if (counting)
+                perfcount_start (&pc);
+        do {
+                rc = begin_txn (&st, &txn);
                 assert (rc == MDB_SUCCESS);
-
-                // get next image
-
-                if ((mdb_cursor_get (cursor, &key, &url, MDB_SET | MDB_NEXT_DUP)) == MDB_SUCCESS) {
-                        image_number++;
-                        key_number = 0;
+                rc = purger_remove (&st, txn, hashed_key, PURGER_BATCH, &urls, &pairs);
+                if (rc == MDB_SUCCESS)
+                        rc = mdb_txn_commit (txn);
+                else
+                        mdb_txn_abort (txn);
+                if (rc != MDB_SUCCESS) {
+                        fprintf (stderr, "Failure to delete from data store: %s\n", surrogate_strerror (rc));
+                        return -1;
                 }
-                else {
-                        // close transaction
-                        mdb_txn_commit (txn);
+                num_images += urls;
+                num_pairs += pairs;
+        } while (urls == PURGER_BATCH);
+        if (counting)
+                perfcount_stop (&pc);
 
-                        //close environment
-                        mdb_env_close (env);
+        if (num_images == 0) {
+                fprintf (stderr, "\nERROR: Key not found\n\n");
+                return -1;
+        }
+        fprintf (stdout, "\nThis key had %zu image(s)\n", num_images);
 
-                        break;
+        // print total number of items deleted
+        fprintf (stdout,"%zu instances of %s deleted from data store\n\n", num_pairs, key_to_delete);
+        if (counting) {
+                fprintf (stdout, "Per URL: ");
+                perfcount_print (stdout, &pc, num_images);
+                fprintf (stdout, "\n\n");
+                perfcount_close (&pc);
+        }
+
+        // the removed URLs, collected over all batches
+        if (em != NULL) {
+                rc = emit (&st, em);
+                if (rc != 0) {
+                        fprintf (stderr, "Failure to notify caches: %s\n", surrogate_strerror (rc));
+                        return -1;
                 }
+                emitter_destroy (em);
         }
 
-        // print total number of items deleted
-        fprintf (stdout,"%d instances of %s deleted from data store\n\n", i, key_to_delete);
+        //close environment
+        surrogate_close (&st);
 
         // free malloc-ed buffers
 	free (key_to_delete);
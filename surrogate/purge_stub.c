@@ -0,0 +1,236 @@
+/*
+ * File Name:	purge_stub.c
+ * Function:	A stand-in cache node for testing emitter.h: listens on
+ *		127.0.0.1, port -p (default 8080), and answers every
+ *		request it reads, pipelined or not, with 200. -f makes
+ *		that percentage of answers 503 instead, so the emitter
+ *		has to resend them, and -c closes each connection after
+ *		that many answers (with Connection: close), as caches
+ *		that limit keep-alive requests do. -b sets how the
+ *		answers' bodies are framed: empty (Content-Length: 0,
+ *		the default), length (a short body after its
+ *		Content-Length), chunked (the body in chunks, with a
+ *		trailer) or close (no length: the body runs to the end
+ *		of the connection, which is closed after the answer).
+ *		-v prints each request line. After -n requests, or on
+ *		an interrupt, it prints the requests, the 200s, the
+ *		503s and the connections accepted, and exits.
+ *
+ *		purge_stub [-p port] [-f percent] [-c n] [-b framing]
+ *		           [-n max] [-v]
+ *
+ *		cc purge_stub.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_CONNS	64
+#define IN_BYTES	16384
+
+enum { EMPTY, LENGTH, CHUNKED, CLOSE };
+static const char *framings[] = { "empty", "length", "chunked", "close", NULL };
+
+typedef struct conn {
+	int fd;
+	size_t answered;
+	char in[IN_BYTES];
+	size_t in_len;
+} conn;
+
+static volatile sig_atomic_t done;
+
+static void
+stop (int sig) {
+
+	(void) sig;
+	done = 1;
+}
+
+// write all of buf; the answers are small, so block for them
+static int
+send_all (int fd, const char *buf, size_t len) {
+
+	ssize_t sent;
+	struct pollfd pfd;
+
+	while (len > 0) {
+		sent = send (fd, buf, len, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EAGAIN) {
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			poll (&pfd, 1, 1000);
+			continue;
+		}
+		if (sent <= 0)
+			return -1;
+		buf += sent;
+		len -= sent;
+	}
+	return 0;
+}
+
+// the status line and headers of an answer, and its body framed as asked
+static int
+answer (char *out, size_t size, int framing, const char *status, int close_it) {
+
+	const char *conn = close_it ? "Connection: close\r\n" : "";
+
+	if (framing == LENGTH)
+		return snprintf (out, size, "HTTP/1.1 %s\r\nContent-Length: 7\r\n%s\r\npurged\n",
+			status, conn);
+	if (framing == CHUNKED)
+		return snprintf (out, size, "HTTP/1.1 %s\r\nTransfer-Encoding: chunked\r\n%s\r\n"
+			"4;note=x\r\npurg\r\n3\r\ned\n\r\n0\r\nX-Trailer: 1\r\n\r\n", status, conn);
+	if (framing == CLOSE)
+		return snprintf (out, size, "HTTP/1.1 %s\r\n\r\npurged\n", status);
+	return snprintf (out, size, "HTTP/1.1 %s\r\nContent-Length: 0\r\n%s\r\n", status, conn);
+}
+
+// the blank line that ends a request, or NULL
+static char *
+request_end (char *buf, size_t len) {
+
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i++)
+		if (memcmp (buf + i, "\r\n\r\n", 4) == 0)
+			return buf + i;
+	return NULL;
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int opt, fd, one = 1, port = 8080, fail = 0, verbose = 0, close_it, framing = EMPTY;
+	size_t i, j, polled, nconns = 0, close_after = 0, max = 0;
+	size_t requests = 0, ok = 0, failed = 0, accepted = 0;
+	ssize_t got;
+	char *end, out[256];
+	struct sockaddr_in addr;
+	struct pollfd pfd[MAX_CONNS + 1];
+	conn *conns[MAX_CONNS], *c;
+
+	while ((opt = getopt (argc, argv, "p:f:c:b:n:v")) != -1) {
+		if (opt == 'p' && (port = atoi (optarg)) > 0)
+			continue;
+		else if (opt == 'f' && (fail = atoi (optarg)) >= 0 && fail <= 100)
+			continue;
+		else if (opt == 'c' && (close_after = atoi (optarg)) > 0)
+			continue;
+		else if (opt == 'n' && (max = atoi (optarg)) > 0)
+			continue;
+		else if (opt == 'b') {
+			for (framing = 0; framings[framing] != NULL; framing++)
+				if (strcmp (optarg, framings[framing]) == 0)
+					break;
+			if (framings[framing] != NULL)
+				continue;
+		}
+		else if (opt == 'v')
+			verbose = 1;
+		else {
+			fprintf (stderr, "usage: %s [-p port] [-f percent] [-c n] "
+				"[-b empty|length|chunked|close] [-n max] [-v]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	fd = socket (AF_INET, SOCK_STREAM, 0);
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+	memset (&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (port);
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	if (fd < 0 || bind (fd, (struct sockaddr *) &addr, sizeof addr) != 0 || listen (fd, 64) != 0) {
+		fprintf (stderr, "Failure to listen on port %d: %s\n", port, strerror (errno));
+		return -1;
+	}
+	signal (SIGINT, stop);
+	signal (SIGTERM, stop);
+	srand (port);
+
+	while (!done && (max == 0 || requests < max)) {
+		pfd[0].fd = fd;
+		pfd[0].events = nconns < MAX_CONNS ? POLLIN : 0;
+		for (i = 0; i < nconns; i++) {
+			pfd[i + 1].fd = conns[i]->fd;
+			pfd[i + 1].events = POLLIN;
+		}
+		polled = nconns;
+		if (poll (pfd, polled + 1, -1) < 0)
+			continue;
+
+		if (pfd[0].revents & POLLIN) {
+			c = calloc (1, sizeof *c);
+			if (c != NULL && (c->fd = accept (fd, NULL, NULL)) >= 0) {
+				fcntl (c->fd, F_SETFL, fcntl (c->fd, F_GETFL) | O_NONBLOCK);
+				setsockopt (c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+				conns[nconns++] = c;
+				accepted++;
+			}
+			else
+				free (c);
+		}
+
+		// a closed connection is replaced by the last one, so walk
+		// down; one just accepted was not polled
+		for (i = polled; i-- > 0; ) {
+			if (pfd[i + 1].revents == 0)
+				continue;
+			c = conns[i];
+			got = recv (c->fd, c->in + c->in_len, sizeof c->in - c->in_len, 0);
+			close_it = got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR);
+			if (got > 0)
+				c->in_len += got;
+
+			// answer each complete request
+			while (!close_it && (end = request_end (c->in, c->in_len)) != NULL) {
+				if (verbose)
+					fprintf (stderr, "%.*s\n", (int) strcspn (c->in, "\r"), c->in);
+				requests++;
+				c->answered++;
+				close_it = framing == CLOSE ||
+					(close_after > 0 && c->answered >= close_after);
+				if (rand () % 100 < fail) {
+					failed++;
+					j = answer (out, sizeof out, framing, "503 Service Unavailable", close_it);
+				}
+				else {
+					ok++;
+					j = answer (out, sizeof out, framing, "200 OK", close_it);
+				}
+				if (send_all (c->fd, out, j) != 0)
+					close_it = 1;
+				c->in_len -= end + 4 - c->in;
+				memmove (c->in, end + 4, c->in_len);
+			}
+			if (c->in_len == sizeof c->in)
+				close_it = 1;
+
+			if (close_it) {
+				close (c->fd);
+				free (c);
+				conns[i] = conns[--nconns];
+			}
+		}
+	}
+
+	fprintf (stdout, "%zu %zu %zu %zu\n", requests, ok, failed, accepted);
+	for (i = 0; i < nconns; i++) {
+		close (conns[i]->fd);
+		free (conns[i]);
+	}
+	close (fd);
+	return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * File Name:	purged.c
+ * Function:	Takes purge requests on stdin, one key per line, hashed
+ *		as map_data.c hashes them or, with -x, given as hex,
+ *		and coalesces them (see purgequeue.h). The first
+ *		request opens a window of -w milliseconds (default 500);
+ *		when it closes, every key received within it is purged
+ *		in one transaction. -n closes a window early once that
+ *		many requests are queued, and -l purges logically, as
+ *		purge -l does. Each window prints the requests, the
+ *		distinct keys, the URLs and pairs removed and the
+ *		milliseconds the transaction took.
+ *
+ *		With -e (once per cache node, host:port) the URLs of
+ *		each window are then sent as PURGE requests, up to -p
+ *		pipelined per connection and resent up to -r times (see
+ *		emitter.h); a second line per window gives the requests,
+ *		the answers ok, the failures, the resends and the
+ *		milliseconds taken.
+ *
+ *		-P counts CPU events over each window's transaction
+ *		(perfcount.h) and prints them on a line of their own
+ *		after it, per URL removed, or per key when the window
+ *		removed none (-l).
+ *
+ *		The URLs are read back in a transaction from a pool of
+ *		one (readpool.h), which keeps its reader slot between
+ *		windows and, once a minute at most, clears the slots of
+ *		crashed readers: those pin old pages that this writer
+ *		could otherwise reuse. When the pool is closed, at exit
+ *		or when a compaction replaced the store, a line on
+ *		stderr gives its transactions in use, the reader slots
+ *		used of those the store has, and the checks run and the
+ *		stale slots they cleared.
+ *
+ *		-W names a hot set saved by warm -s; it is prefetched
+ *		into the page cache, branch pages first, before the
+ *		first request is read, so the first windows after a
+ *		restart do not stall on cold pages (see residency.h).
+ *
+ *		purged [-x] [-l] [-P] [-W hotset] [-w ms] [-n max]
+ *		       [-e host:port ...] [-p depth] [-r retries] < requests
+ *
+ *		cc purged.c purgequeue.c purger.c emitter.c idstrings.c \
+ *		   keyset.c perfcount.c residency.c pagewalk.c readpool.c \
+ *		   surrogate.c blake2/sse/blake2b.c -llmdb -pthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include "lmdb.h"
+#include "surrogate.h"
+#include "purgequeue.h"
+#include "purger.h"
+#include "emitter.h"
+#include "perfcount.h"
+#include "residency.h"
+#include "readpool.h"
+
+#define LINE_BYTES 500
+#define READER_CHECK_SECS 60
+
+static double
+now_ms (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+// open the store, MDB_NOTLS for the pool, and the pool of readers
+static int
+open_store (surrogate_store *st, readpool **pool) {
+
+	int rc;
+
+	rc = surrogate_open (st, SURROGATE_DB_DIR, MDB_NOTLS);
+	if (rc == MDB_SUCCESS) {
+		rc = readpool_create (st->env, 1, READER_CHECK_SECS, pool);
+		if (rc != MDB_SUCCESS)
+			surrogate_close (st);
+	}
+	return rc;
+}
+
+static void
+report_pool (readpool *pool) {
+
+	readpool_stat rs;
+
+	readpool_stats (pool, &rs);
+	fprintf (stderr, "reader pool: %u of %u in use, %u of %u reader slots used, "
+		"%lu checks, %lu stale slots cleared\n", rs.in_use, rs.size, rs.numreaders,
+		rs.maxreaders, rs.checks, rs.reclaimed);
+}
+
+// purge the window in one transaction, on the new store if compact.c
+// swapped it, counting CPU events into pc unless it is NULL, then tell
+// the caches
+static int
+flush (surrogate_store *st, readpool **pool, purgequeue *q, int logical, emitter *em,
+		perfcount *pc) {
+
+	int rc;
+	double t = now_ms ();
+	MDB_txn *txn;
+	purgequeue_stat s;
+	emitter_stat es;
+
+	if (pc != NULL)
+		perfcount_start (pc);
+	rc = surrogate_txn_begin (st, 0, &txn);
+	if (rc == SURROGATE_STALE) {
+		report_pool (*pool);
+		readpool_destroy (*pool);
+		surrogate_close (st);
+		rc = open_store (st, pool);
+		if (rc == MDB_SUCCESS)
+			rc = surrogate_txn_begin (st, 0, &txn);
+	}
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = purgequeue_flush (q, st, txn, logical, &s);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_txn_commit (txn);
+	else
+		mdb_txn_abort (txn);
+	if (pc != NULL)
+		perfcount_stop (pc);
+	if (rc != MDB_SUCCESS) {
+		if (em != NULL)
+			emitter_discard (em);
+		return rc;
+	}
+	fprintf (stdout, "%zu %zu %zu %zu %.3f\n", s.requests, s.keys, s.urls, s.pairs,
+		now_ms () - t);
+	if (pc != NULL) {
+		fprintf (stdout, "perf per %s: ", s.urls > 0 ? "URL" : "key");
+		perfcount_print (stdout, pc, s.urls > 0 ? s.urls : s.keys);
+		fputc ('\n', stdout);
+	}
+
+	if (em != NULL) {
+		rc = readpool_acquire (*pool, &txn);
+		if (rc != MDB_SUCCESS)
+			return rc;
+		rc = emitter_resolve (em, st, txn);
+		readpool_release (*pool, txn);
+		if (rc == 0)
+			rc = emitter_run (em, &es);
+		if (rc != 0)
+			return rc;
+		fprintf (stdout, "%zu %zu %zu %zu %.3f\n", es.requests, es.ok, es.failed, es.retried,
+			es.ms);
+	}
+	fflush (stdout);
+	return MDB_SUCCESS;
+}
+
+static void
+usage (const char *prog) {
+
+	fprintf (stderr, "usage: %s [-x] [-l] [-P] [-W hotset] [-w ms] [-n max] [-e host:port ...] "
+		"[-p depth] [-r retries] < requests\n", prog);
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int rc, opt, hashed = 0, logical = 0, counting = 0, eof = 0, timeout;
+	double window = 500, deadline = 0;
+	size_t max = 0, len = 0, skip = 0;
+	ssize_t got;
+	char buf[64 * 1024], *line, *nl;
+	unsigned char key[SURROGATE_MAX_HASH_BYTES];
+	struct pollfd pfd;
+	surrogate_store st;
+	readpool *pool;
+	purgequeue *q;
+	emitter_config ecfg = { {0}, 0, 0, EMITTER_RETRIES, 0 };
+	emitter *em = NULL;
+	perfcount pc;
+	const char *hotset = NULL;
+	residency_prefetch_stat ps;
+
+	while ((opt = getopt (argc, argv, "xlPW:w:n:e:p:r:")) != -1) {
+		if (opt == 'x')
+			hashed = 1;
+		else if (opt == 'l')
+			logical = 1;
+		else if (opt == 'P')
+			counting = 1;
+		else if (opt == 'W')
+			hotset = optarg;
+		else if (opt == 'w' && (window = atof (optarg)) >= 0)
+			continue;
+		else if (opt == 'n' && (max = atoi (optarg)) > 0)
+			continue;
+		else if (opt == 'e' && ecfg.nendpoints < EMITTER_MAX_ENDPOINTS)
+			ecfg.endpoints[ecfg.nendpoints++] = optarg;
+		else if (opt == 'p' && (ecfg.depth = atoi (optarg)) > 0)
+			continue;
+		else if (opt == 'r' && atoi (optarg) >= 0)
+			ecfg.retries = atoi (optarg);
+		else {
+			usage (argv[0]);
+			return -1;
+		}
+	}
+
+	if (ecfg.nendpoints > 0) {
+		rc = emitter_create (&ecfg, &em);
+		if (rc != 0) {
+			fprintf (stderr, "Invalid cache endpoint: %s\n", surrogate_strerror (rc));
+			return -1;
+		}
+		purger_watch (emitter_watch, em);
+	}
+	if (counting && (rc = perfcount_open (&pc)) != 0) {
+		fprintf (stderr, "No CPU counters: %s\n", strerror (rc));
+		counting = 0;
+	}
+
+	rc = open_store (&st, &pool);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to open data store: %s\n", surrogate_strerror (rc));
+		return -1;
+	}
+	if (hotset != NULL) {
+		// a stale or missing hot set only costs the warm-up
+		rc = residency_prefetch (st.env, hotset, 0, &ps);
+		if (rc == MDB_SUCCESS)
+			fprintf (stderr, "Prefetching %llu pages (%llu branch) of %s\n", ps.pages,
+				ps.branch_pages, hotset);
+		else
+			fprintf (stderr, "No prefetch from %s: %s\n", hotset, surrogate_strerror (rc));
+	}
+	rc = purgequeue_create (st.hash_bytes, &q);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Out of memory\n");
+		return -1;
+	}
+
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	while (!eof || purgequeue_size (q) > 0) {
+		// wait for input, or for the open window to close
+		timeout = -1;
+		if (purgequeue_size (q) > 0)
+			timeout = deadline > now_ms () ? (int) (deadline - now_ms ()) + 1 : 0;
+		if (!eof && poll (&pfd, 1, timeout) > 0) {
+			got = read (STDIN_FILENO, buf + len, sizeof buf - len);
+			if (got <= 0)
+				eof = 1;
+			else
+				len += got;
+		}
+
+		// whole lines; one longer than the buffer is dropped
+		if (eof && len > 0 && len < sizeof buf && buf[len - 1] != '\n')
+			buf[len++] = '\n';
+		for (line = buf; (nl = memchr (line, '\n', buf + len - line)) != NULL; line = nl + 1) {
+			*nl = '\0';
+			if (skip) {
+				skip = 0;
+				continue;
+			}
+			if (nl - line >= LINE_BYTES)
+				continue;
+			line[strcspn (line, " \r")] = '\0';
+			if (line[0] == '\0')
+				continue;
+			rc = hashed ? surrogate_parse_hex (key, line) : surrogate_hash (key, line, strlen (line));
+			if (rc != 0) {
+				fprintf (stderr, "Invalid key: %s\n", line);
+				continue;
+			}
+			if (purgequeue_size (q) == 0)
+				deadline = now_ms () + window;
+			if (purgequeue_add (q, key) != MDB_SUCCESS) {
+				fprintf (stderr, "Out of memory\n");
+				return -1;
+			}
+		}
+		len -= line - buf;
+		memmove (buf, line, len);
+		if (len == sizeof buf) {
+			len = 0;
+			skip = 1;
+		}
+
+		if (purgequeue_size (q) > 0 && (eof || now_ms () >= deadline ||
+		    (max > 0 && purgequeue_size (q) >= max))) {
+			rc = flush (&st, &pool, q, logical, em, counting ? &pc : NULL);
+			if (rc != MDB_SUCCESS) {
+				fprintf (stderr, "Purge failed: %s\n", surrogate_strerror (rc));
+				return -1;
+			}
+		}
+	}
+
+	if (em != NULL)
+		emitter_destroy (em);
+	if (counting)
+		perfcount_close (&pc);
+	purgequeue_destroy (q);
+	report_pool (pool);
+	readpool_destroy (pool);
+	surrogate_close (&st);
+	return 0;
+}
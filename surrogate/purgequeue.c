@@ -0,0 +1,155 @@
+/*
+ * File Name:	purgequeue.c
+ * Function:	Coalescing purge requests. See purgequeue.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "purgequeue.h"
+#include "purger.h"
+#include "keyset.h"
+
+struct purgequeue {
+	size_t key_bytes;
+	unsigned char *keys;		// back to back
+	size_t n, cap;
+	unsigned char *urls;		// the merged URL set of a flush
+	size_t nurls, url_cap;
+};
+
+// qsort has no context argument; flushes are not concurrent
+static size_t sort_bytes;
+
+static int
+by_key (const void *a, const void *b) {
+
+	return memcmp (a, b, sort_bytes);
+}
+
+static int
+grow (unsigned char **p, size_t *cap, size_t need, size_t size) {
+
+	unsigned char *q;
+	size_t c = *cap;
+
+	if (need <= c)
+		return 0;
+	while (c < need)
+		c = c ? 2 * c : 1024;
+	q = realloc (*p, c * size);
+	if (q == NULL)
+		return ENOMEM;
+	*p = q;
+	*cap = c;
+	return 0;
+}
+
+// keyset_union emits each URL once, in order
+static int
+collect_url (const void *url, void *ctx) {
+
+	purgequeue *q = ctx;
+
+	if (grow (&q->urls, &q->url_cap, q->nurls + 1, q->key_bytes) != 0)
+		return ENOMEM;
+	memcpy (q->urls + q->nurls++ * q->key_bytes, url, q->key_bytes);
+	return 0;
+}
+
+int
+purgequeue_create (size_t key_bytes, purgequeue **q) {
+
+	purgequeue *p;
+
+	if (key_bytes == 0 || key_bytes > SURROGATE_MAX_HASH_BYTES)
+		return EINVAL;
+	p = calloc (1, sizeof *p);
+	if (p == NULL)
+		return ENOMEM;
+	p->key_bytes = key_bytes;
+	*q = p;
+	return MDB_SUCCESS;
+}
+
+void
+purgequeue_destroy (purgequeue *q) {
+
+	free (q->keys);
+	free (q->urls);
+	free (q);
+}
+
+int
+purgequeue_add (purgequeue *q, const void *key) {
+
+	if (grow (&q->keys, &q->cap, q->n + 1, q->key_bytes) != 0)
+		return ENOMEM;
+	memcpy (q->keys + q->n++ * q->key_bytes, key, q->key_bytes);
+	return MDB_SUCCESS;
+}
+
+size_t
+purgequeue_size (const purgequeue *q) {
+
+	return q->n;
+}
+
+int
+purgequeue_flush (purgequeue *q, surrogate_store *st, MDB_txn *txn, int logical,
+		purgequeue_stat *stat) {
+
+	int rc = MDB_SUCCESS;
+	size_t i, m = 0, pairs = 0, w = q->key_bytes;
+	MDB_val *keys;
+
+	if (stat != NULL)
+		memset (stat, 0, sizeof *stat);
+	if (q->n == 0)
+		return MDB_SUCCESS;
+	if (w != st->hash_bytes)
+		return EINVAL;
+
+	// identical requests collapse to one key
+	sort_bytes = w;
+	qsort (q->keys, q->n, w, by_key);
+	for (i = 0; i < q->n; i++)
+		if (m == 0 || memcmp (q->keys + (m - 1) * w, q->keys + i * w, w) != 0)
+			memmove (q->keys + m++ * w, q->keys + i * w, w);
+
+	// overlapping keys share URLs; the union holds each once. A
+	// logical purge needs it only to tell a watcher its URLs.
+	q->nurls = 0;
+	if (!logical || purger_watching ()) {
+		keys = malloc (m * sizeof *keys);
+		if (keys == NULL)
+			return ENOMEM;
+		for (i = 0; i < m; i++) {
+			keys[i].mv_size = w;
+			keys[i].mv_data = q->keys + i * w;
+		}
+		rc = keyset_union (txn, st->dbi, keys, (int) m, collect_url, q);
+		free (keys);
+	}
+	if (rc == MDB_SUCCESS && logical) {
+		for (i = 0; rc == MDB_SUCCESS && i < m; i++)
+			rc = purger_mark (st, txn, q->keys + i * w, NULL);
+		for (i = 0; rc == MDB_SUCCESS && i < q->nurls; i++)
+			purger_invalidated (q->urls + i * w);
+	}
+	else if (rc == MDB_SUCCESS)
+		rc = purger_remove_urls (st, txn, q->urls, q->nurls, &pairs);
+	if (rc != MDB_SUCCESS) {
+		q->n = m;
+		return rc;
+	}
+
+	if (stat != NULL) {
+		stat->requests = q->n;
+		stat->keys = m;
+		stat->urls = q->nurls;
+		stat->pairs = pairs;
+	}
+	q->n = 0;
+	return MDB_SUCCESS;
+}
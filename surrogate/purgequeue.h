@@ -0,0 +1,48 @@
+/*
+ * File Name:	purgequeue.h
+ * Function:	An intake queue in front of purger.h for bursts of
+ *		purge requests, as deploys send them: the same keys
+ *		over and over within seconds, and keys that share most
+ *		of their URLs. Requests are queued as they come and
+ *		flushed together. A flush purges each distinct key
+ *		once, merges the URL lists of all of them with
+ *		keyset_union, so a URL under several keys is removed
+ *		once, and removes the merged set in URL order, all in
+ *		the caller's transaction.
+ */
+
+#ifndef PURGEQUEUE_H
+#define PURGEQUEUE_H
+
+#include <stddef.h>
+#include "lmdb.h"
+#include "surrogate.h"
+
+typedef struct purgequeue purgequeue;
+
+typedef struct purgequeue_stat {
+	size_t requests;	// keys queued
+	size_t keys;		// of which distinct
+	size_t urls;		// URLs removed, or marked with logical
+	size_t pairs;		// data_store pairs removed
+} purgequeue_stat;
+
+/* a queue for keys of key_bytes bytes */
+int purgequeue_create (size_t key_bytes, purgequeue **q);
+void purgequeue_destroy (purgequeue *q);
+
+/* queue a hashed key; the key is copied */
+int purgequeue_add (purgequeue *q, const void *key);
+
+/* requests queued since the last flush */
+size_t purgequeue_size (const purgequeue *q);
+
+/* purge the queued keys in txn, immediately or, with logical set, with
+ * purger_mark (their URLs then only go to purger_watch's watcher), and
+ * empty the queue. *stat (if not NULL) describes the
+ * flush. Returns MDB_SUCCESS, ENOMEM or an LMDB error; the queue is
+ * kept on error, for the caller to retry in a new transaction. */
+int purgequeue_flush (purgequeue *q, surrogate_store *st, MDB_txn *txn, int logical,
+		purgequeue_stat *stat);
+
+#endif
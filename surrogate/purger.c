@@ -0,0 +1,514 @@
+/*
+ * File Name:	purger.c
+ * Function:	Immediate and generation-counted purges. See purger.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "purger.h"
+
+static purger_url_fn *watch_fn;
+static void *watch_ctx;
+
+// a gens record: generation, generation cleaned up to
+typedef struct gen_rec {
+	unsigned long long gen, cleaned;
+} gen_rec;
+
+static void
+store_u64 (unsigned char *p, unsigned long long v) {
+
+	int i;
+
+	for (i = 7; i >= 0; i--, v >>= 8)
+		p[i] = (unsigned char) v;
+}
+
+static unsigned long long
+load_u64 (const unsigned char *p) {
+
+	unsigned long long v = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		v = v << 8 | p[i];
+	return v;
+}
+
+// the gens record of key; zeros for a key never purged
+static int
+get_gen (const surrogate_store *st, MDB_txn *txn, const void *key, gen_rec *g) {
+
+	int rc;
+	MDB_val k, v;
+
+	g->gen = g->cleaned = 0;
+	if (st->dbi_gens == 0)
+		return MDB_SUCCESS;
+	k.mv_size = st->hash_bytes;
+	k.mv_data = (void *) key;
+	rc = mdb_get (txn, st->dbi_gens, &k, &v);
+	if (rc == MDB_SUCCESS && v.mv_size == 16) {
+		g->gen = load_u64 (v.mv_data);
+		g->cleaned = load_u64 ((const unsigned char *) v.mv_data + 8);
+	}
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
+static int
+put_gen (surrogate_store *st, MDB_txn *txn, const void *key, const gen_rec *g) {
+
+	int rc;
+	unsigned char b[16];
+	MDB_val k, v;
+
+	store_u64 (b, g->gen);
+	store_u64 (b + 8, g->cleaned);
+	k.mv_size = st->hash_bytes;
+	k.mv_data = (void *) key;
+	v.mv_size = sizeof b;
+	v.mv_data = b;
+	rc = mdb_put (txn, st->dbi_gens, &k, &v, 0);
+	if (rc == MDB_SUCCESS)
+		rc = surrogate_log (st, txn, SURROGATE_LOG_PUT, SURROGATE_LOG_GENS, &k, &v);
+	return rc;
+}
+
+// delete key/data (the whole key when data is NULL) if present, logging it
+static int
+del_logged (surrogate_store *st, MDB_txn *txn, MDB_dbi dbi, int db, MDB_val *key, MDB_val *data,
+		size_t *count) {
+
+	int rc = mdb_del (txn, dbi, key, data);
+
+	if (rc == MDB_SUCCESS) {
+		if (count != NULL)
+			(*count)++;
+		return surrogate_log (st, txn, data != NULL ? SURROGATE_LOG_DEL : SURROGATE_LOG_DEL_KEY,
+			db, key, data);
+	}
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
+// the mappings of url from every key that carries it, then url
+static int
+remove_url (surrogate_store *st, MDB_txn *txn, MDB_cursor *cursor_rev, MDB_val *url,
+		size_t *removed) {
+
+	int rc;
+	MDB_val other;
+
+	rc = mdb_cursor_get (cursor_rev, url, &other, MDB_SET_KEY);
+	while (rc == MDB_SUCCESS) {
+		rc = del_logged (st, txn, st->dbi, SURROGATE_LOG_DATA, &other, url, removed);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_cursor_get (cursor_rev, url, &other, MDB_NEXT_DUP);
+	}
+	if (rc != MDB_NOTFOUND)
+		return rc;
+	if (watch_fn != NULL)
+		watch_fn (url->mv_data, watch_ctx);
+	return del_logged (st, txn, st->dbi_rev, SURROGATE_LOG_REV, url, NULL, NULL);
+}
+
+void
+purger_watch (purger_url_fn *fn, void *ctx) {
+
+	watch_fn = fn;
+	watch_ctx = ctx;
+}
+
+int
+purger_watching (void) {
+
+	return watch_fn != NULL;
+}
+
+void
+purger_invalidated (const void *url) {
+
+	if (watch_fn != NULL)
+		watch_fn (url, watch_ctx);
+}
+
+int
+purger_remove (surrogate_store *st, MDB_txn *txn, const void *key, size_t max,
+		size_t *urls, size_t *pairs) {
+
+	int rc;
+	size_t n = 0, removed = 0;
+	unsigned char u[SURROGATE_MAX_HASH_BYTES];
+	MDB_cursor *cursor, *cursor_rev;
+	MDB_val k, url;
+
+	rc = mdb_cursor_open (txn, st->dbi, &cursor);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = mdb_cursor_open (txn, st->dbi_rev, &cursor_rev);
+	if (rc != MDB_SUCCESS) {
+		mdb_cursor_close (cursor);
+		return rc;
+	}
+
+	k.mv_size = st->hash_bytes;
+	k.mv_data = (void *) key;
+	while (max == 0 || n < max) {
+		// the first URL left under the key
+		rc = mdb_cursor_get (cursor, &k, &url, MDB_SET_KEY);
+		if (rc != MDB_SUCCESS)
+			break;
+		memcpy (u, url.mv_data, st->hash_bytes);
+		url.mv_data = u;
+
+		rc = remove_url (st, txn, cursor_rev, &url, &removed);
+		// in case the reverse mapping lacked the key
+		k.mv_data = (void *) key;
+		if (rc == MDB_SUCCESS)
+			rc = del_logged (st, txn, st->dbi, SURROGATE_LOG_DATA, &k, &url, &removed);
+		if (rc != MDB_SUCCESS)
+			break;
+		n++;
+	}
+	mdb_cursor_close (cursor_rev);
+	mdb_cursor_close (cursor);
+
+	if (urls != NULL)
+		*urls = n;
+	if (pairs != NULL)
+		*pairs = removed;
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
+int
+purger_remove_urls (surrogate_store *st, MDB_txn *txn, const void *urls, size_t n,
+		size_t *pairs) {
+
+	int rc;
+	size_t i, removed = 0;
+	MDB_cursor *cursor_rev;
+	MDB_val url;
+
+	rc = mdb_cursor_open (txn, st->dbi_rev, &cursor_rev);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	url.mv_size = st->hash_bytes;
+	for (i = 0; rc == MDB_SUCCESS && i < n; i++) {
+		url.mv_data = (unsigned char *) urls + i * st->hash_bytes;
+		rc = remove_url (st, txn, cursor_rev, &url, &removed);
+	}
+	mdb_cursor_close (cursor_rev);
+
+	if (pairs != NULL)
+		*pairs = removed;
+	return rc;
+}
+
+int
+purger_mark (surrogate_store *st, MDB_txn *txn, const void *key, unsigned long long *gen) {
+
+	int rc;
+	unsigned char entry[8 + SURROGATE_MAX_HASH_BYTES], b[8];
+	unsigned long long seq = 0;
+	gen_rec g;
+	MDB_cursor *cursor;
+	MDB_val k, v;
+
+	if (st->dbi_gens == 0 || st->dbi_graveyard == 0)
+		return EINVAL;
+	rc = get_gen (st, txn, key, &g);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	g.gen++;
+	rc = put_gen (st, txn, key, &g);
+	if (rc != MDB_SUCCESS)
+		return rc;
+
+	// queue it behind the purges already waiting
+	rc = mdb_cursor_open (txn, st->dbi_graveyard, &cursor);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = mdb_cursor_get (cursor, &k, &v, MDB_LAST);
+	if (rc == MDB_SUCCESS)
+		seq = load_u64 (k.mv_data);
+	if (rc == MDB_SUCCESS || rc == MDB_NOTFOUND) {
+		store_u64 (entry, seq + 1);
+		memcpy (entry + 8, key, st->hash_bytes);
+		store_u64 (b, g.gen);
+		k.mv_size = 8 + st->hash_bytes;
+		k.mv_data = entry;
+		v.mv_size = sizeof b;
+		v.mv_data = b;
+		rc = mdb_cursor_put (cursor, &k, &v, MDB_APPEND);
+	}
+	mdb_cursor_close (cursor);
+	if (rc == MDB_SUCCESS)
+		rc = surrogate_log (st, txn, SURROGATE_LOG_PUT, SURROGATE_LOG_GRAVEYARD, &k, &v);
+	if (rc == MDB_SUCCESS && gen != NULL)
+		*gen = g.gen;
+	return rc;
+}
+
+int
+purger_any (const surrogate_store *st, MDB_txn *txn) {
+
+	int rc;
+	MDB_cursor *cursor;
+	MDB_val k, v;
+
+	if (st->dbi_graveyard == 0 || mdb_cursor_open (txn, st->dbi_graveyard, &cursor) != MDB_SUCCESS)
+		return 0;
+	rc = mdb_cursor_get (cursor, &k, &v, MDB_FIRST);
+	mdb_cursor_close (cursor);
+	return rc == MDB_SUCCESS;
+}
+
+int
+purger_pending (const surrogate_store *st, MDB_txn *txn, const void *key) {
+
+	gen_rec g;
+
+	return get_gen (st, txn, key, &g) == MDB_SUCCESS && g.gen > g.cleaned;
+}
+
+static int
+by_key (const void *a, const void *b) {
+
+	return memcmp (a, b, surrogate_hash_bytes ());
+}
+
+int
+purger_pendset_load (const surrogate_store *st, MDB_txn *txn, purger_pendset *ps) {
+
+	int rc;
+	size_t i, n, w = st->hash_bytes;
+	unsigned char *p;
+	MDB_cursor *cursor;
+	MDB_val k, v;
+
+	ps->n = 0;
+	ps->overflow = 0;
+	if (st->dbi_graveyard == 0)
+		return MDB_SUCCESS;
+	rc = mdb_cursor_open (txn, st->dbi_graveyard, &cursor);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	// entries of keys settled since they were queued are skipped
+	for (rc = mdb_cursor_get (cursor, &k, &v, MDB_FIRST); rc == MDB_SUCCESS;
+	     rc = mdb_cursor_get (cursor, &k, &v, MDB_NEXT)) {
+		if (k.mv_size != 8 + w) {
+			rc = SURROGATE_BAD_META;
+			break;
+		}
+		if (!purger_pending (st, txn, (unsigned char *) k.mv_data + 8))
+			continue;
+		if (ps->n == PURGER_PENDSET_MAX) {
+			ps->overflow = 1;
+			break;
+		}
+		if (ps->n == ps->cap) {
+			n = ps->cap ? 2 * ps->cap : 1024;
+			p = realloc (ps->keys, n * w);
+			if (p == NULL) {
+				rc = ENOMEM;
+				break;
+			}
+			ps->keys = p;
+			ps->cap = n;
+		}
+		memcpy (ps->keys + ps->n++ * w, (unsigned char *) k.mv_data + 8, w);
+	}
+	mdb_cursor_close (cursor);
+	if (rc != MDB_NOTFOUND && rc != MDB_SUCCESS)
+		return rc;
+
+	// a key purged twice is queued twice
+	qsort (ps->keys, ps->n, w, by_key);
+	for (i = n = 0; i < ps->n; i++)
+		if (n == 0 || memcmp (ps->keys + i * w, ps->keys + (n - 1) * w, w) != 0)
+			memmove (ps->keys + n++ * w, ps->keys + i * w, w);
+	ps->n = n;
+	return MDB_SUCCESS;
+}
+
+void
+purger_pendset_free (purger_pendset *ps) {
+
+	free (ps->keys);
+	ps->keys = NULL;
+	ps->n = ps->cap = 0;
+}
+
+int
+purger_pendset_has (const surrogate_store *st, MDB_txn *txn, const purger_pendset *ps,
+		const void *key) {
+
+	if (ps == NULL || ps->overflow)
+		return purger_pending (st, txn, key);
+	return ps->n > 0 && bsearch (key, ps->keys, ps->n, st->hash_bytes, by_key) != NULL;
+}
+
+// key is no longer pending
+static void
+pendset_drop (const surrogate_store *st, purger_pendset *ps, const void *key) {
+
+	size_t w = st->hash_bytes;
+	unsigned char *p;
+
+	if (ps == NULL || ps->n == 0)
+		return;
+	p = bsearch (key, ps->keys, ps->n, w, by_key);
+	if (p != NULL) {
+		memmove (p, p + w, ps->keys + ps->n * w - (p + w));
+		ps->n--;
+	}
+}
+
+// the first pending key carried by url into key; 0 when there is none
+static int
+find_pending (const surrogate_store *st, MDB_txn *txn, const purger_pendset *ps,
+		const void *url, unsigned char *key) {
+
+	int rc, found = 0;
+	MDB_cursor *cursor;
+	MDB_val u, k;
+
+	if (ps != NULL && !ps->overflow && ps->n == 0)
+		return 0;
+	if (mdb_cursor_open (txn, st->dbi_rev, &cursor) != MDB_SUCCESS)
+		return 0;
+	u.mv_size = st->hash_bytes;
+	u.mv_data = (void *) url;
+	for (rc = mdb_cursor_get (cursor, &u, &k, MDB_SET_KEY); rc == MDB_SUCCESS && !found;
+	     rc = mdb_cursor_get (cursor, &u, &k, MDB_NEXT_DUP))
+		if (purger_pendset_has (st, txn, ps, k.mv_data)) {
+			memcpy (key, k.mv_data, st->hash_bytes);
+			found = 1;
+		}
+	mdb_cursor_close (cursor);
+	return found;
+}
+
+int
+purger_pendset_url (const surrogate_store *st, MDB_txn *txn, const purger_pendset *ps,
+		const void *url) {
+
+	unsigned char key[SURROGATE_MAX_HASH_BYTES];
+
+	return find_pending (st, txn, ps, url, key);
+}
+
+int
+purger_url_dead (const surrogate_store *st, MDB_txn *txn, const void *url) {
+
+	return purger_pendset_url (st, txn, NULL, url);
+}
+
+int
+purger_settle (surrogate_store *st, MDB_txn *txn, purger_pendset *ps, const void *key,
+		size_t max, size_t *urls, int *done) {
+
+	int rc;
+	size_t n = 0;
+	gen_rec g;
+
+	*done = 0;
+	if (urls != NULL)
+		*urls = 0;
+	rc = get_gen (st, txn, key, &g);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	if (g.gen > g.cleaned) {
+		rc = purger_remove (st, txn, key, max, &n, NULL);
+		if (urls != NULL)
+			*urls = n;
+		if (rc != MDB_SUCCESS || (max != 0 && n >= max))
+			return rc;
+		// its graveyard entry is dropped by the next cleanup
+		g.cleaned = g.gen;
+		rc = put_gen (st, txn, key, &g);
+		if (rc != MDB_SUCCESS)
+			return rc;
+	}
+	pendset_drop (st, ps, key);
+	*done = 1;
+	return MDB_SUCCESS;
+}
+
+int
+purger_settle_url (surrogate_store *st, MDB_txn *txn, purger_pendset *ps, const void *url,
+		size_t max, size_t *urls, int *done) {
+
+	unsigned char key[SURROGATE_MAX_HASH_BYTES];
+
+	// settling one of its keys removes the URL with all the others
+	if (!find_pending (st, txn, ps, url, key)) {
+		*done = 1;
+		if (urls != NULL)
+			*urls = 0;
+		return MDB_SUCCESS;
+	}
+	return purger_settle (st, txn, ps, key, max, urls, done);
+}
+
+int
+purger_cleanup (surrogate_store *st, size_t batch, size_t *keys) {
+
+	int rc;
+	size_t n, done = 0;
+	unsigned char entry[8 + SURROGATE_MAX_HASH_BYTES], *key = entry + 8;
+	gen_rec g;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_val k, v;
+
+	if (keys != NULL)
+		*keys = 0;
+	if (st->dbi_graveyard == 0)
+		return MDB_SUCCESS;
+	if (batch == 0)
+		batch = PURGER_BATCH;
+
+	for (;;) {
+		rc = surrogate_txn_begin (st, 0, &txn);
+		if (rc != MDB_SUCCESS)
+			break;
+		rc = mdb_cursor_open (txn, st->dbi_graveyard, &cursor);
+		if (rc == MDB_SUCCESS) {
+			rc = mdb_cursor_get (cursor, &k, &v, MDB_FIRST);
+			mdb_cursor_close (cursor);
+		}
+		if (rc == MDB_SUCCESS && k.mv_size != 8 + st->hash_bytes)
+			rc = SURROGATE_BAD_META;
+		if (rc == MDB_SUCCESS) {
+			memcpy (entry, k.mv_data, k.mv_size);
+			k.mv_data = entry;
+			rc = get_gen (st, txn, key, &g);
+		}
+
+		// a batch of its URLs; the entry goes with the last one
+		n = 0;
+		if (rc == MDB_SUCCESS && g.gen > g.cleaned)
+			rc = purger_remove (st, txn, key, batch, &n, NULL);
+		if (rc == MDB_SUCCESS && n < batch) {
+			if (g.gen > g.cleaned) {
+				g.cleaned = g.gen;
+				rc = put_gen (st, txn, key, &g);
+			}
+			if (rc == MDB_SUCCESS)
+				rc = del_logged (st, txn, st->dbi_graveyard, SURROGATE_LOG_GRAVEYARD, &k, NULL, &done);
+		}
+
+		if (rc != MDB_SUCCESS) {
+			mdb_txn_abort (txn);
+			break;
+		}
+		rc = mdb_txn_commit (txn);
+		if (rc != MDB_SUCCESS)
+			break;
+	}
+
+	if (keys != NULL)
+		*keys = done;
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
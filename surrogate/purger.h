@@ -0,0 +1,113 @@
+/*
+ * File Name:	purger.h
+ * Function:	Purging a surrogate key: every URL the key maps to is
+ *		removed from the store with all of its mappings.
+ *
+ *		purger_remove does it in place, which costs the URLs of
+ *		the key times the keys of each URL. purger_mark instead
+ *		bumps the key's generation in the gens database and
+ *		queues it in the graveyard, in constant time. Until the
+ *		queue is worked off by purger_cleanup (sweep.c runs it)
+ *		the key is pending: readers treat it and its URLs as
+ *		gone (purger_pending, purger_url_dead), and a writer
+ *		about to add to it, or to one of its URLs, settles it
+ *		first so that nothing newer than the purge is caught by
+ *		the cleanup. Settling is bounded: a writer spends at
+ *		most so many URLs on it per transaction and holds back
+ *		what it could not settle for the next, rather than
+ *		doing the cleanup's work in its own transaction.
+ *
+ *		A writer checks a batch against a purger_pendset, the
+ *		keys pending when it began, read from the graveyard
+ *		once per transaction instead of from gens per entry.
+ *
+ *		gens maps a key to its generation and the generation
+ *		cleaned up to, both 8 bytes big-endian; the key is
+ *		pending while the first is ahead. The graveyard maps a
+ *		sequence number and the key to the generation queued.
+ */
+
+#ifndef PURGER_H
+#define PURGER_H
+
+#include <stddef.h>
+#include "lmdb.h"
+#include "surrogate.h"
+
+#define PURGER_BATCH	1000	// URLs per cleanup transaction
+#define PURGER_PENDSET_MAX 65536	// pending keys a pendset holds
+
+/* the keys pending as a transaction sees them, sorted; when there are
+ * more than PURGER_PENDSET_MAX, overflow is set and checks fall back to
+ * gens. Starts zeroed; keys are hash_bytes wide. */
+typedef struct purger_pendset {
+	unsigned char *keys;
+	size_t n, cap;
+	int overflow;
+} purger_pendset;
+
+/* called with each URL a purge removes, inside its transaction */
+typedef void (purger_url_fn) (const void *url, void *ctx);
+
+/* have fn called for every URL removed from now on in this process
+ * (NULL stops it), e.g. to tell the caches (emitter.h); and whether
+ * that is the case, for callers that would collect the URLs of a
+ * logical purge only for it */
+void purger_watch (purger_url_fn *fn, void *ctx);
+int purger_watching (void);
+
+/* pass url to the watcher, for a logical purge whose URLs are removed
+ * only later */
+void purger_invalidated (const void *url);
+
+/* remove up to max URLs of key (all when 0) with all their mappings;
+ * *urls and *pairs (if not NULL) get the URLs and the data_store pairs
+ * removed. The key is done when fewer than max URLs were removed. */
+int purger_remove (surrogate_store *st, MDB_txn *txn, const void *key, size_t max,
+		size_t *urls, size_t *pairs);
+
+/* remove n URLs (hashes back to back) with all their mappings, in the
+ * order given; sorted URLs walk rev_data_store left to right */
+int purger_remove_urls (surrogate_store *st, MDB_txn *txn, const void *urls, size_t n,
+		size_t *pairs);
+
+/* purge key logically; *gen (if not NULL) gets its new generation */
+int purger_mark (surrogate_store *st, MDB_txn *txn, const void *key, unsigned long long *gen);
+
+/* whether any purge awaits cleanup; when not, the checks below can be
+ * skipped for the rest of txn */
+int purger_any (const surrogate_store *st, MDB_txn *txn);
+
+/* whether key awaits cleanup, and whether url carries such a key */
+int purger_pending (const surrogate_store *st, MDB_txn *txn, const void *key);
+int purger_url_dead (const surrogate_store *st, MDB_txn *txn, const void *url);
+
+/* read the keys pending in txn into ps, replacing what it held; free
+ * it with purger_pendset_free */
+int purger_pendset_load (const surrogate_store *st, MDB_txn *txn, purger_pendset *ps);
+void purger_pendset_free (purger_pendset *ps);
+
+/* whether key, or a key url carries, is pending as ps has it (from
+ * gens when ps is NULL or overflowed) */
+int purger_pendset_has (const surrogate_store *st, MDB_txn *txn, const purger_pendset *ps,
+		const void *key);
+int purger_pendset_url (const surrogate_store *st, MDB_txn *txn, const purger_pendset *ps,
+		const void *url);
+
+/* before writing to a pending key, or to a URL a pending key carries,
+ * clean up up to max of that key's URLs (all when 0); *urls (if not
+ * NULL) gets the URLs removed. *done is set once nothing is pending on
+ * it any more, and the keys settled leave ps (which may be NULL); when
+ * it is not, write later. */
+int purger_settle (surrogate_store *st, MDB_txn *txn, purger_pendset *ps, const void *key,
+		size_t max, size_t *urls, int *done);
+int purger_settle_url (surrogate_store *st, MDB_txn *txn, purger_pendset *ps, const void *url,
+		size_t max, size_t *urls, int *done);
+
+/* work off the graveyard, batch URLs per transaction (PURGER_BATCH when
+ * 0); *keys (if not NULL) gets the keys cleaned up. Returns
+ * MDB_SUCCESS, SURROGATE_STALE after a compaction (reopen and call
+ * again), or an LMDB error. */
+int purger_cleanup (surrogate_store *st, size_t batch, size_t *keys);
+
+#endif
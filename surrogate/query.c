@@ -0,0 +1,287 @@
+/*
+ * File Name:	query.c
+ * Function:	Answers set queries against the store built by
+ *		map_data.c without dumping and joining lists by hand:
+ *
+ *		  query and <key> <key> ...   URLs carrying every key
+ *		  query or  <key> <key> ...   URLs carrying any key
+ *		  query urls < list           keys carried by each URL
+ *
+ *		Keys and URLs are hashed as map_data.c hashes them; with
+ *		-x they are taken as already-hashed hex. Matching URL
+ *		hashes are printed as hex, one per line, in index order.
+ *		The urls mode reads one URL per line and prints
+ *		"<url>\t<key> <key> ..." per URL, looking URLs up in
+ *		batches sorted by hash rather than in input order.
+ *		Lines longer than URL_BYTES are reported and skipped.
+ *
+ *		Keys purged with purge -l and the URLs under them are
+ *		left out even before sweep.c has removed them.
+ *
+ *		cc query.c keyset.c revlookup.c purger.c surrogate.c \
+ *		   blake2/sse/blake2b.c -llmdb -pthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lmdb.h"
+#include "surrogate.h"
+#include "keyset.h"
+#include "revlookup.h"
+#include "purger.h"
+
+// URLs read per reverse lookup batch
+#define URL_BATCH 65536
+#define URL_BYTES 500
+
+// pending purges to filter out, if any
+typedef struct purges {
+	const surrogate_store *st;
+	MDB_txn *txn;
+	int any;
+} purges;
+
+typedef struct url_batch {
+	char (*lines)[URL_BYTES];
+	const char **urls;
+	unsigned char *hashes;
+	size_t n;
+	int open;		// a URL line has been started
+	int dead;		// its URL is under a pending purge
+	const purges *p;
+} url_batch;
+
+typedef struct url_list {
+	size_t matches;
+	const purges *p;
+} url_list;
+
+static int
+print_url (const void *url, void *ctx) {
+
+	char hex[2 * SURROGATE_MAX_HASH_BYTES + 1];
+	url_list *l = ctx;
+
+	if (l->p->any && purger_url_dead (l->p->st, l->p->txn, url))
+		return 0;
+	surrogate_hex (hex, url);
+	fprintf (stdout, "%s\n", hex);
+	l->matches++;
+	return 0;
+}
+
+static int
+print_keys (size_t index, const MDB_val *keys, int first, void *ctx) {
+
+	char hex[2 * SURROGATE_MAX_HASH_BYTES + 1];
+	url_batch *b = ctx;
+	size_t i, width = surrogate_hash_bytes ();
+
+	if (first) {
+		if (b->open)
+			fputc ('\n', stdout);
+		fprintf (stdout, "%s\t", b->lines[index]);
+		b->open = 1;
+		b->dead = b->p->any && purger_url_dead (b->p->st, b->p->txn,
+			b->hashes + index * width);
+	}
+	for (i = 0; i < keys->mv_size && !b->dead; i += width) {
+		if (b->p->any && purger_pending (b->p->st, b->p->txn, (const char *) keys->mv_data + i))
+			continue;
+		surrogate_hex (hex, (const char *) keys->mv_data + i);
+		fprintf (stdout, b->open == 1 ? "%s" : " %s", hex);
+		b->open = 2;
+	}
+	return 0;
+}
+
+// whether the line fgets read into line was whole; if not, the rest of
+// it is read past
+static int
+line_whole (const char *line, FILE *in) {
+
+	int c;
+
+	if (strchr (line, '\n') != NULL)
+		return 1;
+	c = getc (in);
+	if (c == EOF || c == '\n')
+		return 1;
+	while (c != '\n' && c != EOF)
+		c = getc (in);
+	return 0;
+}
+
+// reverse lookups for the URLs on stdin, one batch at a time
+static int
+lookup_urls (MDB_txn *txn, MDB_dbi dbi_rev, int hashed, const purges *p) {
+
+	int rc = MDB_SUCCESS;
+	size_t total = 0, i;
+	url_batch b;
+
+	b.lines = malloc (URL_BATCH * sizeof *b.lines);
+	b.urls = malloc (URL_BATCH * sizeof *b.urls);
+	b.hashes = malloc (URL_BATCH * surrogate_hash_bytes ());
+	b.open = 0;
+	b.p = p;
+	if (b.lines == NULL || b.urls == NULL || b.hashes == NULL) {
+		fprintf (stderr, "Out of memory\n");
+		return -1;
+	}
+
+	while (rc == MDB_SUCCESS && !feof (stdin)) {
+		for (b.n = 0; b.n < URL_BATCH && fgets (b.lines[b.n], URL_BYTES, stdin) != NULL; ) {
+			if (!line_whole (b.lines[b.n], stdin)) {
+				fprintf (stderr, "URL longer than %d bytes skipped: %.40s...\n",
+					URL_BYTES - 2, b.lines[b.n]);
+				continue;
+			}
+			b.lines[b.n][strcspn (b.lines[b.n], " \r\n")] = '\0';
+			if (b.lines[b.n][0] == '\0')
+				continue;
+			b.urls[b.n] = b.lines[b.n];
+			if (hashed && surrogate_parse_hex (b.hashes + b.n * surrogate_hash_bytes (), b.lines[b.n]) != 0) {
+				fprintf (stderr, "Invalid URL hash: %s\n", b.lines[b.n]);
+				continue;
+			}
+			b.n++;
+		}
+		// the purge check needs the hashes of plain URLs as well
+		if (hashed)
+			rc = revlookup_hashes (txn, dbi_rev, b.hashes, b.n, print_keys, &b);
+		else if (p->any) {
+			for (i = 0; i < b.n; i++)
+				surrogate_hash (b.hashes + i * surrogate_hash_bytes (), b.urls[i], strlen (b.urls[i]));
+			rc = revlookup_hashes (txn, dbi_rev, b.hashes, b.n, print_keys, &b);
+		}
+		else
+			rc = revlookup_urls (txn, dbi_rev, b.urls, b.n, print_keys, &b);
+		total += b.n;
+	}
+	if (b.open)
+		fputc ('\n', stdout);
+	if (rc == MDB_SUCCESS)
+		fprintf (stderr, "%zu URL(s)\n", total);
+
+	free (b.lines);
+	free (b.urls);
+	free (b.hashes);
+	return rc;
+}
+
+static void
+usage (const char *prog) {
+
+	fprintf (stderr, "usage: %s [-x] and|or <key> ...\n", prog);
+	fprintf (stderr, "       %s [-x] urls < list\n", prog);
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int rc, i, n, opt, nkeys, hashed = 0;
+	const char *op;
+	purges p;
+	url_list l;
+	unsigned char *hashes;
+	MDB_val *keys;
+	MDB_txn *txn;
+	surrogate_store st;
+
+	while ((opt = getopt (argc, argv, "x")) != -1) {
+		if (opt == 'x')
+			hashed = 1;
+		else {
+			usage (argv[0]);
+			return -1;
+		}
+	}
+	if (argc - optind < 1) {
+		usage (argv[0]);
+		return -1;
+	}
+	op = argv[optind++];
+	nkeys = argc - optind;
+	if ((strcmp (op, "urls") == 0) != (nkeys == 0)) {
+		usage (argv[0]);
+		return -1;
+	}
+
+	// the store decides how keys are hashed
+	rc = surrogate_open (&st, SURROGATE_DB_DIR, MDB_RDONLY);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to open data store: %s\n", surrogate_strerror (rc));
+		return -1;
+	}
+	if (!st.newline_tokens && !hashed && nkeys > 0)
+		fprintf (stderr, "Note: this store was fed before tokens ended at newlines; "
+			"a key last on its line is found with its newline\n");
+
+	// hash the keys of the query
+	hashes = malloc (nkeys * st.hash_bytes);
+	keys = malloc (nkeys * sizeof *keys);
+	if (nkeys > 0 && (hashes == NULL || keys == NULL)) {
+		fprintf (stderr, "Out of memory\n");
+		return -1;
+	}
+	for (i = 0; i < nkeys; i++) {
+		const char *token = argv[optind + i];
+		keys[i].mv_size = st.hash_bytes;
+		keys[i].mv_data = hashes + i * st.hash_bytes;
+		if (hashed)
+			rc = surrogate_parse_hex (keys[i].mv_data, token);
+		else
+			rc = surrogate_hash (keys[i].mv_data, token, strlen (token));
+		if (rc != 0) {
+			fprintf (stderr, "Invalid key: %s\n", token);
+			return -1;
+		}
+	}
+
+	rc = mdb_txn_begin (st.env, NULL, MDB_RDONLY, &txn);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to begin transaction: %s\n", mdb_strerror (rc));
+		return -1;
+	}
+
+	// purged keys are missing keys, whether or not cleaned up yet
+	p.st = &st;
+	p.txn = txn;
+	p.any = purger_any (&st, txn);
+	l.matches = 0;
+	l.p = &p;
+	if (p.any) {
+		for (i = n = 0; i < nkeys; i++)
+			if (!purger_pending (&st, txn, keys[i].mv_data))
+				keys[n++] = keys[i];
+		// and a purged key empties an intersection
+		if (n < nkeys && strcmp (op, "and") == 0)
+			n = 0;
+		nkeys = n;
+	}
+
+	if (strcmp (op, "and") == 0)
+		rc = keyset_intersect (txn, st.dbi, keys, nkeys, print_url, &l);
+	else if (strcmp (op, "or") == 0)
+		rc = keyset_union (txn, st.dbi, keys, nkeys, print_url, &l);
+	else if (strcmp (op, "urls") == 0)
+		rc = lookup_urls (txn, st.dbi_rev, hashed, &p);
+	else {
+		usage (argv[0]);
+		rc = -1;
+	}
+	if (rc > 0 || rc < -1)
+		fprintf (stderr, "Query failed: %s\n", mdb_strerror (rc));
+	else if (rc == 0 && strcmp (op, "urls") != 0)
+		fprintf (stderr, "%zu URL(s)\n", l.matches);
+
+	mdb_txn_abort (txn);
+	surrogate_close (&st);
+	free (hashes);
+	free (keys);
+
+	return rc == 0 ? 0 : -1;
+}
@@ -0,0 +1,171 @@
+/*
+ * File Name:	readpool.c
+ * Function:	Pre-registered read transactions with periodic stale
+ *		reader checks. See readpool.h.
+ *
+ *		cc ... readpool.c -llmdb -pthread
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "readpool.h"
+
+struct readpool {
+	MDB_env *env;
+	pthread_mutex_t lock;
+	pthread_cond_t available;
+	MDB_txn **txns;		// all transactions
+	MDB_txn **idle;		// stack of reset transactions
+	unsigned int size, nidle;
+	unsigned int check_secs;
+	time_t last_check;
+	unsigned long checks, reclaimed;
+};
+
+static time_t
+now (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+// clear reader slots of dead processes; called with the lock held
+static int
+check_readers (readpool *pool) {
+
+	int rc, dead = 0;
+
+	rc = mdb_reader_check (pool->env, &dead);
+	pool->last_check = now ();
+	pool->checks++;
+	if (rc == MDB_SUCCESS && dead > 0)
+		pool->reclaimed += dead;
+	return rc;
+}
+
+int
+readpool_create (MDB_env *env, unsigned int size, unsigned int check_secs, readpool **pool) {
+
+	int rc;
+	unsigned int flags;
+	readpool *p;
+
+	rc = mdb_env_get_flags (env, &flags);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	if (!(flags & MDB_NOTLS) || size == 0)
+		return EINVAL;
+
+	p = calloc (1, sizeof *p);
+	if (p == NULL)
+		return ENOMEM;
+	p->txns = calloc (size, sizeof *p->txns);
+	p->idle = calloc (size, sizeof *p->idle);
+	if (p->txns == NULL || p->idle == NULL) {
+		free (p->txns);
+		free (p->idle);
+		free (p);
+		return ENOMEM;
+	}
+	p->env = env;
+	p->check_secs = check_secs;
+	pthread_mutex_init (&p->lock, NULL);
+	pthread_cond_init (&p->available, NULL);
+
+	// free slots held by crashed tools before claiming ours
+	rc = check_readers (p);
+
+	for (; rc == MDB_SUCCESS && p->size < size; p->size++) {
+		rc = mdb_txn_begin (env, NULL, MDB_RDONLY, &p->txns[p->size]);
+		if (rc != MDB_SUCCESS)
+			break;
+		// a reset transaction keeps its reader slot
+		mdb_txn_reset (p->txns[p->size]);
+		p->idle[p->nidle++] = p->txns[p->size];
+	}
+	if (rc != MDB_SUCCESS) {
+		readpool_destroy (p);
+		return rc;
+	}
+	*pool = p;
+	return MDB_SUCCESS;
+}
+
+void
+readpool_destroy (readpool *pool) {
+
+	unsigned int i;
+
+	for (i = 0; i < pool->size; i++)
+		mdb_txn_abort (pool->txns[i]);
+	pthread_cond_destroy (&pool->available);
+	pthread_mutex_destroy (&pool->lock);
+	free (pool->txns);
+	free (pool->idle);
+	free (pool);
+}
+
+int
+readpool_acquire (readpool *pool, MDB_txn **txn) {
+
+	int rc;
+	MDB_txn *t;
+
+	pthread_mutex_lock (&pool->lock);
+	while (pool->nidle == 0)
+		pthread_cond_wait (&pool->available, &pool->lock);
+	t = pool->idle[--pool->nidle];
+	if (pool->check_secs > 0 && now () - pool->last_check >= (time_t) pool->check_secs)
+		check_readers (pool);
+	pthread_mutex_unlock (&pool->lock);
+
+	rc = mdb_txn_renew (t);
+	if (rc != MDB_SUCCESS) {
+		readpool_release (pool, t);
+		return rc;
+	}
+	*txn = t;
+	return MDB_SUCCESS;
+}
+
+void
+readpool_release (readpool *pool, MDB_txn *txn) {
+
+	mdb_txn_reset (txn);
+
+	pthread_mutex_lock (&pool->lock);
+	pool->idle[pool->nidle++] = txn;
+	pthread_cond_signal (&pool->available);
+	pthread_mutex_unlock (&pool->lock);
+}
+
+int
+readpool_refresh (readpool *pool, MDB_txn *txn) {
+
+	(void) pool;
+	mdb_txn_reset (txn);
+	return mdb_txn_renew (txn);
+}
+
+void
+readpool_stats (readpool *pool, readpool_stat *stat) {
+
+	MDB_envinfo info;
+
+	pthread_mutex_lock (&pool->lock);
+	stat->size = pool->size;
+	stat->in_use = pool->size - pool->nidle;
+	stat->checks = pool->checks;
+	stat->reclaimed = pool->reclaimed;
+	pthread_mutex_unlock (&pool->lock);
+
+	if (mdb_env_info (pool->env, &info) == MDB_SUCCESS) {
+		stat->maxreaders = info.me_maxreaders;
+		stat->numreaders = info.me_numreaders;
+	}
+	else
+		stat->maxreaders = stat->numreaders = 0;
+}
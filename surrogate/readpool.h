@@ -0,0 +1,47 @@
+/*
+ * File Name:	readpool.h
+ * Function:	A pool of pre-registered read transactions for long
+ *		lived readers of the surrogate store. Each transaction
+ *		keeps its slot in the LMDB reader table while idle, so
+ *		handing one out is an mdb_txn_renew onto the latest
+ *		snapshot instead of a begin/abort pair that takes and
+ *		frees a slot. The pool also clears slots left behind by
+ *		crashed processes with mdb_reader_check.
+ *
+ *		The environment must be opened with MDB_NOTLS, since
+ *		pooled transactions move between threads and one thread
+ *		may hold several of them.
+ */
+
+#ifndef READPOOL_H
+#define READPOOL_H
+
+#include "lmdb.h"
+
+typedef struct readpool readpool;
+
+typedef struct readpool_stat {
+	unsigned int size;		// transactions owned by the pool
+	unsigned int in_use;		// of which handed out
+	unsigned int maxreaders;	// reader table slots in the environment
+	unsigned int numreaders;	// slots used, by all processes
+	unsigned long checks;		// mdb_reader_check runs
+	unsigned long reclaimed;	// stale slots cleared by them
+} readpool_stat;
+
+/* register size read transactions on env and check for stale readers
+ * at most every check_secs seconds (0 checks only at creation) */
+int readpool_create (MDB_env *env, unsigned int size, unsigned int check_secs, readpool **pool);
+void readpool_destroy (readpool *pool);
+
+/* hand out a transaction on the latest snapshot, waiting while all are
+ * in use; give it back with readpool_release */
+int readpool_acquire (readpool *pool, MDB_txn **txn);
+void readpool_release (readpool *pool, MDB_txn *txn);
+
+/* move a held transaction to the latest snapshot */
+int readpool_refresh (readpool *pool, MDB_txn *txn);
+
+void readpool_stats (readpool *pool, readpool_stat *stat);
+
+#endif
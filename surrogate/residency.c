@@ -0,0 +1,356 @@
+/*
+ * File Name:	residency.c
+ * Function:	Page cache residency and hot sets. See residency.h.
+ *
+ *		cc ... residency.c pagewalk.c -llmdb -pthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "residency.h"
+
+// the data file, mapped, and which of its pages the cache holds
+typedef struct core {
+	unsigned char *map;
+	size_t bytes, psize;
+	uint64_t npages;
+	unsigned char *vec;		// per OS page, from mincore; NULL if not asked
+	long ospage;
+} core;
+
+typedef struct hotpage {
+	uint64_t pgno, pages;
+	unsigned int level;
+	int branch;
+	int sub;			// of a MDB_DUPSORT sub-tree
+} hotpage;
+
+// the cache as mincore saw it once, for every database measured, and
+// the hot pages found in them
+struct residency_snapshot {
+	core c;
+	int keep;			// gather the hot pages
+	hotpage *hot;
+	size_t n, cap;
+};
+
+// what one walk thread gathers, on its own
+typedef struct tally {
+	residency_stat stat;
+	hotpage *hot;
+	size_t n, cap;
+	int err;
+} tally;
+
+typedef struct collect {
+	const residency_snapshot *snap;
+	tally *t;			// per thread
+} collect;
+
+static double
+now_ms (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static int
+grow (void **p, size_t *cap, size_t need, size_t size) {
+
+	size_t n = *cap ? *cap : 1024;
+	void *q;
+
+	if (need <= *cap)
+		return 0;
+	while (n < need)
+		n *= 2;
+	q = realloc (*p, n * size);
+	if (q == NULL)
+		return ENOMEM;
+	*p = q;
+	*cap = n;
+	return 0;
+}
+
+static int
+core_open (MDB_env *env, int residency, core *c) {
+
+	int rc, fd;
+	MDB_stat ms;
+	struct stat sb;
+
+	memset (c, 0, sizeof *c);
+	rc = mdb_env_stat (env, &ms);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_env_get_fd (env, &fd);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	if (fstat (fd, &sb) != 0)
+		return errno;
+	c->psize = ms.ms_psize;
+	c->bytes = sb.st_size;
+	c->npages = c->bytes / c->psize;
+	c->ospage = sysconf (_SC_PAGESIZE);
+	if (c->bytes == 0)
+		return MDB_SUCCESS;
+	c->map = mmap (NULL, c->bytes, PROT_READ, MAP_SHARED, fd, 0);
+	if (c->map == MAP_FAILED) {
+		c->map = NULL;
+		return errno;
+	}
+	if (residency) {
+		c->vec = malloc ((c->bytes + c->ospage - 1) / c->ospage);
+		if (c->vec == NULL)
+			return ENOMEM;
+		if (mincore (c->map, c->bytes, c->vec) != 0)
+			return errno;
+	}
+	return MDB_SUCCESS;
+}
+
+static void
+core_close (core *c) {
+
+	if (c->map != NULL)
+		munmap (c->map, c->bytes);
+	free (c->vec);
+	c->map = NULL;
+	c->vec = NULL;
+}
+
+static int
+cached (const core *c, uint64_t pgno) {
+
+	return pgno < c->npages && c->vec[pgno * c->psize / c->ospage] & 1;
+}
+
+static void
+on_page (uint64_t pgno, int kind, unsigned int level, unsigned int pages, unsigned int thread,
+		void *ctx) {
+
+	collect *col = ctx;
+	const core *c = &col->snap->c;
+	tally *t = &col->t[thread];
+	unsigned int i, in = 0;
+	int branch = kind == PAGEWALK_BRANCH || kind == PAGEWALK_SUB_BRANCH;
+
+	for (i = 0; i < pages; i++)
+		in += cached (c, pgno + i);
+	t->stat.pages[kind] += pages;
+	t->stat.resident[kind] += in;
+	if (!col->snap->keep || !(branch || cached (c, pgno)))
+		return;
+	if (grow ((void **) &t->hot, &t->cap, t->n + 1, sizeof *t->hot) != 0) {
+		t->err = ENOMEM;
+		return;
+	}
+	t->hot[t->n].pgno = pgno;
+	t->hot[t->n].pages = pages;
+	t->hot[t->n].level = level;
+	t->hot[t->n].branch = branch;
+	t->hot[t->n++].sub = kind == PAGEWALK_SUB_BRANCH || kind == PAGEWALK_SUB_LEAF;
+}
+
+// branch pages of the main trees by level, then those of sub-trees by
+// level, then the rest, each in file order: a lookup passes the main
+// tree before it reaches a sub-tree, and most keys have none
+static int
+by_heat (const void *a, const void *b) {
+
+	const hotpage *x = a, *y = b;
+
+	if (x->branch != y->branch)
+		return y->branch - x->branch;
+	if (x->branch && x->sub != y->sub)
+		return x->sub - y->sub;
+	if (x->branch && x->level != y->level)
+		return x->level < y->level ? -1 : 1;
+	return (x->pgno > y->pgno) - (x->pgno < y->pgno);
+}
+
+int
+residency_snapshot_create (MDB_env *env, int keep, residency_snapshot **snap) {
+
+	int rc;
+
+	*snap = calloc (1, sizeof **snap);
+	if (*snap == NULL)
+		return ENOMEM;
+	(*snap)->keep = keep;
+	rc = core_open (env, 1, &(*snap)->c);
+	if (rc != MDB_SUCCESS) {
+		residency_snapshot_destroy (*snap);
+		*snap = NULL;
+	}
+	return rc;
+}
+
+void
+residency_snapshot_destroy (residency_snapshot *snap) {
+
+	core_close (&snap->c);
+	free (snap->hot);
+	free (snap);
+}
+
+int
+residency_measure (residency_snapshot *snap, MDB_txn *txn, const char *name,
+		unsigned int threads, residency_stat *stat) {
+
+	int rc, k;
+	unsigned int i;
+	size_t n;
+	collect col;
+	pagewalk_stat ws;
+
+	memset (stat, 0, sizeof *stat);
+	if (threads == 0)
+		threads = 1;
+	col.snap = snap;
+	col.t = calloc (threads, sizeof *col.t);
+	if (col.t == NULL)
+		return ENOMEM;
+	rc = pagewalk_pages (txn, name, threads, on_page, &col, &ws);
+
+	// the threads' tallies, summed and appended
+	for (i = 0, n = snap->n; i < threads; i++) {
+		for (k = 0; k < PAGEWALK_KINDS; k++) {
+			stat->pages[k] += col.t[i].stat.pages[k];
+			stat->resident[k] += col.t[i].stat.resident[k];
+		}
+		if (rc == MDB_SUCCESS)
+			rc = col.t[i].err;
+		n += col.t[i].n;
+	}
+	if (rc == MDB_SUCCESS && grow ((void **) &snap->hot, &snap->cap, n, sizeof *snap->hot) != 0)
+		rc = ENOMEM;
+	for (i = 0; i < threads; i++) {
+		if (rc == MDB_SUCCESS && col.t[i].n > 0) {
+			memcpy (snap->hot + snap->n, col.t[i].hot, col.t[i].n * sizeof *snap->hot);
+			snap->n += col.t[i].n;
+		}
+		free (col.t[i].hot);
+	}
+	free (col.t);
+	return rc;
+}
+
+int
+residency_save (residency_snapshot *snap, const char *path, unsigned long long *pages) {
+
+	int rc = MDB_SUCCESS;
+	size_t i, j;
+	uint64_t end;
+	char tmp[4096];
+	FILE *out;
+	const hotpage *h = snap->hot;
+
+	*pages = 0;
+	qsort (snap->hot, snap->n, sizeof *snap->hot, by_heat);
+
+	// written aside and renamed over, so a reader never sees half
+	snprintf (tmp, sizeof tmp, "%s.tmp", path);
+	out = fopen (tmp, "w");
+	if (out == NULL)
+		return errno;
+	fprintf (out, "hotset %zu\n", snap->c.psize);
+	for (i = 0; i < snap->n; i = j) {
+		end = h[i].pgno + h[i].pages;
+		// neighbours of the same kind and level make one range
+		for (j = i + 1; j < snap->n && h[j].pgno == end && h[j].branch == h[i].branch &&
+		     (!h[i].branch || (h[j].sub == h[i].sub && h[j].level == h[i].level)); j++)
+			end += h[j].pages;
+		fprintf (out, "%c %llu %llu\n", h[i].branch ? 'b' : 'l',
+			(unsigned long long) h[i].pgno, (unsigned long long) (end - h[i].pgno));
+		*pages += end - h[i].pgno;
+	}
+	if (fclose (out) != 0 || rename (tmp, path) != 0) {
+		rc = errno;
+		unlink (tmp);
+	}
+	return rc;
+}
+
+// madvise, and with wait read, the ranges of one kind
+static void
+fetch (const core *c, const hotpage *r, size_t n, int branch, int wait,
+		residency_prefetch_stat *stat) {
+
+	volatile unsigned char sink;
+	size_t i;
+	uint64_t p;
+
+	for (i = 0; i < n; i++) {
+		if (r[i].branch != branch || r[i].pages == 0)
+			continue;
+		madvise (c->map + r[i].pgno * c->psize, (size_t) r[i].pages * c->psize, MADV_WILLNEED);
+		stat->ranges++;
+		stat->pages += r[i].pages;
+		if (branch)
+			stat->branch_pages += r[i].pages;
+	}
+	if (!wait)
+		return;
+	for (i = 0; i < n; i++)
+		if (r[i].branch == branch)
+			for (p = r[i].pgno; p < r[i].pgno + r[i].pages; p++)
+				sink = c->map[p * c->psize];
+	(void) sink;
+}
+
+int
+residency_prefetch (MDB_env *env, const char *path, int wait, residency_prefetch_stat *stat) {
+
+	int rc;
+	char kind;
+	size_t psize, n = 0, cap = 0;
+	unsigned long long first, pages;
+	double t = now_ms ();
+	hotpage *r = NULL;
+	FILE *in;
+	core c;
+
+	memset (stat, 0, sizeof *stat);
+	in = fopen (path, "r");
+	if (in == NULL)
+		return errno;
+	rc = core_open (env, 0, &c);
+	if (rc == MDB_SUCCESS && (fscanf (in, "hotset %zu", &psize) != 1 || psize != c.psize))
+		rc = EINVAL;
+	while (rc == MDB_SUCCESS && fscanf (in, " %c %llu %llu", &kind, &first, &pages) == 3) {
+		// the file may have shrunk since
+		if (first >= c.npages) {
+			stat->skipped += pages;
+			continue;
+		}
+		if (pages > c.npages - first) {
+			stat->skipped += pages - (c.npages - first);
+			pages = c.npages - first;
+		}
+		rc = grow ((void **) &r, &cap, n + 1, sizeof *r);
+		if (rc != 0)
+			break;
+		r[n].pgno = first;
+		r[n].pages = pages;
+		r[n].level = 0;
+		r[n].sub = 0;
+		r[n++].branch = kind == 'b';
+	}
+	fclose (in);
+	if (rc == MDB_SUCCESS) {
+		// branch pages first, in the file's order
+		fetch (&c, r, n, 1, wait, stat);
+		fetch (&c, r, n, 0, wait, stat);
+	}
+	free (r);
+	core_close (&c);
+	stat->ms = now_ms () - t;
+	return rc;
+}
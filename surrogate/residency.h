@@ -0,0 +1,69 @@
+/*
+ * File Name:	residency.h
+ * Function:	Page cache residency of the store's databases, and
+ *		warming it up after a restart. The store is read
+ *		through mmap, so a process started on a cold cache
+ *		stalls on a disk read for every page its first lookups
+ *		and purges touch, branch pages above all, which every
+ *		lookup passes through.
+ *
+ *		A snapshot asks mincore once which pages of the data
+ *		file are cached. residency_measure walks a database
+ *		(pagewalk.h) against it, each thread counting on its
+ *		own, and gathers the database's hot pages into it when
+ *		asked to keep them. residency_save writes those to a
+ *		file: every branch page of the
+ *		databases' main trees, top levels first, then those of
+ *		their MDB_DUPSORT sub-trees likewise, then the leaf and
+ *		overflow pages cached at the time, in file order.
+ *		residency_prefetch, called at startup, maps the data
+ *		file and madvises MADV_WILLNEED over the set, branch
+ *		pages first, merging neighbouring pages into ranges. A
+ *		hot set outliving the layout it was saved from (after
+ *		a compaction, say) only prefetches the wrong pages.
+ *
+ *		The file is text: "hotset <page size>", then a line
+ *		"b|l <first page> <pages>" per range, b for branch
+ *		pages.
+ */
+
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include "lmdb.h"
+#include "pagewalk.h"
+
+typedef struct residency_stat {
+	unsigned long long pages[PAGEWALK_KINDS];	// by PAGEWALK_BRANCH ...
+	unsigned long long resident[PAGEWALK_KINDS];
+} residency_stat;
+
+typedef struct residency_snapshot residency_snapshot;
+
+typedef struct residency_prefetch_stat {
+	unsigned long long pages, branch_pages;	// prefetched; of which branch
+	unsigned long long ranges;		// madvise calls
+	unsigned long long skipped;		// pages past the end of the file
+	double ms;				// taken, including the wait
+} residency_prefetch_stat;
+
+/* map env's data file and take which of its pages are cached; with
+ * keep, the databases measured against it also leave their hot pages */
+int residency_snapshot_create (MDB_env *env, int keep, residency_snapshot **snap);
+void residency_snapshot_destroy (residency_snapshot *snap);
+
+/* count the pages of database name as txn sees it, by kind, and those
+ * cached in snap; MDB_NOTFOUND when there is no such database */
+int residency_measure (residency_snapshot *snap, MDB_txn *txn, const char *name,
+		unsigned int threads, residency_stat *stat);
+
+/* write the hot set of the databases measured against snap, which must
+ * have been created with keep, to path, replacing it; *pages gets its
+ * size */
+int residency_save (residency_snapshot *snap, const char *path, unsigned long long *pages);
+
+/* prefetch the hot set at path into the page cache of env's data file;
+ * with wait, also read every page, returning once all are cached */
+int residency_prefetch (MDB_env *env, const char *path, int wait, residency_prefetch_stat *stat);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * File Name:	revlookup.c
+ * Function:	Batched URL -> keys lookups in rev_data_store. See
+ *		revlookup.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "revlookup.h"
+#include "surrogate.h"
+
+typedef struct rev_entry {
+	unsigned char hash[SURROGATE_MAX_HASH_BYTES];	// zero padded
+	size_t index;
+} rev_entry;
+
+static int
+by_hash (const void *a, const void *b) {
+
+	const rev_entry *x = a, *y = b;
+	int c = memcmp (x->hash, y->hash, sizeof x->hash);
+	if (c == 0)
+		c = (x->index > y->index) - (x->index < y->index);
+	return c;
+}
+
+static int
+lookup_sorted (MDB_cursor *cursor, const rev_entry *e, size_t n,
+		revlookup_emit_fn *emit, void *ctx) {
+
+	int rc, first;
+	size_t i;
+	size_t width = surrogate_hash_bytes ();
+	MDB_val key, data, none;
+
+	none.mv_size = 0;
+	none.mv_data = NULL;
+
+	for (i = 0; i < n; i++) {
+		key.mv_size = width;
+		key.mv_data = (void *) e[i].hash;
+
+		rc = mdb_cursor_get (cursor, &key, &data, MDB_SET_KEY);
+		if (rc == MDB_NOTFOUND) {
+			if ((rc = emit (e[i].index, &none, 1, ctx)) != 0)
+				return rc;
+			continue;
+		}
+		if (rc != MDB_SUCCESS)
+			return rc;
+
+		// stream the URL's keys a page at a time
+		rc = mdb_cursor_get (cursor, &key, &data, MDB_GET_MULTIPLE);
+		for (first = 1; rc == MDB_SUCCESS; first = 0) {
+			if ((rc = emit (e[i].index, &data, first, ctx)) != 0)
+				return rc;
+			rc = mdb_cursor_get (cursor, &key, &data, MDB_NEXT_MULTIPLE);
+		}
+		if (rc != MDB_NOTFOUND)
+			return rc;
+	}
+	return MDB_SUCCESS;
+}
+
+int
+revlookup_hashes (MDB_txn *txn, MDB_dbi dbi_rev, const void *hashes, size_t n,
+		revlookup_emit_fn *emit, void *ctx) {
+
+	int rc;
+	size_t i, width = surrogate_hash_bytes ();
+	rev_entry *e;
+	MDB_cursor *cursor;
+
+	if (n == 0)
+		return MDB_SUCCESS;
+	e = malloc (n * sizeof *e);
+	if (e == NULL)
+		return ENOMEM;
+	for (i = 0; i < n; i++) {
+		memset (e[i].hash, 0, sizeof e[i].hash);
+		memcpy (e[i].hash, (const char *) hashes + i * width, width);
+		e[i].index = i;
+	}
+	qsort (e, n, sizeof *e, by_hash);
+
+	rc = mdb_cursor_open (txn, dbi_rev, &cursor);
+	if (rc == MDB_SUCCESS) {
+		rc = lookup_sorted (cursor, e, n, emit, ctx);
+		mdb_cursor_close (cursor);
+	}
+	free (e);
+	return rc;
+}
+
+int
+revlookup_urls (MDB_txn *txn, MDB_dbi dbi_rev, const char * const *urls, size_t n,
+		revlookup_emit_fn *emit, void *ctx) {
+
+	int rc;
+	size_t i, width = surrogate_hash_bytes ();
+	unsigned char *hashes;
+
+	if (n == 0)
+		return MDB_SUCCESS;
+	hashes = malloc (n * width);
+	if (hashes == NULL)
+		return ENOMEM;
+
+	// hash the whole batch before touching the tree
+	for (i = 0; i < n; i++) {
+		if (surrogate_hash (hashes + i * width, urls[i], strlen (urls[i])) != 0) {
+			free (hashes);
+			return EINVAL;
+		}
+	}
+	rc = revlookup_hashes (txn, dbi_rev, hashes, n, emit, ctx);
+	free (hashes);
+	return rc;
+}
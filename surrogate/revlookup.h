@@ -0,0 +1,34 @@
+/*
+ * File Name:	revlookup.h
+ * Function:	Batched reverse lookups: which surrogate keys does each
+ *		of many URLs carry. The batch is looked up in hash order
+ *		so consecutive lookups walk neighbouring leaf pages of
+ *		rev_data_store, and the branch pages above them stay
+ *		in cache from one lookup to the next. There is no
+ *		software prefetch: LMDB gives out no page address
+ *		before a cursor has descended to it, and a second
+ *		cursor descending ahead costs as much as the lookup it
+ *		would hide.
+ */
+
+#ifndef REVLOOKUP_H
+#define REVLOOKUP_H
+
+#include <stddef.h>
+#include "lmdb.h"
+
+/* called for each page of key hashes stored under the URL at index in
+ * the batch, with first set on its first page. A URL without keys gets
+ * a single call with keys->mv_size == 0. Calls come in hash order, not
+ * batch order. A non-zero return stops the lookup and is passed back. */
+typedef int (revlookup_emit_fn) (size_t index, const MDB_val *keys, int first, void *ctx);
+
+/* look up n URL hashes of surrogate_hash_bytes () bytes each */
+int revlookup_hashes (MDB_txn *txn, MDB_dbi dbi_rev, const void *hashes, size_t n,
+		revlookup_emit_fn *emit, void *ctx);
+
+/* hash n URLs as map_data.c does, then look them up */
+int revlookup_urls (MDB_txn *txn, MDB_dbi dbi_rev, const char * const *urls, size_t n,
+		revlookup_emit_fn *emit, void *ctx);
+
+#endif
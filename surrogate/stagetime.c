@@ -0,0 +1,130 @@
+/*
+ * File Name:	stagetime.c
+ * Function:	Stage timing. See stagetime.h.
+ *
+ *		Values under 2^SUB_BITS get a bucket each; above, a
+ *		value with its top bit at e lands in group e - SUB_BITS
+ *		+ 1 at the sub-bucket of its next SUB_BITS bits.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "stagetime.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TSC 1
+#endif
+
+#define SUB	(1u << STAGETIME_SUB_BITS)
+
+static double ns_per_tick;
+
+static uint64_t
+mono_ns (void) {
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint64_t
+stagetime_now (void) {
+
+#ifdef TSC
+	return __rdtsc ();
+#else
+	return mono_ns ();
+#endif
+}
+
+double
+stagetime_ns_per_tick (void) {
+
+#ifdef TSC
+	struct timespec pause = { 0, 20000000 };
+	uint64_t t0, c0;
+
+	if (ns_per_tick == 0) {
+		t0 = mono_ns ();
+		c0 = __rdtsc ();
+		nanosleep (&pause, NULL);
+		ns_per_tick = (double) (mono_ns () - t0) / (__rdtsc () - c0);
+	}
+#else
+	ns_per_tick = 1;
+#endif
+	return ns_per_tick;
+}
+
+static size_t
+bucket (uint64_t v) {
+
+	unsigned int e, shift;
+
+	if (v < SUB)
+		return v;
+	e = 63 - __builtin_clzll (v);
+	shift = e - STAGETIME_SUB_BITS + 1;
+	return ((size_t) shift << STAGETIME_SUB_BITS) + ((v >> (shift - 1)) - SUB);
+}
+
+// the middle of bucket i
+static uint64_t
+bucket_value (size_t i) {
+
+	unsigned int shift = i >> STAGETIME_SUB_BITS;
+
+	if (shift == 0)
+		return i;
+	return ((uint64_t) (SUB + (i & (SUB - 1))) << (shift - 1)) + ((1ULL << (shift - 1)) >> 1);
+}
+
+void
+stagetime_record (stagetime_hist *h, uint64_t ticks) {
+
+	h->counts[bucket (ticks)]++;
+	h->n++;
+	h->sum += ticks;
+	if (ticks > h->max)
+		h->max = ticks;
+}
+
+void
+stagetime_reset (stagetime_hist *h) {
+
+	memset (h, 0, sizeof *h);
+}
+
+uint64_t
+stagetime_percentile (const stagetime_hist *h, double q) {
+
+	uint64_t rank, seen = 0, v;
+	size_t i;
+
+	if (h->n == 0)
+		return 0;
+	rank = (uint64_t) (q * h->n);
+	if (rank >= h->n)
+		rank = h->n - 1;
+	for (i = 0; i < STAGETIME_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen > rank)
+			break;
+	}
+	v = bucket_value (i);
+	return v < h->max ? v : h->max;
+}
+
+void
+stagetime_json (FILE *out, const stagetime_hist *h) {
+
+	double ns = stagetime_ns_per_tick ();
+
+	fprintf (out, "{\"count\":%llu,\"total_us\":%.1f,\"p50_ns\":%.0f,\"p90_ns\":%.0f,"
+		"\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f}",
+		(unsigned long long) h->n, h->sum * ns / 1e3,
+		stagetime_percentile (h, 0.5) * ns, stagetime_percentile (h, 0.9) * ns,
+		stagetime_percentile (h, 0.99) * ns, stagetime_percentile (h, 0.999) * ns,
+		h->max * ns);
+}
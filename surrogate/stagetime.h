@@ -0,0 +1,42 @@
+/*
+ * File Name:	stagetime.h
+ * Function:	Cheap timing of the stages of a hot loop. Time is read
+ *		from the CPU's time stamp counter where there is one (a
+ *		few nanoseconds, no system call), calibrated against
+ *		CLOCK_MONOTONIC once, and durations go into
+ *		log-linear histograms in the manner of HdrHistogram:
+ *		2^STAGETIME_SUB_BITS buckets per power of two, so every
+ *		percentile is within about 3% of the truth, recording is
+ *		an index computation and an increment, and nothing is
+ *		allocated while recording.
+ */
+
+#ifndef STAGETIME_H
+#define STAGETIME_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define STAGETIME_SUB_BITS	5
+#define STAGETIME_BUCKETS	((64 - STAGETIME_SUB_BITS + 1) << STAGETIME_SUB_BITS)
+
+typedef struct stagetime_hist {
+	uint64_t n, sum, max;		// in ticks
+	uint64_t counts[STAGETIME_BUCKETS];
+} stagetime_hist;
+
+/* the current tick count, and nanoseconds per tick (calibrated on the
+ * first call, taking some 20 ms) */
+uint64_t stagetime_now (void);
+double stagetime_ns_per_tick (void);
+
+void stagetime_record (stagetime_hist *h, uint64_t ticks);
+void stagetime_reset (stagetime_hist *h);
+
+/* the duration, in ticks, under which fraction q of those recorded fall */
+uint64_t stagetime_percentile (const stagetime_hist *h, double q);
+
+/* h as a JSON object: "count", "total_us" and "p50_ns" ... "max_ns" */
+void stagetime_json (FILE *out, const stagetime_hist *h);
+
+#endif
@@ -0,0 +1,644 @@
+/*
+ * File Name:	surrogate.c
+ * Function:	Helpers shared by the surrogate key tools for opening
+ *		the store and hashing tokens the same way map_data.c
+ *		does.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "surrogate.h"
+#include "blake2/sse/blake2.h"
+
+// meta records
+#define META_HASH	"hash"
+#define META_HASH_KEY	"hash_key"
+#define META_HASH_BYTES	"hash_bytes"
+#define META_TOKENS	"tokens"
+#define META_COMPACTING	"compacting"
+
+/* The hash policy is the process's, not the store's: surrogate_hash
+ * takes no store. It is set by the default once, then by each open or
+ * surrogate_select_hash, and may only change while no store is open, so
+ * a process has every store it holds hashed one way and hashing threads
+ * never see it rewritten. The tools open one store at a time; compact.c
+ * opens its copy, which carries the same meta records. */
+static pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t hash_once = PTHREAD_ONCE_INIT;
+static int stores_open;
+
+// width of the IDs surrogate_hash writes
+static size_t hash_bytes = SURROGATE_HASH_BYTES;
+
+// the tools key BLAKE2b with the bytes 0, 1, ..., 7 at every width
+static const uint8_t hash_key[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+// the key block compressed once; most tokens then fit one more block
+static blake2b_prekey_state hash_state;
+
+static void
+blake2b_select (const unsigned char *key) {
+
+	(void) key;
+	blake2b_prekey (&hash_state, hash_bytes, hash_key, sizeof hash_key);
+}
+
+static int
+blake2b_hash (void *out, const char *token, size_t len) {
+
+	return blake2b_prekeyed (&hash_state, out, token, len);
+}
+
+// SipHash-1-3: one compression round per word and three to finalize,
+// the variant Rust and CPython use for hash tables. Wider IDs take
+// its 128-bit output, truncated to 12 bytes where asked.
+static uint64_t sip_k0, sip_k1;
+
+#define SIP_ROTL(x, b)	(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND(v0, v1, v2, v3) do { \
+		v0 += v1; v1 = SIP_ROTL (v1, 13); v1 ^= v0; v0 = SIP_ROTL (v0, 32); \
+		v2 += v3; v3 = SIP_ROTL (v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = SIP_ROTL (v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = SIP_ROTL (v1, 17); v1 ^= v2; v2 = SIP_ROTL (v2, 32); \
+	} while (0)
+
+static uint64_t
+load64_le (const unsigned char *p) {
+
+	return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+		(uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 |
+		(uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static void
+store64_le (unsigned char *p, uint64_t w, size_t n) {
+
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		p[i] = (unsigned char) (w >> (8 * i));
+}
+
+static void
+siphash_select (const unsigned char *key) {
+
+	sip_k0 = load64_le (key);
+	sip_k1 = load64_le (key + 8);
+}
+
+static int
+siphash_hash (void *out, const char *token, size_t len) {
+
+	const unsigned char *in = (const unsigned char *) token;
+	const unsigned char *end = in + (len & ~(size_t) 7);
+	const int wide = hash_bytes > 8;
+	uint64_t v0 = 0x736f6d6570736575ULL ^ sip_k0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ sip_k1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ sip_k0;
+	uint64_t v3 = 0x7465646279746573ULL ^ sip_k1;
+	uint64_t m, b = (uint64_t) len << 56;
+	unsigned char *o = out;
+	int i;
+
+	if (wide)
+		v1 ^= 0xee;
+	for (; in != end; in += 8) {
+		m = load64_le (in);
+		v3 ^= m;
+		SIP_ROUND (v0, v1, v2, v3);
+		v0 ^= m;
+	}
+	for (i = (int) (len & 7) - 1; i >= 0; i--)
+		b |= (uint64_t) in[i] << (8 * i);
+
+	v3 ^= b;
+	SIP_ROUND (v0, v1, v2, v3);
+	v0 ^= b;
+	v2 ^= wide ? 0xee : 0xff;
+	SIP_ROUND (v0, v1, v2, v3);
+	SIP_ROUND (v0, v1, v2, v3);
+	SIP_ROUND (v0, v1, v2, v3);
+	store64_le (o, v0 ^ v1 ^ v2 ^ v3, 8);
+
+	if (wide) {
+		v1 ^= 0xdd;
+		SIP_ROUND (v0, v1, v2, v3);
+		SIP_ROUND (v0, v1, v2, v3);
+		SIP_ROUND (v0, v1, v2, v3);
+		store64_le (o + 8, v0 ^ v1 ^ v2 ^ v3, hash_bytes - 8);
+	}
+	return 0;
+}
+
+typedef struct hash_policy {
+	const char *name;
+	int keyed;		// draws a per-store key kept in meta
+	void (*select) (const unsigned char *key);
+	int (*hash) (void *out, const char *token, size_t len);
+} hash_policy;
+
+static const hash_policy policies[] = {
+	{ "blake2b", 0, blake2b_select, blake2b_hash },
+	{ "siphash13", 1, siphash_select, siphash_hash },
+};
+#define NUM_POLICIES (sizeof policies / sizeof policies[0])
+
+const char * const surrogate_hash_names[] = { "blake2b", "siphash13", NULL };
+
+static const hash_policy *policy = &policies[0];
+static unsigned char policy_key[SURROGATE_HASH_KEY_BYTES];
+
+static void
+hash_init (void) {
+
+	policies[0].select (NULL);
+}
+
+static const hash_policy *
+find_policy (const char *name, size_t len) {
+
+	size_t i;
+
+	for (i = 0; i < NUM_POLICIES; i++)
+		if (strlen (policies[i].name) == len && memcmp (policies[i].name, name, len) == 0)
+			return &policies[i];
+	return NULL;
+}
+
+static int
+valid_width (size_t bytes) {
+
+	return bytes == 8 || bytes == 12 || bytes == 16;
+}
+
+// make p at bytes wide the process's policy, unless it already is; with
+// a store open, only the same policy is accepted
+static int
+select_policy (const hash_policy *p, size_t bytes, const unsigned char *key) {
+
+	int rc = 0;
+
+	pthread_once (&hash_once, hash_init);
+	pthread_mutex_lock (&policy_lock);
+	if (p == policy && bytes == hash_bytes &&
+	    (!p->keyed || memcmp (key, policy_key, sizeof policy_key) == 0))
+		;
+	else if (stores_open > 0)
+		rc = SURROGATE_HASH_MISMATCH;
+	else {
+		hash_bytes = bytes;
+		p->select (key);
+		if (p->keyed)
+			memcpy (policy_key, key, sizeof policy_key);
+		policy = p;
+	}
+	pthread_mutex_unlock (&policy_lock);
+	return rc;
+}
+
+int
+surrogate_select_hash (const char *name, size_t bytes, const void *key) {
+
+	const hash_policy *p = find_policy (name, strlen (name));
+
+	if (p == NULL || !valid_width (bytes) || (p->keyed && key == NULL))
+		return EINVAL;
+	return select_policy (p, bytes, key);
+}
+
+const char *
+surrogate_hash_name (void) {
+
+	return policy->name;
+}
+
+size_t
+surrogate_hash_bytes (void) {
+
+	return hash_bytes;
+}
+
+const char *
+surrogate_token_delims (const surrogate_store *st) {
+
+	return st->newline_tokens ? " \n" : " ";
+}
+
+const char *
+surrogate_strerror (int rc) {
+
+	if (rc == SURROGATE_HASH_MISMATCH)
+		return "SURROGATE_HASH_MISMATCH: store was built with another hash or width";
+	if (rc == SURROGATE_BAD_META)
+		return "SURROGATE_BAD_META: unknown hash or malformed meta record";
+	if (rc == SURROGATE_STALE)
+		return "SURROGATE_STALE: store was replaced by a compaction";
+	return mdb_strerror (rc);
+}
+
+static int
+random_key (unsigned char *key) {
+
+	FILE *f = fopen ("/dev/urandom", "rb");
+	size_t n = 0;
+
+	if (f != NULL) {
+		n = fread (key, 1, SURROGATE_HASH_KEY_BYTES, f);
+		fclose (f);
+	}
+	return n == SURROGATE_HASH_KEY_BYTES ? 0 : EIO;
+}
+
+static MDB_val
+meta_name (const char *name) {
+
+	MDB_val v;
+
+	v.mv_size = strlen (name);
+	v.mv_data = (void *) name;
+	return v;
+}
+
+// settle the hash policy and width of the store inside txn and select them
+static int
+open_policy (MDB_txn *txn, surrogate_store *st, const surrogate_config *cfg, int rdonly) {
+
+	int rc;
+	const char *want = cfg != NULL ? cfg->hash : NULL;
+	size_t want_bytes = cfg != NULL ? cfg->hash_bytes : 0, bytes;
+	const hash_policy *p;
+	unsigned char key[SURROGATE_HASH_KEY_BYTES], width;
+	MDB_val name_key = meta_name (META_HASH), key_key = meta_name (META_HASH_KEY);
+	MDB_val bytes_key = meta_name (META_HASH_BYTES), name, keyval, bytesval;
+	MDB_val tokens_key = meta_name (META_TOKENS), tokens;
+	MDB_stat stat;
+
+	if (want != NULL && find_policy (want, strlen (want)) == NULL)
+		return EINVAL;
+	if (want_bytes != 0 && !valid_width (want_bytes))
+		return EINVAL;
+	st->newline_tokens = 0;
+
+	rc = mdb_dbi_open (txn, SURROGATE_META, rdonly ? 0 : MDB_CREATE, &st->dbi_meta);
+	if (rc == MDB_NOTFOUND && rdonly)
+		st->dbi_meta = 0;
+	else if (rc != MDB_SUCCESS)
+		return rc;
+
+	rc = st->dbi_meta != 0 ? mdb_get (txn, st->dbi_meta, &name_key, &name) : MDB_NOTFOUND;
+	if (rc == MDB_SUCCESS) {
+		p = find_policy (name.mv_data, name.mv_size);
+		if (p == NULL)
+			return SURROGATE_BAD_META;
+		if (p->keyed) {
+			rc = mdb_get (txn, st->dbi_meta, &key_key, &keyval);
+			if (rc == MDB_NOTFOUND || (rc == MDB_SUCCESS && keyval.mv_size != SURROGATE_HASH_KEY_BYTES))
+				return SURROGATE_BAD_META;
+			if (rc != MDB_SUCCESS)
+				return rc;
+			memcpy (key, keyval.mv_data, SURROGATE_HASH_KEY_BYTES);
+		}
+		// stores from before widths were recorded are 8 bytes wide
+		rc = mdb_get (txn, st->dbi_meta, &bytes_key, &bytesval);
+		if (rc == MDB_NOTFOUND)
+			bytes = SURROGATE_HASH_BYTES;
+		else if (rc != MDB_SUCCESS)
+			return rc;
+		else if (bytesval.mv_size != 1 || !valid_width (*(unsigned char *) bytesval.mv_data))
+			return SURROGATE_BAD_META;
+		else
+			bytes = *(unsigned char *) bytesval.mv_data;
+		if ((want != NULL && strcmp (want, p->name) != 0) ||
+		    (want_bytes != 0 && want_bytes != bytes))
+			return SURROGATE_HASH_MISMATCH;
+		// stores without the record split lines on spaces only
+		rc = mdb_get (txn, st->dbi_meta, &tokens_key, &tokens);
+		if (rc == MDB_SUCCESS)
+			st->newline_tokens = tokens.mv_size == 5 && memcmp (tokens.mv_data, "lines", 5) == 0;
+		else if (rc != MDB_NOTFOUND)
+			return rc;
+		rc = select_policy (p, bytes, key);
+		if (rc == 0)
+			st->hash_bytes = bytes;
+		return rc;
+	}
+	if (rc != MDB_NOTFOUND)
+		return rc;
+
+	// no record: a store with data was built before policies existed,
+	// and before tokens ended at newlines; a new one ends them there
+	rc = mdb_stat (txn, st->dbi, &stat);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	if (stat.ms_entries > 0) {
+		p = &policies[0];
+		bytes = SURROGATE_HASH_BYTES;
+	}
+	else {
+		p = want != NULL ? find_policy (want, strlen (want)) : &policies[0];
+		bytes = want_bytes != 0 ? want_bytes : SURROGATE_HASH_BYTES;
+		st->newline_tokens = !rdonly;
+	}
+	if ((want != NULL && strcmp (want, p->name) != 0) ||
+	    (want_bytes != 0 && want_bytes != bytes))
+		return SURROGATE_HASH_MISMATCH;
+
+	if (p->keyed && (rc = random_key (key)) != 0)
+		return rc;
+	if (!rdonly) {
+		name = meta_name (p->name);
+		rc = mdb_put (txn, st->dbi_meta, &name_key, &name, 0);
+		if (rc == MDB_SUCCESS && p->keyed) {
+			keyval.mv_size = SURROGATE_HASH_KEY_BYTES;
+			keyval.mv_data = key;
+			rc = mdb_put (txn, st->dbi_meta, &key_key, &keyval, 0);
+		}
+		if (rc == MDB_SUCCESS) {
+			width = (unsigned char) bytes;
+			bytesval.mv_size = 1;
+			bytesval.mv_data = &width;
+			rc = mdb_put (txn, st->dbi_meta, &bytes_key, &bytesval, 0);
+		}
+		if (rc == MDB_SUCCESS && st->newline_tokens) {
+			tokens = meta_name ("lines");
+			rc = mdb_put (txn, st->dbi_meta, &tokens_key, &tokens, 0);
+		}
+		if (rc != MDB_SUCCESS)
+			return rc;
+	}
+	rc = select_policy (p, bytes, key);
+	if (rc == 0)
+		st->hash_bytes = bytes;
+	return rc;
+}
+
+// an optional database, if the store keeps it or create starts it;
+// *dbi is 0 otherwise
+static int
+open_optional (MDB_txn *txn, const char *name, int create, MDB_dbi *dbi) {
+
+	int rc = mdb_dbi_open (txn, name, create ? MDB_CREATE : 0, dbi);
+
+	if (rc == MDB_NOTFOUND) {
+		*dbi = 0;
+		rc = MDB_SUCCESS;
+	}
+	return rc;
+}
+
+int
+surrogate_open (surrogate_store *st, const char *path, unsigned int env_flags) {
+
+	return surrogate_open_config (st, path, env_flags, NULL);
+}
+
+int
+surrogate_open_config (surrogate_store *st, const char *path, unsigned int env_flags,
+		const surrogate_config *cfg) {
+
+	int rc;
+	MDB_txn *txn;
+	unsigned int db_flags = SURROGATE_FLAGS;
+	int rdonly = env_flags & MDB_RDONLY;
+
+	st->path = path;
+	st->logging = 0;
+	st->log_txn = NULL;
+	st->dbi_changes = 0;
+
+	rc = mdb_env_create (&st->env);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = mdb_env_set_mapsize (st->env, cfg != NULL && cfg->map_size != 0 ? cfg->map_size :
+		SURROGATE_MAP_SIZE);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_env_set_maxdbs (st->env, SURROGATE_MAX_DBS);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_env_set_maxreaders (st->env, SURROGATE_MAX_READERS);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_env_open (st->env, path, env_flags, 0664);
+	if (rc != MDB_SUCCESS)
+		goto fail;
+
+	// read-only opens expect the databases to exist already
+	if (!rdonly)
+		db_flags |= MDB_CREATE;
+
+	rc = mdb_txn_begin (st->env, NULL, rdonly, &txn);
+	if (rc != MDB_SUCCESS)
+		goto fail;
+	rc = mdb_dbi_open (txn, SURROGATE_DATA_STORE, db_flags, &st->dbi);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_dbi_open (txn, SURROGATE_REV_STORE, db_flags, &st->dbi_rev);
+	if (rc == MDB_SUCCESS)
+		rc = open_policy (txn, st, cfg, rdonly);
+	if (rc == MDB_SUCCESS)
+		rc = open_optional (txn, SURROGATE_STRINGS, !rdonly && cfg != NULL && cfg->strings,
+			&st->dbi_strings);
+	if (rc == MDB_SUCCESS)
+		rc = open_optional (txn, SURROGATE_LASTSEEN, !rdonly && cfg != NULL && cfg->expiry,
+			&st->dbi_lastseen);
+	if (rc == MDB_SUCCESS)
+		rc = open_optional (txn, SURROGATE_EXPIRY, !rdonly && cfg != NULL && cfg->expiry,
+			&st->dbi_expiry);
+	if (rc == MDB_SUCCESS)
+		rc = open_optional (txn, SURROGATE_GENS, !rdonly, &st->dbi_gens);
+	if (rc == MDB_SUCCESS)
+		rc = open_optional (txn, SURROGATE_GRAVEYARD, !rdonly, &st->dbi_graveyard);
+	// writers may have to log while a compaction copies the store
+	if (rc == MDB_SUCCESS && !rdonly)
+		rc = mdb_dbi_open (txn, SURROGATE_CHANGES, MDB_CREATE, &st->dbi_changes);
+	if (rc != MDB_SUCCESS) {
+		mdb_txn_abort (txn);
+		goto fail;
+	}
+	rc = mdb_txn_commit (txn);
+	if (rc != MDB_SUCCESS)
+		goto fail;
+	pthread_mutex_lock (&policy_lock);
+	stores_open++;
+	pthread_mutex_unlock (&policy_lock);
+	return MDB_SUCCESS;
+
+fail:
+	mdb_env_close (st->env);
+	st->env = NULL;
+	return rc;
+}
+
+void
+surrogate_close (surrogate_store *st) {
+
+	if (st->env == NULL)
+		return;
+	mdb_env_close (st->env);
+	st->env = NULL;
+	pthread_mutex_lock (&policy_lock);
+	stores_open--;
+	pthread_mutex_unlock (&policy_lock);
+}
+
+int
+surrogate_stale (const surrogate_store *st) {
+
+	char file[4096];
+	struct stat now, opened;
+	mdb_filehandle_t fd;
+
+	// a path that does not resolve right now is not a replacement
+	if (mdb_env_get_fd (st->env, &fd) != MDB_SUCCESS || fstat (fd, &opened) != 0)
+		return 0;
+	snprintf (file, sizeof file, "%s/data.mdb", st->path);
+	if (stat (file, &now) != 0)
+		return 0;
+	return now.st_dev != opened.st_dev || now.st_ino != opened.st_ino;
+}
+
+int
+surrogate_txn_begin (surrogate_store *st, unsigned int flags, MDB_txn **txn) {
+
+	int rc;
+	MDB_val key = meta_name (META_COMPACTING), data;
+
+	if (surrogate_stale (st))
+		return SURROGATE_STALE;
+	rc = mdb_txn_begin (st->env, NULL, flags, txn);
+	if (rc != MDB_SUCCESS || (flags & MDB_RDONLY))
+		return rc;
+
+	// compact.c swaps stores holding the write lock; check again under it
+	if (surrogate_stale (st)) {
+		mdb_txn_abort (*txn);
+		return SURROGATE_STALE;
+	}
+	st->log_txn = NULL;
+	rc = mdb_get (*txn, st->dbi_meta, &key, &data);
+	st->logging = rc == MDB_SUCCESS;
+	if (rc == MDB_NOTFOUND)
+		rc = MDB_SUCCESS;
+	if (rc != MDB_SUCCESS)
+		mdb_txn_abort (*txn);
+	return rc;
+}
+
+int
+surrogate_compacting (surrogate_store *st, MDB_txn *txn, int on) {
+
+	MDB_val key = meta_name (META_COMPACTING), data;
+	int rc;
+
+	if (!on) {
+		rc = mdb_del (txn, st->dbi_meta, &key, NULL);
+		return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+	}
+	data.mv_size = 1;
+	data.mv_data = "1";
+	return mdb_put (txn, st->dbi_meta, &key, &data, 0);
+}
+
+int
+surrogate_log (surrogate_store *st, MDB_txn *txn, int op, int db,
+		const MDB_val *key, const MDB_val *data) {
+
+	int rc, i;
+	unsigned char seq[8], *p;
+	MDB_cursor *cursor;
+	MDB_val k, v;
+	size_t dlen = op == SURROGATE_LOG_DEL_KEY ? 0 : data->mv_size;
+
+	if (!st->logging)
+		return MDB_SUCCESS;
+
+	// continue after the last record; only one writer runs at a time
+	if (st->log_txn != txn) {
+		rc = mdb_cursor_open (txn, st->dbi_changes, &cursor);
+		if (rc != MDB_SUCCESS)
+			return rc;
+		rc = mdb_cursor_get (cursor, &k, &v, MDB_LAST);
+		mdb_cursor_close (cursor);
+		st->log_seq = 0;
+		if (rc == MDB_SUCCESS)
+			for (i = 0; i < 8; i++)
+				st->log_seq = st->log_seq << 8 | ((unsigned char *) k.mv_data)[i];
+		else if (rc != MDB_NOTFOUND)
+			return rc;
+		st->log_txn = txn;
+	}
+
+	// big-endian sequence numbers keep the records in write order
+	st->log_seq++;
+	for (i = 0; i < 8; i++)
+		seq[i] = (unsigned char) (st->log_seq >> (56 - 8 * i));
+	k.mv_size = sizeof seq;
+	k.mv_data = seq;
+
+	// op, db, 2-byte key length, key, data
+	v.mv_size = 4 + key->mv_size + dlen;
+	rc = mdb_put (txn, st->dbi_changes, &k, &v, MDB_APPEND | MDB_RESERVE);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	p = v.mv_data;
+	p[0] = (unsigned char) op;
+	p[1] = (unsigned char) db;
+	p[2] = (unsigned char) (key->mv_size >> 8);
+	p[3] = (unsigned char) key->mv_size;
+	memcpy (p + 4, key->mv_data, key->mv_size);
+	if (dlen > 0)
+		memcpy (p + 4 + key->mv_size, data->mv_data, dlen);
+	return MDB_SUCCESS;
+}
+
+int
+surrogate_hash (void *out, const char *token, size_t len) {
+
+	pthread_once (&hash_once, hash_init);
+	return policy->hash (out, token, len);
+}
+
+static int
+hex_digit (char c) {
+
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+int
+surrogate_parse_hex (void *out, const char *hex) {
+
+	int i, hi, lo;
+	unsigned char *p = out;
+
+	if (strlen (hex) != 2 * hash_bytes)
+		return -1;
+	for (i = 0; i < (int) hash_bytes; i++) {
+		hi = hex_digit (hex[2*i]);
+		lo = hex_digit (hex[2*i + 1]);
+		if (hi < 0 || lo < 0)
+			return -1;
+		p[i] = (unsigned char) (hi << 4 | lo);
+	}
+	return 0;
+}
+
+void
+surrogate_hex (char *out, const void *hash) {
+
+	static const char digits[] = "0123456789abcdef";
+	const unsigned char *p = hash;
+	int i;
+
+	for (i = 0; i < (int) hash_bytes; i++) {
+		out[2*i] = digits[p[i] >> 4];
+		out[2*i + 1] = digits[p[i] & 0xf];
+	}
+	out[2 * hash_bytes] = '\0';
+}
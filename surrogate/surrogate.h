@@ -0,0 +1,178 @@
+/*
+ * File Name:	surrogate.h
+ * Function:	Shared layout of the surrogate key store written by
+ *		map_data.c: the environment location, the names and
+ *		flags of the forward (key -> URLs) and reverse
+ *		(URL -> keys) databases, and the keyed hash that
+ *		turns keys and URLs into fixed-width IDs.
+ *
+ *		The hash is a per-store policy: keyed BLAKE2b, as the
+ *		tools have always used, or SipHash-1-3 under a random
+ *		key drawn when the store is created. IDs are 8, 12 or
+ *		16 bytes wide, also chosen per store. The policy, its
+ *		key and the width live in the meta database, so every
+ *		tool that opens a store hashes the way the store was
+ *		built. The meta database also records whether the
+ *		store's tokens end at newlines as well as at spaces:
+ *		map_data once split lines on spaces only, so the last
+ *		key of each line in a store it built then was hashed
+ *		with its newline, and adding to such a store has to
+ *		keep doing so. A store may also keep the original bytes of each
+ *		ID in the strings database (see idstrings.h), which
+ *		catches two tokens hashing to the same ID, and an
+ *		expiry index of when each (key, URL) pair was last
+ *		ingested, from which sweep.c removes stale pairs (see
+ *		expiry.h). Keys purged with purge -l are only marked
+ *		in the gens database and cleaned up later (purger.h).
+ *
+ *		compact.c rebuilds a store into a dense copy while the
+ *		tools keep running. Writers begin their transactions
+ *		with surrogate_txn_begin and report each write with
+ *		surrogate_log, which appends it to the changes database
+ *		while a compaction is copying, so the copy can catch
+ *		up. The copy then replaces the directory the store path
+ *		links to, and surrogate_txn_begin tells the tools still
+ *		holding the old one to reopen.
+ */
+
+#ifndef SURROGATE_H
+#define SURROGATE_H
+
+#include <stddef.h>
+#include "lmdb.h"
+
+#define SURROGATE_HASH_BYTES	8	// ID width of stores that predate wider IDs
+#define SURROGATE_MAX_HASH_BYTES 16
+#define SURROGATE_DB_DIR	"./db_dir"
+#define SURROGATE_DATA_STORE	"data_store"
+#define SURROGATE_REV_STORE	"rev_data_store"
+#define SURROGATE_META		"meta"
+#define SURROGATE_STRINGS	"strings"
+#define SURROGATE_CHANGES	"changes"
+#define SURROGATE_LASTSEEN	"lastseen"
+#define SURROGATE_EXPIRY	"expiry"
+#define SURROGATE_GENS		"gens"
+#define SURROGATE_GRAVEYARD	"graveyard"
+#define SURROGATE_FLAGS		(MDB_DUPSORT | MDB_DUPFIXED)
+#define SURROGATE_MAX_DBS	16
+#define SURROGATE_MAX_READERS	126
+#define SURROGATE_MAP_SIZE	((size_t) 8*1024*1024*1024)
+
+// hash policies; stores without a meta record predate them and use blake2b
+#define SURROGATE_HASH_DEFAULT	"blake2b"
+#define SURROGATE_HASH_KEY_BYTES 16
+
+// errors of surrogate_open_config beyond those of LMDB
+#define SURROGATE_HASH_MISMATCH	(-30600)	/* store was built with another hash or width */
+#define SURROGATE_BAD_META	(-30599)	/* unknown hash or malformed meta record */
+#define SURROGATE_STALE		(-30598)	/* store was replaced by a compaction; reopen */
+
+// databases and operations of changes records
+#define SURROGATE_LOG_DATA	0
+#define SURROGATE_LOG_REV	1
+#define SURROGATE_LOG_STRINGS	2
+#define SURROGATE_LOG_LASTSEEN	3
+#define SURROGATE_LOG_EXPIRY	4
+#define SURROGATE_LOG_GENS	5
+#define SURROGATE_LOG_GRAVEYARD	6
+#define SURROGATE_LOG_PUT	'P'	/* put key/data */
+#define SURROGATE_LOG_DEL	'D'	/* delete key/data */
+#define SURROGATE_LOG_DEL_KEY	'K'	/* delete key with all its data */
+
+/* settings of a new store, or those expected of an existing one; zero
+ * fields take whatever the store uses */
+typedef struct surrogate_config {
+	const char *hash;	// hash policy
+	size_t hash_bytes;	// ID width: 8, 12 or 16
+	int strings;		// keep original strings; starts the strings
+				// database on an existing store that has none
+	int expiry;		// keep the expiry index; starts it likewise
+	size_t map_size;	// bytes the store may grow to; SURROGATE_MAP_SIZE
+				// when 0. Opens of a larger store map all of it.
+} surrogate_config;
+
+typedef struct surrogate_store {
+	MDB_env *env;
+	MDB_dbi dbi;		// data_store: key hash -> URL hashes
+	MDB_dbi dbi_rev;	// rev_data_store: URL hash -> key hashes
+	MDB_dbi dbi_meta;	// meta: store settings; 0 for a read-only legacy store
+	MDB_dbi dbi_strings;	// strings: ID -> original token; 0 when not kept
+	MDB_dbi dbi_lastseen;	// lastseen: key|URL -> time; 0 when not kept
+	MDB_dbi dbi_expiry;	// expiry: time|key|URL, in time order; likewise
+	MDB_dbi dbi_gens;	// gens: key -> purge generations (purger.h);
+	MDB_dbi dbi_graveyard;	// graveyard: purges awaiting cleanup; both 0
+				// for read-only opens of stores without them
+	MDB_dbi dbi_changes;	// changes: writes made during a compaction;
+				// 0 for read-only opens
+	size_t hash_bytes;	// ID width
+	int newline_tokens;	// tokens end at newlines too; 0 for stores from
+				// before, where a line's last key kept its '\n'
+	const char *path;	// as opened; must outlive the store
+	int logging;		// a compaction is copying the store
+	MDB_txn *log_txn;	// transaction log_seq belongs to
+	unsigned long long log_seq;
+} surrogate_store;
+
+/* open the environment at path and its databases; env_flags are passed
+ * to mdb_env_open, so MDB_RDONLY opens an existing store for lookups.
+ * The store's hash policy and width become the ones surrogate_hash
+ * uses. A new store ends tokens at newlines and records cfg->hash (SURROGATE_HASH_DEFAULT when
+ * NULL) and cfg->hash_bytes (SURROGATE_HASH_BYTES when 0); an existing
+ * store built with another hash or width fails with
+ * SURROGATE_HASH_MISMATCH. The policy is the process's, so opening a
+ * store hashed otherwise than one still open also fails with
+ * SURROGATE_HASH_MISMATCH. surrogate_open passes no config. */
+int surrogate_open (surrogate_store *st, const char *path, unsigned int env_flags);
+int surrogate_open_config (surrogate_store *st, const char *path, unsigned int env_flags,
+		const surrogate_config *cfg);
+void surrogate_close (surrogate_store *st);
+
+/* begin a transaction on the store; fails with SURROGATE_STALE once a
+ * compaction has replaced it, after which the caller closes and
+ * reopens the store. Write transactions also learn whether their
+ * writes need logging. */
+int surrogate_txn_begin (surrogate_store *st, unsigned int flags, MDB_txn **txn);
+
+/* whether the store path now leads to another environment */
+int surrogate_stale (const surrogate_store *st);
+
+/* record a write made in txn to database db (SURROGATE_LOG_*) for a
+ * running compaction; does nothing when none is running. data is
+ * ignored for SURROGATE_LOG_DEL_KEY. */
+int surrogate_log (surrogate_store *st, MDB_txn *txn, int op, int db,
+		const MDB_val *key, const MDB_val *data);
+
+/* mark (on) or clear a running compaction of the store in txn; for
+ * compact.c */
+int surrogate_compacting (surrogate_store *st, MDB_txn *txn, int on);
+
+/* the characters that end tokens in lines fed to the store */
+const char *surrogate_token_delims (const surrogate_store *st);
+
+/* mdb_strerror, extended with the surrogate errors */
+const char *surrogate_strerror (int rc);
+
+/* hash a key or URL token into surrogate_hash_bytes () bytes with the
+ * policy of the stores open (SURROGATE_HASH_DEFAULT and
+ * SURROGATE_HASH_BYTES before any) */
+int surrogate_hash (void *out, const char *token, size_t len);
+size_t surrogate_hash_bytes (void);
+
+/* make name at width bytes the policy of surrogate_hash without
+ * opening a store; key holds SURROGATE_HASH_KEY_BYTES bytes and may be
+ * NULL for blake2b, whose key is fixed. Not safe while other threads
+ * are hashing. Returns EINVAL for an unknown name or width or a missing
+ * key, and SURROGATE_HASH_MISMATCH for another policy while a store is
+ * open. */
+int surrogate_select_hash (const char *name, size_t bytes, const void *key);
+const char *surrogate_hash_name (void);
+
+/* the policy names, NULL terminated */
+extern const char * const surrogate_hash_names[];
+
+/* parse/format a hash as 2*surrogate_hash_bytes () hex digits; out
+ * gets a terminating NUL */
+int surrogate_parse_hex (void *out, const char *hex);
+void surrogate_hex (char *out, const void *hash);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * File Name:	sweep.c
+ * Function:	Background cleanup of the store. Each pass removes the
+ *		URLs of keys purged with purge -l (see purger.h) and,
+ *		with -t, the (key, URL) pairs that map_data.c has not
+ *		seen for that time to live from a store that keeps the
+ *		expiry index (map_data -T), see expiry.h. With -i it
+ *		keeps running alongside ingest and sweeps every
+ *		interval; otherwise it sweeps once. Times take an s, m,
+ *		h or d suffix and default to seconds. Each pass prints
+ *		the time, the pairs expired and the keys cleaned up.
+ *
+ *		sweep [-t ttl] [-i interval] [-b batch]
+ *
+ *		cc sweep.c expiry.c purger.c surrogate.c \
+ *		   blake2/sse/blake2b.c -llmdb -pthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "lmdb.h"
+#include "surrogate.h"
+#include "expiry.h"
+#include "purger.h"
+
+// seconds in "<n>[smhd]"; 0 when malformed
+static unsigned long long
+parse_time (const char *s) {
+
+	char *end;
+	unsigned long long n = strtoull (s, &end, 10);
+
+	if (end == s)
+		return 0;
+	switch (*end) {
+	case 'd':
+		n *= 24;
+		/* fall through */
+	case 'h':
+		n *= 60;
+		/* fall through */
+	case 'm':
+		n *= 60;
+		/* fall through */
+	case 's':
+		end++;
+		break;
+	}
+	return *end == '\0' ? n : 0;
+}
+
+static void
+usage (const char *prog) {
+
+	fprintf (stderr, "usage: %s [-t ttl] [-i interval] [-b batch]\n", prog);
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int rc, opt;
+	unsigned long long ttl = 0, interval = 0, now;
+	size_t batch = 0, removed = 0, cleaned;
+	surrogate_store st;
+
+	while ((opt = getopt (argc, argv, "t:i:b:")) != -1) {
+		if (opt == 't' && (ttl = parse_time (optarg)) > 0)
+			continue;
+		if (opt == 'i' && (interval = parse_time (optarg)) > 0)
+			continue;
+		if (opt == 'b' && (batch = atoi (optarg)) > 0)
+			continue;
+		usage (argv[0]);
+		return -1;
+	}
+
+	rc = surrogate_open (&st, SURROGATE_DB_DIR, 0);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to open data store: %s\n", surrogate_strerror (rc));
+		return -1;
+	}
+	if (ttl > 0 && st.dbi_expiry == 0) {
+		fprintf (stderr, "The data store keeps no expiry index; ingest with map_data -T\n");
+		surrogate_close (&st);
+		return -1;
+	}
+
+	for (;;) {
+		now = time (NULL);
+		rc = MDB_SUCCESS;
+		if (ttl > 0)
+			rc = expiry_sweep (&st, now > ttl ? now - ttl : 0, batch, &removed);
+		if (rc == MDB_SUCCESS)
+			rc = purger_cleanup (&st, batch, &cleaned);
+		if (rc == SURROGATE_STALE) {
+			// compacted meanwhile; what was swept so far is in the copy
+			surrogate_close (&st);
+			rc = surrogate_open (&st, SURROGATE_DB_DIR, 0);
+			if (rc == MDB_SUCCESS)
+				continue;
+		}
+		if (rc != MDB_SUCCESS) {
+			fprintf (stderr, "Sweep failed: %s\n", surrogate_strerror (rc));
+			surrogate_close (&st);
+			return -1;
+		}
+		fprintf (stdout, "%llu %zu %zu\n", now, removed, cleaned);
+		fflush (stdout);
+		if (interval == 0)
+			break;
+		sleep (interval);
+	}
+
+	surrogate_close (&st);
+	return 0;
+}
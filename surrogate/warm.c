@@ -0,0 +1,147 @@
+/*
+ * File Name:	warm.c
+ * Function:	Page cache residency of the store, and warming it up
+ *		(see residency.h).
+ *
+ *		By default prints, per database, how many of its branch,
+ *		leaf, overflow and MDB_DUPSORT sub-tree pages are in the
+ *		page cache, as resident/pages, walking it with -j
+ *		threads (default one per CPU). -s also saves the hot
+ *		set to a file: run it once the lookup and purge tools
+ *		have settled to their steady state, and again now and
+ *		then as the store changes.
+ *
+ *		-l prefetches a saved hot set, branch pages first, as
+ *		purged -W does when it starts; with -w it returns only
+ *		once every page of the set is cached, and the time it
+ *		prints is how long a cold start takes to warm up.
+ *
+ *		warm [-j threads] [-s hotset]
+ *		warm -l hotset [-w]
+ *
+ *		cc warm.c residency.c pagewalk.c surrogate.c \
+ *		   blake2/sse/blake2b.c -llmdb -pthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lmdb.h"
+#include "surrogate.h"
+#include "residency.h"
+
+// the databases lookups and purges read
+static const char *hot_dbs[] = { SURROGATE_DATA_STORE, SURROGATE_REV_STORE, SURROGATE_STRINGS,
+	SURROGATE_LASTSEEN, SURROGATE_EXPIRY, SURROGATE_GENS, SURROGATE_GRAVEYARD, NULL };
+
+static const char *kind_names[] = { "branch", "leaf", "overflow", "sub branch", "sub leaf" };
+
+static void
+usage (const char *prog) {
+
+	fprintf (stderr, "usage: %s [-j threads] [-s hotset]\n"
+		"       %s -l hotset [-w]\n", prog, prog);
+}
+
+static int
+measure (surrogate_store *st, unsigned int threads, const char *save) {
+
+	int rc, i, k;
+	unsigned long long pages, total = 0, resident = 0;
+	MDB_txn *txn;
+	residency_stat rs;
+	residency_snapshot *snap;
+
+	// one mincore for all the databases; the walk that measures them
+	// gathers the hot set too
+	rc = mdb_txn_begin (st->env, NULL, MDB_RDONLY, &txn);
+	if (rc != MDB_SUCCESS)
+		return rc;
+	rc = residency_snapshot_create (st->env, save != NULL, &snap);
+	if (rc != MDB_SUCCESS) {
+		mdb_txn_abort (txn);
+		return rc;
+	}
+	fprintf (stdout, "%-16s", "database");
+	for (k = 0; k < PAGEWALK_KINDS; k++)
+		fprintf (stdout, "  %-17s", kind_names[k]);
+	fputc ('\n', stdout);
+	for (i = 0; hot_dbs[i] != NULL; i++) {
+		rc = residency_measure (snap, txn, hot_dbs[i], threads, &rs);
+		if (rc == MDB_NOTFOUND)
+			continue;
+		if (rc != MDB_SUCCESS)
+			break;
+		fprintf (stdout, "%-16s", hot_dbs[i]);
+		for (k = 0; k < PAGEWALK_KINDS; k++) {
+			fprintf (stdout, "  %8llu/%-8llu", rs.resident[k], rs.pages[k]);
+			total += rs.pages[k];
+			resident += rs.resident[k];
+		}
+		fputc ('\n', stdout);
+	}
+	if (rc == MDB_SUCCESS || rc == MDB_NOTFOUND) {
+		fprintf (stdout, "\n%llu of %llu pages resident (%.1f%%)\n", resident, total,
+			total ? 100.0 * resident / total : 100.0);
+		rc = MDB_SUCCESS;
+	}
+	mdb_txn_abort (txn);
+	if (rc == MDB_SUCCESS && save != NULL) {
+		rc = residency_save (snap, save, &pages);
+		if (rc == MDB_SUCCESS)
+			fprintf (stdout, "%llu pages saved to %s\n", pages, save);
+	}
+	residency_snapshot_destroy (snap);
+	return rc;
+}
+
+int
+main (int argc, char * argv[]) {
+
+	int rc, opt, wait = 0;
+	long threads = sysconf (_SC_NPROCESSORS_ONLN);
+	const char *save = NULL, *load = NULL;
+	surrogate_store st;
+	residency_prefetch_stat ps;
+
+	while ((opt = getopt (argc, argv, "j:s:l:w")) != -1) {
+		if (opt == 'j' && (threads = atol (optarg)) > 0)
+			continue;
+		else if (opt == 's')
+			save = optarg;
+		else if (opt == 'l')
+			load = optarg;
+		else if (opt == 'w')
+			wait = 1;
+		else {
+			usage (argv[0]);
+			return -1;
+		}
+	}
+	if (optind != argc || (load != NULL && save != NULL)) {
+		usage (argv[0]);
+		return -1;
+	}
+
+	rc = surrogate_open (&st, SURROGATE_DB_DIR, MDB_RDONLY);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure to open data store: %s\n", surrogate_strerror (rc));
+		return -1;
+	}
+	if (load != NULL) {
+		rc = residency_prefetch (st.env, load, wait, &ps);
+		if (rc == MDB_SUCCESS)
+			fprintf (stdout, "%llu pages (%llu branch) in %llu ranges %s in %.3f ms; "
+				"%llu past the end\n", ps.pages, ps.branch_pages, ps.ranges,
+				wait ? "loaded" : "requested", ps.ms, ps.skipped);
+	}
+	else
+		rc = measure (&st, threads > 0 ? threads : 1, save);
+	surrogate_close (&st);
+	if (rc != MDB_SUCCESS) {
+		fprintf (stderr, "Failure: %s\n", surrogate_strerror (rc));
+		return -1;
+	}
+	return 0;
+}
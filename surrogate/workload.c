@@ -0,0 +1,181 @@
+/*
+ * File Name:	workload.c
+ * Function:	Synthetic ingest feeds. See workload.h.
+ *
+ *		Zipf keys by rejection-inversion (Hörmann and Derflinger,
+ *		"Rejection-inversion to generate variates from monotone
+ *		discrete distributions", 1996): a continuous hat over
+ *		the probabilities is inverted and the few draws that
+ *		fall outside the bars are rejected.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "workload.h"
+
+const char *workload_dist_names[] = { "fixed", "uniform", "geometric", NULL };
+
+// splitmix64
+static uint64_t
+next_u64 (workload *w) {
+
+	uint64_t z = (w->rng += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// uniform in [0, 1)
+static double
+next_double (workload *w) {
+
+	return (next_u64 (w) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// log1p(x) / x and expm1(x) / x, also near 0
+static double
+helper1 (double x) {
+
+	return fabs (x) > 1e-8 ? log1p (x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double
+helper2 (double x) {
+
+	return fabs (x) > 1e-8 ? expm1 (x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+// the hat, its integral and the inverse of that
+static double
+h (const workload *w, double x) {
+
+	return exp (-w->s * log (x));
+}
+
+static double
+h_integral (const workload *w, double x) {
+
+	double lx = log (x);
+	return helper2 ((1 - w->s) * lx) * lx;
+}
+
+static double
+h_integral_inverse (const workload *w, double x) {
+
+	double t = x * (1 - w->s);
+
+	if (t < -1)
+		t = -1;
+	return exp (helper1 (t) * x);
+}
+
+int
+workload_init (workload *w, const workload_config *cfg) {
+
+	if (cfg->keys == 0 || !(cfg->skew >= 0) || cfg->mean == 0 ||
+	    cfg->mean > WORKLOAD_MAX_KEYS || cfg->dist < WORKLOAD_FIXED || cfg->dist > WORKLOAD_GEOMETRIC)
+		return EINVAL;
+	memset (w, 0, sizeof *w);
+	w->cfg = *cfg;
+	w->rng = cfg->seed;
+	w->s = cfg->skew;
+	w->h_x1 = h_integral (w, 1.5) - 1;
+	w->h_n = h_integral (w, cfg->keys + 0.5);
+	w->sv = 2 - h_integral_inverse (w, h_integral (w, 2.5) - h (w, 2));
+	return 0;
+}
+
+uint64_t
+workload_key (workload *w) {
+
+	double u, x;
+	uint64_t k;
+
+	for (;;) {
+		u = w->h_n + next_double (w) * (w->h_x1 - w->h_n);
+		x = h_integral_inverse (w, u);
+		k = (uint64_t) (x + 0.5);
+		if (k < 1)
+			k = 1;
+		else if (k > w->cfg.keys)
+			k = w->cfg.keys;
+		if (k - x <= w->sv || u >= h_integral (w, k + 0.5) - h (w, k))
+			return k;
+	}
+}
+
+// how many keys the next line has
+static size_t
+line_keys (workload *w) {
+
+	size_t n = w->cfg.mean;
+
+	if (w->cfg.dist == WORKLOAD_UNIFORM)
+		n = 1 + next_u64 (w) % (2 * w->cfg.mean - 1);
+	else if (w->cfg.dist == WORKLOAD_GEOMETRIC && w->cfg.mean > 1)
+		// trials up to the first success of p = 1 / mean
+		n = 1 + (size_t) floor (log (1 - next_double (w)) / log (1 - 1.0 / w->cfg.mean));
+	if (n > WORKLOAD_MAX_KEYS)
+		n = WORKLOAD_MAX_KEYS;
+	if (n > w->cfg.keys)
+		n = w->cfg.keys;
+	return n;
+}
+
+size_t
+workload_next (workload *w, uint64_t *url, uint64_t keys[WORKLOAD_MAX_KEYS]) {
+
+	size_t n = line_keys (w), got = 0, i, tries;
+	uint64_t k;
+
+	*url = ++w->line;
+	// redraw repeats; with a steep skew over few keys, give up on some
+	for (tries = 0; got < n && tries < 16 * n; tries++) {
+		k = workload_key (w);
+		for (i = 0; i < got && keys[i] != k; i++)
+			;
+		if (i == got)
+			keys[got++] = k;
+	}
+	return got;
+}
+
+int
+workload_url (char *buf, size_t size, uint64_t url) {
+
+	return snprintf (buf, size, "http://img.example.com/%llu.jpg", (unsigned long long) url);
+}
+
+int
+workload_key_name (char *buf, size_t size, uint64_t key) {
+
+	return snprintf (buf, size, "k%llu", (unsigned long long) key);
+}
+
+size_t
+workload_line (workload *w, char *buf, size_t size) {
+
+	uint64_t url, keys[WORKLOAD_MAX_KEYS];
+	size_t n, i, len, k;
+	char key[32];
+
+	// keys that would not fit are left off
+	n = workload_next (w, &url, keys);
+	len = workload_url (buf, size, url);
+	if (len + 2 > size)
+		return 0;
+	for (i = 0; i < n; i++) {
+		k = workload_key_name (key, sizeof key, keys[i]);
+		if (len + k + 3 > size)
+			break;
+		buf[len++] = ' ';
+		memcpy (buf + len, key, k);
+		len += k;
+	}
+	buf[len++] = '\n';
+	buf[len] = '\0';
+	return len;
+}
@@ -0,0 +1,66 @@
+/*
+ * File Name:	workload.h
+ * Function:	Synthetic ingest feeds in map_data.c's format, "<url>
+ *		<key> ..." per line, for benchmarks. Each line is a new
+ *		URL; the number of keys on it follows one of the
+ *		distributions below around a mean, and which keys they
+ *		are follows a Zipf law of the given skew over the key
+ *		space (0 is uniform; around 1 a few keys, like a site
+ *		wide tag, sit on a large share of the URLs). Keys are
+ *		drawn by rejection-inversion, in constant time and
+ *		memory whatever the size of the key space.
+ *
+ *		The same seed gives the same feed, and workload_key
+ *		draws keys with the same popularity, for lookup and
+ *		purge streams that hit the keys the feed made popular.
+ */
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// keys per line; map_data.c reads lines of up to 500 bytes
+#define WORKLOAD_MAX_KEYS	32
+
+enum {
+	WORKLOAD_FIXED,			// every line has the mean
+	WORKLOAD_UNIFORM,		// 1 to 2 * mean - 1
+	WORKLOAD_GEOMETRIC		// mostly few, with a long tail
+};
+
+typedef struct workload_config {
+	uint64_t keys;			// size of the key space
+	double skew;			// Zipf exponent, >= 0
+	unsigned int mean;		// keys per line
+	int dist;			// WORKLOAD_FIXED ...
+	uint64_t seed;
+} workload_config;
+
+typedef struct workload {
+	workload_config cfg;
+	uint64_t rng, line;
+	double h_x1, h_n, s, sv;	// rejection-inversion constants
+} workload;
+
+extern const char *workload_dist_names[];	// by WORKLOAD_FIXED ..., NULL ended
+
+/* EINVAL on an empty key space, a negative skew or a mean of 0 or over
+ * WORKLOAD_MAX_KEYS */
+int workload_init (workload *w, const workload_config *cfg);
+
+/* a key index in 1 .. keys, popular ones more often */
+uint64_t workload_key (workload *w);
+
+/* the next line's URL index and n distinct key indexes; returns n */
+size_t workload_next (workload *w, uint64_t *url, uint64_t keys[WORKLOAD_MAX_KEYS]);
+
+/* the strings of a URL and a key index, as the feed writes them */
+int workload_url (char *buf, size_t size, uint64_t url);
+int workload_key_name (char *buf, size_t size, uint64_t key);
+
+/* the next line as text, newline ended; returns its length */
+size_t workload_line (workload *w, char *buf, size_t size);
+
+#endif